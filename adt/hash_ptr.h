@@ -0,0 +1,33 @@
+/**
+ * @file
+ * @brief   Hash functions for pointers
+ *
+ * Objects are aligned, so the low bits of their addresses are mostly zero and
+ * hashing the address directly puts nearby objects into the same buckets.
+ * hash_ptr() mixes all bits of the address instead.
+ */
+#ifndef HASH_PTR_H
+#define HASH_PTR_H
+
+#include <stdint.h>
+
+/** spreads every bit of @p hash over the result (the MurmurHash3 finalizer) */
+static inline __attribute__((const))
+unsigned hash_mix(unsigned hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6Bu;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+static inline __attribute__((const))
+unsigned hash_ptr(const void *ptr)
+{
+	uintptr_t value = (uintptr_t) ptr;
+	return hash_mix((unsigned) (value >> 3) ^ (unsigned) ((uint64_t) value >> 32));
+}
+
+#endif
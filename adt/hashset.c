@@ -61,6 +61,14 @@
  *  <li><b>SetRangeEmpty(ptr,count)</b> Efficiently sets a range of elements to
  *                                      the Null value</li>
  *  <li><b>ADDITIONAL_DATA<b>   Additional fields appended to the hashset struct</li>
+ *  <li><b>hashset_find_hash</b> Also generate this function, it searches a key
+ *                              whose hash the caller already computed</li>
+ *  <li><b>GROUP_PROBING</b>    Use the implementation in hashset_group.c, which
+ *                              probes 16 buckets at once and runs at higher
+ *                              load (JUMP, DeletedValue and SetRangeEmpty
+ *                              are not used then, NullValue is never stored
+ *                              but still returned by find and by the
+ *                              iterator at the end)</li>
  * </ul>
  */
 #ifdef HashSet
@@ -213,6 +221,14 @@ void hashset_init_size(HashSet *self, size_t expected_elements);
 void hashset_iterator_init(HashSetIterator *self, const HashSet *hashset);
 ValueType hashset_iterator_next(HashSetIterator *self);
 void hashset_remove_iterator(HashSet *self, const HashSetIterator *iter);
+#ifdef hashset_find_hash
+InsertReturnValue hashset_find_hash(const HashSet *self, ConstKeyType key,
+                                    unsigned hash);
+#endif
+
+#ifdef GROUP_PROBING
+#include "hashset_group.c"
+#else
 
 /**
  * Returns the number of elements in the hashset
@@ -437,18 +453,16 @@ InsertReturnValue hashset_insert(HashSet *self, KeyType key)
 }
 
 /**
- * Searchs for an element with key @p key.
- *
- * @param self      the hashset
- * @param key       the key to search for
- * @returns         the found value or NullValue if nothing was found
+ * Searchs for an element with key @p key and hash @p hash.
+ * @internal
  */
-InsertReturnValue hashset_find(const HashSet *self, ConstKeyType key)
+static inline
+InsertReturnValue find_with_hash(const HashSet *self, ConstKeyType key,
+                                 unsigned hash)
 {
 	size_t   num_probes  = 0;
 	size_t   num_buckets = self->num_buckets;
 	size_t   hashmask    = num_buckets - 1;
-	unsigned hash        = Hash(self, key);
 	size_t   bucknum     = hash & hashmask;
 
 	while(1) {
@@ -472,6 +486,29 @@ InsertReturnValue hashset_find(const HashSet *self, ConstKeyType key)
 	}
 }
 
+/**
+ * Searchs for an element with key @p key.
+ *
+ * @param self      the hashset
+ * @param key       the key to search for
+ * @returns         the found value or NullValue if nothing was found
+ */
+InsertReturnValue hashset_find(const HashSet *self, ConstKeyType key)
+{
+	return find_with_hash(self, key, Hash(self, key));
+}
+
+#ifdef hashset_find_hash
+/**
+ * Searchs for an element with key @p key, @p hash has to be Hash(self, key).
+ */
+InsertReturnValue hashset_find_hash(const HashSet *self, ConstKeyType key,
+                                    unsigned hash)
+{
+	return find_with_hash(self, key, hash);
+}
+#endif
+
 /**
  * Removes an element from a hashset. Does nothing if the set doesn't contain
  * the element.
@@ -634,6 +671,8 @@ void hashset_remove_iterator(HashSet *self, const HashSetIterator *iter)
 	self->consider_shrink = 1;
 }
 
+#endif /* GROUP_PROBING */
+
 #else
 __attribute__((unused)) static int dummy;
 #endif
@@ -25,7 +25,8 @@
  * @version $Id$
  *
  * You have to specialize this header by defining HashSet, HashSetIterator and
- * ValueType
+ * ValueType. Define GROUP_PROBING here and for hashset.c to use the group
+ * probing implementation (see hashset_group.c).
  */
 #ifdef HashSet
 
@@ -42,6 +43,9 @@ typedef struct HashSetEntry {
 
 struct HashSet {
 	HashSetEntry *entries;
+#ifdef GROUP_PROBING
+	unsigned char *ctrl;
+#endif
 	size_t num_buckets;
 	size_t enlarge_threshold;
 	size_t shrink_threshold;
@@ -59,6 +63,9 @@ struct HashSet {
 struct HashSetIterator {
 	HashSetEntry *current_bucket;
 	HashSetEntry *end;
+#ifdef GROUP_PROBING
+	const unsigned char *current_ctrl;
+#endif
 #ifndef NDEBUG
 	const struct HashSet *set;
 	unsigned entries_version;
@@ -0,0 +1,510 @@
+/**
+ * @file
+ * @brief   Group probing implementation of the generic hashset
+ *
+ * This file is included by hashset.c when GROUP_PROBING is defined, it uses
+ * the same specialization macros. Next to the entries there is an array with
+ * one control byte per bucket: CTRL_EMPTY, CTRL_DELETED or a 7 bit tag of the
+ * hash of the stored element. Buckets are probed in groups of GROUP_SIZE, the
+ * control bytes of a group are compared to a tag at once (with SSE2 if
+ * available), so only entries with a matching tag are looked at. Probing stops
+ * at the first group with an empty bucket, this allows a maximum load of 7/8.
+ */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define GROUP_SIZE     16
+/** index of the first bucket in a (non-zero) match mask */
+#define FIRST_MATCH(mask)  ((size_t) __builtin_ctz(mask))
+#define CTRL_EMPTY     ((unsigned char) 0x80)
+#define CTRL_DELETED   ((unsigned char) 0xFE)
+
+#ifndef GROUP_OCCUPANCY
+/** how full before we double size */
+#define GROUP_OCCUPANCY(x)  ((x) / 8 * 7)
+#endif /* GROUP_OCCUPANCY */
+
+/**
+ * Mixes all bits of the hash into the tag, a bad hash function (like one
+ * based on pointers) would produce only a few distinct tags otherwise.
+ * @internal
+ */
+static inline
+unsigned char hash_tag(unsigned hash)
+{
+	return (unsigned char) ((hash * 2654435761U) >> 25);
+}
+
+/**
+ * Returns the first group to probe for a hash.
+ * @internal
+ */
+static inline
+size_t hash_group(const HashSet *self, unsigned hash)
+{
+	return (hash * GROUP_SIZE) & (self->num_buckets - 1);
+}
+
+/**
+ * Returns a bitmask of the buckets in the group at @p ctrl whose control byte
+ * is @p byte.
+ * @internal
+ */
+static inline
+unsigned group_match(const unsigned char *ctrl, unsigned char byte)
+{
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i*) ctrl);
+	__m128i cmp   = _mm_cmpeq_epi8(group, _mm_set1_epi8((char) byte));
+	return (unsigned) _mm_movemask_epi8(cmp);
+#else
+	unsigned mask = 0;
+	for(unsigned i = 0; i < GROUP_SIZE; ++i) {
+		if(ctrl[i] == byte)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+/**
+ * Returns a bitmask of the empty and deleted buckets in the group at @p ctrl.
+ * @internal
+ */
+static inline
+unsigned group_match_free(const unsigned char *ctrl)
+{
+#ifdef __SSE2__
+	/* only CTRL_EMPTY and CTRL_DELETED have the highest bit set */
+	__m128i group = _mm_loadu_si128((const __m128i*) ctrl);
+	return (unsigned) _mm_movemask_epi8(group);
+#else
+	unsigned mask = 0;
+	for(unsigned i = 0; i < GROUP_SIZE; ++i) {
+		if(ctrl[i] & 0x80)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+/**
+ * Returns the number of elements in the hashset
+ */
+size_t hashset_size(const HashSet *self)
+{
+	return self->num_elements - self->num_deleted;
+}
+
+/**
+ * Returns the bucket of the element with key @p key and hash @p hash or
+ * ILLEGAL_POS.
+ * @internal
+ */
+static inline
+size_t find_pos(const HashSet *self, ConstKeyType key, unsigned hash)
+{
+	size_t        hashmask   = self->num_buckets - 1;
+	unsigned char tag        = hash_tag(hash);
+	size_t        group      = hash_group(self, hash);
+	size_t        num_probes = 0;
+
+	while(1) {
+		const unsigned char *ctrl = &self->ctrl[group];
+
+		for(unsigned match = group_match(ctrl, tag); match != 0;
+		    match &= match - 1) {
+			size_t        pos   = group + FIRST_MATCH(match);
+			HashSetEntry *entry = &self->entries[pos];
+			if(EntryGetHash(self, *entry) == hash
+					&& KeysEqual(self, GetKey(EntryGetValue(*entry)), key))
+				return pos;
+		}
+		if(group_match(ctrl, CTRL_EMPTY) != 0)
+			return ILLEGAL_POS;
+
+		++num_probes;
+		group = (group + num_probes * GROUP_SIZE) & hashmask;
+		assert(num_probes * GROUP_SIZE <= self->num_buckets);
+	}
+}
+
+/**
+ * Returns the first empty or deleted bucket in the probe sequence of @p hash.
+ * @internal
+ */
+static inline
+size_t find_free(const HashSet *self, unsigned hash)
+{
+	size_t hashmask   = self->num_buckets - 1;
+	size_t group      = hash_group(self, hash);
+	size_t num_probes = 0;
+
+	while(1) {
+		unsigned match = group_match_free(&self->ctrl[group]);
+		if(match != 0)
+			return group + FIRST_MATCH(match);
+
+		++num_probes;
+		group = (group + num_probes * GROUP_SIZE) & hashmask;
+		assert(num_probes * GROUP_SIZE <= self->num_buckets);
+	}
+}
+
+/**
+ * Inserts an element into a hashset without growing the set (you have to make
+ * sure there's enough room for that.
+ * @note also see comments for hashset_insert()
+ * @internal
+ */
+static inline
+InsertReturnValue insert_nogrow(HashSet *self, KeyType key)
+{
+	unsigned hash = Hash(self, key);
+	size_t   pos  = find_pos(self, key, hash);
+	if(pos != ILLEGAL_POS) {
+		// Value already in the set, return it
+		return GetInsertReturnValue(self->entries[pos], 1);
+	}
+
+	pos = find_free(self, hash);
+	if(self->ctrl[pos] == CTRL_DELETED) {
+		self->num_deleted--;
+	} else {
+		self->num_elements++;
+	}
+	self->ctrl[pos] = hash_tag(hash);
+
+	HashSetEntry *nentry = &self->entries[pos];
+	InitData(self, EntryGetValue(*nentry), key);
+	EntrySetHash(*nentry, hash);
+	return GetInsertReturnValue(*nentry, 0);
+}
+
+/**
+ * Inserts an element into a hashset under the assumption that the hashset
+ * contains no deleted entries and the element doesn't exist in the hashset yet.
+ * @internal
+ */
+static
+void insert_new(HashSet *self, unsigned hash, ValueType value)
+{
+	size_t pos = find_free(self, hash);
+	self->ctrl[pos] = hash_tag(hash);
+
+	HashSetEntry *nentry = &self->entries[pos];
+	EntryGetValue(*nentry) = value;
+	EntrySetHash(*nentry, hash);
+	self->num_elements++;
+}
+
+/**
+ * calculate shrink and enlarge limits
+ * @internal
+ */
+static inline
+void reset_thresholds(HashSet *self)
+{
+	self->enlarge_threshold = (size_t) GROUP_OCCUPANCY(self->num_buckets);
+	self->shrink_threshold  = (size_t) HT_EMPTY_FLT(self->num_buckets);
+	self->consider_shrink   = 0;
+}
+
+/**
+ * Allocates the buckets of the hashset, all of them empty. The control bytes
+ * are stored behind the entries in the same block.
+ * @internal
+ */
+static inline
+void alloc_buckets(HashSet *self, size_t num_buckets)
+{
+	assert((num_buckets & (num_buckets - 1)) == 0);
+	assert(num_buckets >= GROUP_SIZE);
+
+	size_t ctrl_entries = (num_buckets + sizeof(HashSetEntry) - 1)
+	                      / sizeof(HashSetEntry);
+	self->entries      = Alloc(num_buckets + ctrl_entries);
+	self->ctrl         = (unsigned char*) (self->entries + num_buckets);
+	memset(self->ctrl, CTRL_EMPTY, num_buckets);
+	self->num_buckets  = num_buckets;
+	self->num_elements = 0;
+	self->num_deleted  = 0;
+	reset_thresholds(self);
+}
+
+/**
+ * Resize the hashset
+ * @internal
+ */
+static inline
+void resize(HashSet *self, size_t new_size)
+{
+	size_t               num_buckets = self->num_buckets;
+	HashSetEntry        *old_entries = self->entries;
+	const unsigned char *old_ctrl    = self->ctrl;
+
+	alloc_buckets(self, new_size);
+#ifndef NDEBUG
+	self->entries_version++;
+#endif
+
+	/* reinsert all elements */
+	for(size_t i = 0; i < num_buckets; ++i) {
+		if(old_ctrl[i] & 0x80)
+			continue;
+
+		HashSetEntry *entry = &old_entries[i];
+		insert_new(self, EntryGetHash(self, *entry), EntryGetValue(*entry));
+	}
+
+	/* now we can free the old array */
+	Free(old_entries);
+}
+
+/**
+ * grow the hashset if adding 1 more elements would make it too crowded
+ * @internal
+ */
+static inline
+void maybe_grow(HashSet *self)
+{
+	if(LIKELY(self->num_elements + 1 <= self->enlarge_threshold))
+		return;
+
+	/* only rehash in place if enough deleted buckets can be reused */
+	size_t size = hashset_size(self);
+	if(size + 1 <= GROUP_OCCUPANCY(self->num_buckets) / 2) {
+		resize(self, self->num_buckets);
+	} else {
+		resize(self, self->num_buckets * 2);
+	}
+}
+
+/**
+ * shrink the hashset if it is only sparsely filled
+ * @internal
+ */
+static inline
+void maybe_shrink(HashSet *self)
+{
+	if(!self->consider_shrink)
+		return;
+
+	self->consider_shrink = 0;
+	size_t size           = hashset_size(self);
+	if(size <= HT_MIN_BUCKETS)
+		return;
+
+	if(LIKELY(size > self->shrink_threshold))
+		return;
+
+	/* stay below the maximum load after shrinking */
+	size_t resize_to = ceil_po2(size * 2);
+	if(resize_to < GROUP_SIZE)
+		resize_to = GROUP_SIZE;
+
+	resize(self, resize_to);
+}
+
+/**
+ * Insert an element into the hashset. If no element with key key exists yet,
+ * then a new one is created and initialized with the InitData function.
+ * Otherwise the exisiting element is returned (for hashs where key is equal to
+ * value, nothing is returned.)
+ *
+ * @param self   the hashset
+ * @param key    the key that identifies the data
+ * @returns      the existing or newly created data element (or nothing in case of hashs where keys are the while value)
+ */
+InsertReturnValue hashset_insert(HashSet *self, KeyType key)
+{
+#ifndef NDEBUG
+	self->entries_version++;
+#endif
+
+	maybe_shrink(self);
+	maybe_grow(self);
+	return insert_nogrow(self, key);
+}
+
+/**
+ * Searchs for an element with key @p key.
+ *
+ * @param self      the hashset
+ * @param key       the key to search for
+ * @returns         the found value or NullValue if nothing was found
+ */
+InsertReturnValue hashset_find(const HashSet *self, ConstKeyType key)
+{
+	size_t pos = find_pos(self, key, Hash(self, key));
+	if(pos == ILLEGAL_POS)
+		return NullReturnValue;
+	return GetInsertReturnValue(self->entries[pos], 1);
+}
+
+#ifdef hashset_find_hash
+/**
+ * Searchs for an element with key @p key, @p hash has to be Hash(self, key).
+ */
+InsertReturnValue hashset_find_hash(const HashSet *self, ConstKeyType key,
+                                    unsigned hash)
+{
+	size_t pos = find_pos(self, key, hash);
+	if(pos == ILLEGAL_POS)
+		return NullReturnValue;
+	return GetInsertReturnValue(self->entries[pos], 1);
+}
+#endif
+
+/**
+ * Marks bucket @p pos as unused.
+ * @internal
+ */
+static inline
+void remove_pos(HashSet *self, size_t pos)
+{
+	/* a group with an empty bucket never made a probe sequence continue, so
+	 * the bucket can become empty again */
+	size_t group = pos & ~(size_t) (GROUP_SIZE - 1);
+	if(group_match(&self->ctrl[group], CTRL_EMPTY) != 0) {
+		self->ctrl[pos] = CTRL_EMPTY;
+		self->num_elements--;
+	} else {
+		self->ctrl[pos] = CTRL_DELETED;
+		self->num_deleted++;
+	}
+	self->consider_shrink = 1;
+}
+
+/**
+ * Removes an element from a hashset. Does nothing if the set doesn't contain
+ * the element.
+ *
+ * @param self    the hashset
+ * @param key     key that identifies the data to remove
+ */
+void hashset_remove(HashSet *self, ConstKeyType key)
+{
+#ifndef NDEBUG
+	self->entries_version++;
+#endif
+
+	size_t pos = find_pos(self, key, Hash(self, key));
+	if(pos != ILLEGAL_POS)
+		remove_pos(self, pos);
+}
+
+/**
+ * Initializes hashset with a specific size
+ * @internal
+ */
+static inline
+void init_size(HashSet *self, size_t initial_size)
+{
+	if(initial_size < GROUP_SIZE)
+		initial_size = GROUP_SIZE;
+
+	alloc_buckets(self, initial_size);
+#ifndef NDEBUG
+	self->entries_version = 0;
+#endif
+}
+
+/**
+ * Initialializes a hashset with the default size. The memory for the set has to
+ * already allocated.
+ */
+void hashset_init(HashSet *self)
+{
+	init_size(self, HT_MIN_BUCKETS);
+}
+
+/**
+ * Destroys a hashset, freeing all used memory (except the memory for the
+ * HashSet struct itself).
+ */
+void hashset_destroy(HashSet *self)
+{
+	Free(self->entries);
+#ifndef NDEBUG
+	self->entries = NULL;
+	self->ctrl    = NULL;
+#endif
+}
+
+/**
+ * Initializes a hashset expecting expected_element size
+ */
+void hashset_init_size(HashSet *self, size_t expected_elements)
+{
+	if(expected_elements >= UINT_MAX/2) {
+		abort();
+	}
+
+	size_t needed_size = expected_elements + expected_elements / 7 + 1;
+	init_size(self, ceil_po2(needed_size));
+}
+
+/**
+ * Initializes a hashset iterator. The memory for the allocator has to be
+ * already allocated.
+ * @note it is not allowed to remove or insert elements while iterating
+ */
+void hashset_iterator_init(HashSetIterator *self, const HashSet *hashset)
+{
+	self->current_bucket = hashset->entries - 1;
+	self->current_ctrl   = hashset->ctrl - 1;
+	self->end            = hashset->entries + hashset->num_buckets;
+#ifndef NDEBUG
+	self->set             = hashset;
+	self->entries_version = hashset->entries_version;
+#endif
+}
+
+/**
+ * Returns the next value in the iterator or NULL if no value is left
+ * in the hashset.
+ * @note it is not allowed to remove or insert elements while iterating
+ */
+ValueType hashset_iterator_next(HashSetIterator *self)
+{
+	HashSetEntry        *current_bucket = self->current_bucket;
+	const unsigned char *current_ctrl   = self->current_ctrl;
+	HashSetEntry        *end            = self->end;
+
+	/* using hashset_insert or hashset_remove is not allowed while iterating */
+	assert(self->entries_version == self->set->entries_version);
+
+	do {
+		current_bucket++;
+		current_ctrl++;
+		if(current_bucket >= end)
+			return NullValue;
+	} while(*current_ctrl & 0x80);
+
+	self->current_bucket = current_bucket;
+	self->current_ctrl   = current_ctrl;
+	return EntryGetValue(*current_bucket);
+}
+
+/**
+ * Removes the element the iterator points to. Removing an element a second time
+ * has no result.
+ */
+void hashset_remove_iterator(HashSet *self, const HashSetIterator *iter)
+{
+	HashSetEntry *entry = iter->current_bucket;
+
+	/* iterator_next needs to have been called at least once */
+	assert(entry >= self->entries);
+	/* needs to be on a valid element */
+	assert(entry < self->entries + self->num_buckets);
+
+	size_t pos = (size_t) (entry - self->entries);
+	if(self->ctrl[pos] & 0x80)
+		return;
+
+	remove_pos(self, pos);
+}
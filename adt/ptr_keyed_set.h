@@ -0,0 +1,58 @@
+/**
+ * @file
+ * @brief   Hashset of structs which are found by one pointer field
+ *
+ * Instantiates the generic hashset (with GROUP_PROBING) for pointers to
+ * structs, two structs are equal if they have the same key pointer. Define
+ * before including this file:
+ *
+ *  - PtrKeyedSet          prefix of the generated names
+ *  - PtrKeyedEntry        the struct type, the set stores PtrKeyedEntry*
+ *  - PtrKeyedKey(entry)   the key of an entry
+ *  - PtrKeyedDeclared     (optional) if a header already has the typedef of
+ *                         PtrKeyedSet_t
+ *
+ * This defines the types PtrKeyedSet_t and PtrKeyedSet_iterator_t and the
+ * functions PtrKeyedSet_init, PtrKeyedSet_insert, PtrKeyedSet_find and so on,
+ * with the same meaning as for strset_t. Like hashset.c this can only be
+ * included once per file.
+ */
+#include <string.h>
+
+#include "hash_ptr.h"
+
+#define PTR_KEYED_CONCAT2(a, b)  a##b
+#define PTR_KEYED_CONCAT(a, b)   PTR_KEYED_CONCAT2(a, b)
+#define PTR_KEYED_NAME(suffix)   PTR_KEYED_CONCAT(PtrKeyedSet, suffix)
+
+#define HashSet         PTR_KEYED_NAME(_t)
+#define HashSetIterator PTR_KEYED_NAME(_iterator_t)
+#define HashSetEntry    PTR_KEYED_NAME(_entry_t)
+#define ValueType       PtrKeyedEntry*
+#define GROUP_PROBING
+#include "hashset.h"
+
+#ifndef PtrKeyedDeclared
+typedef struct PTR_KEYED_NAME(_t)          PTR_KEYED_NAME(_t);
+#endif
+typedef struct PTR_KEYED_NAME(_iterator_t) PTR_KEYED_NAME(_iterator_t);
+
+#define NullValue                  NULL
+#define DeletedValue               ((PtrKeyedEntry*)-1)
+#define Hash(this, key)            hash_ptr(PtrKeyedKey(key))
+#define KeysEqual(this,key1,key2)  (PtrKeyedKey(key1) == PtrKeyedKey(key2))
+#define SetRangeEmpty(ptr,size)    memset(ptr, 0, (size) * sizeof(*(ptr)))
+
+#define hashset_init             PTR_KEYED_NAME(_init)
+#define hashset_init_size        PTR_KEYED_NAME(_init_size)
+#define hashset_destroy          PTR_KEYED_NAME(_destroy)
+#define hashset_insert           PTR_KEYED_NAME(_insert)
+#define hashset_remove           PTR_KEYED_NAME(_remove)
+#define hashset_find             PTR_KEYED_NAME(_find)
+#define hashset_size             PTR_KEYED_NAME(_size)
+#define hashset_iterator_init    PTR_KEYED_NAME(_iterator_init)
+#define hashset_iterator_next    PTR_KEYED_NAME(_iterator_next)
+#define hashset_remove_iterator  PTR_KEYED_NAME(_remove_iterator)
+#define SCALAR_RETURN
+
+#include "hashset.c"
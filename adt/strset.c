@@ -33,6 +33,7 @@
 #define KeysEqual(this,key1,key2)  (strcmp(key1, key2) == 0)
 #define SetRangeEmpty(ptr,size)    memset(ptr, 0, (size) * sizeof(strset_entry_t))
 #define SCALAR_RETURN
+#define GROUP_PROBING
 
 #define hashset_init            strset_init
 #define hashset_init_size       strset_init_size
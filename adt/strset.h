@@ -24,7 +24,9 @@
 #define HashSetIterator  strset_iterator_t
 #define HashSetEntry     strset_entry_t
 #define ValueType        const char*
+#define GROUP_PROBING
 #include "hashset.h"
+#undef GROUP_PROBING
 #undef ValueType
 #undef HashSetEntry
 #undef HashSetIterator
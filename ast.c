@@ -2,6 +2,7 @@
 
 #include "ast_t.h"
 #include "type_t.h"
+#include "mem_report.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -9,7 +10,8 @@
 
 #include "adt/error.h"
 
-struct obstack  ast_obstack;
+static struct obstack        _ast_obstack;
+THREAD_LOCAL struct obstack *ast_obstack = &_ast_obstack;
 
 static FILE *out;
 static int   indent = 0;
@@ -46,17 +48,11 @@ static void print_call_expression(const call_expression_t *call)
 {
 	print_expression(call->function);
 	fprintf(out, "(");
-	call_argument_t *argument = call->arguments;
-	int              first    = 1;
-	while (argument != NULL) {
-		if (!first) {
+	const call_arguments_t *arguments = call->arguments;
+	for (unsigned i = 0; i < arguments->n_arguments; ++i) {
+		if (i > 0)
 			fprintf(out, ", ");
-		} else {
-			first = 0;
-		}
-		print_expression(argument->expression);
-
-		argument = argument->next;
+		print_expression(arguments->arguments[i]);
 	}
 	fprintf(out, ")");
 }
@@ -630,15 +626,80 @@ const char *get_entity_kind_name(entity_kind_t type)
 	panic("invalid environment entry found");
 }
 
+const char *get_expression_kind_name(expression_kind_t kind)
+{
+	switch (kind) {
+	case EXPR_INVALID:              return "invalid";
+	case EXPR_ERROR:                return "error";
+	case EXPR_INT_CONST:            return "int const";
+	case EXPR_FLOAT_CONST:          return "float const";
+	case EXPR_BOOL_CONST:           return "bool const";
+	case EXPR_STRING_CONST:         return "string const";
+	case EXPR_NULL_POINTER:         return "null pointer";
+	case EXPR_REFERENCE:            return "reference";
+	case EXPR_CALL:                 return "call";
+	case EXPR_SELECT:               return "select";
+	case EXPR_ARRAY_ACCESS:         return "array access";
+	case EXPR_SIZEOF:               return "sizeof";
+	case EXPR_FUNC:                 return "func";
+	case EXPR_UNARY_NEGATE:         return "negate";
+	case EXPR_UNARY_NOT:            return "not";
+	case EXPR_UNARY_BITWISE_NOT:    return "bitwise not";
+	case EXPR_UNARY_DEREFERENCE:    return "dereference";
+	case EXPR_UNARY_TAKE_ADDRESS:   return "take address";
+	case EXPR_UNARY_CAST:           return "cast";
+	case EXPR_UNARY_INCREMENT:      return "increment";
+	case EXPR_UNARY_DECREMENT:      return "decrement";
+	case EXPR_BINARY_ASSIGN:        return "assign";
+	case EXPR_BINARY_ADD:           return "add";
+	case EXPR_BINARY_SUB:           return "sub";
+	case EXPR_BINARY_MUL:           return "mul";
+	case EXPR_BINARY_DIV:           return "div";
+	case EXPR_BINARY_MOD:           return "mod";
+	case EXPR_BINARY_EQUAL:         return "equal";
+	case EXPR_BINARY_NOTEQUAL:      return "not equal";
+	case EXPR_BINARY_LESS:          return "less";
+	case EXPR_BINARY_LESSEQUAL:     return "less equal";
+	case EXPR_BINARY_GREATER:       return "greater";
+	case EXPR_BINARY_GREATEREQUAL:  return "greater equal";
+	case EXPR_BINARY_LAZY_AND:      return "lazy and";
+	case EXPR_BINARY_LAZY_OR:       return "lazy or";
+	case EXPR_BINARY_AND:           return "and";
+	case EXPR_BINARY_OR:            return "or";
+	case EXPR_BINARY_XOR:           return "xor";
+	case EXPR_BINARY_SHIFTLEFT:     return "shift left";
+	case EXPR_BINARY_SHIFTRIGHT:    return "shift right";
+	}
+	panic("invalid expression kind found");
+}
+
+const char *get_statement_kind_name(statement_kind_t kind)
+{
+	switch (kind) {
+	case STATEMENT_INVALID:     return "invalid";
+	case STATEMENT_ERROR:       return "error";
+	case STATEMENT_BLOCK:       return "block";
+	case STATEMENT_RETURN:      return "return";
+	case STATEMENT_DECLARATION: return "declaration";
+	case STATEMENT_IF:          return "if";
+	case STATEMENT_EXPRESSION:  return "expression";
+	case STATEMENT_GOTO:        return "goto";
+	case STATEMENT_LABEL:       return "label";
+	}
+	panic("invalid statement kind found");
+}
+
 void init_ast_module(void)
 {
 	out = stderr;
-	obstack_init(&ast_obstack);
+	obstack_init(ast_obstack);
+	mem_report_add_obstack("ast", ast_obstack);
 }
 
 void exit_ast_module(void)
 {
-	obstack_free(&ast_obstack, NULL);
+	mem_report_remove_obstack(ast_obstack);
+	obstack_free(ast_obstack, NULL);
 }
 
 void* (allocate_ast) (size_t size)
@@ -10,6 +10,7 @@ typedef union  expression_t             expression_t;
 typedef union  statement_t              statement_t;
 
 typedef struct context_t                context_t;
+typedef struct entity_index_t           entity_index_t;
 typedef struct export_t                 export_t;
 typedef struct import_t                 import_t;
 typedef struct expression_base_t        expression_base_t;
@@ -19,7 +20,7 @@ typedef struct string_const_t           string_const_t;
 typedef struct bool_const_t             bool_const_t;
 typedef struct cast_expression_t        cast_expression_t;
 typedef struct reference_expression_t   reference_expression_t;
-typedef struct call_argument_t          call_argument_t;
+typedef struct call_arguments_t         call_arguments_t;
 typedef struct call_expression_t        call_expression_t;
 typedef struct binary_expression_t      binary_expression_t;
 typedef struct unary_expression_t       unary_expression_t;
@@ -42,6 +43,7 @@ typedef struct module_t                 module_t;
 
 typedef struct function_parameter_t     function_parameter_t;
 typedef struct function_t               function_t;
+typedef struct lazy_body_t              lazy_body_t;
 typedef struct variable_t               variable_t;
 typedef struct function_entity_t        function_entity_t;
 typedef struct constant_t               constant_t;
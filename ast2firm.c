@@ -1,6 +1,7 @@
 #include <config.h>
 
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 
 #include <libfirm/firm.h>
@@ -9,9 +10,11 @@
 #include "type_t.h"
 #include "semantic_t.h"
 #include "mangle.h"
+#include "mem_report.h"
+#include "type_hash.h"
+#include "type_tuple_map.h"
 #include "adt/array.h"
 #include "adt/obst.h"
-#include "adt/strset.h"
 #include "adt/error.h"
 #include "adt/xmalloc.h"
 #include <libfirm/adt/pdeq.h>
@@ -21,6 +24,9 @@ static label_t           *labels           = NULL;
 /** context for the variables, this is usually the stack frame but might
  * be something else for things like coroutines */
 static ir_node           *variable_context = NULL;
+/** binds the type parameters of the polymorphic function instance being
+ * built, NULL for other functions */
+static const type_substitution_t *instance_substitution = NULL;
 
 typedef struct instantiate_function_t  instantiate_function_t;
 
@@ -37,11 +43,31 @@ typedef struct type2firm_env_t type2firm_env_t;
 struct type2firm_env_t {
 	int can_cache;       /* nonzero if type can safely be cached because
 	                        no typevariables are in the hierarchy */
+	/** binds the type parameters of the compound being laid out, outside
+	 * of bound compounds the ones of the function instance (if any) */
+	const type_substitution_t *substitution;
 };
 
-static struct obstack     obst;
-static strset_t           instantiated_functions;
-static pdeq              *instantiate_functions   = NULL;
+/** the entity holding the contents of a (pooled) string literal */
+typedef struct string_entity_t string_entity_t;
+struct string_entity_t {
+	const char *string;
+	ir_entity  *entity;
+};
+
+/* string literals come from the string pool, so equal contents means equal
+ * pointers */
+#define PtrKeyedSet        string_entity_set
+#define PtrKeyedEntry      string_entity_t
+#define PtrKeyedKey(entry) (entry)->string
+#include "adt/ptr_keyed_set.h"
+
+static struct obstack      obst;
+/** the entities of the queued functions, see assure_instance() */
+static type_tuple_map_t   *instances;
+static type_tuple_map_t   *variadic_call_types;
+static string_entity_set_t string_entities;
+static pdeq               *instantiate_functions   = NULL;
 
 static ir_type *_get_ir_type(type2firm_env_t *env, type_t *type);
 static ir_type *get_ir_type(type_t *type);
@@ -59,21 +85,17 @@ ir_node *uninitialized_local_var(ir_graph *irg, ir_mode *mode, int pos)
 
 unsigned dbg_snprint(char *buf, unsigned len, const dbg_info *dbg)
 {
-	const source_position_t *pos = (const source_position_t*) dbg;
-	if (pos == NULL)
+	unsigned    linenr;
+	const char *input_name
+		= decode_source_position((source_position_t) (uintptr_t) dbg, &linenr);
+	if (input_name == NULL)
 		return 0;
-	return (unsigned) snprintf(buf, len, "%s:%u", pos->input_name,
-	                           pos->linenr);
+	return (unsigned) snprintf(buf, len, "%s:%u", input_name, linenr);
 }
 
 const char *dbg_retrieve(const dbg_info *dbg, unsigned *line)
 {
-	const source_position_t *pos = (const source_position_t*) dbg;
-	if (pos == NULL)
-		return NULL;
-	if (line != NULL)
-		*line = pos->linenr;
-	return pos->input_name;
+	return decode_source_position((source_position_t) (uintptr_t) dbg, line);
 }
 
 void init_ast2firm(void)
@@ -110,15 +132,12 @@ static ident *unique_ident(const char *tag)
 
 static symbol_t *unique_symbol(const char *tag)
 {
-	obstack_printf(&symbol_obstack, "%s.%d", tag, unique_id);
-	unique_id++;
-
-	const char *string = obstack_finish(&symbol_obstack);
-	symbol_t   *symbol = symbol_table_insert(string);
-
-	assert(symbol->string == string);
+	char buf[256];
 
-	return symbol;
+	snprintf(buf, sizeof(buf), "%s.%d", tag, unique_id);
+	unique_id++;
+	/* the symbol table keeps its own copy of the string */
+	return symbol_table_insert(buf);
 }
 
 static ir_mode *get_atomic_mode(const atomic_type_kind_t atomic_kind)
@@ -186,13 +205,16 @@ static unsigned get_compound_type_size(compound_type_t *type)
 
 static unsigned get_type_reference_type_var_size(const type_reference_t *type)
 {
-	type_variable_t *type_variable = type->type_variable;
+	type_t *bound_type = NULL;
+	if (instance_substitution != NULL)
+		bound_type = get_substituted_type(instance_substitution,
+		                                  type->type_variable);
 
-	if (type_variable->current_type == NULL) {
+	if (bound_type == NULL) {
 		panic("taking size of unbound type variable");
 		return 0;
 	}
-	return get_type_size(type_variable->current_type);
+	return get_type_size(bound_type);
 }
 
 static unsigned get_array_type_size(array_type_t *type)
@@ -365,7 +387,10 @@ static ir_type *get_array_type(type2firm_env_t *env, array_type_t *type)
 
 #define INVALID_TYPE ((ir_type*)-1)
 
-static ir_type *get_struct_type(type2firm_env_t *env, compound_type_t *type)
+/* the firm type is registered in @p cache before the entries are
+ * transformed, they may point back to the type */
+static ir_type *get_struct_type(type2firm_env_t *env, compound_type_t *type,
+                                type_base_t *cache)
 {
 	symbol_t *symbol = type->symbol;
 	ident    *id;
@@ -376,7 +401,7 @@ static ir_type *get_struct_type(type2firm_env_t *env, compound_type_t *type)
 	}
 	ir_type *type_ir = new_type_struct(id);
 
-	type->base.firm_type = type_ir;
+	cache->firm_type = type_ir;
 
 	int align_all = 1;
 	int offset    = 0;
@@ -413,7 +438,8 @@ static ir_type *get_struct_type(type2firm_env_t *env, compound_type_t *type)
 	return type_ir;
 }
 
-static ir_type *get_union_type(type2firm_env_t *env, compound_type_t *type)
+static ir_type *get_union_type(type2firm_env_t *env, compound_type_t *type,
+                               type_base_t *cache)
 {
 	symbol_t *symbol = type->symbol;
 	ident    *id;
@@ -424,7 +450,7 @@ static ir_type *get_union_type(type2firm_env_t *env, compound_type_t *type)
 	}
 	ir_type *type_ir = new_type_union(id);
 
-	type->base.firm_type = type_ir;
+	cache->firm_type = type_ir;
 
 	int align_all = 1;
 	int size      = 0;
@@ -465,14 +491,16 @@ static ir_type *get_type_for_type_variable(type2firm_env_t *env,
 {
 	assert(ref->base.kind == TYPE_REFERENCE_TYPE_VARIABLE);
 	type_variable_t *type_variable = ref->type_variable;
-	type_t          *current_type  = type_variable->current_type;
+	type_t          *bound_type    = NULL;
+	if (env->substitution != NULL)
+		bound_type = get_substituted_type(env->substitution, type_variable);
 
-	if (current_type == NULL) {
+	if (bound_type == NULL) {
 		fprintf(stderr, "Panic: trying to transform unbound type variable "
 		        "'%s'\n", type_variable->base.symbol->string);
 		abort();
 	}
-	ir_type *ir_type = _get_ir_type(env, current_type);
+	ir_type *ir_type = _get_ir_type(env, bound_type);
 	env->can_cache   = 0;
 
 	return ir_type;
@@ -481,15 +509,38 @@ static ir_type *get_type_for_type_variable(type2firm_env_t *env,
 static ir_type *get_type_for_bind_typevariables(type2firm_env_t *env,
                                                 bind_typevariables_type_t *type)
 {
-	compound_type_t *polymorphic_type = type->polymorphic_type;
-
-	int old_top = typevar_binding_stack_top();
-	push_type_variable_bindings(polymorphic_type->type_parameters,
-	                            type->type_arguments);
-
-	ir_type *result = _get_ir_type(env, (type_t*) polymorphic_type);
-
-	pop_type_variable_bindings(old_top);
+	/* the layout only depends on the concrete type arguments, so all uses
+	 * of the same (interned) concrete type share one firm type */
+	type_t *concrete_type = env->substitution != NULL
+		? substitute_type(env->substitution, (type_t*) type)
+		: (type_t*) type;
+	if (concrete_type != (type_t*) type)
+		env->can_cache = 0;
+	if (concrete_type->base.firm_type != NULL)
+		return concrete_type->base.firm_type;
+
+	bind_typevariables_type_t *bind_typevariables
+		= &concrete_type->bind_typevariables;
+	compound_type_t           *polymorphic_type
+		= bind_typevariables->polymorphic_type;
+
+	/* the entries refer to the bound type variables, this does not keep
+	 * the concrete type from being cached */
+	type2firm_env_t compound_env;
+	compound_env.can_cache    = 1;
+	compound_env.substitution
+		= make_type_substitution(NULL, polymorphic_type->type_parameters,
+		                         bind_typevariables->type_arguments);
+
+	ir_type *result;
+	if (polymorphic_type->base.kind == TYPE_COMPOUND_STRUCT) {
+		result = get_struct_type(&compound_env, polymorphic_type,
+		                         &concrete_type->base);
+	} else {
+		assert(polymorphic_type->base.kind == TYPE_COMPOUND_UNION);
+		result = get_union_type(&compound_env, polymorphic_type,
+		                        &concrete_type->base);
+	}
 
 	return result;
 }
@@ -522,10 +573,10 @@ static ir_type *_get_ir_type(type2firm_env_t *env, type_t *type)
 		firm_type = new_type_primitive(mode_ANY);
 		break;
 	case TYPE_COMPOUND_STRUCT:
-		firm_type = get_struct_type(env, &type->compound);
+		firm_type = get_struct_type(env, &type->compound, &type->base);
 		break;
 	case TYPE_COMPOUND_UNION:
-		firm_type = get_union_type(env, &type->compound);
+		firm_type = get_union_type(env, &type->compound, &type->base);
 		break;
 	case TYPE_REFERENCE_TYPE_VARIABLE:
 		firm_type = get_type_for_type_variable(env, &type->reference);
@@ -559,7 +610,8 @@ static ir_type *_get_ir_type(type2firm_env_t *env, type_t *type)
 static ir_type *get_ir_type(type_t *type)
 {
 	type2firm_env_t env;
-	env.can_cache = 1;
+	env.can_cache    = 1;
+	env.substitution = instance_substitution;
 
 	return _get_ir_type(&env, type);
 }
@@ -604,8 +656,8 @@ static ir_entity* get_concept_function_instance_entity(
 		concept_function_instance_t *function_instance)
 {
 	function_t *function = & function_instance->function;
-	if (function->e.entity != NULL)
-		return function->e.entity;
+	if (function->entity != NULL)
+		return function->entity;
 
 	function_type_t *function_type = function->type;
 
@@ -631,45 +683,24 @@ static ir_entity* get_concept_function_instance_entity(
 	set_entity_ld_ident(entity, id);
 	set_entity_visibility(entity, ir_visibility_local);
 
-	function->e.entity = entity;
+	function->entity = entity;
 
 	return entity;
 }
 
-static ir_entity* get_function_entity(function_t *function, symbol_t *symbol,
-                                      bool exported)
+/**
+ * Creates the entity of @p function, for polymorphic functions the instance
+ * with the types bound by @p substitution.
+ */
+static ir_entity *create_function_entity(const function_t *function,
+		const type_substitution_t *substitution, ident *id, bool exported)
 {
-	function_type_t *function_type  = function->type;
-	int              is_polymorphic = is_polymorphic_function(function);
-
-	if (!is_polymorphic && function->e.entity != NULL) {
-		return function->e.entity;
-	}
-
-	start_mangle();
-	mangle_symbol_simple(symbol);
-	if (is_polymorphic) {
-		type_variable_t *type_variable = function->type_parameters;
-		for ( ; type_variable != NULL; type_variable = type_variable->next) {
-			mangle_type(type_variable->current_type);
-		}
-	}
-	ident *id = finish_mangle();
-
-	/* search for an existing entity */
-	if (is_polymorphic && function->e.entities != NULL) {
-		int len = ARR_LEN(function->e.entities);
-		for (int i = 0; i < len; ++i) {
-			ir_entity *entity = function->e.entities[i];
-			if (get_entity_ident(entity) == id) {
-				return entity;
-			}
-		}
-	}
+	type_t *type = (type_t*) function->type;
+	if (substitution != NULL)
+		type = substitute_type(substitution, type);
 
-	/* create the entity */
 	ir_type *global_type    = get_glob_type();
-	ir_type *ir_method_type = get_ir_type((type_t*) function_type);
+	ir_type *ir_method_type = get_ir_type(type);
 
 	ir_entity *entity       = new_entity(global_type, id, ir_method_type);
 	set_entity_ld_ident(entity, id);
@@ -677,29 +708,64 @@ static ir_entity* get_function_entity(function_t *function, symbol_t *symbol,
 		set_entity_visibility(entity, ir_visibility_local);
 	}
 
-	if (!is_polymorphic) {
-		function->e.entity = entity;
-	} else {
-		if (function->e.entities == NULL)
-			function->e.entities = NEW_ARR_F(ir_entity*, 0);
-		ARR_APP1(ir_entity*, function->e.entities, entity);
-	}
 	return entity;
 }
 
-static dbg_info* get_dbg_info(const source_position_t *pos)
+static ir_entity* get_function_entity(function_t *function, symbol_t *symbol,
+                                      bool exported)
 {
-	return (dbg_info*) pos;
+	assert(!is_polymorphic_function(function));
+	if (function->entity != NULL)
+		return function->entity;
+
+	start_mangle();
+	mangle_symbol_simple(symbol);
+	ident *id = finish_mangle();
+
+	function->entity = create_function_entity(function, NULL, id, exported);
+	return function->entity;
+}
+
+/**
+ * Returns the name of the instance of a polymorphic function for the
+ * @p n_types concrete @p types bound to its type parameters.
+ */
+static ident *get_instance_ident(symbol_t *symbol, type_t *const *types,
+                                 size_t n_types)
+{
+	start_mangle();
+	mangle_symbol_simple(symbol);
+	for (size_t i = 0; i < n_types; ++i) {
+		mangle_type(types[i]);
+	}
+	return finish_mangle();
+}
+
+/**
+ * Returns @p type with the type parameters of the function instance being
+ * built replaced by their concrete types.
+ */
+static type_t *get_instance_type(type_t *type)
+{
+	if (instance_substitution == NULL)
+		return type;
+	return substitute_type(instance_substitution, type);
+}
+
+/** the position itself is used as dbg_info, see dbg_retrieve() */
+static dbg_info* get_dbg_info(source_position_t pos)
+{
+	return (dbg_info*) (uintptr_t) pos;
 }
 
 static ir_node *load_from_expression_addr(type_t *type, ir_node *addr,
-                                          const source_position_t *pos);
+                                          source_position_t pos);
 
 static ir_node *int_const_to_firm(const int_const_t *cnst)
 {
 	ir_mode   *mode = get_ir_mode(cnst->base.type);
 	ir_tarval *tv   = new_tarval_from_long(cnst->value, mode);
-	dbg_info  *dbgi = get_dbg_info(&cnst->base.source_position);
+	dbg_info  *dbgi = get_dbg_info(cnst->base.source_position);
 
 	return new_d_Const(dbgi, tv);
 }
@@ -708,14 +774,14 @@ static ir_node *float_const_to_firm(const float_const_t *cnst)
 {
 	ir_mode   *mode = get_ir_mode(cnst->base.type);
 	ir_tarval *tv   = new_tarval_from_double(cnst->value, mode);
-	dbg_info  *dbgi = get_dbg_info(&cnst->base.source_position);
+	dbg_info  *dbgi = get_dbg_info(cnst->base.source_position);
 
 	return new_d_Const(dbgi, tv);
 }
 
 static ir_node *bool_const_to_firm(const bool_const_t *cnst)
 {
-	dbg_info *dbgi = get_dbg_info(&cnst->base.source_position);
+	dbg_info *dbgi = get_dbg_info(cnst->base.source_position);
 
 	if (cnst->value == 0) {
 		return new_d_Const(dbgi, get_tarval_b_false());
@@ -732,7 +798,7 @@ static ir_node *create_symconst(dbg_info *dbgi, ir_entity *entity)
 	return new_d_SymConst(dbgi, mode_P, sym, symconst_addr_ent);
 }
 
-static ir_node *string_const_to_firm(const string_const_t* cnst)
+static ir_entity *create_string_entity(const char *string)
 {
 	ir_type   *global_type = get_glob_type();
 	ir_type   *type        = new_type_array(1, byte_ir_type);
@@ -745,7 +811,6 @@ static ir_node *string_const_to_firm(const string_const_t* cnst)
 	ir_type    *elem_type = byte_ir_type;
 	ir_mode    *mode      = get_type_mode(elem_type);
 
-	const char   *string = cnst->value;
 	const size_t  slen   = strlen(string) + 1;
 
 	set_array_lower_bound_int(type, 0, 0);
@@ -753,11 +818,6 @@ static ir_node *string_const_to_firm(const string_const_t* cnst)
 	set_type_size_bytes(type, slen);
 	set_type_state(type, layout_fixed);
 
-	ir_tarval **tvs = xmalloc(slen * sizeof(tvs[0]));
-	for (size_t i = 0; i < slen; ++i) {
-		tvs[i] = new_tarval_from_long(string[i], mode);
-	}
-
 	ir_initializer_t *initializer = create_initializer_compound(slen);
 	for (size_t i = 0; i < slen; ++i) {
 		ir_tarval        *tv  = new_tarval_from_long(string[i], mode);
@@ -766,8 +826,25 @@ static ir_node *string_const_to_firm(const string_const_t* cnst)
 	}
 	set_entity_initializer(entity, initializer);
 
-	dbg_info *dbgi = get_dbg_info(&cnst->base.source_position);
-	return create_symconst(dbgi, entity);
+	return entity;
+}
+
+static ir_node *string_const_to_firm(const string_const_t* cnst)
+{
+	/* all uses of the same literal share one entity */
+	string_entity_t *entry = obstack_alloc(&obst, sizeof(entry[0]));
+	entry->string = cnst->value;
+	entry->entity = NULL;
+
+	string_entity_t *result = string_entity_set_insert(&string_entities, entry);
+	if (result == entry) {
+		entry->entity = create_string_entity(cnst->value);
+	} else {
+		obstack_free(&obst, entry);
+	}
+
+	dbg_info *dbgi = get_dbg_info(cnst->base.source_position);
+	return create_symconst(dbgi, result->entity);
 }
 
 static ir_node *null_pointer_to_firm(void)
@@ -778,22 +855,48 @@ static ir_node *null_pointer_to_firm(void)
 	return new_Const(tv);
 }
 
+/**
+ * Returns the entity of @p entry in @p ir_compound, the firm type of the
+ * compound @p type. The entries of a polymorphic compound are shared by all
+ * bound types, so their entity field is only valid for plain compounds.
+ */
+static ir_entity *get_compound_entry_entity(const type_t *type,
+                                            ir_type *ir_compound,
+                                            const compound_entry_t *entry)
+{
+	if (type->kind != TYPE_BIND_TYPEVARIABLES)
+		return entry->entity;
+
+	const compound_type_t  *polymorphic_type
+		= type->bind_typevariables.polymorphic_type;
+	const compound_entry_t *member = polymorphic_type->entries;
+	size_t                  index  = 0;
+	for ( ; member != entry; member = member->next) {
+		++index;
+	}
+	return get_compound_member(ir_compound, index);
+}
+
 static ir_node *select_expression_addr(const select_expression_t *select)
 {
-	expression_t *compound_ptr = select->compound;
+	expression_t *compound_ptr  = select->compound;
+	type_t       *compound_type = compound_ptr->base.type;
+	if (compound_type->kind == TYPE_POINTER)
+		compound_type = compound_type->pointer.points_to;
 	/* make sure the firm type for the struct is constructed */
-	get_ir_type(compound_ptr->base.type);
+	ir_type *ir_compound = get_ir_type(compound_type);
 
 	ir_node   *compound_ptr_node = expression_to_firm(compound_ptr);
 	ir_node   *nomem             = new_NoMem();
 	ir_entity *entity;
 	if (select->compound_entry != NULL) {
-		entity = select->compound_entry->entity;
+		entity = get_compound_entry_entity(compound_type, ir_compound,
+		                                   select->compound_entry);
 	} else {
 		// TODO
 	}
 
-	dbg_info *dbgi = get_dbg_info(&select->base.source_position);
+	dbg_info *dbgi = get_dbg_info(select->base.source_position);
 	ir_node  *addr = new_d_simpleSel(dbgi, nomem, compound_ptr_node, entity);
 
 	return addr;
@@ -810,7 +913,7 @@ static ir_node *array_access_expression_addr(const array_access_expression_t* ac
 	ir_tarval    *elem_size_tv    = new_tarval_from_long(elem_size, mode_Is);
 	ir_node      *elem_size_const = new_Const(elem_size_tv);
 	dbg_info     *dbgi
-		= get_dbg_info(&access->base.source_position);
+		= get_dbg_info(access->base.source_position);
 
 	ir_node      *mul = new_d_Mul(dbgi, index_node, elem_size_const, mode_Is);
 	ir_node      *add = new_d_Add(dbgi, base_addr, mul, mode_P);
@@ -856,7 +959,7 @@ static ir_entity *create_variable_entity(variable_t *variable)
 static ir_node *variable_addr(variable_t *variable)
 {
 	ir_entity *entity = create_variable_entity(variable);
-	dbg_info  *dbgi   = get_dbg_info(&variable->base.source_position);
+	dbg_info  *dbgi   = get_dbg_info(variable->base.source_position);
 
 	ir_node *result;
 
@@ -874,7 +977,7 @@ static ir_node *variable_addr(variable_t *variable)
 }
 
 static ir_node *variable_to_firm(variable_t *variable,
-                                 const source_position_t *source_position)
+                                 source_position_t source_position)
 {
 	if (variable->is_global || variable->needs_entity) {
 		ir_node *addr = variable_addr(variable);
@@ -952,7 +1055,7 @@ static ir_node *expression_addr(const expression_t *expression)
 }
 
 static void firm_assign(expression_t *dest_expr, ir_node *value,
-                        const source_position_t *source_position)
+                        source_position_t source_position)
 {
 	if (dest_expr->kind == EXPR_REFERENCE) {
 		const reference_expression_t *ref
@@ -999,7 +1102,7 @@ static ir_node *assign_expression_to_firm(const binary_expression_t *assign)
 	expression_t *right = assign->right;
 	ir_node      *value = expression_to_firm(right);
 
-	firm_assign(left, value, & assign->base.source_position);
+	firm_assign(left, value, assign->base.source_position);
 
 	return value;
 }
@@ -1024,7 +1127,7 @@ static ir_node *create_lazy_op(const binary_expression_t *binary_expression)
 	bool is_or = binary_expression->base.kind == EXPR_BINARY_LAZY_OR;
 	assert(is_or || binary_expression->base.kind == EXPR_BINARY_LAZY_AND);
 
-	dbg_info *dbgi = get_dbg_info(&binary_expression->base.source_position);
+	dbg_info *dbgi = get_dbg_info(binary_expression->base.source_position);
 	ir_node  *val1 = expression_to_firm(binary_expression->left);
 
 	ir_node *cond       = new_d_Cond(dbgi, val1);
@@ -1087,7 +1190,7 @@ static ir_node *binary_expression_to_firm(
 	ir_node  *left  = expression_to_firm(binary_expression->left);
 	ir_node  *right = expression_to_firm(binary_expression->right);
 	dbg_info *dbgi
-		= get_dbg_info(&binary_expression->base.source_position);
+		= get_dbg_info(binary_expression->base.source_position);
 
 	if (kind == EXPR_BINARY_DIV) {
 		ir_mode *mode  = get_ir_mode(binary_expression->base.type);
@@ -1145,13 +1248,13 @@ static ir_node *cast_expression_to_firm(const unary_expression_t *cast)
 		return NULL;
 	} else {
 		ir_mode  *mode    = get_ir_mode(to_type);
-		dbg_info *dbgi    = get_dbg_info(&cast->base.source_position);
+		dbg_info *dbgi    = get_dbg_info(cast->base.source_position);
 		return new_d_Conv(dbgi, node, mode);
 	}
 }
 
 static ir_node *load_from_expression_addr(type_t *type, ir_node *addr,
-                                          const source_position_t *pos)
+                                          source_position_t pos)
 {
 	dbg_info *dbgi  = get_dbg_info(pos);
 	ir_mode  *mode  = get_ir_mode(type);
@@ -1174,7 +1277,7 @@ typedef ir_node* (*create_unop_node_func) (dbg_info *dbgi, ir_node *value,
 static ir_node *create_unary_expression_node(const unary_expression_t *expression,
                                              create_unop_node_func create_func)
 {
-	dbg_info *dbgi  = get_dbg_info(&expression->base.source_position);
+	dbg_info *dbgi  = get_dbg_info(expression->base.source_position);
 	type_t   *type  = expression->base.type;
 	ir_mode  *mode  = get_ir_mode(type);
 	ir_node  *value = expression_to_firm(expression->value);
@@ -1195,7 +1298,7 @@ static ir_node *unary_expression_to_firm(
 		addr = expression_to_firm(unary_expression->value);
 		return load_from_expression_addr(unary_expression->base.type,
 		                                 addr,
-	                             &unary_expression->base.source_position);
+	                             unary_expression->base.source_position);
 	case EXPR_UNARY_TAKE_ADDRESS:
 		return expression_addr(unary_expression->value);
 	case EXPR_UNARY_BITWISE_NOT:
@@ -1222,9 +1325,15 @@ static ir_node *select_expression_to_firm(const select_expression_t *select)
 		return addr;
 
 	return load_from_expression_addr(select->base.type, addr,
-	                                 &select->base.source_position);
+	                                 select->base.source_position);
 }
 
+/**
+ * Returns the entity of the instance of @p function_entity for
+ * @p type_arguments and queues the instance if it is new. Instances are
+ * looked up by their concrete type arguments, the name is only mangled when
+ * an instance is created.
+ */
 static ir_entity *assure_instance(function_entity_t *function_entity,
                                   type_argument_t *type_arguments)
 {
@@ -1232,31 +1341,64 @@ static ir_entity *assure_instance(function_entity_t *function_entity,
 	function_t *function = &function_entity->function;
 	symbol_t   *symbol   = function_entity->base.symbol;
 
-	int old_top        = typevar_binding_stack_top();
-	push_type_variable_bindings(function->type_parameters, type_arguments);
+	size_t n_types = 0;
+	type_argument_t *type_argument = type_arguments;
+	for ( ; type_argument != NULL; type_argument = type_argument->next) {
+		++n_types;
+	}
 
-	ir_entity  *entity = get_function_entity(function, symbol,
-	                                         function_entity->base.exported);
-	const char *name   = get_entity_name(entity);
+	type_t *types[n_types > 0 ? n_types : 1];
+	bool    interned = true;
+	type_argument = type_arguments;
+	for (size_t i = 0; i < n_types; ++i) {
+		types[i] = get_instance_type(type_argument->type);
+		if (!typehash_is_interned(types[i]))
+			interned = false;
+		type_argument = type_argument->next;
+	}
 
-	pop_type_variable_bindings(old_top);
+	ir_entity *entity;
+	if (interned) {
+		entity = type_tuple_map_find(instances, function, types, n_types);
+		if (entity != NULL)
+			return entity;
+	}
 
-	if (strset_find(&instantiated_functions, name) != NULL) {
-		return entity;
+	if (is_polymorphic_function(function)) {
+		/* instances with types that are not interned are only found by
+		 * their name */
+		ident *id = get_instance_ident(symbol, types, n_types);
+		entity    = type_tuple_map_find(instances, id, NULL, 0);
+		bool queued = entity != NULL;
+		if (!queued) {
+			const type_substitution_t *substitution
+				= make_type_substitution_from_types(function->type_parameters,
+				                                    types);
+			entity = create_function_entity(function, substitution, id,
+			                                function_entity->base.exported);
+			type_tuple_map_set(instances, id, NULL, 0, entity);
+		}
+
+		if (interned)
+			type_tuple_map_set(instances, function, types, n_types, entity);
+		if (queued)
+			return entity;
+	} else {
+		entity = get_function_entity(function, symbol,
+		                             function_entity->base.exported);
+		type_tuple_map_set(instances, function, types, n_types, entity);
 	}
 
 	instantiate_function_t *instantiate
 		= queue_function_instantiation(function, entity);
 
-	type_argument_t *type_argument = type_arguments;
 	type_argument_t *last_argument = NULL;
-	while (type_argument != NULL) {
-		type_t          *type         = type_argument->type;
+	for (size_t i = 0; i < n_types; ++i) {
 		type_argument_t *new_argument
 			= obstack_alloc(&obst, sizeof(new_argument[0]));
 		memset(new_argument, 0, sizeof(new_argument[0]));
 
-		new_argument->type = create_concrete_type(type);
+		new_argument->type = types[i];
 
 		if (last_argument != NULL) {
 			last_argument->next = new_argument;
@@ -1264,18 +1406,14 @@ static ir_entity *assure_instance(function_entity_t *function_entity,
 			instantiate->type_arguments = new_argument;
 		}
 		last_argument = new_argument;
-
-		type_argument = type_argument->next;
 	}
 
-	strset_insert(&instantiated_functions, name);
-
 	return entity;
 }
 
 static ir_node *function_reference_to_firm(function_entity_t *function,
                                            type_argument_t *type_arguments,
-                                           const source_position_t *source_position)
+                                           source_position_t source_position)
 {
 	dbg_info  *dbgi   = get_dbg_info(source_position);
 	ir_entity *entity = assure_instance(function, type_arguments);
@@ -1286,19 +1424,21 @@ static ir_node *function_reference_to_firm(function_entity_t *function,
 
 static ir_node *concept_function_reference_to_firm(concept_function_t *function,
                                        type_argument_t *type_arguments,
-                                       const source_position_t *source_position)
+                                       source_position_t source_position)
 {
 	concept_t *concept = function->concept;
 
-	int old_top = typevar_binding_stack_top();
-	push_type_variable_bindings(concept->type_parameters, type_arguments);
+	const type_substitution_t *substitution
+		= make_type_substitution(instance_substitution,
+		                         concept->type_parameters, type_arguments);
 
-	concept_instance_t *instance = find_concept_instance(concept);
+	concept_instance_t *instance = find_concept_instance(concept, substitution);
 	if (instance == NULL) {
 		fprintf(stderr, "while looking at function '%s' from '%s'\n",
 		        function->base.symbol->string,
 		        concept->base.symbol->string);
-		print_type(concept->type_parameters->current_type);
+		print_type(get_substituted_type(substitution,
+		                                concept->type_parameters));
 		panic("no concept instance found in ast2firm phase");
 		return NULL;
 	}
@@ -1316,7 +1456,6 @@ static ir_node *concept_function_reference_to_firm(concept_function_t *function,
 	dbg_info  *dbgi     = get_dbg_info(source_position);
 	ir_entity *entity   = get_concept_function_instance_entity(function_instance);
 	ir_node   *symconst = create_symconst(dbgi, entity);
-	pop_type_variable_bindings(old_top);
 	return symconst;
 }
 
@@ -1349,6 +1488,54 @@ static ir_node *create_conv(dbg_info *dbgi, ir_node *op, ir_mode *dest_mode)
 	return new_d_Conv(dbgi, op, dest_mode);
 }
 
+/**
+ * Returns the method type for a call of a variadic function with the
+ * (firm) type @p ir_method_type, matching the call @p arguments. Calls with
+ * the same concrete argument types share one method type.
+ */
+static ir_type *get_variadic_call_type(ir_type *ir_method_type,
+                                       const call_arguments_t *arguments)
+{
+	size_t n_arguments = arguments->n_arguments;
+	type_t *types[n_arguments > 0 ? n_arguments : 1];
+	bool    interned = true;
+	for (size_t i = 0; i < n_arguments; ++i) {
+		types[i] = get_instance_type(arguments->arguments[i]->base.type);
+		if (!typehash_is_interned(types[i]))
+			interned = false;
+	}
+
+	if (interned) {
+		ir_type *method_type = type_tuple_map_find(variadic_call_types,
+				ir_method_type, types, n_arguments);
+		if (method_type != NULL)
+			return method_type;
+	}
+
+	ir_type *method_type = new_type_method(n_arguments,
+	                                       get_method_n_ress(ir_method_type));
+	set_method_calling_convention(method_type,
+	               get_method_calling_convention(ir_method_type));
+	set_method_additional_properties(method_type,
+	               get_method_additional_properties(ir_method_type));
+
+	for (size_t i = 0; i < get_method_n_ress(ir_method_type); ++i) {
+		set_method_res_type(method_type, i,
+		                    get_method_res_type(ir_method_type, i));
+	}
+	for (size_t i = 0; i < n_arguments; ++i) {
+		expression_t *expression = arguments->arguments[i];
+		set_method_param_type(method_type, i,
+		                      get_ir_type(expression->base.type));
+	}
+
+	if (interned) {
+		type_tuple_map_set(variadic_call_types, ir_method_type, types,
+		                   n_arguments, method_type);
+	}
+	return method_type;
+}
+
 static ir_node *call_expression_to_firm(const call_expression_t *call)
 {
 	expression_t  *function = call->function;
@@ -1361,36 +1548,14 @@ static ir_node *call_expression_to_firm(const call_expression_t *call)
 	assert(points_to->kind == TYPE_FUNCTION);
 	function_type_t *function_type   = (function_type_t*) points_to;
 	ir_type         *ir_method_type  = get_ir_type((type_t*) function_type);
-	ir_type         *new_method_type = NULL;
 
-	int              n_parameters = 0;
-	call_argument_t *argument     = call->arguments;
-	while (argument != NULL) {
-		n_parameters++;
-		argument = argument->next;
-	}
+	const call_arguments_t *arguments    = call->arguments;
+	int                     n_parameters = (int) arguments->n_arguments;
 
-	if (function_type->variable_arguments) {
-		/* we need to construct a new method type matching the call
-		 * arguments... */
-		new_method_type = new_type_method(n_parameters,
-		                                  get_method_n_ress(ir_method_type));
-		set_method_calling_convention(new_method_type,
-		               get_method_calling_convention(ir_method_type));
-		set_method_additional_properties(new_method_type,
-		               get_method_additional_properties(ir_method_type));
-
-		for (size_t i = 0; i < get_method_n_ress(ir_method_type); ++i) {
-			set_method_res_type(new_method_type, i,
-			                    get_method_res_type(ir_method_type, i));
-		}
-	}
 	ir_node *in[n_parameters];
 
-	argument = call->arguments;
-	int n = 0;
-	while (argument != NULL) {
-		expression_t *expression = argument->expression;
+	for (int n = 0; n < n_parameters; ++n) {
+		expression_t *expression = arguments->arguments[n];
 
 		ir_type *irtype   = get_ir_type(expression->base.type);
 		ir_node *arg_node = expression_to_firm(expression);
@@ -1399,18 +1564,14 @@ static ir_node *call_expression_to_firm(const call_expression_t *call)
 			arg_node = new_Conv(arg_node, mode);
 		}
 		in[n] = arg_node;
-		if (new_method_type != NULL) {
-			set_method_param_type(new_method_type, n, irtype);
-		}
-
-		argument = argument->next;
-		n++;
 	}
 
-	if (new_method_type != NULL)
-		ir_method_type = new_method_type;
+	if (function_type->variable_arguments) {
+		/* we need a method type matching the call arguments */
+		ir_method_type = get_variadic_call_type(ir_method_type, arguments);
+	}
 
-	dbg_info *dbgi  = get_dbg_info(&call->base.source_position);
+	dbg_info *dbgi  = get_dbg_info(call->base.source_position);
 	ir_node  *store = get_store();
 	ir_node  *node  = new_d_Call(dbgi, store, callee, n_parameters, in,
 	                             ir_method_type);
@@ -1434,7 +1595,7 @@ static ir_node *call_expression_to_firm(const call_expression_t *call)
 static ir_node *func_expression_to_firm(func_expression_t *expression)
 {
 	function_t *function = &expression->function;
-	ir_entity  *entity   = function->e.entity;
+	ir_entity  *entity   = function->entity;
 
 	if (entity == NULL) {
 		symbol_t *symbol = unique_symbol("anonfunc");
@@ -1452,7 +1613,7 @@ static ir_node *reference_expression_to_firm(const reference_expression_t *refer
 {
 	entity_t                *entity          = reference->entity;
 	type_argument_t         *type_arguments  = reference->type_arguments;
-	const source_position_t *source_position = &reference->base.source_position;
+	source_position_t        source_position = reference->base.source_position;
 
 	switch (entity->kind) {
 	case ENTITY_FUNCTION:
@@ -1505,7 +1666,7 @@ static ir_node *expression_to_firm(expression_t *expression)
 	case EXPR_ARRAY_ACCESS:
 		addr = expression_addr(expression);
 		return load_from_expression_addr(expression->base.type, addr,
-		                                 &expression->base.source_position);
+		                                 expression->base.source_position);
 	case EXPR_CALL:
 		return call_expression_to_firm(&expression->call);
 	case EXPR_SIZEOF:
@@ -1525,7 +1686,7 @@ static void statement_to_firm(statement_t *statement);
 
 static void return_statement_to_firm(const return_statement_t *statement)
 {
-	dbg_info     *dbgi  = get_dbg_info(&statement->base.source_position);
+	dbg_info     *dbgi  = get_dbg_info(statement->base.source_position);
 	expression_t *value = statement->value;
 	ir_node      *ret;
 	if (value != NULL) {
@@ -1549,7 +1710,7 @@ static void return_statement_to_firm(const return_statement_t *statement)
 
 static void if_statement_to_firm(const if_statement_t *statement)
 {
-	dbg_info *dbgi      = get_dbg_info(&statement->base.source_position);
+	dbg_info *dbgi      = get_dbg_info(statement->base.source_position);
 	ir_node  *condition = expression_to_firm(statement->condition);
 	assert(condition != NULL);
 
@@ -1609,7 +1770,7 @@ static void block_statement_to_firm(const block_statement_t *block)
 static void goto_statement_to_firm(goto_statement_t *goto_statement)
 {
 	dbg_info *dbgi
-		= get_dbg_info(&goto_statement->base.source_position);
+		= get_dbg_info(goto_statement->base.source_position);
 	label_t  *label = goto_statement->label;
 	ir_node  *block = label->block;
 
@@ -1687,10 +1848,12 @@ static void create_function(function_t *function, ir_entity *entity,
 	if (function->is_extern)
 		return;
 
-	int old_top = typevar_binding_stack_top();
+	assert(instance_substitution == NULL);
 	if (is_polymorphic_function(function)) {
 		assert(type_arguments != NULL);
-		push_type_variable_bindings(function->type_parameters, type_arguments);
+		instance_substitution
+			= make_type_substitution(NULL, function->type_parameters,
+			                         type_arguments);
 	}
 
 	ir_graph *irg = new_ir_graph(entity, function->n_local_vars);
@@ -1770,9 +1933,8 @@ static void create_function(function_t *function, ir_entity *entity,
 	free(value_numbers);
 	value_numbers = NULL;
 
-	variable_context = NULL;
-
-	pop_type_variable_bindings(old_top);
+	variable_context      = NULL;
+	instance_substitution = NULL;
 }
 
 static void create_concept_instance(concept_instance_t *instance)
@@ -1800,12 +1962,17 @@ static void context2firm(const context_t *context)
 	entity_t *entity = context->entities;
 	for ( ; entity != NULL; entity = entity->base.next) {
 		switch (entity->kind) {
-		case ENTITY_FUNCTION:
-			if (!is_polymorphic_function(&entity->function.function)) {
+		case ENTITY_FUNCTION: {
+			const function_t *function = &entity->function.function;
+			/* an unparsed lazy body belongs to an unused function */
+			if (function->lazy_body != NULL && !function->lazy_body->parsed)
+				break;
+			if (!is_polymorphic_function(function)) {
 				assure_instance(&entity->function, NULL);
 			}
 
 			break;
+		}
 		case ENTITY_VARIABLE:
 			create_variable_entity(&entity->variable);
 			break;
@@ -1836,13 +2003,14 @@ static void context2firm(const context_t *context)
 void ast2firm(const module_t *modules)
 {
 	obstack_init(&obst);
-	strset_init(&instantiated_functions);
+	mem_report_add_obstack("ast2firm", &obst);
+	instances           = new_type_tuple_map();
+	variadic_call_types = new_type_tuple_map();
+	string_entity_set_init(&string_entities);
 	instantiate_functions = new_pdeq();
 
 	init_ir_types();
 
-	assert(typevar_binding_stack_top() == 0);
-
 	/* transform toplevel stuff */
 	const module_t *module = modules;
 	for ( ; module != NULL; module = module->next) {
@@ -1854,16 +2022,15 @@ void ast2firm(const module_t *modules)
 		instantiate_function_t *instantiate_function
 			= pdeq_getl(instantiate_functions);
 
-		assert(typevar_binding_stack_top() == 0);
-
 		create_function(instantiate_function->function,
 		                instantiate_function->entity,
 		                instantiate_function->type_arguments);
 	}
 
-	assert(typevar_binding_stack_top() == 0);
-
 	del_pdeq(instantiate_functions);
+	string_entity_set_destroy(&string_entities);
+	mem_report_remove_obstack(&obst);
 	obstack_free(&obst, NULL);
-	strset_destroy(&instantiated_functions);
+	free_type_tuple_map(instances);
+	free_type_tuple_map(variadic_call_types);
 }
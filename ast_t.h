@@ -8,10 +8,12 @@
 #include "semantic.h"
 #include "lexer.h"
 #include "type.h"
+#include "compiler.h"
 #include "adt/obst.h"
 #include <libfirm/typerep.h>
 
-extern struct obstack  ast_obstack;
+/** AST nodes are allocated here, each parser thread has its own obstack */
+extern THREAD_LOCAL struct obstack *ast_obstack;
 
 extern module_t *modules;
 
@@ -57,8 +59,8 @@ typedef enum entity_kind_t {
  */
 typedef struct entity_base_t {
 	entity_kind_t      kind;
-	symbol_t          *symbol;
 	source_position_t  source_position;
+	symbol_t          *symbol;
 	entity_t          *next;
 	bool               exported;
 	int                refs;         /**< temporarily used by semantic phase */
@@ -87,6 +89,8 @@ struct context_t {
 	concept_instance_t *concept_instances;
 	export_t           *exports;
 	import_t           *imports;
+	/** entities by symbol, only built by the semantic checks while needed */
+	entity_index_t     *entity_index;
 };
 
 /**
@@ -103,8 +107,6 @@ struct type_variable_t {
 	entity_base_t      base;
 	type_constraint_t *constraints;
 	type_variable_t   *next;
-
-	type_t            *current_type;
 };
 
 struct function_parameter_t {
@@ -114,6 +116,16 @@ struct function_parameter_t {
 	int                   value_number;
 };
 
+/**
+ * The tokens of a function body that is only parsed when it is used, see
+ * parser_set_lazy_bodies().
+ */
+struct lazy_body_t {
+	lexed_token_t *tokens;     /**< NEWLINE INDENT ... DEDENT, ends with T_EOF */
+	const char    *input_name;
+	bool           parsed;
+};
+
 struct function_t {
 	function_type_t      *type;
 	type_variable_t      *type_parameters;
@@ -123,11 +135,11 @@ struct function_t {
 	context_t    context;
 	statement_t *statement;
 
-	union {
-		ir_entity   *entity;
-		ir_entity  **entities;
-	} e;
+	/** NULL for polymorphic functions, see assure_instance() in ast2firm */
+	ir_entity   *entity;
 	unsigned n_local_vars;
+
+	lazy_body_t *lazy_body; /**< NULL if the body was parsed with the rest */
 };
 
 struct function_entity_t {
@@ -181,6 +193,10 @@ struct concept_t {
 	concept_function_t *functions;
 	concept_instance_t *instances;
 	context_t           context;
+
+	/* the instances are looked up by semantic, see find_concept_instance() */
+	concept_instance_t *indexed_instances;  /**< newest indexed instance */
+	concept_instance_t *polymorphic_instances;
 };
 
 union entity_t {
@@ -198,11 +214,16 @@ union entity_t {
 };
 
 struct module_t {
-	symbol_t  *name;
-	context_t  context;
-	module_t  *next;
-	bool       processing : 1;
-	bool       processed : 1;
+	symbol_t           *name;
+	context_t           context;
+	module_t           *next;
+	/* the ends of the context lists, files are appended there */
+	entity_t           *last_entity;
+	concept_instance_t *last_concept_instance;
+	export_t           *last_export;
+	import_t           *last_import;
+	bool                processing : 1;
+	bool                processed : 1;
 };
 
 typedef enum {
@@ -292,8 +313,8 @@ typedef enum {
  */
 struct expression_base_t {
 	expression_kind_t  kind;
-	type_t            *type;
 	source_position_t  source_position;
+	type_t            *type;
 	bool               lowered;
 };
 
@@ -329,15 +350,18 @@ struct reference_expression_t {
 	type_argument_t   *type_arguments;
 };
 
-struct call_argument_t {
-	expression_t    *expression;
-	call_argument_t *next;
+/**
+ * the arguments of a call, stored in one piece behind their number
+ */
+struct call_arguments_t {
+	unsigned      n_arguments;
+	expression_t *arguments[];
 };
 
 struct call_expression_t {
 	expression_base_t  base;
 	expression_t      *function;
-	call_argument_t   *arguments;
+	call_arguments_t  *arguments;
 };
 
 struct unary_expression_t {
@@ -403,8 +427,8 @@ typedef enum {
 
 struct statement_base_t {
 	statement_kind_t   kind;
-	statement_t       *next;
 	source_position_t  source_position;
+	statement_t       *next;
 };
 
 struct return_statement_t {
@@ -479,16 +503,19 @@ struct concept_instance_t {
 	concept_instance_t          *next_in_concept;
 	context_t                    context;
 	type_variable_t             *type_parameters;
+	concept_instance_t          *next_polymorphic;
 };
 
 static inline void *_allocate_ast(size_t size)
 {
-	return obstack_alloc(&ast_obstack, size);
+	return obstack_alloc(ast_obstack, size);
 }
 
 #define allocate_ast(size)                 _allocate_ast(size)
 
 const char *get_entity_kind_name(entity_kind_t type);
+const char *get_expression_kind_name(expression_kind_t kind);
+const char *get_statement_kind_name(statement_kind_t kind);
 
 /* ----- helpers for plugins ------ */
 
@@ -497,6 +524,8 @@ unsigned register_statement(void);
 unsigned register_entity(void);
 
 expression_t *allocate_expression(expression_kind_t kind);
+call_arguments_t *allocate_call_arguments(unsigned n_arguments);
+statement_t *allocate_statement(statement_kind_t kind);
 entity_t *allocate_entity(entity_kind_t kind);
 
 #endif
@@ -0,0 +1,116 @@
+/*
+ * Micro benchmark for the utf-8 input validation: reads the given files many
+ * times through input_from_stream and input_get_utf8 and reports the
+ * throughput with the scalar and the vectorized (if available) ascii skipping.
+ *
+ * usage: decode_bench file1.fluffy file2.fluffy ...
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "input.h"
+#include "adt/error.h"
+
+/** read at least this many bytes per measurement */
+#define MIN_BENCH_BYTES   (64 * 1024 * 1024)
+
+static size_t decode_errors;
+
+static void bench_input_error(unsigned delta_lines, unsigned delta_cols,
+                              const char *message)
+{
+	(void) delta_lines;
+	(void) delta_cols;
+	(void) message;
+	decode_errors++;
+}
+
+static size_t append_file(FILE *out, const char *name)
+{
+	FILE *in = fopen(name, "rb");
+	if (in == NULL) {
+		fprintf(stderr, "Couldn't open '%s'\n", name);
+		exit(1);
+	}
+
+	char   buf[4096];
+	size_t total = 0;
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		if (fwrite(buf, 1, n, out) != n)
+			panic("couldn't write temporary file");
+		total += n;
+	}
+	fclose(in);
+	return total;
+}
+
+static double bench_validate(FILE *file, size_t size, size_t *errors)
+{
+	size_t  rounds = MIN_BENCH_BYTES / size + 1;
+	clock_t start  = clock();
+
+	decode_errors = 0;
+	for (size_t r = 0; r < rounds; ++r) {
+		rewind(file);
+		input_t             *input = input_from_stream(file, NULL);
+		const unsigned char *end;
+		const unsigned char *begin = input_get_utf8(input, &end);
+		if ((size_t) (end - begin) != size)
+			panic("input was not read completely");
+		input_free(input);
+	}
+	*errors = decode_errors;
+
+	double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+	if (seconds <= 0)
+		seconds = 1e-9;
+	return (double) (rounds * size) / (1024.0 * 1024.0) / seconds;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s file1 file2 ...\n", argv[0]);
+		return 1;
+	}
+
+	init_input();
+
+	/* concatenate all inputs, so small files don't measure fopen */
+	FILE *file = tmpfile();
+	if (file == NULL)
+		panic("couldn't create temporary file");
+	size_t size = 0;
+	for (int i = 1; i < argc; ++i) {
+		size += append_file(file, argv[i]);
+	}
+	if (size == 0)
+		panic("inputs are empty");
+
+	set_input_error_callback(bench_input_error);
+
+	size_t errors_scalar;
+	size_t errors_simd;
+
+	input_set_scalar_only(true);
+	double scalar = bench_validate(file, size, &errors_scalar);
+	input_set_scalar_only(false);
+	double simd   = bench_validate(file, size, &errors_simd);
+
+	if (errors_scalar != errors_simd)
+		panic("scalar and vectorized validation disagree");
+
+	size_t rounds = MIN_BENCH_BYTES / size + 1;
+	printf("%d files, %lu bytes, %lu decode errors\n", argc - 1,
+	       (unsigned long) size, (unsigned long) (errors_simd / rounds));
+	printf("scalar:     %8.1f MB/s\n", scalar);
+	printf("vectorized: %8.1f MB/s (%.2fx)\n", simd, simd / scalar);
+
+	fclose(file);
+	return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Micro benchmark for the lexer: tokenizes the given files many times and
+ * reports the throughput. A second measurement runs on generated, operator
+ * dense code which stresses parse_operator.
+ *
+ * usage: lexer_bench file1.fluffy file2.fluffy ...
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lexer.h"
+#include "input.h"
+#include "symbol_table.h"
+#include "string_pool.h"
+#include "token_t.h"
+#include "ast.h"
+#include "adt/error.h"
+#include "adt/util.h"
+
+/** lex at least this many bytes per measurement */
+#define MIN_BENCH_BYTES   (64 * 1024 * 1024)
+
+static size_t append_file(FILE *out, const char *name)
+{
+	FILE *in = fopen(name, "rb");
+	if (in == NULL) {
+		fprintf(stderr, "Couldn't open '%s'\n", name);
+		exit(1);
+	}
+
+	char   buf[4096];
+	size_t total = 0;
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		if (fwrite(buf, 1, n, out) != n)
+			panic("couldn't write temporary file");
+		total += n;
+	}
+	fclose(in);
+	return total;
+}
+
+static size_t append_operator_code(FILE *out)
+{
+	static const char *const lines[] = {
+		"\tx = a<<2 + b>>1 - c*d/e % f\n",
+		"\tif a<=b && c>=d || e/=f && g==h:\n",
+		"\t\ty = ~a & b | c ^ !d\n",
+		"\tp = cast<byte*>(q) + i++ - j--\n",
+		"\tz = (a+b)*(c-d)/(e+f) <= g<<h\n",
+	};
+
+	size_t total = 0;
+	fputs("func f():\n", out);
+	while (total < 1024 * 1024) {
+		for (size_t i = 0; i < lengthof(lines); ++i) {
+			fputs(lines[i], out);
+			total += strlen(lines[i]);
+		}
+	}
+	return total;
+}
+
+static double bench_lex(FILE *file, size_t size, unsigned long *n_tokens)
+{
+	size_t  rounds = MIN_BENCH_BYTES / size + 1;
+	clock_t start  = clock();
+
+	*n_tokens = 0;
+	for (size_t r = 0; r < rounds; ++r) {
+		rewind(file);
+		input_t *input = input_from_file(file, NULL);
+		lexer_t  lexer;
+		lexer_init(&lexer, input, "<bench>", stderr);
+
+		token_t token;
+		do {
+			lexer_next_token(&lexer, &token);
+			++*n_tokens;
+		} while (token.type != T_EOF);
+
+		lexer_destroy(&lexer);
+		input_free(input);
+	}
+
+	double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+	if (seconds <= 0)
+		seconds = 1e-9;
+	*n_tokens = (unsigned long) (*n_tokens / seconds);
+	return (double) (rounds * size) / (1024.0 * 1024.0) / seconds;
+}
+
+static void report(const char *name, FILE *file, size_t size)
+{
+	unsigned long tokens_per_second;
+	double        mb_per_second = bench_lex(file, size, &tokens_per_second);
+	printf("%-10s %8.1f MB/s %12lu tokens/s\n", name, mb_per_second,
+	       tokens_per_second);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s file1 file2 ...\n", argv[0]);
+		return 1;
+	}
+
+	init_input();
+	init_symbol_table();
+	init_string_pool();
+	init_tokens();
+	init_ast_module();
+
+	/* concatenate all inputs, so small files don't measure fopen */
+	FILE *file = tmpfile();
+	if (file == NULL)
+		panic("couldn't create temporary file");
+	size_t size = 0;
+	for (int i = 1; i < argc; ++i) {
+		size += append_file(file, argv[i]);
+	}
+	if (size == 0)
+		panic("inputs are empty");
+
+	FILE *operators = tmpfile();
+	if (operators == NULL)
+		panic("couldn't create temporary file");
+	size_t operators_size = append_operator_code(operators);
+
+	/* lexer errors in the inputs are not interesting here */
+	if (freopen("/dev/null", "w", stderr) == NULL)
+		panic("couldn't redirect stderr");
+
+	printf("%d files, %lu bytes\n", argc - 1, (unsigned long) size);
+	report("inputs:", file, size);
+	report("operators:", operators, operators_size);
+
+	fclose(operators);
+	fclose(file);
+	exit_ast_module();
+	exit_tokens();
+	exit_string_pool();
+	exit_symbol_table();
+	return 0;
+}
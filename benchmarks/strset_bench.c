@@ -0,0 +1,169 @@
+/*
+ * Micro benchmark for the generic hashset: inserts N strings into a fresh
+ * set, looks all of them up again (hits) and looks up N strings which are not
+ * in the set (misses). This is done for strset_t, which uses the group probing
+ * backend, and for the same set with the classic backend. Besides the speed
+ * the size of the table after inserting N strings is printed.
+ *
+ * usage: strset_bench [N ...]
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "adt/strset.h"
+#include "adt/hash_string.h"
+#include "adt/xmalloc.h"
+
+#define HashSet          classic_set_t
+#define HashSetIterator  classic_set_iterator_t
+#define HashSetEntry     classic_set_entry_t
+#define ValueType        const char*
+#include "adt/hashset.h"
+#undef ValueType
+#undef HashSetEntry
+#undef HashSetIterator
+#undef HashSet
+
+typedef struct classic_set_t          classic_set_t;
+typedef struct classic_set_iterator_t classic_set_iterator_t;
+
+#define HashSet                    classic_set_t
+#define HashSetIterator            classic_set_iterator_t
+#define HashSetEntry               classic_set_entry_t
+#define ValueType                  const char*
+#define ConstKeyType               const char*
+#define NullValue                  NULL
+#define DeletedValue               ((void*)-1)
+#define Hash(this, value)          hash_string(value)
+#define KeysEqual(this,key1,key2)  (strcmp(key1, key2) == 0)
+#define SetRangeEmpty(ptr,size)    memset(ptr, 0, (size) * sizeof(classic_set_entry_t))
+#define SCALAR_RETURN
+
+#define hashset_init            classic_set_init
+#define hashset_init_size       classic_set_init_size
+#define hashset_destroy         classic_set_destroy
+#define hashset_insert          classic_set_insert
+#define hashset_remove          classic_set_remove
+#define hashset_find            classic_set_find
+#define hashset_size            classic_set_size
+#define hashset_iterator_init   classic_set_iterator_init
+#define hashset_iterator_next   classic_set_iterator_next
+#define hashset_remove_iterator classic_set_remove_iterator
+
+#include "adt/hashset.c"
+
+/** do at least this many operations of each kind per measurement */
+#define MIN_BENCH_OPERATIONS  (16 * 1024 * 1024)
+
+static double elapsed(clock_t start)
+{
+	double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+	return seconds <= 0 ? 1e-9 : seconds;
+}
+
+static void print_result(const char *name, size_t n, size_t operations,
+                         double insert_time, double hit_time, double miss_time,
+                         size_t table_size)
+{
+	printf("%-11s %6lu strings: insert %6.1f hit %6.1f miss %6.1f Mops/s, "
+	       "table %.1f bytes/string\n", name, (unsigned long) n,
+	       operations / insert_time / 1e6, operations / hit_time / 1e6,
+	       operations / miss_time / 1e6, (double) table_size / n);
+}
+
+/*
+ * Both backends are measured the same way, only the names differ. The group
+ * probing table has one control byte per bucket next to the entries.
+ */
+#define DEFINE_SET_BENCH(prefix, set_t, control_bytes)                          \
+static void bench_##prefix(char **keys, char **missing, size_t n)               \
+{                                                                               \
+	size_t rounds      = MIN_BENCH_OPERATIONS / n + 1;                          \
+	double insert_time = 0;                                                     \
+	double hit_time    = 0;                                                     \
+	double miss_time   = 0;                                                     \
+	size_t table_size  = 0;                                                     \
+	size_t found       = 0;                                                     \
+                                                                                \
+	for (size_t r = 0; r < rounds; ++r) {                                       \
+		set_t set;                                                              \
+		prefix##_init(&set);                                                    \
+                                                                                \
+		clock_t start = clock();                                                \
+		for (size_t i = 0; i < n; ++i) {                                        \
+			prefix##_insert(&set, keys[i]);                                     \
+		}                                                                       \
+		insert_time += elapsed(start);                                          \
+                                                                                \
+		start = clock();                                                        \
+		for (size_t i = 0; i < n; ++i) {                                        \
+			found += prefix##_find(&set, keys[i]) != NULL;                      \
+		}                                                                       \
+		hit_time += elapsed(start);                                             \
+                                                                                \
+		start = clock();                                                        \
+		for (size_t i = 0; i < n; ++i) {                                        \
+			found += prefix##_find(&set, missing[i]) != NULL;                   \
+		}                                                                       \
+		miss_time += elapsed(start);                                            \
+                                                                                \
+		table_size = set.num_buckets * (sizeof(set.entries[0]) + control_bytes);\
+		prefix##_destroy(&set);                                                 \
+	}                                                                           \
+	if (found != rounds * n) {                                                  \
+		fprintf(stderr, "%s: lookups are wrong\n", #prefix);                    \
+		exit(1);                                                                \
+	}                                                                           \
+	print_result(#prefix, n, rounds * n, insert_time, hit_time, miss_time,      \
+	             table_size);                                                   \
+}
+
+DEFINE_SET_BENCH(strset, strset_t, 1)
+DEFINE_SET_BENCH(classic_set, classic_set_t, 0)
+
+static void bench(size_t n)
+{
+	char **keys    = XMALLOCN(char*, n);
+	char **missing = XMALLOCN(char*, n);
+	for (size_t i = 0; i < n; ++i) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "ident_%lu", (unsigned long) i * 7919);
+		keys[i] = xstrdup(buf);
+		snprintf(buf, sizeof(buf), "other_%lu", (unsigned long) i);
+		missing[i] = xstrdup(buf);
+	}
+
+	bench_classic_set(keys, missing, n);
+	bench_strset(keys, missing, n);
+
+	for (size_t i = 0; i < n; ++i) {
+		free(keys[i]);
+		free(missing[i]);
+	}
+	xfree(missing);
+	xfree(keys);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		bench(200);
+		bench(5000);
+		bench(100000);
+		return 0;
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		long n = strtol(argv[i], NULL, 10);
+		if (n <= 0) {
+			fprintf(stderr, "Usage: %s [N ...]\n", argv[0]);
+			return 1;
+		}
+		bench((size_t) n);
+	}
+	return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Micro benchmark for the symbol table: collects the identifiers of the given
+ * files and interns them into a fresh symbol table many times. The first
+ * measurement replays the identifier stream as the lexer sees it (a miss for
+ * the first occurrence of every identifier, hits afterwards), the second one
+ * only looks up symbols which are already in the table. Finally the stream is
+ * interned concurrently by 1 to 16 threads (with locking enabled), each thread
+ * starting at a different position.
+ *
+ * usage: symbol_bench file1.fluffy file2.fluffy ...
+ */
+#define _POSIX_C_SOURCE 200112L
+#include <config.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lexer.h"
+#include "input.h"
+#include "symbol_table.h"
+#include "string_pool.h"
+#include "token_t.h"
+#include "ast.h"
+#include "adt/error.h"
+#include "adt/obst.h"
+#include "adt/util.h"
+#include "adt/xmalloc.h"
+
+/** intern at least this many identifiers per measurement */
+#define MIN_BENCH_IDENTIFIERS   (32 * 1024 * 1024)
+
+/** identifiers interned by all threads together per measurement */
+#define THREAD_BENCH_IDENTIFIERS  (16 * 1024 * 1024)
+
+typedef struct identifier_t {
+	const char *string;
+	size_t      len;
+} identifier_t;
+
+static struct obstack string_obst;
+static struct obstack identifier_obst;
+
+static void collect_identifiers(const char *name)
+{
+	FILE *in = fopen(name, "rb");
+	if (in == NULL) {
+		fprintf(stderr, "Couldn't open '%s'\n", name);
+		exit(1);
+	}
+
+	input_t *input = input_from_file(in, NULL);
+	lexer_t  lexer;
+	lexer_init(&lexer, input, name, stderr);
+
+	token_t token;
+	do {
+		lexer_next_token(&lexer, &token);
+		if (token.type != T_IDENTIFIER)
+			continue;
+		/* the symbol table is reset later, keep our own copy */
+		const char  *string = token.v.symbol->string;
+		identifier_t identifier;
+		identifier.len    = strlen(string);
+		identifier.string = obstack_copy(&string_obst, string,
+		                                 identifier.len);
+		obstack_grow(&identifier_obst, &identifier, sizeof(identifier));
+	} while (token.type != T_EOF);
+
+	lexer_destroy(&lexer);
+	input_free(input);
+	fclose(in);
+}
+
+static double elapsed(clock_t start)
+{
+	double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+	return seconds <= 0 ? 1e-9 : seconds;
+}
+
+static void bench_intern(const identifier_t *identifiers, size_t n,
+                         size_t *n_symbols)
+{
+	size_t rounds      = MIN_BENCH_IDENTIFIERS / n + 1;
+	double insert_time = 0;
+	double lookup_time = 0;
+	size_t n_distinct  = 0;
+
+	for (size_t r = 0; r < rounds; ++r) {
+		init_symbol_table();
+
+		clock_t start = clock();
+		for (size_t i = 0; i < n; ++i) {
+			symbol_table_insert_len(identifiers[i].string, identifiers[i].len);
+		}
+		insert_time += elapsed(start);
+
+		start = clock();
+		for (size_t i = 0; i < n; ++i) {
+			symbol_table_insert_len(identifiers[i].string, identifiers[i].len);
+		}
+		lookup_time += elapsed(start);
+
+		/* count the distinct identifiers once */
+		if (r == 0) {
+			for (size_t i = 0; i < n; ++i) {
+				const char *string = identifiers[i].string;
+				symbol_t   *symbol = symbol_table_insert_len(string,
+				                                             identifiers[i].len);
+				if (symbol->ID == 0) {
+					symbol->ID = 1;
+					++n_distinct;
+				}
+			}
+		}
+
+		exit_symbol_table();
+	}
+
+	*n_symbols = n_distinct;
+	printf("%-10s %12lu identifiers/s\n", "stream:",
+	       (unsigned long) (rounds * n / insert_time));
+	printf("%-10s %12lu lookups/s\n", "lookup:",
+	       (unsigned long) (rounds * n / lookup_time));
+}
+
+typedef struct intern_job_t {
+	const identifier_t *identifiers;
+	size_t              n;
+	size_t              begin;
+	size_t              count;
+} intern_job_t;
+
+static void *intern_thread(void *data)
+{
+	const intern_job_t *job = (const intern_job_t*) data;
+	size_t              i   = job->begin;
+	for (size_t c = 0; c < job->count; ++c) {
+		symbol_table_insert_len(job->identifiers[i].string,
+		                        job->identifiers[i].len);
+		if (++i == job->n)
+			i = 0;
+	}
+	return NULL;
+}
+
+static double wall_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void bench_threads(const identifier_t *identifiers, size_t n)
+{
+	static const unsigned n_threads[] = { 1, 2, 4, 8, 16 };
+
+	for (size_t t = 0; t < lengthof(n_threads); ++t) {
+		unsigned      count   = n_threads[t];
+		pthread_t    *threads = XMALLOCN(pthread_t, count);
+		intern_job_t *jobs    = XMALLOCN(intern_job_t, count);
+
+		init_symbol_table();
+		symbol_table_set_locking(true);
+
+		double start = wall_time();
+		for (unsigned i = 0; i < count; ++i) {
+			intern_job_t *job = &jobs[i];
+			job->identifiers = identifiers;
+			job->n           = n;
+			job->begin       = n * i / count;
+			job->count       = THREAD_BENCH_IDENTIFIERS / count;
+			if (pthread_create(&threads[i], NULL, intern_thread, job) != 0)
+				panic("couldn't create thread");
+		}
+		for (unsigned i = 0; i < count; ++i) {
+			pthread_join(threads[i], NULL);
+		}
+		double seconds = wall_time() - start;
+		if (seconds <= 0)
+			seconds = 1e-9;
+
+		symbol_table_set_locking(false);
+		exit_symbol_table();
+		xfree(jobs);
+		xfree(threads);
+
+		printf("%2u threads %12lu identifiers/s\n", count,
+		       (unsigned long) (THREAD_BENCH_IDENTIFIERS / count * count
+		                        / seconds));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s file1 file2 ...\n", argv[0]);
+		return 1;
+	}
+
+	init_input();
+	init_symbol_table();
+	init_string_pool();
+	init_tokens();
+	init_ast_module();
+
+	/* lexer errors in the inputs are not interesting here */
+	if (freopen("/dev/null", "w", stderr) == NULL)
+		panic("couldn't redirect stderr");
+
+	obstack_init(&string_obst);
+	obstack_init(&identifier_obst);
+	for (int i = 1; i < argc; ++i) {
+		collect_identifiers(argv[i]);
+	}
+	size_t        size        = obstack_object_size(&identifier_obst);
+	identifier_t *identifiers = obstack_finish(&identifier_obst);
+	size_t        n           = size / sizeof(identifiers[0]);
+	if (n == 0)
+		panic("inputs contain no identifiers");
+
+	exit_ast_module();
+	exit_tokens();
+	exit_string_pool();
+	exit_symbol_table();
+
+	size_t n_symbols;
+	printf("%d files, %lu identifiers\n", argc - 1, (unsigned long) n);
+	bench_intern(identifiers, n, &n_symbols);
+	printf("%lu distinct identifiers\n", (unsigned long) n_symbols);
+	bench_threads(identifiers, n);
+
+	obstack_free(&identifier_obst, NULL);
+	obstack_free(&string_obst, NULL);
+	return 0;
+}
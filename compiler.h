@@ -7,4 +7,10 @@
 #define WARN_UNUSED
 #endif
 
+#if defined __GNUC__
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 #endif
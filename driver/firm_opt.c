@@ -20,6 +20,7 @@
 #include "firm_opt.h"
 #include "firm_timing.h"
 #include "ast2firm.h"
+#include "mem_report.h"
 #include "adt/strutil.h"
 #include "adt/util.h"
 
@@ -790,7 +791,9 @@ void generate_code(FILE *out, const char *input_filename)
 	}
 
 	do_firm_optimizations(input_filename);
+	mem_report_phase("optimization");
 	do_firm_lowering(input_filename);
+	mem_report_phase("lowering");
 
 	timer_stop(t_all_opt);
 
@@ -801,6 +804,7 @@ void generate_code(FILE *out, const char *input_filename)
 	timer_start(t_backend);
 	be_main(out, input_filename);
 	timer_stop(t_backend);
+	mem_report_phase("backend");
 
 	if (firm_dump.statistic & STAT_FINAL)
 		stat_dump_snapshot(input_filename, "final");
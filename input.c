@@ -1,15 +1,27 @@
+#define _POSIX_C_SOURCE 200112L
 #include "config.h"
 
 #include "input.h"
 
 #include <ctype.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "lexer.h"
+#include "adt/util.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
 
 typedef size_t (*decode_func)(input_t *input, utf32 *buffer, size_t buffer_size);
 
 typedef enum {
 	INPUT_FILE,
-	INPUT_STRING
+	INPUT_STRING,
+	INPUT_MAPPED
 } input_kind_t;
 
 struct input_t {
@@ -17,13 +29,16 @@ struct input_t {
 	union {
 		FILE *file;
 		const char *string;
+		struct {
+			void                *base;   /**< start of the mapping */
+			size_t               length; /**< length of the mapping */
+			const unsigned char *begin;  /**< first byte to lex */
+		} mapped;
 	} in;
-	decode_func decode;
+	decode_func decode; /**< NULL for utf-8, which is lexed as is */
 
-	/* state for utf-8 decoder */
-	utf32  utf8_part_decoded_min_code;
-	utf32  utf8_part_decoded_char;
-	size_t utf8_part_decoded_rest_len;
+	/* utf-8 copy of not mapped inputs (see input_get_utf8) */
+	unsigned char *utf8_copy;
 };
 
 static input_error_callback_func input_error;
@@ -47,6 +62,14 @@ static size_t read_block(input_t *input, unsigned char *const read_buf,
 			return 0;
 		}
 		return s;
+	} else if (input->kind == INPUT_MAPPED) {
+		const unsigned char *base = input->in.mapped.base;
+		size_t len = base + input->in.mapped.length - input->in.mapped.begin;
+		if (len > n)
+			len = n;
+		memcpy(read_buf, input->in.mapped.begin, len);
+		input->in.mapped.begin += len;
+		return len;
 	} else {
 		assert(input->kind == INPUT_STRING);
 		size_t len = strlen(input->in.string);
@@ -100,114 +123,76 @@ static size_t decode_iso_8859_15(input_t *input, utf32 *buffer,
 	return s;
 }
 
-static size_t decode_utf8(input_t *input, utf32 *buffer, size_t buffer_size)
-{
-	unsigned char read_buf[buffer_size];
+/**
+ * Returns the length of the ascii prefix of src[0..n).
+ */
+typedef size_t (*skip_ascii_func)(const unsigned char *src, size_t n);
 
-	while (true) {
-		size_t const s = read_block(input, read_buf, sizeof(read_buf));
-		if (s == 0) {
-			if (input->utf8_part_decoded_rest_len > 0)
-				input_error(0, 0, "incomplete input char at end of input");
-			return 0;
-		}
+static skip_ascii_func skip_ascii;
+static bool            scalar_only;
 
-		unsigned char const *src = read_buf;
-		unsigned char const *end = read_buf + s;
-		utf32               *dst = buffer;
-		utf32                decoded;
-		utf32                min_code;
-
-		if (input->utf8_part_decoded_rest_len != 0) {
-			min_code              = input->utf8_part_decoded_min_code;
-			decoded               = input->utf8_part_decoded_char;
-			size_t const rest_len = input->utf8_part_decoded_rest_len;
-			input->utf8_part_decoded_rest_len = 0;
-			switch (rest_len) {
-				case 4:  goto realign;
-				case 3:  goto three_more;
-				case 2:  goto two_more;
-				default: goto one_more;
-			}
-		}
+static size_t skip_ascii_scalar(const unsigned char *src, size_t n)
+{
+	size_t i = 0;
+	while (i < n && src[i] < 0x80)
+		++i;
+	return i;
+}
 
-		while (src != end) {
-			if ((*src & 0x80) == 0) {
-				decoded = *src++;
-			} else if ((*src & 0xE0) == 0xC0) {
-				min_code = 0x80;
-				decoded  = *src++ & 0x1F;
-one_more:
-				if (src == end) {
-					input->utf8_part_decoded_min_code = min_code;
-					input->utf8_part_decoded_char     = decoded;
-					input->utf8_part_decoded_rest_len = 1;
-					break;
-				}
-				if ((*src & 0xC0) == 0x80) {
-					decoded = (decoded << 6) | (*src++ & 0x3F);
-				} else {
-					goto invalid_char;
-				}
-				if (decoded < min_code                      ||
-						decoded > 0x10FFFF                      ||
-						(0xD800 <= decoded && decoded < 0xE000) || // high/low surrogates
-						(0xFDD0 <= decoded && decoded < 0xFDF0) || // noncharacters
-						(decoded & 0xFFFE) == 0xFFFE) {            // noncharacters
-					input_error(0, 0, "invalid byte sequence in input");
-				}
-			} else if ((*src & 0xF0) == 0xE0) {
-				min_code = 0x800;
-				decoded  = *src++ & 0x0F;
-two_more:
-				if (src == end) {
-					input->utf8_part_decoded_min_code = min_code;
-					input->utf8_part_decoded_char     = decoded;
-					input->utf8_part_decoded_rest_len = 2;
-					break;
-				}
-				if ((*src & 0xC0) == 0x80) {
-					decoded = (decoded << 6) | (*src++ & 0x3F);
-				} else {
-					goto invalid_char;
-				}
-				goto one_more;
-			} else if ((*src & 0xF8) == 0xF0) {
-				min_code = 0x10000;
-				decoded  = *src++ & 0x07;
-three_more:
-				if (src == end) {
-					input->utf8_part_decoded_min_code = min_code;
-					input->utf8_part_decoded_char     = decoded;
-					input->utf8_part_decoded_rest_len = 3;
-					break;
-				}
-				if ((*src & 0xC0) == 0x80) {
-					decoded = (decoded << 6) | (*src++ & 0x3F);
-				} else {
-					goto invalid_char;
-				}
-				goto two_more;
-			} else {
-invalid_char:
-				input_error(0, 0, "invalid byte sequence in input");
-realign:
-				do {
-					++src;
-					if (src == end) {
-						input->utf8_part_decoded_rest_len = 4;
-						break;
-					}
-				} while ((*src & 0xC0) == 0x80 || (*src & 0xF8) == 0xF8);
-				continue;
-			}
-			*dst++ = decoded;
-		}
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static size_t skip_ascii_sse2(const unsigned char *src, size_t n)
+{
+	size_t i = 0;
+	for ( ; i + 16 <= n; i += 16) {
+		__m128i const bytes = _mm_loadu_si128((const __m128i*) (src + i));
+		/* a set high bit starts or continues a multibyte sequence */
+		int const mask = _mm_movemask_epi8(bytes);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + skip_ascii_scalar(src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t skip_ascii_avx2(const unsigned char *src, size_t n)
+{
+	size_t i = 0;
+	for ( ; i + 32 <= n; i += 32) {
+		__m256i const bytes = _mm256_loadu_si256((const __m256i*) (src + i));
+		unsigned const mask = (unsigned) _mm256_movemask_epi8(bytes);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + skip_ascii_scalar(src + i, n - i);
+}
+#endif
 
-		/* we're done when we could read more than 1 char */
-		if (buffer != dst)
-			return dst - buffer;
+/* not synchronized, called before any threads are started */
+static void choose_skip_ascii(void)
+{
+	skip_ascii = skip_ascii_scalar;
+#ifdef HAVE_X86_SIMD
+	if (scalar_only)
+		return;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		skip_ascii = skip_ascii_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		skip_ascii = skip_ascii_sse2;
 	}
+#endif
+}
+
+void input_set_scalar_only(bool new_scalar_only)
+{
+	scalar_only = new_scalar_only;
+	choose_skip_ascii();
+}
+
+void init_input(void)
+{
+	choose_skip_ascii();
 }
 
 static size_t decode_windows_1252(input_t *input, utf32 *buffer,
@@ -272,7 +257,6 @@ static named_decoder_t const decoders[] = {
 	{ "ISO_8859-15",     decode_iso_8859_15  }, // official alias
 	{ "ISO_8859-1:1987", decode_iso_8859_1   }, // official name
 	{ "Latin-9",         decode_iso_8859_15  }, // official alias
-	{ "UTF-8",           decode_utf8         }, // official name
 	{ "csISOLatin1",     decode_iso_8859_1   }, // official alias
 	{ "cp1252",          decode_windows_1252 },
 	{ "iso-ir-100",      decode_iso_8859_1   }, // official alias
@@ -293,23 +277,25 @@ static int my_strcasecmp(const char *s1, const char *s2)
 	return (unsigned char)*s1 - (unsigned char)*s2;
 }
 
+static bool is_utf8(const char *encoding)
+{
+	return encoding == NULL || my_strcasecmp(encoding, "UTF-8") == 0;
+}
+
+/* utf-8 needs no decoder, it is validated and lexed as is */
 static void choose_decoder(input_t *result, const char *encoding)
 {
-	if (encoding == NULL) {
-		result->decode = decode_utf8;
-	} else {
-		for (named_decoder_t const *i = decoders; i->name != NULL; ++i) {
-			if (my_strcasecmp(encoding, i->name) != 0)
-				continue;
-			result->decode = i->decoder;
-			break;
-		}
-		if (result->decode == NULL) {
-			fprintf(stderr, "error: input encoding \"%s\" not supported\n",
-					encoding);
-			result->decode = decode_utf8;
-		}
+	if (is_utf8(encoding))
+		return;
+
+	for (named_decoder_t const *i = decoders; i->name != NULL; ++i) {
+		if (my_strcasecmp(encoding, i->name) != 0)
+			continue;
+		result->decode = i->decoder;
+		return;
 	}
+	fprintf(stderr, "error: input encoding \"%s\" not supported\n",
+			encoding);
 }
 
 input_t *input_from_stream(FILE *file, const char *encoding)
@@ -323,6 +309,35 @@ input_t *input_from_stream(FILE *file, const char *encoding)
 	return result;
 }
 
+input_t *input_from_file(FILE *file, const char *encoding)
+{
+	/* only utf-8 is scanned in place, other encodings need a decoder */
+	if (!is_utf8(encoding))
+		return input_from_stream(file, encoding);
+
+	struct stat st;
+	int         fd = fileno(file);
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return input_from_stream(file, encoding);
+
+	long const pos = ftell(file);
+	if (pos < 0 || (off_t) pos >= st.st_size)
+		return input_from_stream(file, encoding);
+
+	size_t const length = (size_t) st.st_size;
+	void  *const base   = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED)
+		return input_from_stream(file, encoding);
+
+	input_t *result          = XMALLOCZ(input_t);
+	result->kind             = INPUT_MAPPED;
+	result->in.mapped.base   = base;
+	result->in.mapped.length = length;
+	result->in.mapped.begin  = (const unsigned char*) base + pos;
+
+	return result;
+}
+
 input_t *input_from_string(const char *string, const char *encoding)
 {
 	input_t *result   = XMALLOCZ(input_t);
@@ -334,12 +349,199 @@ input_t *input_from_string(const char *string, const char *encoding)
 	return result;
 }
 
-size_t decode(input_t *input, utf32 *buffer, size_t buffer_size)
+/** Writes the utf-8 encoding of @p tc to @p dst and returns its length. */
+static size_t encode_utf8_char(unsigned char *dst, utf32 const tc)
 {
-	return input->decode(input, buffer, buffer_size);
+	if (tc < 0x80U) {
+		dst[0] = tc;
+		return 1;
+	} else if (tc < 0x800) {
+		dst[0] = 0xC0 | (tc >> 6);
+		dst[1] = 0x80 | (tc & 0x3F);
+		return 2;
+	} else if (tc < 0x10000) {
+		dst[0] = 0xE0 | ( tc >> 12);
+		dst[1] = 0x80 | ((tc >>  6) & 0x3F);
+		dst[2] = 0x80 | ( tc        & 0x3F);
+		return 3;
+	} else {
+		dst[0] = 0xF0 | ( tc >> 18);
+		dst[1] = 0x80 | ((tc >> 12) & 0x3F);
+		dst[2] = 0x80 | ((tc >>  6) & 0x3F);
+		dst[3] = 0x80 | ( tc        & 0x3F);
+		return 4;
+	}
+}
+
+/**
+ * Decodes the character at *pos (before @p end) and advances *pos behind it.
+ * Returns NULL or a message if the character is invalid. A character that is
+ * encoded correctly but not allowed is still stored in *result, for broken
+ * sequences *pos is moved to the next possible start of a character and
+ * *result is EOF.
+ */
+static const char *decode_sequence(const unsigned char **pos,
+                                   const unsigned char *end, utf32 *result)
+{
+	const unsigned char *src = *pos;
+	utf32                decoded;
+	utf32                min_code;
+	unsigned             rest_len;
+
+	if ((*src & 0x80) == 0) {
+		*pos    = src + 1;
+		*result = *src;
+		return NULL;
+	} else if ((*src & 0xE0) == 0xC0) {
+		min_code = 0x80;
+		decoded  = *src++ & 0x1F;
+		rest_len = 1;
+	} else if ((*src & 0xF0) == 0xE0) {
+		min_code = 0x800;
+		decoded  = *src++ & 0x0F;
+		rest_len = 2;
+	} else if ((*src & 0xF8) == 0xF0) {
+		min_code = 0x10000;
+		decoded  = *src++ & 0x07;
+		rest_len = 3;
+	} else {
+		goto invalid_char;
+	}
+
+	for ( ; rest_len > 0; --rest_len) {
+		if (src == end) {
+			*pos    = end;
+			*result = (utf32) EOF;
+			return "incomplete input char at end of input";
+		}
+		if ((*src & 0xC0) != 0x80)
+			goto invalid_char;
+		decoded = (decoded << 6) | (*src++ & 0x3F);
+	}
+
+	*pos    = src;
+	*result = decoded;
+	if (decoded < min_code                      ||
+			decoded > 0x10FFFF                      ||
+			(0xD800 <= decoded && decoded < 0xE000) || // high/low surrogates
+			(0xFDD0 <= decoded && decoded < 0xFDF0) || // noncharacters
+			(decoded & 0xFFFE) == 0xFFFE) {            // noncharacters
+		return "invalid byte sequence in input";
+	}
+	return NULL;
+
+invalid_char:
+	do {
+		++src;
+	} while (src != end && ((*src & 0xC0) == 0x80 || (*src & 0xF8) == 0xF8));
+	*pos    = src;
+	*result = (utf32) EOF;
+	return "invalid byte sequence in input";
+}
+
+static unsigned count_lines(const unsigned char *pos, const unsigned char *end)
+{
+	unsigned n = 0;
+	while ((pos = memchr(pos, '\n', end - pos)) != NULL) {
+		++pos;
+		++n;
+	}
+	return n;
+}
+
+/**
+ * Reports the invalid characters in [begin, end) to the input error callback,
+ * their lines are counted from @p begin on. Ascii runs are skipped in bulk.
+ */
+static void validate_utf8(const unsigned char *begin, const unsigned char *end)
+{
+	const unsigned char *pos      = begin;
+	const unsigned char *line_pos = begin; /* lines are counted up to here */
+	unsigned             lines    = 0;
+
+	assert(skip_ascii != NULL && "init_input() not called");
+	while (pos != end) {
+		pos += skip_ascii(pos, end - pos);
+		if (pos == end)
+			break;
+
+		const unsigned char *start = pos;
+		utf32                tc;
+		const char          *message = decode_sequence(&pos, end, &tc);
+		if (LIKELY(message == NULL))
+			continue;
+
+		lines    += count_lines(line_pos, start);
+		line_pos  = start;
+		input_error(lines, 0, message);
+	}
+}
+
+const unsigned char *input_get_utf8(input_t *input, const unsigned char **end)
+{
+	if (input->kind == INPUT_MAPPED) {
+		const unsigned char *base  = input->in.mapped.base;
+		const unsigned char *begin = input->in.mapped.begin;
+		*end                      = base + input->in.mapped.length;
+		input->in.mapped.begin    = *end;
+		validate_utf8(begin, *end);
+		return begin;
+	}
+
+	assert(input->utf8_copy == NULL);
+	size_t         size     = 0;
+	size_t         capacity = 16384;
+	unsigned char *copy     = XMALLOCN(unsigned char, capacity);
+
+	if (input->decode == NULL) {
+		/* read utf-8 as is */
+		size_t n;
+		do {
+			if (capacity - size < capacity / 2) {
+				capacity *= 2;
+				copy      = XREALLOC(copy, unsigned char, capacity);
+			}
+			n     = read_block(input, copy + size, capacity - size);
+			size += n;
+		} while (n > 0);
+		validate_utf8(copy, copy + size);
+	} else {
+		/* the decoders produce valid characters only */
+		utf32  buf[1024];
+		size_t n;
+		while ((n = input->decode(input, buf, lengthof(buf))) > 0) {
+			if (capacity - size < n * 4) {
+				capacity = 2 * capacity + n * 4;
+				copy     = XREALLOC(copy, unsigned char, capacity);
+			}
+			for (size_t i = 0; i < n; ++i) {
+				size += encode_utf8_char(copy + size, buf[i]);
+			}
+		}
+	}
+
+	input->utf8_copy = copy;
+	*end             = copy + size;
+	return copy;
+}
+
+utf32 decode_utf8_char(const unsigned char **pos, const unsigned char *end)
+{
+	/* invalid characters were reported by input_get_utf8() already */
+	while (*pos != end) {
+		utf32 tc;
+		decode_sequence(pos, end, &tc);
+		if (tc != (utf32) EOF)
+			return tc;
+	}
+	return (utf32) EOF;
 }
 
 void input_free(input_t *input)
 {
+	if (input->kind == INPUT_MAPPED) {
+		munmap(input->in.mapped.base, input->in.mapped.length);
+	}
+	xfree(input->utf8_copy);
 	xfree(input);
 }
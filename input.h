@@ -2,21 +2,61 @@
 #define INPUT_H
 
 #include <stdio.h>
+#include <stdbool.h>
 #include "unicode.h"
 
 typedef struct input_t input_t;
 
+/**
+ * Chooses the code paths for the cpu. Must be called before inputs are used
+ * and before other threads are started.
+ */
+void init_input(void);
+
 input_t *input_from_stream(FILE *stream, const char *encoding);
 input_t *input_from_string(const char *string, const char *encoding);
 
-/** Type for a function being called on an input (or encoding) errors. */
+/**
+ * Create an input for @p file. Regular utf-8 files are mapped into memory
+ * so the lexer can scan them in place (see input_get_utf8), everything else
+ * (pipes, terminals, other encodings) falls back to input_from_stream.
+ */
+input_t *input_from_file(FILE *file, const char *encoding);
+
+/**
+ * Type for a function being called on an input (or encoding) errors.
+ * @p delta_lines is the line of the error relative to the start of the input
+ * block being read.
+ */
 typedef void (*input_error_callback_func)(unsigned delta_lines,
                                           unsigned delta_cols,
                                           const char *message);
 
 void set_input_error_callback(input_error_callback_func func);
 
-size_t decode(input_t *input, utf32 *buffer, size_t buffer_size);
+/**
+ * Restrict the utf-8 validation to its scalar code path instead of the
+ * vectorized ascii skipping chosen at runtime (for benchmarks and debugging).
+ * Like init_input() this must not be called while other threads use inputs.
+ */
+void input_set_scalar_only(bool scalar_only);
+
+/**
+ * Consumes the rest of the input and returns it as one contiguous utf-8 block,
+ * its end is stored in @p end. Memory mapped inputs are returned in place,
+ * everything else is decoded into a copy owned by the input. The block stays
+ * valid until input_free. Invalid utf-8 in the block is reported to the input
+ * error callback here.
+ */
+const unsigned char *input_get_utf8(input_t *input, const unsigned char **end);
+
+/**
+ * Decode a single utf-8 character at @p pos of a block returned by
+ * input_get_utf8 and advance @p pos behind it. Invalid sequences were
+ * reported by input_get_utf8 and are skipped silently. Returns EOF when
+ * @p end is reached.
+ */
+utf32 decode_utf8_char(const unsigned char **pos, const unsigned char *end);
 
 void input_free(input_t *input);
 
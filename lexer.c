@@ -4,19 +4,24 @@
 #include "input.h"
 #include "unicode.h"
 #include "symbol_table.h"
+#include "string_pool.h"
+#include "ast_t.h"
 #include "adt/error.h"
-#include "adt/strset.h"
 #include "adt/array.h"
+#include "adt/util.h"
+#include "compiler.h"
 
 #include <stdbool.h>
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 
-#define MAX_PUTBACK  16   // 1 would be enough, 16 gives a nicer alignment
-#define MAX_INDENT   256
-#define C_EOF        ((utf32)EOF)
+#define KEYWORD_HASH_SIZE  128   /* power of 2 */
+#define MAX_OPERATOR_CHARS 32
+/** lexer_split() doesn't create chunks smaller than this */
+#define MIN_CHUNK_SIZE     (64 * 1024)
 
 enum TOKEN_START_TYPE {
 	START_UNKNOWN = 0,
@@ -33,22 +38,128 @@ enum TOKEN_START_TYPE {
 static bool          tables_init = false;
 static unsigned char char_type[256];
 static unsigned char ident_char[256];
+/** keyword symbols from tokens.inc, see find_keyword() */
+static symbol_t     *keywords[KEYWORD_HASH_SIZE];
+
+/** a state of the operator trie, see parse_operator() */
+typedef struct operator_node_t operator_node_t;
+struct operator_node_t {
+	int             token_type; /**< operator ending here, 0 if none */
+	symbol_t       *symbol;
+	unsigned short  next[MAX_OPERATOR_CHARS]; /**< 0 if there is no successor */
+};
+
+/** trie column of each byte, 0 for bytes that appear in no operator */
+static unsigned char    operator_char[256];
+static unsigned         n_operator_chars;
+/** flexible array with the operator trie, the root is node 0 */
+static operator_node_t *operator_nodes;
+
+/** the lexer whose input is being decoded, for input_error() */
+static THREAD_LOCAL lexer_t *error_lexer;
+
+static void input_error(unsigned delta_lines, unsigned delta_cols,
+                        const char *message);
+
+
+/**
+ * Hash for keyword lookup. It only looks at the length, the first and the last
+ * character, which is collision free for the keywords in tokens.inc.
+ */
+static inline unsigned keyword_hash(const unsigned char *string, size_t len)
+{
+	return (string[0] * 5 + string[len-1] * 11 + len) & (KEYWORD_HASH_SIZE-1);
+}
+
+static void add_keyword(symbol_t *symbol)
+{
+	/* collisions are only slower, so add new keywords without fear */
+	const char *string = symbol->string;
+	unsigned    hash   = keyword_hash((const unsigned char*) string,
+	                                  strlen(string));
+	while (keywords[hash] != NULL) {
+		hash = (hash + 1) & (KEYWORD_HASH_SIZE-1);
+	}
+	keywords[hash] = symbol;
+}
+
+static void add_operator(const char *string, int token_type, symbol_t *symbol)
+{
+	unsigned node = 0;
+	for (const unsigned char *p = (const unsigned char*) string; *p != '\0';
+	     ++p) {
+		unsigned column = operator_char[*p];
+		if (column == 0) {
+			if (n_operator_chars + 1 >= MAX_OPERATOR_CHARS)
+				panic("too many different characters in operators");
+			column            = ++n_operator_chars;
+			operator_char[*p] = column;
+		}
+
+		unsigned next = operator_nodes[node].next[column];
+		if (next == 0) {
+			next = ARR_LEN(operator_nodes);
+			if (next > USHRT_MAX)
+				panic("too many operators");
+
+			operator_node_t new_node;
+			memset(&new_node, 0, sizeof(new_node));
+			ARR_APP1(operator_node_t, operator_nodes, new_node);
+			operator_nodes[node].next[column] = next;
+		}
+		node = next;
+	}
+	operator_nodes[node].token_type = token_type;
+	operator_nodes[node].symbol     = symbol;
+}
+
+static void add_token(const char *string)
+{
+	symbol_t *symbol = symbol_table_insert(string);
+	assert(symbol->ID > 0);
+
+	/* tokens.inc contains keywords and operators */
+	if (isalpha((unsigned char) string[0])) {
+		add_keyword(symbol);
+	} else {
+		add_operator(string, symbol->ID, symbol);
+	}
+}
 
-static utf32       c;
-source_position_t  source_position;
-static input_t    *input;
-static utf32       input_buf[1024 + MAX_PUTBACK];
-static utf32      *bufend;
-static utf32      *bufpos;
-static strset_t    stringset;
-static bool        at_line_begin;
-static unsigned    not_returned_dedents;
-static unsigned    newline_after_dedents;
-static unsigned    indent_levels[MAX_INDENT];
-static unsigned    indent_levels_len;
-static utf32       last_line_indent[MAX_INDENT];
-static unsigned    last_line_indent_len;
+static void init_token_tables(void)
+{
+	memset(keywords, 0, sizeof(keywords));
+	memset(operator_char, 0, sizeof(operator_char));
+	n_operator_chars = 0;
+
+	operator_node_t root;
+	memset(&root, 0, sizeof(root));
+	operator_nodes = NEW_ARR_F(operator_node_t, 0);
+	ARR_APP1(operator_node_t, operator_nodes, root);
+
+#define T(x,str,val)  add_token(str);
+#define TS(x,str,val)
+#include "tokens.inc"
+#undef TS
+#undef T
+}
 
+/**
+ * Returns the symbol of the keyword @p string or NULL if it is no keyword.
+ * This avoids the symbol table for the most frequent identifiers, tokens
+ * registered later by plugins are found in the symbol table.
+ */
+static inline symbol_t *find_keyword(const unsigned char *string, size_t len)
+{
+	unsigned hash = keyword_hash(string, len);
+	for (symbol_t *symbol; (symbol = keywords[hash]) != NULL;
+	     hash = (hash + 1) & (KEYWORD_HASH_SIZE-1)) {
+		if (strncmp(symbol->string, (const char*) string, len) == 0
+		    && symbol->string[len] == '\0')
+			return symbol;
+	}
+	return NULL;
+}
 
 static void init_tables(void)
 {
@@ -91,63 +202,108 @@ static void init_tables(void)
 	char_type['\n'] = START_NEWLINE;
 	char_type['\\'] = START_BACKSLASH;
 
+	init_token_tables();
+	set_input_error_callback(input_error);
+
 	tables_init = true;
 }
 
+void lexer_register_token(symbol_t *symbol)
+{
+	if (!tables_init)
+		init_tables();
+
+	/* new identifier like tokens are found in the symbol table */
+	const unsigned char *string = (const unsigned char*) symbol->string;
+	switch (char_type[string[0]]) {
+	case START_UNKNOWN:
+		char_type[string[0]] = START_OPERATOR;
+		break;
+	case START_SINGLE_CHARACTER_OPERATOR:
+		if (string[1] == '\0')
+			return;
+		/* the character alone has to stay a token */
+		char_type[string[0]] = START_OPERATOR;
+		char single[2] = { (char) string[0], '\0' };
+		add_operator(single, string[0], NULL);
+		break;
+	case START_OPERATOR:
+	case START_BACKSLASH:
+		break;
+	default:
+		return;
+	}
+	add_operator(symbol->string, symbol->ID, symbol);
+}
+
 static inline int is_ident_char(int c)
 {
 	return ident_char[c];
 }
 
-static void error_prefix_at(const char *input_name, unsigned linenr)
+static void error_prefix_at(lexer_t *lexer, unsigned linenr)
 {
-	fprintf(stderr, "%s:%d: Error: ", input_name, linenr);
+	fprintf(lexer->errors, "%s:%d: Error: ", lexer->input_name,
+	        linenr);
 }
 
-static void error_prefix(void)
+static void error_prefix(lexer_t *lexer)
 {
-	error_prefix_at(source_position.input_name, source_position.linenr);
+	error_prefix_at(lexer, lexer->linenr);
 }
 
-static void parse_error(const char *msg)
+static void parse_error(lexer_t *lexer, const char *msg)
 {
-	error_prefix();
-	fprintf(stderr, "%s\n", msg);
+	error_prefix(lexer);
+	fprintf(lexer->errors, "%s\n", msg);
 }
 
-static inline void next_char(void)
+static inline void next_char(lexer_t *lexer)
 {
-	if (bufpos >= bufend) {
-		size_t n = decode(input, input_buf+MAX_PUTBACK,
-		                  sizeof(input_buf)-MAX_PUTBACK);
-		if (n == 0) {
-			c = EOF;
-			return;
-		}
-		bufpos = input_buf + MAX_PUTBACK;
-		bufend = bufpos + n;
+	if (LIKELY(lexer->bufpos < lexer->bufend)) {
+		lexer->c = *(lexer->bufpos++);
+	} else {
+		lexer->c = EOF;
 	}
-	c = *(bufpos++);
 }
 
-static inline void put_back(const utf32 pc)
+/** the current (not EOF) character starts at this position */
+static inline const unsigned char *current_pos(const lexer_t *lexer)
+{
+	assert(lexer->c != EOF);
+	return lexer->bufpos - 1;
+}
+
+static inline void put_back(lexer_t *lexer)
 {
-	*(--bufpos - input_buf + input_buf) = pc;
+	if (lexer->c != EOF)
+		--lexer->bufpos;
 }
 
-static void parse_symbol(token_t *token)
+/**
+ * Decode the (multibyte) utf-8 character starting at the current byte and
+ * advance behind it. Returns EOF for invalid input at the end of file.
+ */
+static utf32 decode_current_char(lexer_t *lexer)
 {
-	symbol_t *symbol;
-	char     *string;
+	const unsigned char *pos = current_pos(lexer);
+	utf32 const          tc  = decode_utf8_char(&pos, lexer->bufend);
+	lexer->bufpos = pos;
+	return tc;
+}
 
-	do {
-		obstack_1grow(&symbol_obstack, c);
-		next_char();
-	} while (is_ident_char(c));
-	obstack_1grow(&symbol_obstack, '\0');
-	string = obstack_finish(&symbol_obstack);
+static void parse_symbol(lexer_t *lexer, token_t *token)
+{
+	const unsigned char *start = current_pos(lexer);
+	while (lexer->bufpos < lexer->bufend && is_ident_char(*lexer->bufpos)) {
+		++lexer->bufpos;
+	}
+	size_t const len = lexer->bufpos - start;
+	next_char(lexer);
 
-	symbol = symbol_table_insert(string);
+	symbol_t *symbol = find_keyword(start, len);
+	if (symbol == NULL)
+		symbol = symbol_table_insert_len((const char*) start, len);
 
 	if (symbol->ID > 0) {
 		token->type = symbol->ID;
@@ -155,26 +311,22 @@ static void parse_symbol(token_t *token)
 		token->type = T_IDENTIFIER;
 	}
 	token->v.symbol = symbol;
-
-	if (symbol->string != string) {
-		obstack_free(&symbol_obstack, string);
-	}
 }
 
-static void parse_number_bin(token_t *token)
+static void parse_number_bin(lexer_t *lexer, token_t *token)
 {
-	assert(c == 'b' || c == 'B');
-	next_char();
+	assert(lexer->c == 'b' || lexer->c == 'B');
+	next_char(lexer);
 
-	if (c != '0' && c != '1') {
-		parse_error("premature end of binary number literal");
+	if (lexer->c != '0' && lexer->c != '1') {
+		parse_error(lexer, "premature end of binary number literal");
 		token->type = T_ERROR;
 		return;
 	}
 
 	int value = 0;
 	for (;;) {
-		switch (c) {
+		switch (lexer->c) {
 			case '0': value = 2 * value;     break;
 			case '1': value = 2 * value + 1; break;
 
@@ -183,59 +335,59 @@ static void parse_number_bin(token_t *token)
 				token->v.intvalue = value;
 				return;
 		}
-		next_char();
+		next_char(lexer);
 	}
 }
 
-static void parse_number_hex(token_t *token)
+static void parse_number_hex(lexer_t *lexer, token_t *token)
 {
-	assert(c == 'x' || c == 'X');
-	next_char();
+	assert(lexer->c == 'x' || lexer->c == 'X');
+	next_char(lexer);
 
-	if (!isdigit(c) &&
-		!('A' <= c && c <= 'F') &&
-		!('a' <= c && c <= 'f')) {
-		parse_error("premature end of hex number literal");
+	if (!isdigit(lexer->c) &&
+		!('A' <= lexer->c && lexer->c <= 'F') &&
+		!('a' <= lexer->c && lexer->c <= 'f')) {
+		parse_error(lexer, "premature end of hex number literal");
 		token->type = T_ERROR;
 		return;
 	}
 
 	int value = 0;
 	for (;;) {
-		if (isdigit(c)) {
-			value = 16 * value + c - '0';
-		} else if ('A' <= c && c <= 'F') {
-			value = 16 * value + c - 'A' + 10;
-		} else if ('a' <= c && c <= 'f') {
-			value = 16 * value + c - 'a' + 10;
+		if (isdigit(lexer->c)) {
+			value = 16 * value + lexer->c - '0';
+		} else if ('A' <= lexer->c && lexer->c <= 'F') {
+			value = 16 * value + lexer->c - 'A' + 10;
+		} else if ('a' <= lexer->c && lexer->c <= 'f') {
+			value = 16 * value + lexer->c - 'a' + 10;
 		} else {
 			token->type     = T_INTEGER;
 			token->v.intvalue = value;
 			return;
 		}
-		next_char();
+		next_char(lexer);
 	}
 }
 
-static void parse_number_oct(token_t *token)
+static void parse_number_oct(lexer_t *lexer, token_t *token)
 {
-	assert(c == 'o' || c == 'O');
-	next_char();
+	assert(lexer->c == 'o' || lexer->c == 'O');
+	next_char(lexer);
 
 	int value = 0;
 	for (;;) {
-		if ('0' <= c && c <= '7') {
-			value = 8 * value + c - '0';
+		if ('0' <= lexer->c && lexer->c <= '7') {
+			value = 8 * value + lexer->c - '0';
 		} else {
 			token->type     = T_INTEGER;
 			token->v.intvalue = value;
 			return;
 		}
-		next_char();
+		next_char(lexer);
 	}
 }
 
-static void parse_number_dec(token_t *token, int first_char)
+static void parse_number_dec(lexer_t *lexer, token_t *token, int first_char)
 {
 	int value = 0;
 	if (first_char > 0) {
@@ -244,44 +396,44 @@ static void parse_number_dec(token_t *token, int first_char)
 	}
 
 	for (;;) {
-		if (isdigit(c)) {
-			value = 10 * value + c - '0';
+		if (isdigit(lexer->c)) {
+			value = 10 * value + lexer->c - '0';
 		} else {
 			token->type     = T_INTEGER;
 			token->v.intvalue = value;
 			return;
 		}
-		next_char();
+		next_char(lexer);
 	}
 }
 
-static void parse_number(token_t *token)
+static void parse_number(lexer_t *lexer, token_t *token)
 {
 	// TODO check for overflow
 	// TODO check for various invalid inputs sequences
 
-	if (c == '0') {
-		next_char();
-		switch (c) {
+	if (lexer->c == '0') {
+		next_char(lexer);
+		switch (lexer->c) {
 			case 'b':
-			case 'B': parse_number_bin(token); break;
+			case 'B': parse_number_bin(lexer, token); break;
 			case 'X':
-			case 'x': parse_number_hex(token); break;
+			case 'x': parse_number_hex(lexer, token); break;
 			case 'o':
-			case 'O': parse_number_oct(token); break;
-			default:  parse_number_dec(token, '0');
+			case 'O': parse_number_oct(lexer, token); break;
+			default:  parse_number_dec(lexer, token, '0');
 		}
 	} else {
-		parse_number_dec(token, 0);
+		parse_number_dec(lexer, token, 0);
 	}
 }
 
-static int parse_escape_sequence(void)
+static int parse_escape_sequence(lexer_t *lexer)
 {
-	assert(c == '\\');
-	next_char();
+	assert(lexer->c == '\\');
+	next_char(lexer);
 
-	switch (c) {
+	switch (lexer->c) {
 	case 'a': return '\a';
 	case 'b': return '\b';
 	case 'f': return '\f';
@@ -294,277 +446,312 @@ static int parse_escape_sequence(void)
 	case '\'': return'\'';
 	case '?': return '\?';
 	case 'x': /* TODO parse hex number ... */
-		parse_error("hex escape sequences not implemented yet");
+		parse_error(lexer, "hex escape sequences not implemented yet");
 		return 0;
 	case 'o': /* TODO parse octal number ... */
-		parse_error("octal escape sequences not implemented yet");
+		parse_error(lexer, "octal escape sequences not implemented yet");
 		return 0;
 	case EOF:
-		parse_error("reached end of file while parsing escape sequence");
+		parse_error(lexer, "reached end of file while parsing escape sequence");
 		return EOF;
 	default:
-		parse_error("unknown escape sequence\n");
+		parse_error(lexer, "unknown escape sequence\n");
 		return 0;
 	}
 }
 
-static void parse_string_literal(token_t *token)
+static void parse_string_literal(lexer_t *lexer, token_t *token)
 {
-	unsigned    start_linenr = source_position.linenr;
+	unsigned    start_linenr = lexer->linenr;
 	char       *string;
 	const char *result;
 
-	assert(c == '"');
-	next_char();
+	assert(lexer->c == '"');
+	next_char(lexer);
+
+	while (lexer->c != '\"') {
+		if (lexer->c >= ' ' && lexer->c < 0x80 && lexer->c != '\\') {
+			/* copy runs of plain ascii characters at once */
+			const unsigned char *start = current_pos(lexer);
+			const unsigned char *pos   = lexer->bufpos;
+			while (pos < lexer->bufend && *pos >= ' ' && *pos < 0x80
+			       && *pos != '"' && *pos != '\\') {
+				++pos;
+			}
+			lexer->bufpos = pos;
+			obstack_grow(ast_obstack, start, lexer->bufpos - start);
+			next_char(lexer);
+			continue;
+		}
 
-	while (c != '\"') {
-		if (c == '\\') {
-			c = parse_escape_sequence();
-		} else if (c == '\n') {
-			source_position.linenr++;
+		utf32 tc = lexer->c;
+		if (lexer->c == '\\') {
+			tc = parse_escape_sequence(lexer);
+		} else if (lexer->c == '\n') {
+			lexer->linenr++;
+		} else if (lexer->c >= 0x80) {
+			tc = decode_current_char(lexer);
+			if (tc == (utf32) EOF || tc < 0x80) {
+				/* an invalid sequence was skipped, rescan what follows it */
+				if (tc != (utf32) EOF)
+					--lexer->bufpos;
+				next_char(lexer);
+				continue;
+			}
 		}
 
-		if (c == C_EOF) {
-			error_prefix_at(source_position.input_name, start_linenr);
-			fprintf(stderr, "string has no end\n");
+		if (tc == (utf32) EOF) {
+			error_prefix_at(lexer, start_linenr);
+			fprintf(lexer->errors, "string has no end\n");
 			token->type = T_ERROR;
 			return;
 		}
 
-		obstack_grow_symbol(&symbol_obstack, c);
-		next_char();
+		obstack_grow_symbol(ast_obstack, tc);
+		next_char(lexer);
 	}
-	next_char();
+	next_char(lexer);
 
 	/* add finishing 0 to the string */
-	obstack_1grow(&symbol_obstack, '\0');
-	string = obstack_finish(&symbol_obstack);
+	obstack_1grow(ast_obstack, '\0');
+	string = obstack_finish(ast_obstack);
 
-	/* check if there is already a copy of the string */
-	result = strset_insert(&stringset, string);
-	if (result != string) {
-		obstack_free(&symbol_obstack, string);
-	}
+	/* literals are shared by all inputs, see string_pool.h */
+	result = string_pool_insert(string);
+	obstack_free(ast_obstack, string);
 
 	token->type     = T_STRING_LITERAL;
 	token->v.string = result;
 }
 
-static void skip_multiline_comment(void)
+static void skip_multiline_comment(lexer_t *lexer)
 {
-	unsigned start_linenr = source_position.linenr;
+	unsigned start_linenr = lexer->linenr;
 	unsigned level = 1;
 
 	while (true) {
-		switch (c) {
+		switch (lexer->c) {
 		case '*':
-			next_char();
-			if (c == '/') {
-				next_char();
+			next_char(lexer);
+			if (lexer->c == '/') {
+				next_char(lexer);
 				level--;
 				if (level == 0)
 					return;
 			}
 			break;
 		case '/':
-			next_char();
-			if (c == '*') {
-				next_char();
+			next_char(lexer);
+			if (lexer->c == '*') {
+				next_char(lexer);
 				level++;
 			}
 			break;
 		case EOF:
-			error_prefix_at(source_position.input_name, start_linenr);
-			fprintf(stderr, "comment has no end\n");
+			error_prefix_at(lexer, start_linenr);
+			fprintf(lexer->errors, "comment has no end\n");
 			return;
 		case '\n':
-			next_char();
-			source_position.linenr++;
+			next_char(lexer);
+			lexer->linenr++;
 			break;
 		default:
-			next_char();
+			next_char(lexer);
 			break;
 		}
 	}
 }
 
-static void skip_line_comment(void)
+static void skip_line_comment(lexer_t *lexer)
 {
-	while (c != '\n' && c != C_EOF) {
-		next_char();
-	}
+	if (lexer->c == '\n' || lexer->c == EOF)
+		return;
+
+	const unsigned char *start   = current_pos(lexer);
+	const unsigned char *newline = memchr(start, '\n', lexer->bufend - start);
+	lexer->bufpos = newline != NULL ? newline : lexer->bufend;
+	next_char(lexer);
 }
 
-static void parse_operator(token_t *token, int firstchar)
+/**
+ * Parse the operator starting at the current character (or skip the comment
+ * if it starts one).
+ */
+static void parse_operator(lexer_t *lexer, token_t *token)
 {
-	if (firstchar == '/') {
-		if (c == '*') {
-			next_char();
-			skip_multiline_comment();
-			return lexer_next_token(token);
-		} else if (c == '/') {
-			next_char();
-			skip_line_comment();
-			return lexer_next_token(token);
+	const unsigned char *start = current_pos(lexer);
+	if (lexer->c == '/' && lexer->bufpos < lexer->bufend) {
+		if (*lexer->bufpos == '*') {
+			next_char(lexer);
+			next_char(lexer);
+			skip_multiline_comment(lexer);
+			return lexer_next_token(lexer, token);
+		} else if (*lexer->bufpos == '/') {
+			next_char(lexer);
+			next_char(lexer);
+			skip_line_comment(lexer);
+			return lexer_next_token(lexer, token);
 		}
 	}
 
-	obstack_1grow(&symbol_obstack, firstchar);
-	while (char_type[c] == START_OPERATOR) {
-		obstack_1grow(&symbol_obstack, c);
-		next_char();
+	/* longest match in the operator trie */
+	const operator_node_t *match = NULL;
+	const unsigned char   *end   = start;
+	unsigned               node  = 0;
+	for (const unsigned char *p = start; p < lexer->bufend; ) {
+		node = operator_nodes[node].next[operator_char[*p++]];
+		if (node == 0)
+			break;
+		if (operator_nodes[node].token_type != 0) {
+			match = &operator_nodes[node];
+			end   = p;
+		}
 	}
-	obstack_1grow(&symbol_obstack, '\0');
-	char     *string = obstack_finish(&symbol_obstack);
-	symbol_t *symbol = symbol_table_insert(string);
 
-	int ID = symbol->ID;
-	if (ID > 0) {
-		token->type = ID;
-	} else {
-		error_prefix();
-		fprintf(stderr, "unknown operator %s found\n", string);
+	if (match == NULL) {
+		error_prefix(lexer);
+		fprintf(lexer->errors, "unknown operator %c found\n", lexer->c);
 		token->type = T_ERROR;
+		next_char(lexer);
+		return;
 	}
-	token->v.symbol = symbol;
 
-	if (symbol->string != string) {
-		obstack_free(&symbol_obstack, string);
-	}
+	lexer->bufpos = end;
+	next_char(lexer);
+	token->type     = match->token_type;
+	token->v.symbol = match->symbol;
 }
 
-static void parse_indent(token_t *token)
+static void parse_indent(lexer_t *lexer, token_t *token)
 {
-	if (not_returned_dedents > 0) {
+	if (lexer->not_returned_dedents > 0) {
 		token->type = T_DEDENT;
-		not_returned_dedents--;
-		if (not_returned_dedents == 0 && !newline_after_dedents)
-			at_line_begin = false;
+		lexer->not_returned_dedents--;
+		if (lexer->not_returned_dedents == 0 && !lexer->newline_after_dedents)
+			lexer->at_line_begin = false;
 		return;
 	}
 
-	if (newline_after_dedents) {
+	if (lexer->newline_after_dedents) {
 		token->type = T_NEWLINE;
-		at_line_begin         = false;
-		newline_after_dedents = 0;
+		lexer->at_line_begin         = false;
+		lexer->newline_after_dedents = 0;
 		return;
 	}
 
 	int      skipped_line = 0;
-	utf32    indent[MAX_INDENT];
-	unsigned indent_len;
+	unsigned char indent[MAX_INDENT];
+	unsigned      indent_len;
 
 start_indent_parsing:
 	indent_len = 0;
-	while (c == ' ' || c == '\t') {
-		indent[indent_len] = c;
+	while (lexer->c == ' ' || lexer->c == '\t') {
+		indent[indent_len] = lexer->c;
 		indent_len++;
 		if (indent_len > MAX_INDENT) {
 			panic("Indentation bigger than MAX_INDENT not supported");
 		}
-		next_char();
+		next_char(lexer);
 	}
 
 	/* skip empty lines */
-	while (c == '/') {
-		next_char();
-		if (c == '*') {
-			next_char();
-			skip_multiline_comment();
-		} else if (c == '/') {
-			next_char();
-			skip_line_comment();
+	while (lexer->c == '/') {
+		next_char(lexer);
+		if (lexer->c == '*') {
+			next_char(lexer);
+			skip_multiline_comment(lexer);
+		} else if (lexer->c == '/') {
+			next_char(lexer);
+			skip_line_comment(lexer);
 		} else {
-			put_back(c);
+			put_back(lexer);
 		}
 	}
-	if (c == '\n') {
-		next_char();
-		source_position.linenr++;
+	if (lexer->c == '\n') {
+		next_char(lexer);
+		lexer->linenr++;
 		skipped_line = 1;
 		goto start_indent_parsing;
 	}
-	at_line_begin = false;
+	lexer->at_line_begin = false;
 
 	unsigned i;
-	for (i = 0; i < indent_len && i < last_line_indent_len; ++i) {
-		if (indent[i] != last_line_indent[i]) {
-			parse_error("space/tab usage for indentation different from "
+	for (i = 0; i < indent_len && i < lexer->last_line_indent_len; ++i) {
+		if (indent[i] != lexer->last_line_indent[i]) {
+			parse_error(lexer, "space/tab usage for indentation different from "
 			            "previous line");
 			token->type = T_ERROR;
 			return;
 		}
 	}
-	if (last_line_indent_len < indent_len) {
+	if (lexer->last_line_indent_len < indent_len) {
 		/* more indentation */
-		memcpy(& last_line_indent[i], & indent[i], indent_len - i);
-		last_line_indent_len  = indent_len;
-		newline_after_dedents = 0;
+		memcpy(& lexer->last_line_indent[i], & indent[i], indent_len - i);
+		lexer->last_line_indent_len  = indent_len;
+		lexer->newline_after_dedents = 0;
 
-		indent_levels[indent_levels_len] = indent_len;
-		indent_levels_len++;
+		lexer->indent_levels[lexer->indent_levels_len] = indent_len;
+		lexer->indent_levels_len++;
 
 		token->type = T_INDENT;
 		return;
-	} else if (last_line_indent_len > indent_len) {
+	} else if (lexer->last_line_indent_len > indent_len) {
 		/* less indentation */
 		unsigned lower_level;
 		unsigned dedents = 0;
 		do {
 			dedents++;
-			indent_levels_len--;
-			lower_level = indent_levels[indent_levels_len - 1];
+			lexer->indent_levels_len--;
+			lower_level = lexer->indent_levels[lexer->indent_levels_len - 1];
 		} while (lower_level > indent_len);
 
 		if (lower_level < indent_len) {
-			parse_error("returning to invalid indentation level");
+			parse_error(lexer, "returning to invalid indentation level");
 			token->type = T_ERROR;
 			return;
 		}
 		assert(dedents >= 1);
 
-		not_returned_dedents = dedents - 1;
+		lexer->not_returned_dedents = dedents - 1;
 		if (skipped_line) {
-			newline_after_dedents = 1;
-			at_line_begin         = true;
+			lexer->newline_after_dedents = 1;
+			lexer->at_line_begin         = true;
 		} else {
-			newline_after_dedents = 0;
-			if (not_returned_dedents > 0) {
-				at_line_begin = true;
+			lexer->newline_after_dedents = 0;
+			if (lexer->not_returned_dedents > 0) {
+				lexer->at_line_begin = true;
 			}
 		}
 
-		last_line_indent_len = indent_len;
+		lexer->last_line_indent_len = indent_len;
 
 		token->type = T_DEDENT;
 		return;
 	}
 
-	lexer_next_token(token);
+	lexer_next_token(lexer, token);
 	return;
 }
 
-void lexer_next_token(token_t *token)
+void lexer_next_token(lexer_t *lexer, token_t *token)
 {
-	int firstchar;
-
-	if (at_line_begin) {
-		parse_indent(token);
+	if (lexer->at_line_begin) {
+		parse_indent(lexer, token);
 		return;
 	} else {
 		/* skip whitespaces */
-		while (c == ' ' || c == '\t') {
-			next_char();
+		while (lexer->c == ' ' || lexer->c == '\t') {
+			next_char(lexer);
 		}
 	}
 
-	if (c == C_EOF) {
+	if (lexer->c == EOF) {
 		/* if we're indented at end of file, then emit a newline, dedent, ...
 		 * sequence of tokens */
-		if (indent_levels_len > 1) {
-			not_returned_dedents = indent_levels_len - 1;
-			at_line_begin        = true;
-			indent_levels_len    = 1;
+		if (lexer->indent_levels_len > 1) {
+			lexer->not_returned_dedents = lexer->indent_levels_len - 1;
+			lexer->at_line_begin        = true;
+			lexer->indent_levels_len    = 1;
 			token->type          = T_NEWLINE;
 			return;
 		}
@@ -572,85 +759,93 @@ void lexer_next_token(token_t *token)
 		return;
 	}
 
-	int type = char_type[c];
+	int type = char_type[lexer->c];
 	switch (type) {
 	case START_SINGLE_CHARACTER_OPERATOR:
-		token->type = c;
-		next_char();
+		token->type = lexer->c;
+		next_char(lexer);
 		break;
 
 	case START_OPERATOR:
-		firstchar = c;
-		next_char();
-		parse_operator(token, firstchar);
+		parse_operator(lexer, token);
 		break;
 
 	case START_IDENT:
-		parse_symbol(token);
+		parse_symbol(lexer, token);
 		break;
 
 	case START_NUMBER:
-		parse_number(token);
+		parse_number(lexer, token);
 		break;
 
 	case START_STRING_LITERAL:
-		parse_string_literal(token);
+		parse_string_literal(lexer, token);
 		break;
 
 	case START_CHARACTER_CONSTANT:
-		next_char();
-		if (c == '\\') {
+		next_char(lexer);
+		if (lexer->c == '\\') {
 			token->type       = T_INTEGER;
-			token->v.intvalue = parse_escape_sequence();
-			next_char();
+			token->v.intvalue = parse_escape_sequence(lexer);
+			next_char(lexer);
 		} else {
-			if (c == '\n') {
-				parse_error("newline while parsing character constant");
-				source_position.linenr++;
+			if (lexer->c == '\n') {
+				parse_error(lexer, "newline while parsing character constant");
+				lexer->linenr++;
 			}
 			token->type       = T_INTEGER;
-			token->v.intvalue = c;
-			next_char();
+			token->v.intvalue = lexer->c;
+			if (lexer->c >= 0x80) {
+				token->v.intvalue = (int) decode_current_char(lexer);
+			}
+			next_char(lexer);
 		}
 
 		{
 			int err_displayed = 0;
-			while (c != '\'' && c != C_EOF) {
+			while (lexer->c != '\'' && lexer->c != EOF) {
 				if (!err_displayed) {
-					parse_error("multibyte character constant");
+					parse_error(lexer, "multibyte character constant");
 					err_displayed = 1;
 				}
 				token->type = T_ERROR;
-				next_char();
+				next_char(lexer);
 			}
 		}
-		next_char();
+		next_char(lexer);
 		break;
 
 	case START_NEWLINE:
-		next_char();
+		next_char(lexer);
 		token->type = T_NEWLINE;
-		source_position.linenr++;
-		at_line_begin = true;
+		lexer->linenr++;
+		lexer->at_line_begin = true;
 		break;
 
 	case START_BACKSLASH:
-		next_char();
-		if (c == '\n') {
-			next_char();
-			source_position.linenr++;
+		if (lexer->bufpos < lexer->bufend && *lexer->bufpos == '\n') {
+			next_char(lexer);
+			next_char(lexer);
+			lexer->linenr++;
 		} else {
-			parse_operator(token, '\\');
+			parse_operator(lexer, token);
 			return;
 		}
-		lexer_next_token(token);
+		lexer_next_token(lexer, token);
 		return;
 
 	default:
-		error_prefix();
-		fprintf(stderr, "unknown character '%c' found\n", c);
+		error_prefix(lexer);
+		if (lexer->c < 0x80) {
+			fprintf(lexer->errors, "unknown character '%c' found\n", lexer->c);
+		} else {
+			const unsigned char *start = current_pos(lexer);
+			decode_current_char(lexer);
+			fprintf(lexer->errors, "unknown character '%.*s' found\n",
+			        (int) (lexer->bufpos - start), (const char*) start);
+		}
 		token->type = T_ERROR;
-		next_char();
+		next_char(lexer);
 		break;
 	}
 }
@@ -658,44 +853,140 @@ void lexer_next_token(token_t *token)
 static void input_error(unsigned delta_lines, unsigned delta_cols,
                         const char *message)
 {
-	source_position.linenr += delta_lines;
+	lexer_t *lexer = error_lexer;
 	(void) delta_cols;
-	parse_error(message);
+	error_prefix_at(lexer, lexer->linenr + delta_lines);
+	fprintf(lexer->errors, "%s\n", message);
 }
 
-void lexer_init(input_t *new_input, const char *input_name)
+static void init_lexer_state(lexer_t *lexer, input_t *input, FILE *errors,
+                             const char *input_name)
 {
-	input                      = new_input;
-	bufpos                     = NULL;
-	bufend                     = NULL;
-	source_position.linenr     = 1;
-	source_position.input_name = input_name;
-	at_line_begin              = true;
-	indent_levels[0]           = 0;
-	indent_levels_len          = 1;
-	last_line_indent_len       = 0;
-	strset_init(&stringset);
-	not_returned_dedents       = 0;
-	newline_after_dedents      = 0;
-
-	set_input_error_callback(input_error);
+	memset(lexer, 0, sizeof(lexer[0]));
+	lexer->input             = input;
+	lexer->errors            = errors;
+	lexer->linenr            = 1;
+	lexer->input_name        = input_name;
+	lexer->at_line_begin     = true;
+	lexer->indent_levels[0]  = 0;
+	lexer->indent_levels_len = 1;
+}
 
+void lexer_init(lexer_t *lexer, input_t *input, const char *input_name,
+                FILE *errors)
+{
 	if (!tables_init) {
 		init_tables();
 	}
 
-	next_char();
+	init_lexer_state(lexer, input, errors, input_name);
+
+	error_lexer   = lexer;
+	lexer->bufpos = input_get_utf8(input, &lexer->bufend);
+
+	next_char(lexer);
+}
+
+void lexer_init_chunk(lexer_t *chunk, const lexer_t *lexer,
+                      const unsigned char *begin)
+{
+	assert(begin >= lexer->bufpos - 1 && begin < lexer->bufend);
+	init_lexer_state(chunk, lexer->input, lexer->errors,
+	                 lexer->input_name);
+	chunk->bufpos = begin;
+	chunk->bufend = lexer->bufend;
+
+	next_char(chunk);
+}
+
+void lexer_destroy(lexer_t *lexer)
+{
+	(void) lexer;
+}
+
+/**
+ * Returns the start of the first line behind @p pos beginning with an
+ * identifier (as top level declarations do) or NULL if there is none.
+ */
+static const unsigned char *find_declaration_line(const unsigned char *pos,
+                                                  const unsigned char *end)
+{
+	while (pos < end) {
+		const unsigned char *newline = memchr(pos, '\n', end - pos);
+		if (newline == NULL)
+			break;
+		pos = newline + 1;
+		if (pos < end && char_type[*pos] == START_IDENT)
+			return pos;
+	}
+	return NULL;
 }
 
-void lexer_destroy(void)
+size_t lexer_split(const lexer_t *lexer, size_t n_chunks,
+                   const unsigned char **starts)
 {
+	if (lexer->c == EOF)
+		return 0;
+
+	const unsigned char *begin = current_pos(lexer);
+	size_t               size  = lexer->bufend - begin;
+	if (n_chunks > size / MIN_CHUNK_SIZE)
+		n_chunks = size / MIN_CHUNK_SIZE;
+
+	size_t n = 0;
+	starts[n++] = begin;
+	for (size_t i = 1; i < n_chunks; ++i) {
+		const unsigned char *pos = begin + size / n_chunks * i;
+		if (pos < starts[n-1])
+			pos = starts[n-1];
+		pos = find_declaration_line(pos, lexer->bufend);
+		if (pos == NULL)
+			break;
+		starts[n++] = pos;
+	}
+	return n;
+}
+
+/**
+ * Returns true if a lexer started at the current position with
+ * lexer_init_chunk() produces the same tokens as @p lexer from here on: the
+ * next token is an identifier in column 0 and there is no indentation or
+ * pending dedent.
+ */
+static bool at_chunk_boundary(const lexer_t *lexer)
+{
+	if (lexer->c == EOF || char_type[lexer->c] != START_IDENT)
+		return false;
+	return current_pos(lexer)[-1] == '\n'
+	    && lexer->indent_levels_len == 1
+	    && lexer->last_line_indent_len == 0
+	    && lexer->not_returned_dedents == 0
+	    && !lexer->newline_after_dedents;
+}
+
+const unsigned char *lexer_tokenize(lexer_t *lexer, const unsigned char *limit,
+                                    lexed_token_t **tokens)
+{
+	for (;;) {
+		if (limit != NULL && lexer->c != EOF && current_pos(lexer) >= limit
+		    && at_chunk_boundary(lexer))
+			return current_pos(lexer);
+
+		lexed_token_t lexed;
+		lexer_next_token(lexer, &lexed.token);
+		lexed.linenr = lexer->linenr;
+		ARR_APP1(lexed_token_t, *tokens, lexed);
+		if (lexed.token.type == T_EOF)
+			return NULL;
+	}
 }
 
 static __attribute__((unused))
 void dbg_pos(const source_position_t source_position)
 {
-	fprintf(stdout, "%s:%d\n", source_position.input_name,
-	                           source_position.linenr);
+	unsigned    linenr;
+	const char *input_name = decode_source_position(source_position, &linenr);
+	fprintf(stdout, "%s:%u\n", input_name, linenr);
 	fflush(stdout);
 }
 
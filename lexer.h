@@ -1,20 +1,89 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
 #include "symbol_table_t.h"
 #include "token_t.h"
 #include "input.h"
+#include "source_position.h"
+
+#define MAX_INDENT   256
+
+/**
+ * The state of the lexer for one input. Several lexers may be active at the
+ * same time (in different threads).
+ */
+typedef struct lexer_t lexer_t;
+struct lexer_t {
+	/* the lexer works on the utf-8 bytes of the input, c is the current byte */
+	int                  c;
+	unsigned             linenr;
+	const char          *input_name;
+	input_t             *input;
+	FILE                *errors; /**< diagnostics are printed here */
+	const unsigned char *bufpos; /**< position behind c */
+	const unsigned char *bufend;
+	bool                 at_line_begin;
+	unsigned             not_returned_dedents;
+	unsigned             newline_after_dedents;
+	unsigned             indent_levels[MAX_INDENT];
+	unsigned             indent_levels_len;
+	unsigned char        last_line_indent[MAX_INDENT];
+	unsigned             last_line_indent_len;
+};
 
-typedef struct source_position_t source_position_t;
-struct source_position_t {
-	const char *input_name;
-	unsigned    linenr;
+/**
+ * Initializes @p lexer for the rest of @p input. Diagnostics, including the
+ * ones for invalid utf-8 in the input, are printed to @p errors.
+ */
+void lexer_init(lexer_t *lexer, input_t *input, const char *input_name,
+                FILE *errors);
+void lexer_destroy(lexer_t *lexer);
+
+void lexer_next_token(lexer_t *lexer, token_t *token);
+
+/** a token and the line the lexer was in after reading it */
+typedef struct lexed_token_t lexed_token_t;
+struct lexed_token_t {
+	token_t  token;
+	unsigned linenr;
 };
-extern source_position_t source_position;
 
-void lexer_init(input_t *input, const char *input_name);
-void lexer_destroy(void);
+/**
+ * Splits the rest of the input of @p lexer into at most @p n_chunks chunks
+ * for parallel lexing. Except for the first one, chunks start with an
+ * identifier in column 0, which is where top level declarations begin. Small
+ * inputs get fewer chunks. The starts of the chunks are stored in @p starts,
+ * their number is returned.
+ *
+ * A chunk start may still be inside a multi-line comment or string, so it is
+ * only used if lexer_tokenize() of the previous chunk stops exactly there.
+ */
+size_t lexer_split(const lexer_t *lexer, size_t n_chunks,
+                   const unsigned char **starts);
+
+/**
+ * Initializes @p chunk to lex the input of @p lexer from @p begin on (up to
+ * the end of the input). Line numbers are counted from 1 at @p begin.
+ */
+void lexer_init_chunk(lexer_t *chunk, const lexer_t *lexer,
+                      const unsigned char *begin);
+
+/**
+ * Appends the tokens of @p lexer to the flexible array @p *tokens until it
+ * reaches a point at @p limit or behind it where a lexer started with
+ * lexer_init_chunk() would continue the same way. Returns that position, or
+ * NULL when the end of the input was reached (the T_EOF token is appended
+ * then). With a NULL @p limit everything is lexed.
+ */
+const unsigned char *lexer_tokenize(lexer_t *lexer, const unsigned char *limit,
+                                    lexed_token_t **tokens);
 
-void lexer_next_token(token_t *token);
+/**
+ * Makes the lexer recognize a token added by register_new_token().
+ */
+void lexer_register_token(symbol_t *symbol);
 
 #endif
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/time.h>
 
 #include <libfirm/firm.h>
@@ -16,15 +17,23 @@
 #include "driver/firm_machine.h"
 
 #include "type.h"
+#include "input.h"
 #include "parser.h"
 #include "ast_t.h"
 #include "semantic.h"
 #include "ast2firm.h"
-#include "plugins.h"
+#include "plugins_t.h"
 #include "type_hash.h"
+#include "symbol_table.h"
+#include "string_pool.h"
+#include "source_position.h"
 #include "mangle.h"
+#include "module_cache.h"
+#include "mem_report.h"
 #include "adt/error.h"
 #include "adt/strutil.h"
+#include "adt/xmalloc.h"
+#include "adt/array.h"
 
 #define LINKER "gcc -m32"
 
@@ -36,6 +45,25 @@ struct file_list_entry_t {
 
 static file_list_entry_t *temp_files;
 
+/** a file parsed by a parser thread, see parse_files_parallel() */
+typedef struct parse_job_t parse_job_t;
+struct parse_job_t {
+	const char *input_name;
+	FILE       *in;
+	parser_t   *parser;
+	FILE       *errors; /**< diagnostics, copied to stderr in file order */
+	bool        result;
+	bool        use_cache;   /**< record the interface after parsing */
+	uint64_t    hash;        /**< key of the interface, see module_cache.h */
+	symbol_t   *module_name; /**< module of a loaded interface */
+	context_t   context;     /**< declarations of a loaded interface */
+};
+
+static parse_job_t     *parse_jobs;
+static size_t           n_parse_jobs;
+static size_t           next_parse_job;
+static pthread_mutex_t  parse_jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static machine_triple_t *target_machine;
 static bool dump_graphs;
 static bool dump_asts;
@@ -89,9 +117,30 @@ static void dump_ast(const context_t *context, const char *name,
 	fclose(out);
 }
 
-static void do_parse_file(FILE *in, const char *input_name)
+/**
+ * Parses a file, with @p n_threads > 1 it is lexed by that many threads.
+ */
+static void do_parse_file(FILE *in, const char *input_name, unsigned n_threads)
 {
-	bool result = parse_file(in, input_name);
+	uint64_t hash;
+	bool     use_cache = module_cache_hash(in, &hash);
+	if (use_cache) {
+		symbol_t  *module_name;
+		context_t  context;
+		if (module_cache_load(hash, input_name, &module_name, &context)) {
+			append_to_module(module_name, &context);
+			return;
+		}
+	}
+
+	parser_t *parser = parser_from_file(in, input_name, stderr);
+	if (n_threads > 1)
+		parser_tokenize(parser, n_threads);
+	bool result = parser_parse(parser);
+	if (result && use_cache)
+		module_cache_record(hash, parser);
+	parser_append_to_module(parser);
+	parser_free(parser);
 	if (!result) {
 		fprintf(stderr, "syntax errors found...\n");
 		had_parse_errors = true;
@@ -99,6 +148,158 @@ static void do_parse_file(FILE *in, const char *input_name)
 	}
 }
 
+/**
+ * Opens an input file, "-" is stdin. Changes *input_name to the name used
+ * in messages.
+ */
+static FILE *open_input(const char **input_name)
+{
+	if (strcmp(*input_name, "-") == 0) {
+		/* nitpicking: is there a way so we can't have a normal file
+		 * with the same name? probably not... */
+		*input_name = "<stdin>";
+		return stdin;
+	}
+	return fopen(*input_name, "r");
+}
+
+static void open_input_failed(const char *input_name)
+{
+	fprintf(stderr, "Couldn't open file '%s' for reading: %s\n",
+	        input_name, strerror(errno));
+	exit(1);
+}
+
+static void parse_files(const char **input_names, unsigned n_threads)
+{
+	for (size_t i = 0; i < ARR_LEN(input_names); ++i) {
+		const char *input_name = input_names[i];
+		FILE       *in         = open_input(&input_name);
+		if (in == NULL)
+			open_input_failed(input_name);
+
+		do_parse_file(in, input_name, n_threads);
+		if (in != stdin) {
+			fclose(in);
+		}
+	}
+}
+
+static void *parse_thread(void *data)
+{
+	(void) data;
+	parser_init_thread();
+
+	for (;;) {
+		pthread_mutex_lock(&parse_jobs_lock);
+		size_t i = next_parse_job++;
+		pthread_mutex_unlock(&parse_jobs_lock);
+		if (i >= n_parse_jobs)
+			break;
+
+		parse_job_t *job = &parse_jobs[i];
+		if (job->parser != NULL)
+			job->result = parser_parse(job->parser);
+	}
+	return NULL;
+}
+
+static void copy_file(FILE *in, FILE *out)
+{
+	char   buf[4096];
+	size_t n;
+
+	rewind(in);
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		fwrite(buf, 1, n, out);
+	}
+}
+
+/**
+ * Parses the files with @p n_threads threads. The results are appended to
+ * the modules in file order and the diagnostics are printed in file order, so
+ * the output is the same as with parse_files().
+ */
+static void parse_files_parallel(const char **input_names, unsigned n_threads)
+{
+	size_t      n_input_names = ARR_LEN(input_names);
+	const char *failed_name   = NULL;
+
+	parse_jobs     = XMALLOCNZ(parse_job_t, n_input_names);
+	n_parse_jobs   = 0;
+	next_parse_job = 0;
+
+	/* read the inputs and set up the lexers before starting threads, a file
+	 * that can't be opened stops parsing like in serial mode */
+	for (size_t i = 0; i < n_input_names; ++i) {
+		parse_job_t *job = &parse_jobs[i];
+		job->input_name  = input_names[i];
+		job->in          = open_input(&job->input_name);
+		if (job->in == NULL) {
+			failed_name = job->input_name;
+			break;
+		}
+
+		++n_parse_jobs;
+
+		/* interfaces are loaded here, threads only parse */
+		job->use_cache = module_cache_hash(job->in, &job->hash);
+		if (job->use_cache && module_cache_load(job->hash, job->input_name,
+		                                        &job->module_name,
+		                                        &job->context)) {
+			job->result = true;
+			continue;
+		}
+
+		job->errors = tmpfile();
+		if (job->errors == NULL)
+			panic("couldn't create temporary file");
+		job->parser = parser_from_file(job->in, job->input_name,
+		                               job->errors);
+	}
+
+	if (n_threads > n_parse_jobs)
+		n_threads = n_parse_jobs;
+	symbol_table_set_locking(true);
+	pthread_t *threads = XMALLOCN(pthread_t, n_threads);
+	for (unsigned t = 0; t < n_threads; ++t) {
+		if (pthread_create(&threads[t], NULL, parse_thread, NULL) != 0)
+			panic("couldn't create parser thread");
+	}
+	for (unsigned t = 0; t < n_threads; ++t) {
+		pthread_join(threads[t], NULL);
+	}
+	xfree(threads);
+	symbol_table_set_locking(false);
+
+	for (size_t i = 0; i < n_parse_jobs; ++i) {
+		parse_job_t *job = &parse_jobs[i];
+		if (job->parser == NULL) {
+			append_to_module(job->module_name, &job->context);
+		} else {
+			copy_file(job->errors, stderr);
+			fclose(job->errors);
+			if (!job->result) {
+				fprintf(stderr, "syntax errors found...\n");
+				had_parse_errors = true;
+			} else if (job->use_cache) {
+				module_cache_record(job->hash, job->parser);
+			}
+
+			parser_append_to_module(job->parser);
+			parser_free(job->parser);
+		}
+		if (job->in != stdin) {
+			fclose(job->in);
+		}
+	}
+	xfree(parse_jobs);
+	parse_jobs = NULL;
+
+	if (failed_name != NULL)
+		open_input_failed(failed_name);
+}
+
 static void do_check_semantic(void)
 {
 	bool result = check_semantic();
@@ -138,7 +339,8 @@ static void do_link(const char *in, const char *out)
 
 static void usage(const char *argv0)
 {
-	fprintf(stderr, "Usage: %s input1 input2 [-o output]\n", argv0);
+	fprintf(stderr, "Usage: %s input1 input2 [-o output] [-j threads] "
+	        "[--mem-report[=json]]\n", argv0);
 }
 
 static void setup_target(void)
@@ -246,11 +448,53 @@ static void free_temp_files(void)
 	temp_files = NULL;
 }
 
+/**
+ * Frees the memory of the front end: the AST, the types, the symbols and the
+ * string literals. The firm graphs don't reference any of it (their debug
+ * info is just a source position), so this is done as soon as ast2firm() is
+ * finished and the optimizer and backend reuse the memory.
+ */
+static void exit_frontend(void)
+{
+	exit_module_cache();
+	exit_mangle();
+	exit_semantic_module();
+	exit_parser();
+	exit_ast_module();
+	exit_type_module();
+	exit_typehash();
+	exit_tokens();
+	exit_string_pool();
+	exit_symbol_table();
+}
+
 int main(int argc, const char **argv)
 {
-	int opt_level = 2;
+	int  opt_level       = 2;
+	bool mem_report_json = false;
+
+	/* early options parsing */
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		if (arg[0] != '-')
+			continue;
+
+		const char *option = &arg[1];
+		if (option[0] == 'O') {
+			sscanf(&option[1], "%d", &opt_level);
+		} else if (strcmp(arg, "--mem-report") == 0) {
+			mem_report_enable();
+		} else if (strcmp(arg, "--mem-report=json") == 0) {
+			mem_report_enable();
+			mem_report_json = true;
+		}
+	}
 
+	/* the obstacks are reported from their creation on */
 	init_symbol_table();
+	init_string_pool();
+	init_source_positions();
+	init_input();
 	init_tokens();
 	init_type_module();
 	init_typehash();
@@ -263,17 +507,6 @@ int main(int argc, const char **argv)
 	init_ast2firm();
 	init_mangle();
 
-	/* early options parsing */
-	for (int i = 1; i < argc; ++i) {
-		const char *arg = argv[i];
-		if (arg[0] != '-')
-			continue;
-
-		const char *option = &arg[1];
-		if (option[0] == 'O') {
-			sscanf(&option[1], "%d", &opt_level);
-		}
-	}
 	const char *target = getenv("TARGET");
 	if (target != NULL)
 		target_machine = firm_parse_machine_triple(target);
@@ -285,7 +518,8 @@ int main(int argc, const char **argv)
 
 	const char *outname = NULL;
 	compile_mode_t mode = CompileAndLink;
-	int parsed = 0;
+	unsigned n_threads = 1;
+	const char **input_names = NEW_ARR_F(const char*, 0);
 
 	for (int i = 1; i < argc; ++i) {
 		const char *arg = argv[i];
@@ -296,6 +530,20 @@ int main(int argc, const char **argv)
 				return 1;
 			}
 			outname = argv[i];
+		} else if (strstart(arg, "-j")) {
+			const char *count = arg+2;
+			if (count[0] == 0) {
+				++i;
+				if (i >= argc) {
+					usage(argv[0]);
+					return 1;
+				}
+				count = argv[i];
+			}
+			if (sscanf(count, "%u", &n_threads) != 1 || n_threads == 0) {
+				fprintf(stderr, "Invalid thread count: %s\n", count);
+				return 1;
+			}
 		} else if (strstart(arg, "-O")) {
 			/* already processed in first pass */
 		} else if (strcmp(arg, "--dump") == 0) {
@@ -305,6 +553,18 @@ int main(int argc, const char **argv)
 			dump_asts = 1;
 		} else if (strcmp(arg, "--dump-graph") == 0) {
 			dump_graphs = 1;
+		} else if (strcmp(arg, "--mem-report") == 0
+		           || strcmp(arg, "--mem-report=json") == 0) {
+			/* already processed in first pass */
+		} else if (strcmp(arg, "--lazy-bodies") == 0) {
+			parser_set_lazy_bodies(true);
+		} else if (strcmp(arg, "--module-cache") == 0) {
+			++i;
+			if (i >= argc) {
+				usage(argv[0]);
+				return 1;
+			}
+			module_cache_set_dir(argv[i]);
 		} else if (strcmp(arg, "--help") == 0) {
 			usage(argv[0]);
 			return 0;
@@ -336,39 +596,38 @@ int main(int argc, const char **argv)
 			fprintf(stderr, "Invalid option '%s'\n", arg);
 			return 1;
 		} else {
-			const char *filename = argv[i];
-			FILE *in;
-			if (strcmp(filename, "-") == 0) {
-				in       = stdin;
-				/* nitpicking: is there a way so we can't have a normal file
-				 * with the same name? probably not... */
-				filename = "<stdin>";
-			} else {
-				in = fopen(filename, "r");
-				if (in == NULL) {
-					fprintf(stderr, "Couldn't open file '%s' for reading: %s\n",
-					        filename, strerror(errno));
-					exit(1);
-				}
-			}
-			do_parse_file(in, filename);
-			parsed++;
-			if (in != stdin) {
-				fclose(in);
-			}
+			ARR_APP1(const char*, input_names, arg);
 		}
 	}
-	if (parsed == 0) {
+	if (ARR_LEN(input_names) == 0) {
 		fprintf(stderr, "Error: no input files specified\n");
 		return 0;
 	}
+
+	/* plugin parsers use global state, so they force serial parsing. They
+	 * also create nodes which interface files can't hold */
+	if (plugins != NULL) {
+		module_cache_set_dir(NULL);
+		parse_files(input_names, 1);
+	} else if (n_threads > 1 && ARR_LEN(input_names) > 1) {
+		parse_files_parallel(input_names, n_threads);
+	} else {
+		parse_files(input_names, n_threads);
+	}
+	DEL_ARR_F(input_names);
+	mem_report_phase("parse");
+
 	if (had_parse_errors) {
 		return 1;
 	}
 
 	do_check_semantic();
+	module_cache_flush();
+	mem_report_phase("semantic");
 
 	ast2firm(modules);
+	mem_report_phase("ast2firm");
+	exit_frontend();
 
 	const char *asmname;
 	char        temp[1024];
@@ -386,6 +645,7 @@ int main(int argc, const char **argv)
 	}
 	generate_code(asm_out, asmname);
 	fclose(asm_out);
+	mem_report_print(stderr, mem_report_json);
 
 	if (mode == CompileAndLink) {
 		do_link(asmname, outname);
@@ -395,16 +655,10 @@ int main(int argc, const char **argv)
 	(void)free_temp_files;
 
 	gen_firm_finish();
-	exit_mangle();
 	exit_ast2firm();
 	free_plugins();
-	exit_semantic_module();
-	exit_parser();
-	exit_ast_module();
-	exit_type_module();
-	exit_typehash();
-	exit_tokens();
-	exit_symbol_table();
+	exit_source_positions();
+	exit_mem_report();
 
 	return 0;
 }
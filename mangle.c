@@ -4,6 +4,7 @@
 #include "mangle.h"
 #include "ast_t.h"
 #include "type_t.h"
+#include "mem_report.h"
 #include "adt/error.h"
 #include <libfirm/firm.h>
 
@@ -82,71 +83,98 @@ void set_add_underscore_prefix(bool new_add_underscore_prefix)
 	add_underscore_prefix = new_add_underscore_prefix;
 }
 
-static void mangle_type_variables(type_variable_t *type_variables)
+static void mangle_substituted_type(const type_substitution_t *substitution,
+                                    const type_t *type);
+
+/**
+ * Returns the type bound to @p type_variable by @p substitution (which may be
+ * NULL), unbound type variables can't be mangled.
+ */
+static type_t *get_bound_type(const type_substitution_t *substitution,
+                              const type_variable_t *type_variable)
+{
+	type_t *type = NULL;
+	if (substitution != NULL)
+		type = get_substituted_type(substitution, type_variable);
+
+	if (type == NULL) {
+		panic("can't mangle unbound type variable");
+	}
+	return type;
+}
+
+static void mangle_type_variables(const type_substitution_t *substitution,
+                                  type_variable_t *type_variables)
 {
 	type_variable_t *type_variable = type_variables;
 	for ( ; type_variable != NULL; type_variable = type_variable->next) {
 		/* is this a good char? */
 		obstack_1grow(&obst, 'T');
-		mangle_type(type_variable->current_type);
+		/* the bound types are already substituted */
+		mangle_type(get_bound_type(substitution, type_variable));
 	}
 }
 
-static void mangle_compound_type(const compound_type_t *type)
+static void mangle_compound_type(const type_substitution_t *substitution,
+                                 const compound_type_t *type)
 {
 	mangle_len_string(type->symbol->string);
-	mangle_type_variables(type->type_parameters);
+	mangle_type_variables(substitution, type->type_parameters);
 }
 
-static void mangle_pointer_type(const pointer_type_t *type)
+static void mangle_pointer_type(const type_substitution_t *substitution,
+                                const pointer_type_t *type)
 {
 	obstack_1grow(&obst, 'P');
-	mangle_type(type->points_to);
+	mangle_substituted_type(substitution, type->points_to);
 }
 
-static void mangle_array_type(const array_type_t *type)
+static void mangle_array_type(const type_substitution_t *substitution,
+                              const array_type_t *type)
 {
 	obstack_1grow(&obst, 'A');
-	mangle_type(type->element_type);
+	mangle_substituted_type(substitution, type->element_type);
 	int size = fold_constant_to_int(type->size_expression);
 	obstack_printf(&obst, "%lu", size);
 }
 
-static void mangle_function_type(const function_type_t *type)
+static void mangle_function_type(const type_substitution_t *substitution,
+                                 const function_type_t *type)
 {
 	obstack_1grow(&obst, 'F');
-	mangle_type(type->result_type);
+	mangle_substituted_type(substitution, type->result_type);
 
 	function_parameter_type_t *parameter_type = type->parameter_types;
-	while (parameter_type != NULL) {
-		mangle_type(parameter_type->type);
+	for ( ; parameter_type != NULL; parameter_type = parameter_type->next) {
+		mangle_substituted_type(substitution, parameter_type->type);
 	}
 	obstack_1grow(&obst, 'E');
 }
 
-static void mangle_reference_type_variable(const type_reference_t* ref)
+static void mangle_reference_type_variable(
+		const type_substitution_t *substitution, const type_reference_t* ref)
 {
-	type_variable_t *type_var     = ref->type_variable;
-	type_t          *current_type = type_var->current_type;
-
-	if (current_type == NULL) {
-		panic("can't mangle unbound type variable");
-	}
-	mangle_type(current_type);
+	mangle_type(get_bound_type(substitution, ref->type_variable));
 }
 
-static void mangle_bind_typevariables(const bind_typevariables_type_t *type)
+static void mangle_bind_typevariables(const type_substitution_t *substitution,
+                                      const bind_typevariables_type_t *type)
 {
 	compound_type_t *polymorphic_type = type->polymorphic_type;
 
-	int old_top = typevar_binding_stack_top();
-	push_type_variable_bindings(polymorphic_type->type_parameters,
-	                            type->type_arguments);
-	mangle_type((type_t*) polymorphic_type);
-	pop_type_variable_bindings(old_top);
+	const type_substitution_t *bindings
+		= make_type_substitution(substitution,
+		                         polymorphic_type->type_parameters,
+		                         type->type_arguments);
+	mangle_compound_type(bindings, polymorphic_type);
 }
 
-void mangle_type(const type_t *type)
+/**
+ * Mangles @p type with the type variables bound by @p substitution (which
+ * may be NULL) replaced, all type variables in @p type have to be bound.
+ */
+static void mangle_substituted_type(const type_substitution_t *substitution,
+                                    const type_t *type)
 {
 	switch (type->kind) {
 	case TYPE_INVALID:
@@ -159,30 +187,33 @@ void mangle_type(const type_t *type)
 		return;
 	case TYPE_TYPEOF: {
 		const typeof_type_t *typeof_type = (const typeof_type_t*) type;
-		mangle_type(typeof_type->expression->base.type);
+		mangle_substituted_type(substitution,
+		                        typeof_type->expression->base.type);
 		return;
 	}
 	case TYPE_COMPOUND_UNION:
 	case TYPE_COMPOUND_STRUCT:
-		mangle_compound_type((const compound_type_t*) type);
+		mangle_compound_type(substitution, (const compound_type_t*) type);
 		return;
 	case TYPE_FUNCTION:
-		mangle_function_type((const function_type_t*) type);
+		mangle_function_type(substitution, (const function_type_t*) type);
 		return;
 	case TYPE_POINTER:
-		mangle_pointer_type((const pointer_type_t*) type);
+		mangle_pointer_type(substitution, (const pointer_type_t*) type);
 		return;
 	case TYPE_ARRAY:
-		mangle_array_type((const array_type_t*) type);
+		mangle_array_type(substitution, (const array_type_t*) type);
 		return;
 	case TYPE_REFERENCE:
 		panic("can't mangle unresolved type reference");
 		return;
 	case TYPE_BIND_TYPEVARIABLES:
-		mangle_bind_typevariables((const bind_typevariables_type_t*) type);
+		mangle_bind_typevariables(substitution,
+		                          (const bind_typevariables_type_t*) type);
 		return;
 	case TYPE_REFERENCE_TYPE_VARIABLE:
-		mangle_reference_type_variable((const type_reference_t*) type);
+		mangle_reference_type_variable(substitution,
+		                               (const type_reference_t*) type);
 		return;
 	case TYPE_ERROR:
 		panic("trying to mangle error type");
@@ -190,6 +221,11 @@ void mangle_type(const type_t *type)
 	panic("Unknown type mangled");
 }
 
+void mangle_type(const type_t *type)
+{
+	mangle_substituted_type(NULL, type);
+}
+
 void mangle_symbol_simple(symbol_t *symbol)
 {
 	mangle_string(symbol->string);
@@ -225,9 +261,11 @@ ident *finish_mangle(void)
 void init_mangle(void)
 {
 	obstack_init(&obst);
+	mem_report_add_obstack("mangle", &obst);
 }
 
 void exit_mangle(void)
 {
+	mem_report_remove_obstack(&obst);
 	obstack_free(&obst, NULL);
 }
@@ -21,32 +21,65 @@ static inline void match_error(type_t *variant, type_t *concrete,
 	fprintf(stderr, "\n");
 }
 
-static bool matched_type_variable(type_variable_t *type_variable, type_t *type,
+/** returns the slot of @p type_variable in @p bindings, NULL if it is none of
+ * the type parameters bound there */
+static type_t **get_binding(type_bindings_t *bindings,
+                            const type_variable_t *type_variable)
+{
+	type_variable_t *type_parameter = bindings->type_parameters;
+	for (size_t i = 0; type_parameter != NULL; ++i) {
+		if (type_parameter == type_variable)
+			return &bindings->types[i];
+		type_parameter = type_parameter->next;
+	}
+	return NULL;
+}
+
+static bool matched_type_variable(type_bindings_t *bindings,
+                                  type_variable_t *type_variable, type_t *type,
                                   const source_position_t source_position,
 								  bool report_errors)
 {
-	type_t *current_type = type_variable->current_type;
-	if (current_type != NULL && current_type != type) {
+	type_t **binding = get_binding(bindings, type_variable);
+	if (binding == NULL) {
+		/* not inferred here, the type variable only matches itself */
+		if (type->kind != TYPE_REFERENCE_TYPE_VARIABLE
+		    || type->reference.type_variable != type_variable) {
+			if (report_errors) {
+				print_error_prefix(source_position);
+				fprintf(stderr, "can't match type variable '%s' against ",
+				        type_variable->base.symbol->string);
+				print_type(type);
+				fprintf(stderr, "\n");
+			}
+			return false;
+		}
+		return true;
+	}
+
+	type_t *bound_type = *binding;
+	if (bound_type != NULL && bound_type != type) {
 		if (report_errors) {
 			print_error_prefix(source_position);
 			fprintf(stderr, "ambiguous matches found for type variable '%s': ",
 					type_variable->base.symbol->string);
-			print_type(current_type);
+			print_type(bound_type);
 			fprintf(stderr, ", ");
 			print_type(type);
 			fprintf(stderr, "\n");
 		}
 		/* are both types normalized? */
-		assert(typehash_contains(current_type));
-		assert(typehash_contains(type));
+		assert(typehash_is_interned(bound_type));
+		assert(typehash_is_interned(type));
 		return false;
 	}
-	type_variable->current_type = type;
+	*binding = type;
 
 	return true;
 }
 
-static bool match_compound_type(compound_type_t *variant_type,
+static bool match_compound_type(type_bindings_t *bindings,
+                                compound_type_t *variant_type,
                                 type_t *concrete_type,
                                 const source_position_t source_position,
 								bool report_errors)
@@ -83,7 +116,8 @@ static bool match_compound_type(compound_type_t *variant_type,
 	while (type_parameter != NULL) {
 		assert(type_argument != NULL);
 
-		if (!matched_type_variable(type_parameter, type_argument->type,
+		if (!matched_type_variable(bindings, type_parameter,
+		                           type_argument->type,
 		                          source_position, true))
 			result = false;
 
@@ -93,7 +127,8 @@ static bool match_compound_type(compound_type_t *variant_type,
 	return result;
 }
 
-static bool match_bind_typevariables(bind_typevariables_type_t *variant_type,
+static bool match_bind_typevariables(type_bindings_t *bindings,
+                                     bind_typevariables_type_t *variant_type,
                                      type_t *concrete_type,
                                      const source_position_t source_position,
 									 bool report_errors)
@@ -120,7 +155,7 @@ static bool match_bind_typevariables(bind_typevariables_type_t *variant_type,
 	while (argument1 != NULL) {
 		assert(argument2 != NULL);
 
-		if (!match_variant_to_concrete_type(argument1->type,
+		if (!match_variant_to_concrete_type(bindings, argument1->type,
 		                                   argument2->type, source_position,
 										   report_errors))
 			result = false;
@@ -132,7 +167,8 @@ static bool match_bind_typevariables(bind_typevariables_type_t *variant_type,
 	return result;
 }
 
-bool match_variant_to_concrete_type(type_t *variant_type,
+bool match_variant_to_concrete_type(type_bindings_t *bindings,
+                                    type_t *variant_type,
                                     type_t *concrete_type,
                                     const source_position_t source_position,
 									bool report_errors)
@@ -154,8 +190,8 @@ bool match_variant_to_concrete_type(type_t *variant_type,
 	case TYPE_REFERENCE_TYPE_VARIABLE:
 		type_ref     = (type_reference_t*) variant_type;
 		type_var     = type_ref->type_variable;
-		return matched_type_variable(type_var, concrete_type, source_position,
-		                             report_errors);
+		return matched_type_variable(bindings, type_var, concrete_type,
+		                             source_position, report_errors);
 
 	case TYPE_VOID:
 	case TYPE_ATOMIC:
@@ -168,7 +204,7 @@ bool match_variant_to_concrete_type(type_t *variant_type,
 
 	case TYPE_COMPOUND_STRUCT:
 	case TYPE_COMPOUND_UNION:
-		return match_compound_type((compound_type_t*) variant_type,
+		return match_compound_type(bindings, (compound_type_t*) variant_type,
 		                           concrete_type, source_position,
 								   report_errors);
 
@@ -180,7 +216,8 @@ bool match_variant_to_concrete_type(type_t *variant_type,
 		}
 		pointer_type_1 = (pointer_type_t*) variant_type;
 		pointer_type_2 = (pointer_type_t*) concrete_type;
-		return match_variant_to_concrete_type(pointer_type_1->points_to,
+		return match_variant_to_concrete_type(bindings,
+		                                      pointer_type_1->points_to,
 		                                      pointer_type_2->points_to,
 		                                      source_position,
 		                                      report_errors);
@@ -193,7 +230,8 @@ bool match_variant_to_concrete_type(type_t *variant_type,
 		}
 		function_type_1 = (function_type_t*) variant_type;
 		function_type_2 = (function_type_t*) concrete_type;
-		bool result = match_variant_to_concrete_type(function_type_1->result_type,
+		bool result = match_variant_to_concrete_type(bindings,
+		                               function_type_1->result_type,
 		                               function_type_2->result_type,
 		                               source_position,
 									   report_errors);
@@ -201,7 +239,8 @@ bool match_variant_to_concrete_type(type_t *variant_type,
 		function_parameter_type_t *param1 = function_type_1->parameter_types;
 		function_parameter_type_t *param2 = function_type_2->parameter_types;
 		while (param1 != NULL && param2 != NULL) {
-			if (!match_variant_to_concrete_type(param1->type, param2->type,
+			if (!match_variant_to_concrete_type(bindings, param1->type,
+			                               param2->type,
 			                               source_position, report_errors))
 				result = false;
 
@@ -215,7 +254,7 @@ bool match_variant_to_concrete_type(type_t *variant_type,
 		}
 		return result;
 	case TYPE_BIND_TYPEVARIABLES:
-		return match_bind_typevariables(
+		return match_bind_typevariables(bindings,
 		        (bind_typevariables_type_t*) variant_type,
 		        concrete_type, source_position, report_errors);
 	case TYPE_ARRAY:
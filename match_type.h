@@ -6,12 +6,24 @@
 #include "type.h"
 #include "lexer.h"
 
+/**
+ * The types found for some type parameters while matching. types[i] is bound
+ * to the i-th of the type parameters, NULL while it is not known yet.
+ */
+typedef struct type_bindings_t type_bindings_t;
+struct type_bindings_t {
+	type_variable_t  *type_parameters;
+	type_t          **types;
+};
+
 /**
  * compares a variant type (that contains 1 or more unbound type variable)
  * and a concrete and binds the type variables in the variant type so it
- * matches the concrete type
+ * matches the concrete type. Only the type parameters of @p bindings are
+ * bound, other type variables just match themselves.
  */
-bool match_variant_to_concrete_type(type_t *variant_type,
+bool match_variant_to_concrete_type(type_bindings_t *bindings,
+                                    type_t *variant_type,
                                     type_t *concrete_type,
                                     const source_position_t source_position,
 									bool report_errors);
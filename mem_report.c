@@ -0,0 +1,270 @@
+#define _POSIX_C_SOURCE 200112L
+#include <config.h>
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "mem_report.h"
+#include "ast_t.h"
+#include "adt/array.h"
+#include "adt/error.h"
+#include "adt/util.h"
+
+#define MAX_GROUPS  16
+#define MAX_PHASES  16
+
+typedef struct reported_obstack_t reported_obstack_t;
+struct reported_obstack_t {
+	struct obstack *obst;
+	unsigned        group;
+};
+
+typedef struct group_t group_t;
+struct group_t {
+	const char *name;
+	size_t      released; /**< size of the removed obstacks */
+};
+
+typedef struct phase_t phase_t;
+struct phase_t {
+	const char    *name;
+	size_t         allocated[MAX_GROUPS]; /**< bytes allocated up to its end */
+	long           peak_rss;              /**< in KiB */
+	unsigned long  n_types;
+};
+
+static bool                enabled;
+/** obstacks are added and removed by parser threads, too */
+static pthread_mutex_t     lock = PTHREAD_MUTEX_INITIALIZER;
+static reported_obstack_t *obstacks;
+static group_t             groups[MAX_GROUPS];
+static unsigned            n_groups;
+static phase_t             phases[MAX_PHASES];
+static unsigned            n_phases;
+/* the last entries count the kinds registered by plugins */
+static unsigned long       expression_counts[EXPR_LAST + 2];
+static unsigned long       statement_counts[STATEMENT_LAST + 2];
+static unsigned long       n_types;
+
+void mem_report_enable(void)
+{
+	enabled = true;
+}
+
+static unsigned get_group(const char *name)
+{
+	for (unsigned g = 0; g < n_groups; ++g) {
+		if (strcmp(groups[g].name, name) == 0)
+			return g;
+	}
+	if (n_groups == MAX_GROUPS)
+		panic("too many obstack groups");
+	groups[n_groups].name     = name;
+	groups[n_groups].released = 0;
+	return n_groups++;
+}
+
+void mem_report_add_obstack(const char *name, struct obstack *obst)
+{
+	if (!enabled)
+		return;
+
+	pthread_mutex_lock(&lock);
+	if (obstacks == NULL)
+		obstacks = NEW_ARR_F(reported_obstack_t, 0);
+	reported_obstack_t entry;
+	entry.obst  = obst;
+	entry.group = get_group(name);
+	ARR_APP1(reported_obstack_t, obstacks, entry);
+	pthread_mutex_unlock(&lock);
+}
+
+void mem_report_remove_obstack(struct obstack *obst)
+{
+	if (!enabled)
+		return;
+
+	pthread_mutex_lock(&lock);
+	size_t n = obstacks != NULL ? ARR_LEN(obstacks) : 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (obstacks[i].obst != obst)
+			continue;
+		groups[obstacks[i].group].released += obstack_memory_used(obst);
+		obstacks[i] = obstacks[n - 1];
+		ARR_SHRINKLEN(obstacks, n - 1);
+		break;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void mem_report_count_expression(unsigned kind)
+{
+	if (!enabled)
+		return;
+	if (kind > EXPR_LAST)
+		kind = EXPR_LAST + 1;
+	__sync_fetch_and_add(&expression_counts[kind], 1);
+}
+
+void mem_report_count_statement(unsigned kind)
+{
+	if (!enabled)
+		return;
+	if (kind > STATEMENT_LAST)
+		kind = STATEMENT_LAST + 1;
+	__sync_fetch_and_add(&statement_counts[kind], 1);
+}
+
+void mem_report_count_type(void)
+{
+	if (!enabled)
+		return;
+	__sync_fetch_and_add(&n_types, 1);
+}
+
+void mem_report_phase(const char *name)
+{
+	if (!enabled)
+		return;
+	if (n_phases == MAX_PHASES)
+		panic("too many phases");
+
+	phase_t *phase = &phases[n_phases++];
+	phase->name = name;
+
+	pthread_mutex_lock(&lock);
+	for (unsigned g = 0; g < n_groups; ++g) {
+		phase->allocated[g] = groups[g].released;
+	}
+	for (size_t i = 0; obstacks != NULL && i < ARR_LEN(obstacks); ++i) {
+		const reported_obstack_t *entry = &obstacks[i];
+		phase->allocated[entry->group] += obstack_memory_used(entry->obst);
+	}
+	for (unsigned g = n_groups; g < MAX_GROUPS; ++g) {
+		phase->allocated[g] = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	phase->peak_rss = usage.ru_maxrss;
+	phase->n_types  = n_types;
+}
+
+/** bytes allocated on the obstacks of group @p g during phase @p p */
+static long long get_phase_bytes(unsigned p, unsigned g)
+{
+	long long before = p > 0 ? (long long) phases[p - 1].allocated[g] : 0;
+	return (long long) phases[p].allocated[g] - before;
+}
+
+static const char *get_expression_count_name(unsigned kind)
+{
+	return kind > EXPR_LAST ? "plugin"
+	                        : get_expression_kind_name((expression_kind_t) kind);
+}
+
+static const char *get_statement_count_name(unsigned kind)
+{
+	return kind > STATEMENT_LAST ? "plugin"
+	                             : get_statement_kind_name((statement_kind_t) kind);
+}
+
+static void print_table(FILE *out)
+{
+	fprintf(out, "%-14s", "phase");
+	for (unsigned g = 0; g < n_groups; ++g) {
+		fprintf(out, " %14s", groups[g].name);
+	}
+	fprintf(out, " %14s %8s\n", "peak RSS KiB", "types");
+
+	for (unsigned p = 0; p < n_phases; ++p) {
+		const phase_t *phase = &phases[p];
+		fprintf(out, "%-14s", phase->name);
+		for (unsigned g = 0; g < n_groups; ++g) {
+			fprintf(out, " %14lld", get_phase_bytes(p, g));
+		}
+		fprintf(out, " %14ld %8lu\n", phase->peak_rss, phase->n_types);
+	}
+	if (n_phases > 0) {
+		const phase_t *last = &phases[n_phases - 1];
+		fprintf(out, "%-14s", "total");
+		for (unsigned g = 0; g < n_groups; ++g) {
+			fprintf(out, " %14lu", (unsigned long) last->allocated[g]);
+		}
+		fprintf(out, " %14ld %8lu\n", last->peak_rss, last->n_types);
+	}
+
+	fprintf(out, "\n%-24s %10s\n", "expression", "count");
+	for (unsigned k = 0; k < lengthof(expression_counts); ++k) {
+		if (expression_counts[k] == 0)
+			continue;
+		fprintf(out, "%-24s %10lu\n", get_expression_count_name(k),
+		        expression_counts[k]);
+	}
+	fprintf(out, "\n%-24s %10s\n", "statement", "count");
+	for (unsigned k = 0; k < lengthof(statement_counts); ++k) {
+		if (statement_counts[k] == 0)
+			continue;
+		fprintf(out, "%-24s %10lu\n", get_statement_count_name(k),
+		        statement_counts[k]);
+	}
+}
+
+static void print_json_counts(FILE *out, const unsigned long *counts,
+                              unsigned n_counts,
+                              const char *(*get_name)(unsigned kind))
+{
+	const char *separator = "";
+	fputc('{', out);
+	for (unsigned k = 0; k < n_counts; ++k) {
+		if (counts[k] == 0)
+			continue;
+		fprintf(out, "%s\"%s\": %lu", separator, get_name(k), counts[k]);
+		separator = ", ";
+	}
+	fputc('}', out);
+}
+
+static void print_json(FILE *out)
+{
+	fputs("{\"phases\": [", out);
+	for (unsigned p = 0; p < n_phases; ++p) {
+		const phase_t *phase = &phases[p];
+		fprintf(out, "%s{\"name\": \"%s\", \"allocated\": {",
+		        p > 0 ? ", " : "", phase->name);
+		for (unsigned g = 0; g < n_groups; ++g) {
+			fprintf(out, "%s\"%s\": %lld", g > 0 ? ", " : "", groups[g].name,
+			        get_phase_bytes(p, g));
+		}
+		fprintf(out, "}, \"peak_rss_kib\": %ld, \"types\": %lu}",
+		        phase->peak_rss, phase->n_types);
+	}
+	fputs("], \"expressions\": ", out);
+	print_json_counts(out, expression_counts, lengthof(expression_counts),
+	                  get_expression_count_name);
+	fputs(", \"statements\": ", out);
+	print_json_counts(out, statement_counts, lengthof(statement_counts),
+	                  get_statement_count_name);
+	fprintf(out, ", \"types\": %lu}\n", n_types);
+}
+
+void mem_report_print(FILE *out, bool json)
+{
+	if (!enabled)
+		return;
+	if (json) {
+		print_json(out);
+	} else {
+		print_table(out);
+	}
+}
+
+void exit_mem_report(void)
+{
+	if (obstacks != NULL) {
+		DEL_ARR_F(obstacks);
+		obstacks = NULL;
+	}
+}
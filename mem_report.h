@@ -0,0 +1,36 @@
+#ifndef MEM_REPORT_H
+#define MEM_REPORT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "adt/obst.h"
+
+/**
+ * Memory statistics for --mem-report: the bytes allocated on the obstacks of
+ * the compiler in each phase, the peak RSS after each phase, the number of AST
+ * nodes of each kind and the number of interned types. Nothing is recorded
+ * unless mem_report_enable() was called.
+ */
+void mem_report_enable(void);
+
+/**
+ * Reports the memory of @p obst as part of group @p name (several obstacks may
+ * share a group). Must be removed again before the obstack is freed.
+ */
+void mem_report_add_obstack(const char *name, struct obstack *obst);
+void mem_report_remove_obstack(struct obstack *obst);
+
+void mem_report_count_expression(unsigned kind);
+void mem_report_count_statement(unsigned kind);
+void mem_report_count_type(void);
+
+/** Ends the phase named @p name. The next phase starts right away. */
+void mem_report_phase(const char *name);
+
+/** Prints the statistics as a table (or as JSON if @p json is set). */
+void mem_report_print(FILE *out, bool json);
+
+void exit_mem_report(void);
+
+#endif
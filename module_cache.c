@@ -0,0 +1,1571 @@
+#define _POSIX_C_SOURCE 200112L
+#include "config.h"
+
+#include "module_cache.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ast_t.h"
+#include "type_t.h"
+#include "token_t.h"
+#include "symbol_table.h"
+#include "string_pool.h"
+#include "adt/array.h"
+#include "adt/error.h"
+#include "adt/obst.h"
+#include "adt/xmalloc.h"
+
+/*
+ * An interface file is a header followed by the declarations of one source
+ * file as the parser produced them. Numbers are LEB128 varints. Entities and
+ * types can be referenced from several places (a parameter is in the
+ * parameter list and in the context of its function), they are written
+ * completely at their first reference and by id at later ones. Lists of
+ * entities are rebuilt from their context, so the next pointers of entities
+ * are not stored.
+ *
+ * Only the parsed form is stored: semantic analysis resolves references into
+ * other modules and normalizes types, so loaded declarations are checked
+ * again like freshly parsed ones.
+ */
+
+/** change this whenever the format or the AST structures change */
+#define INTERFACE_FORMAT  1
+
+#ifndef FLUFFY_VERSION
+#define FLUFFY_VERSION "unknown"
+#endif
+
+static const char interface_magic[4] = { 'F', 'L', 'F', 'I' };
+/** interfaces are only used by the compiler build that wrote them */
+static const char compiler_version[] = FLUFFY_VERSION " " __DATE__ " " __TIME__;
+
+/** tags of entity and type references */
+enum {
+	REF_NULL,
+	REF_NEW,     /**< followed by the object */
+	REF_VOID,    /**< type_void */
+	REF_INVALID, /**< type_invalid */
+	REF_ID       /**< REF_ID + id references an object written before */
+};
+
+typedef struct object_id_t object_id_t;
+struct object_id_t {
+	const void *object;
+	unsigned    id;
+};
+
+#define PtrKeyedSet        object_id_set
+#define PtrKeyedEntry      object_id_t
+#define PtrKeyedKey(entry) (entry)->object
+#include "adt/ptr_keyed_set.h"
+
+/** the state while serializing the declarations of one file */
+typedef struct writer_t {
+	unsigned char   *data;        /**< flexible array with the output */
+	object_id_set_t  ids;         /**< ids of entities and types */
+	struct obstack   obst;        /**< object_id_t entries */
+	unsigned         n_entities;
+	unsigned         n_types;
+	bool             unsupported; /**< found nodes added by plugins */
+} writer_t;
+
+/** the state while loading an interface */
+typedef struct reader_t {
+	const unsigned char  *pos;
+	const unsigned char  *end;
+	const char           *input_name;
+	entity_t            **entities;  /**< entities by id */
+	type_t              **types;     /**< types by id */
+	bool                  error;
+} reader_t;
+
+typedef struct recorded_interface_t recorded_interface_t;
+struct recorded_interface_t {
+	uint64_t       hash;
+	unsigned char *data;
+};
+
+static const char           *cache_dir;
+static recorded_interface_t *recorded;
+
+static void write_byte(writer_t *w, unsigned char byte)
+{
+	ARR_APP1(unsigned char, w->data, byte);
+}
+
+static void write_uint(writer_t *w, uint64_t value)
+{
+	while (value >= 0x80) {
+		write_byte(w, (unsigned char) (value | 0x80));
+		value >>= 7;
+	}
+	write_byte(w, (unsigned char) value);
+}
+
+static void write_int(writer_t *w, int64_t value)
+{
+	/* zigzag encoding keeps small negative numbers short */
+	write_uint(w, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+static void write_bool(writer_t *w, bool value)
+{
+	write_byte(w, value ? 1 : 0);
+}
+
+/** strings are written as length + 1 followed by the bytes, 0 is NULL */
+static void write_string(writer_t *w, const char *string)
+{
+	if (string == NULL) {
+		write_uint(w, 0);
+		return;
+	}
+	size_t len = strlen(string);
+	write_uint(w, len + 1);
+	for (size_t i = 0; i < len; ++i) {
+		write_byte(w, (unsigned char) string[i]);
+	}
+}
+
+static void write_symbol(writer_t *w, const symbol_t *symbol)
+{
+	write_string(w, symbol != NULL ? symbol->string : NULL);
+}
+
+/** all positions are in the same file, 0 is an unset position */
+static void write_position(writer_t *w, const source_position_t *position)
+{
+	unsigned linenr;
+	if (decode_source_position(*position, &linenr) == NULL) {
+		write_uint(w, 0);
+	} else {
+		write_uint(w, linenr + 1);
+	}
+}
+
+/**
+ * Returns the id of @p object or assigns it the next id from @p counter if
+ * it has none yet. *is_new tells which case happened.
+ */
+static unsigned get_object_id(writer_t *w, const void *object,
+                              unsigned *counter, bool *is_new)
+{
+	object_id_t *entry = obstack_alloc(&w->obst, sizeof(entry[0]));
+	entry->object = object;
+	entry->id     = *counter;
+
+	object_id_t *result = object_id_set_insert(&w->ids, entry);
+	*is_new = result == entry;
+	if (*is_new) {
+		++*counter;
+	} else {
+		obstack_free(&w->obst, entry);
+	}
+	return result->id;
+}
+
+static void write_type(writer_t *w, const type_t *type);
+static void write_entity(writer_t *w, const entity_t *entity);
+static void write_expression(writer_t *w, const expression_t *expression);
+static void write_statements(writer_t *w, const statement_t *statement);
+static void write_context(writer_t *w, const context_t *context);
+
+static void write_type_arguments(writer_t *w, const type_argument_t *arguments)
+{
+	size_t n = 0;
+	for (const type_argument_t *a = arguments; a != NULL; a = a->next) {
+		++n;
+	}
+	write_uint(w, n);
+	for (const type_argument_t *a = arguments; a != NULL; a = a->next) {
+		write_type(w, a->type);
+	}
+}
+
+static void write_type_parameters(writer_t *w,
+                                  const type_variable_t *type_parameters)
+{
+	size_t n = 0;
+	for (const type_variable_t *v = type_parameters; v != NULL; v = v->next) {
+		++n;
+	}
+	write_uint(w, n);
+	for (const type_variable_t *v = type_parameters; v != NULL; v = v->next) {
+		write_entity(w, (const entity_t*) v);
+	}
+}
+
+static void write_parameters(writer_t *w,
+                             const function_parameter_t *parameters)
+{
+	size_t n = 0;
+	for (const function_parameter_t *p = parameters; p != NULL; p = p->next) {
+		++n;
+	}
+	write_uint(w, n);
+	for (const function_parameter_t *p = parameters; p != NULL; p = p->next) {
+		write_entity(w, (const entity_t*) p);
+	}
+}
+
+static void write_compound_type(writer_t *w, const compound_type_t *type)
+{
+	if (type->attributes != NULL)
+		w->unsupported = true;
+
+	write_symbol(w, type->symbol);
+	write_position(w, &type->source_position);
+	write_type_parameters(w, type->type_parameters);
+
+	size_t n = 0;
+	for (const compound_entry_t *e = type->entries; e != NULL; e = e->next) {
+		++n;
+	}
+	write_uint(w, n);
+	for (const compound_entry_t *e = type->entries; e != NULL; e = e->next) {
+		if (e->attributes != NULL)
+			w->unsupported = true;
+		write_symbol(w, e->symbol);
+		write_position(w, &e->source_position);
+		write_type(w, e->type);
+	}
+
+	write_context(w, &type->context);
+}
+
+static void write_function_type(writer_t *w, const function_type_t *type)
+{
+	write_type(w, type->result_type);
+
+	size_t n = 0;
+	const function_parameter_type_t *p = type->parameter_types;
+	for ( ; p != NULL; p = p->next) {
+		++n;
+	}
+	write_uint(w, n);
+	for (p = type->parameter_types; p != NULL; p = p->next) {
+		write_type(w, p->type);
+	}
+	write_bool(w, type->variable_arguments);
+}
+
+static void write_type(writer_t *w, const type_t *type)
+{
+	if (type == NULL) {
+		write_uint(w, REF_NULL);
+		return;
+	} else if (type == type_void) {
+		write_uint(w, REF_VOID);
+		return;
+	} else if (type == type_invalid) {
+		write_uint(w, REF_INVALID);
+		return;
+	}
+
+	bool     is_new;
+	unsigned id = get_object_id(w, type, &w->n_types, &is_new);
+	if (!is_new) {
+		write_uint(w, REF_ID + (uint64_t) id);
+		return;
+	}
+	write_uint(w, REF_NEW);
+	write_uint(w, type->kind);
+
+	switch (type->kind) {
+	case TYPE_ERROR:
+		return;
+	case TYPE_ATOMIC:
+		write_uint(w, type->atomic.akind);
+		return;
+	case TYPE_COMPOUND_STRUCT:
+	case TYPE_COMPOUND_UNION:
+		write_compound_type(w, &type->compound);
+		return;
+	case TYPE_FUNCTION:
+		write_function_type(w, &type->function);
+		return;
+	case TYPE_POINTER:
+		write_type(w, type->pointer.points_to);
+		return;
+	case TYPE_ARRAY:
+		write_type(w, type->array.element_type);
+		write_expression(w, type->array.size_expression);
+		return;
+	case TYPE_TYPEOF:
+		write_expression(w, type->typeof.expression);
+		return;
+	case TYPE_REFERENCE:
+		write_symbol(w, type->reference.symbol);
+		write_position(w, &type->reference.source_position);
+		write_type_arguments(w, type->reference.type_arguments);
+		return;
+	case TYPE_INVALID:
+	case TYPE_VOID:
+	case TYPE_REFERENCE_TYPE_VARIABLE:
+	case TYPE_BIND_TYPEVARIABLES:
+		/* these are only created by semantic analysis */
+		break;
+	}
+	w->unsupported = true;
+}
+
+static void write_lazy_body(writer_t *w, const lazy_body_t *lazy_body)
+{
+	size_t n = 0;
+	while (lazy_body->tokens[n].token.type != T_EOF) {
+		++n;
+	}
+	write_uint(w, n + 1);
+
+	for (size_t i = 0; i <= n; ++i) {
+		const lexed_token_t *lexed = &lazy_body->tokens[i];
+		const token_t       *token = &lexed->token;
+		write_uint(w, token->type);
+		write_uint(w, lexed->linenr);
+
+		/* the lexer only sets the value of these tokens */
+		if (token->type == T_INTEGER) {
+			write_int(w, token->v.intvalue);
+		} else if (token->type == T_STRING_LITERAL) {
+			write_string(w, token->v.string);
+		} else if (token->type >= T_IDENTIFIER
+		           && token->type < T_LAST_TOKEN) {
+			write_symbol(w, token->v.symbol);
+		}
+	}
+}
+
+static void write_function(writer_t *w, const function_t *function)
+{
+	write_type_parameters(w, function->type_parameters);
+	write_parameters(w, function->parameters);
+	write_type(w, (const type_t*) function->type);
+	write_bool(w, function->is_extern);
+
+	const lazy_body_t *lazy_body = function->lazy_body;
+	if (lazy_body != NULL && !lazy_body->parsed) {
+		write_bool(w, true);
+		write_lazy_body(w, lazy_body);
+	} else {
+		write_bool(w, false);
+		/* the statements contain entities of the context, see
+		 * write_embedded_entity() */
+		write_statements(w, function->statement);
+	}
+	write_context(w, &function->context);
+}
+
+static void write_variable(writer_t *w, const variable_t *variable)
+{
+	write_type(w, variable->type);
+	write_bool(w, variable->is_extern);
+	write_bool(w, variable->export);
+	write_bool(w, variable->is_global);
+}
+
+static void write_entity_fields(writer_t *w, const entity_t *entity)
+{
+	write_symbol(w, entity->base.symbol);
+	write_position(w, &entity->base.source_position);
+
+	switch (entity->kind) {
+	case ENTITY_ERROR:
+	case ENTITY_LABEL:
+		return;
+	case ENTITY_FUNCTION:
+		write_function(w, &entity->function.function);
+		return;
+	case ENTITY_FUNCTION_PARAMETER:
+		write_type(w, entity->parameter.type);
+		return;
+	case ENTITY_TYPE_VARIABLE: {
+		size_t n = 0;
+		const type_constraint_t *c = entity->type_variable.constraints;
+		for ( ; c != NULL; c = c->next) {
+			++n;
+		}
+		write_uint(w, n);
+		for (c = entity->type_variable.constraints; c != NULL; c = c->next) {
+			write_symbol(w, c->concept_symbol);
+		}
+		return;
+	}
+	case ENTITY_VARIABLE:
+		write_variable(w, &entity->variable);
+		return;
+	case ENTITY_CONSTANT:
+		write_type(w, entity->constant.type);
+		write_expression(w, entity->constant.expression);
+		return;
+	case ENTITY_TYPEALIAS:
+		write_type(w, entity->typealias.type);
+		return;
+	case ENTITY_CONCEPT: {
+		const concept_t *concept = &entity->concept;
+		write_type_parameters(w, concept->type_parameters);
+
+		size_t n = 0;
+		const concept_function_t *f = concept->functions;
+		for ( ; f != NULL; f = f->next) {
+			++n;
+		}
+		write_uint(w, n);
+		for (f = concept->functions; f != NULL; f = f->next) {
+			write_entity(w, (const entity_t*) f);
+		}
+		write_context(w, &concept->context);
+		return;
+	}
+	case ENTITY_CONCEPT_FUNCTION:
+		write_type(w, (const type_t*) entity->concept_function.type);
+		write_parameters(w, entity->concept_function.parameters);
+		write_entity(w, (const entity_t*) entity->concept_function.concept);
+		return;
+	case ENTITY_INVALID:
+		break;
+	}
+	w->unsupported = true;
+}
+
+static void write_entity(writer_t *w, const entity_t *entity)
+{
+	if (entity == NULL) {
+		write_uint(w, REF_NULL);
+		return;
+	}
+
+	bool     is_new;
+	unsigned id = get_object_id(w, entity, &w->n_entities, &is_new);
+	if (!is_new) {
+		write_uint(w, REF_ID + (uint64_t) id);
+		return;
+	}
+	if (entity->kind == ENTITY_LABEL
+	        || (entity->kind == ENTITY_VARIABLE && !entity->variable.is_global)) {
+		/* these are embedded in statements, which must come first */
+		w->unsupported = true;
+	}
+	write_uint(w, REF_NEW);
+	write_uint(w, entity->kind);
+	write_entity_fields(w, entity);
+}
+
+/**
+ * Writes an entity that is part of a statement. It gets an id, so the
+ * context containing it (which is written after the statements) can
+ * reference it.
+ */
+static void write_embedded_entity(writer_t *w, const entity_t *entity)
+{
+	bool is_new;
+	get_object_id(w, entity, &w->n_entities, &is_new);
+	assert(is_new);
+	write_entity_fields(w, entity);
+}
+
+static void write_context(writer_t *w, const context_t *context)
+{
+	size_t n = 0;
+	for (const entity_t *e = context->entities; e != NULL; e = e->base.next) {
+		++n;
+	}
+	write_uint(w, n);
+	for (const entity_t *e = context->entities; e != NULL; e = e->base.next) {
+		write_entity(w, e);
+	}
+
+	n = 0;
+	const concept_instance_t *instance = context->concept_instances;
+	for ( ; instance != NULL; instance = instance->next) {
+		++n;
+	}
+	write_uint(w, n);
+	for (instance = context->concept_instances; instance != NULL;
+	     instance = instance->next) {
+		write_symbol(w, instance->concept_symbol);
+		write_position(w, &instance->source_position);
+		write_type_parameters(w, instance->type_parameters);
+		write_type_arguments(w, instance->type_arguments);
+
+		size_t n_functions = 0;
+		const concept_function_instance_t *f = instance->function_instances;
+		for ( ; f != NULL; f = f->next) {
+			++n_functions;
+		}
+		write_uint(w, n_functions);
+		for (f = instance->function_instances; f != NULL; f = f->next) {
+			write_symbol(w, f->symbol);
+			write_position(w, &f->source_position);
+			write_function(w, &f->function);
+		}
+		write_context(w, &instance->context);
+	}
+
+	n = 0;
+	for (const export_t *e = context->exports; e != NULL; e = e->next) {
+		++n;
+	}
+	write_uint(w, n);
+	for (const export_t *e = context->exports; e != NULL; e = e->next) {
+		write_symbol(w, e->symbol);
+		write_position(w, &e->source_position);
+	}
+
+	n = 0;
+	for (const import_t *i = context->imports; i != NULL; i = i->next) {
+		++n;
+	}
+	write_uint(w, n);
+	for (const import_t *i = context->imports; i != NULL; i = i->next) {
+		write_symbol(w, i->module);
+		write_symbol(w, i->symbol);
+		write_position(w, &i->source_position);
+	}
+}
+
+static void write_expression(writer_t *w, const expression_t *expression)
+{
+	if (expression == NULL) {
+		write_uint(w, EXPR_INVALID);
+		return;
+	}
+	write_uint(w, expression->kind);
+	write_type(w, expression->base.type);
+	write_position(w, &expression->base.source_position);
+
+	switch (expression->kind) {
+	case EXPR_ERROR:
+	case EXPR_NULL_POINTER:
+		return;
+	case EXPR_INT_CONST:
+		write_int(w, expression->int_const.value);
+		return;
+	case EXPR_FLOAT_CONST: {
+		uint64_t bits;
+		memcpy(&bits, &expression->float_const.value, sizeof(bits));
+		write_uint(w, bits);
+		return;
+	}
+	case EXPR_BOOL_CONST:
+		write_bool(w, expression->bool_const.value);
+		return;
+	case EXPR_STRING_CONST:
+		write_string(w, expression->string_const.value);
+		return;
+	case EXPR_REFERENCE:
+		write_symbol(w, expression->reference.symbol);
+		write_type_arguments(w, expression->reference.type_arguments);
+		return;
+	case EXPR_CALL: {
+		write_expression(w, expression->call.function);
+		const call_arguments_t *arguments = expression->call.arguments;
+		write_uint(w, arguments->n_arguments);
+		for (unsigned i = 0; i < arguments->n_arguments; ++i) {
+			write_expression(w, arguments->arguments[i]);
+		}
+		return;
+	}
+	case EXPR_SELECT:
+		write_expression(w, expression->select.compound);
+		write_symbol(w, expression->select.symbol);
+		return;
+	case EXPR_ARRAY_ACCESS:
+		write_expression(w, expression->array_access.array_ref);
+		write_expression(w, expression->array_access.index);
+		return;
+	case EXPR_SIZEOF:
+		write_type(w, expression->sizeofe.type);
+		return;
+	case EXPR_FUNC:
+		write_function(w, &expression->func.function);
+		return;
+	EXPR_UNARY_CASES
+		write_expression(w, expression->unary.value);
+		return;
+	EXPR_BINARY_CASES
+		write_expression(w, expression->binary.left);
+		write_expression(w, expression->binary.right);
+		return;
+	case EXPR_INVALID:
+		break;
+	}
+	w->unsupported = true;
+}
+
+/** writes a list of statements, terminated by STATEMENT_INVALID */
+static void write_statements(writer_t *w, const statement_t *statement)
+{
+	for ( ; statement != NULL; statement = statement->base.next) {
+		write_uint(w, statement->kind);
+		write_position(w, &statement->base.source_position);
+
+		switch (statement->kind) {
+		case STATEMENT_ERROR:
+			continue;
+		case STATEMENT_BLOCK:
+			write_statements(w, statement->block.statements);
+			write_position(w, &statement->block.end_position);
+			write_context(w, &statement->block.context);
+			continue;
+		case STATEMENT_RETURN:
+			write_expression(w, statement->returns.value);
+			continue;
+		case STATEMENT_DECLARATION:
+			write_embedded_entity(w,
+					(const entity_t*) &statement->declaration.entity);
+			continue;
+		case STATEMENT_IF:
+			write_expression(w, statement->ifs.condition);
+			write_statements(w, statement->ifs.true_statement);
+			write_statements(w, statement->ifs.false_statement);
+			continue;
+		case STATEMENT_EXPRESSION:
+			write_expression(w, statement->expression.expression);
+			continue;
+		case STATEMENT_GOTO:
+			write_symbol(w, statement->gotos.label_symbol);
+			continue;
+		case STATEMENT_LABEL:
+			write_embedded_entity(w,
+					(const entity_t*) &statement->label.label);
+			continue;
+		case STATEMENT_INVALID:
+			break;
+		}
+		w->unsupported = true;
+		return;
+	}
+	write_uint(w, STATEMENT_INVALID);
+}
+
+static unsigned char read_byte(reader_t *r)
+{
+	if (r->pos >= r->end) {
+		r->error = true;
+		return 0;
+	}
+	return *r->pos++;
+}
+
+static uint64_t read_uint(reader_t *r)
+{
+	uint64_t result = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		unsigned char byte = read_byte(r);
+		result |= (uint64_t) (byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return result;
+	}
+	r->error = true;
+	return 0;
+}
+
+static int64_t read_int(reader_t *r)
+{
+	uint64_t value = read_uint(r);
+	return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static bool read_bool(reader_t *r)
+{
+	return read_byte(r) != 0;
+}
+
+/** reads the length of a list, each element takes at least one byte */
+static size_t read_count(reader_t *r)
+{
+	uint64_t n = read_uint(r);
+	if (n > (uint64_t) (r->end - r->pos)) {
+		r->error = true;
+		return 0;
+	}
+	return (size_t) n;
+}
+
+/**
+ * Reads a string written by write_string(). Returns a pointer to its bytes
+ * in the input (NULL for a NULL string) and stores its length in *len.
+ */
+static const char *read_string_bytes(reader_t *r, size_t *len)
+{
+	uint64_t n = read_uint(r);
+	*len = 0;
+	if (n == 0)
+		return NULL;
+	if (n - 1 > (uint64_t) (r->end - r->pos)) {
+		r->error = true;
+		return NULL;
+	}
+	const char *string = (const char*) r->pos;
+	*len    = (size_t) (n - 1);
+	r->pos += *len;
+	return string;
+}
+
+/** string literals are shared with the lexed ones, see string_pool.h */
+static const char *read_pooled_string(reader_t *r)
+{
+	size_t      len;
+	const char *string = read_string_bytes(r, &len);
+	if (string == NULL)
+		return NULL;
+	return string_pool_insert_len(string, len);
+}
+
+static symbol_t *read_symbol(reader_t *r)
+{
+	size_t      len;
+	const char *string = read_string_bytes(r, &len);
+	if (string == NULL)
+		return NULL;
+	return symbol_table_insert_len(string, len);
+}
+
+static void read_position(reader_t *r, source_position_t *position)
+{
+	uint64_t linenr = read_uint(r);
+	if (linenr == 0) {
+		*position = NO_SOURCE_POSITION;
+	} else {
+		*position = make_source_position(r->input_name,
+		                                 (unsigned) (linenr - 1));
+	}
+}
+
+static void *allocate_zero(size_t size)
+{
+	void *result = allocate_ast(size);
+	memset(result, 0, size);
+	return result;
+}
+
+static type_t *read_type(reader_t *r);
+static entity_t *read_entity(reader_t *r, entity_kind_t kind);
+static expression_t *read_expression(reader_t *r);
+static statement_t *read_statements(reader_t *r);
+static void read_context(reader_t *r, context_t *context);
+
+static type_argument_t *read_type_arguments(reader_t *r)
+{
+	type_argument_t *first = NULL;
+	type_argument_t *last  = NULL;
+	size_t           n     = read_count(r);
+	for (size_t i = 0; i < n && !r->error; ++i) {
+		type_argument_t *argument = allocate_zero(sizeof(argument[0]));
+		argument->type = read_type(r);
+
+		if (last != NULL) {
+			last->next = argument;
+		} else {
+			first = argument;
+		}
+		last = argument;
+	}
+	return first;
+}
+
+static type_variable_t *read_type_parameters(reader_t *r)
+{
+	type_variable_t *first = NULL;
+	type_variable_t *last  = NULL;
+	size_t           n     = read_count(r);
+	for (size_t i = 0; i < n && !r->error; ++i) {
+		entity_t *entity = read_entity(r, ENTITY_TYPE_VARIABLE);
+		if (entity == NULL)
+			break;
+
+		if (last != NULL) {
+			last->next = &entity->type_variable;
+		} else {
+			first = &entity->type_variable;
+		}
+		last = &entity->type_variable;
+	}
+	return first;
+}
+
+static function_parameter_t *read_parameters(reader_t *r)
+{
+	function_parameter_t *first = NULL;
+	function_parameter_t *last  = NULL;
+	size_t                n     = read_count(r);
+	for (size_t i = 0; i < n && !r->error; ++i) {
+		entity_t *entity = read_entity(r, ENTITY_FUNCTION_PARAMETER);
+		if (entity == NULL)
+			break;
+
+		if (last != NULL) {
+			last->next = &entity->parameter;
+		} else {
+			first = &entity->parameter;
+		}
+		last = &entity->parameter;
+	}
+	return first;
+}
+
+static void read_compound_type(reader_t *r, compound_type_t *type)
+{
+	type->symbol = read_symbol(r);
+	read_position(r, &type->source_position);
+	type->type_parameters = read_type_parameters(r);
+
+	compound_entry_t *last = NULL;
+	size_t            n    = read_count(r);
+	for (size_t i = 0; i < n && !r->error; ++i) {
+		compound_entry_t *entry = allocate_zero(sizeof(entry[0]));
+		entry->symbol = read_symbol(r);
+		read_position(r, &entry->source_position);
+		entry->type   = read_type(r);
+
+		if (last != NULL) {
+			last->next = entry;
+		} else {
+			type->entries = entry;
+		}
+		last = entry;
+	}
+
+	read_context(r, &type->context);
+}
+
+static void read_function_type(reader_t *r, function_type_t *type)
+{
+	type->result_type = read_type(r);
+
+	function_parameter_type_t *last = NULL;
+	size_t                     n    = read_count(r);
+	for (size_t i = 0; i < n && !r->error; ++i) {
+		function_parameter_type_t *parameter
+			= allocate_zero(sizeof(parameter[0]));
+		parameter->type = read_type(r);
+
+		if (last != NULL) {
+			last->next = parameter;
+		} else {
+			type->parameter_types = parameter;
+		}
+		last = parameter;
+	}
+	type->variable_arguments = read_bool(r);
+}
+
+static type_t *read_new_type(reader_t *r)
+{
+	uint64_t kind = read_uint(r);
+	switch (kind) {
+	case TYPE_ERROR:
+	case TYPE_COMPOUND_STRUCT:
+	case TYPE_COMPOUND_UNION:
+	case TYPE_FUNCTION:
+	case TYPE_POINTER:
+	case TYPE_ARRAY:
+	case TYPE_TYPEOF:
+	case TYPE_REFERENCE:
+		break;
+	case TYPE_ATOMIC: {
+		uint64_t akind = read_uint(r);
+		if (akind == ATOMIC_TYPE_INVALID || akind > ATOMIC_TYPE_DOUBLE) {
+			r->error = true;
+			return NULL;
+		}
+		type_t *type = make_atomic_type((atomic_type_kind_t) akind);
+		ARR_APP1(type_t*, r->types, type);
+		return type;
+	}
+	default:
+		r->error = true;
+		return NULL;
+	}
+
+	/* register the type first, its parts may refer to it */
+	type_t *type = allocate_type((type_kind_t) kind);
+	ARR_APP1(type_t*, r->types, type);
+
+	switch (type->kind) {
+	case TYPE_COMPOUND_STRUCT:
+	case TYPE_COMPOUND_UNION:
+		read_compound_type(r, &type->compound);
+		break;
+	case TYPE_FUNCTION:
+		read_function_type(r, &type->function);
+		break;
+	case TYPE_POINTER:
+		type->pointer.points_to = read_type(r);
+		break;
+	case TYPE_ARRAY:
+		type->array.element_type    = read_type(r);
+		type->array.size_expression = read_expression(r);
+		break;
+	case TYPE_TYPEOF:
+		type->typeof.expression = read_expression(r);
+		break;
+	case TYPE_REFERENCE:
+		type->reference.symbol = read_symbol(r);
+		read_position(r, &type->reference.source_position);
+		type->reference.type_arguments = read_type_arguments(r);
+		break;
+	default:
+		break;
+	}
+	return type;
+}
+
+static type_t *read_type(reader_t *r)
+{
+	uint64_t ref = read_uint(r);
+	switch (ref) {
+	case REF_NULL:
+		return NULL;
+	case REF_NEW:
+		return read_new_type(r);
+	case REF_VOID:
+		return type_void;
+	case REF_INVALID:
+		return type_invalid;
+	}
+	if (ref - REF_ID >= ARR_LEN(r->types)) {
+		r->error = true;
+		return NULL;
+	}
+	return r->types[ref - REF_ID];
+}
+
+static function_type_t *read_function_type_ref(reader_t *r)
+{
+	type_t *type = read_type(r);
+	if (type == NULL || type->kind != TYPE_FUNCTION) {
+		r->error = true;
+		return NULL;
+	}
+	return &type->function;
+}
+
+static lazy_body_t *read_lazy_body(reader_t *r)
+{
+	size_t n = read_count(r);
+	if (n == 0) {
+		r->error = true;
+		return NULL;
+	}
+
+	lazy_body_t *lazy_body = allocate_zero(sizeof(lazy_body[0]));
+	lazy_body->tokens      = allocate_zero(n * sizeof(lazy_body->tokens[0]));
+	lazy_body->input_name  = r->input_name;
+
+	for (size_t i = 0; i < n && !r->error; ++i) {
+		lexed_token_t *lexed = &lazy_body->tokens[i];
+		token_t       *token = &lexed->token;
+		token->type   = (token_type_t) read_uint(r);
+		lexed->linenr = (unsigned) read_uint(r);
+
+		if (token->type == T_INTEGER) {
+			token->v.intvalue = (int) read_int(r);
+		} else if (token->type == T_STRING_LITERAL) {
+			token->v.string = read_pooled_string(r);
+		} else if (token->type >= T_IDENTIFIER
+		           && token->type < T_LAST_TOKEN) {
+			token->v.symbol = read_symbol(r);
+		}
+	}
+	/* parse_lazy_body() stops at the T_EOF */
+	if (lazy_body->tokens[n - 1].token.type != T_EOF)
+		r->error = true;
+	return lazy_body;
+}
+
+static void read_function(reader_t *r, function_t *function)
+{
+	function->type_parameters = read_type_parameters(r);
+	function->parameters      = read_parameters(r);
+	function->type            = read_function_type_ref(r);
+	function->is_extern       = read_bool(r);
+
+	if (read_bool(r)) {
+		function->lazy_body = read_lazy_body(r);
+	} else {
+		function->statement = read_statements(r);
+	}
+	read_context(r, &function->context);
+}
+
+static void read_variable(reader_t *r, variable_t *variable)
+{
+	variable->type      = read_type(r);
+	variable->is_extern = read_bool(r);
+	variable->export    = read_bool(r);
+	variable->is_global = read_bool(r);
+}
+
+static void read_entity_fields(reader_t *r, entity_t *entity)
+{
+	entity->base.symbol = read_symbol(r);
+	read_position(r, &entity->base.source_position);
+
+	switch (entity->kind) {
+	case ENTITY_FUNCTION:
+		read_function(r, &entity->function.function);
+		return;
+	case ENTITY_FUNCTION_PARAMETER:
+		entity->parameter.type = read_type(r);
+		return;
+	case ENTITY_TYPE_VARIABLE: {
+		type_constraint_t *last = NULL;
+		size_t             n    = read_count(r);
+		for (size_t i = 0; i < n && !r->error; ++i) {
+			type_constraint_t *constraint
+				= allocate_zero(sizeof(constraint[0]));
+			constraint->concept_symbol = read_symbol(r);
+
+			if (last != NULL) {
+				last->next = constraint;
+			} else {
+				entity->type_variable.constraints = constraint;
+			}
+			last = constraint;
+		}
+		return;
+	}
+	case ENTITY_VARIABLE:
+		read_variable(r, &entity->variable);
+		return;
+	case ENTITY_CONSTANT:
+		entity->constant.type       = read_type(r);
+		entity->constant.expression = read_expression(r);
+		return;
+	case ENTITY_TYPEALIAS:
+		entity->typealias.type = read_type(r);
+		return;
+	case ENTITY_CONCEPT: {
+		concept_t *concept = &entity->concept;
+		concept->type_parameters = read_type_parameters(r);
+
+		concept_function_t *last = NULL;
+		size_t              n    = read_count(r);
+		for (size_t i = 0; i < n && !r->error; ++i) {
+			entity_t *function = read_entity(r, ENTITY_CONCEPT_FUNCTION);
+			if (function == NULL)
+				break;
+
+			if (last != NULL) {
+				last->next = &function->concept_function;
+			} else {
+				concept->functions = &function->concept_function;
+			}
+			last = &function->concept_function;
+		}
+		read_context(r, &concept->context);
+		return;
+	}
+	case ENTITY_CONCEPT_FUNCTION: {
+		concept_function_t *function = &entity->concept_function;
+		function->type       = read_function_type_ref(r);
+		function->parameters = read_parameters(r);
+
+		entity_t *concept = read_entity(r, ENTITY_CONCEPT);
+		if (concept != NULL)
+			function->concept = &concept->concept;
+		return;
+	}
+	default:
+		return;
+	}
+}
+
+static entity_t *read_entity(reader_t *r, entity_kind_t kind)
+{
+	uint64_t  ref = read_uint(r);
+	entity_t *entity;
+	if (ref == REF_NULL) {
+		return NULL;
+	} else if (ref == REF_NEW) {
+		uint64_t new_kind = read_uint(r);
+		if (new_kind == ENTITY_INVALID || new_kind > ENTITY_LAST
+		        || new_kind == ENTITY_LABEL) {
+			r->error = true;
+			return NULL;
+		}
+		/* register the entity first, its parts may refer to it */
+		entity = allocate_entity((entity_kind_t) new_kind);
+		ARR_APP1(entity_t*, r->entities, entity);
+		read_entity_fields(r, entity);
+	} else if (ref >= REF_ID && ref - REF_ID < ARR_LEN(r->entities)) {
+		entity = r->entities[ref - REF_ID];
+	} else {
+		r->error = true;
+		return NULL;
+	}
+
+	if (kind != ENTITY_INVALID && entity->kind != kind) {
+		r->error = true;
+		return NULL;
+	}
+	return entity;
+}
+
+/** reads an entity written by write_embedded_entity() */
+static void read_embedded_entity(reader_t *r, entity_t *entity,
+                                 entity_kind_t kind)
+{
+	entity->base.kind = kind;
+	ARR_APP1(entity_t*, r->entities, entity);
+	read_entity_fields(r, entity);
+}
+
+static void read_context(reader_t *r, context_t *context)
+{
+	entity_t *last_entity = NULL;
+	size_t    n           = read_count(r);
+	for (size_t i = 0; i < n && !r->error; ++i) {
+		entity_t *entity = read_entity(r, ENTITY_INVALID);
+		if (entity == NULL) {
+			r->error = true;
+			break;
+		}
+
+		if (last_entity != NULL) {
+			last_entity->base.next = entity;
+		} else {
+			context->entities = entity;
+		}
+		last_entity = entity;
+	}
+
+	concept_instance_t *last_instance = NULL;
+	n = read_count(r);
+	for (size_t i = 0; i < n && !r->error; ++i) {
+		concept_instance_t *instance = allocate_zero(sizeof(instance[0]));
+		instance->concept_symbol = read_symbol(r);
+		read_position(r, &instance->source_position);
+		instance->type_parameters = read_type_parameters(r);
+		instance->type_arguments  = read_type_arguments(r);
+
+		concept_function_instance_t *last_function = NULL;
+		size_t n_functions = read_count(r);
+		for (size_t f = 0; f < n_functions && !r->error; ++f) {
+			concept_function_instance_t *function
+				= allocate_zero(sizeof(function[0]));
+			function->symbol = read_symbol(r);
+			read_position(r, &function->source_position);
+			read_function(r, &function->function);
+
+			if (last_function != NULL) {
+				last_function->next = function;
+			} else {
+				instance->function_instances = function;
+			}
+			last_function = function;
+		}
+		read_context(r, &instance->context);
+
+		if (last_instance != NULL) {
+			last_instance->next = instance;
+		} else {
+			context->concept_instances = instance;
+		}
+		last_instance = instance;
+	}
+
+	export_t *last_export = NULL;
+	n = read_count(r);
+	for (size_t i = 0; i < n && !r->error; ++i) {
+		export_t *export = allocate_zero(sizeof(export[0]));
+		export->symbol = read_symbol(r);
+		read_position(r, &export->source_position);
+
+		if (last_export != NULL) {
+			last_export->next = export;
+		} else {
+			context->exports = export;
+		}
+		last_export = export;
+	}
+
+	import_t *last_import = NULL;
+	n = read_count(r);
+	for (size_t i = 0; i < n && !r->error; ++i) {
+		import_t *import = allocate_zero(sizeof(import[0]));
+		import->module = read_symbol(r);
+		import->symbol = read_symbol(r);
+		read_position(r, &import->source_position);
+
+		if (last_import != NULL) {
+			last_import->next = import;
+		} else {
+			context->imports = import;
+		}
+		last_import = import;
+	}
+}
+
+static call_arguments_t *read_call_arguments(reader_t *r)
+{
+	size_t            n         = read_count(r);
+	call_arguments_t *arguments = allocate_call_arguments((unsigned) n);
+	for (size_t i = 0; i < n; ++i) {
+		arguments->arguments[i] = r->error ? NULL : read_expression(r);
+	}
+	return arguments;
+}
+
+static expression_t *read_expression(reader_t *r)
+{
+	uint64_t kind = read_uint(r);
+	if (kind == EXPR_INVALID)
+		return NULL;
+	if (kind > EXPR_LAST) {
+		r->error = true;
+		return NULL;
+	}
+
+	expression_t *expression = allocate_expression((expression_kind_t) kind);
+	expression->base.type = read_type(r);
+	read_position(r, &expression->base.source_position);
+
+	switch (expression->kind) {
+	case EXPR_INT_CONST:
+		expression->int_const.value = (int) read_int(r);
+		break;
+	case EXPR_FLOAT_CONST: {
+		uint64_t bits = read_uint(r);
+		memcpy(&expression->float_const.value, &bits, sizeof(bits));
+		break;
+	}
+	case EXPR_BOOL_CONST:
+		expression->bool_const.value = read_bool(r);
+		break;
+	case EXPR_STRING_CONST:
+		expression->string_const.value = read_pooled_string(r);
+		break;
+	case EXPR_REFERENCE:
+		expression->reference.symbol         = read_symbol(r);
+		expression->reference.type_arguments = read_type_arguments(r);
+		break;
+	case EXPR_CALL:
+		expression->call.function  = read_expression(r);
+		expression->call.arguments = read_call_arguments(r);
+		break;
+	case EXPR_SELECT:
+		expression->select.compound = read_expression(r);
+		expression->select.symbol   = read_symbol(r);
+		break;
+	case EXPR_ARRAY_ACCESS:
+		expression->array_access.array_ref = read_expression(r);
+		expression->array_access.index     = read_expression(r);
+		break;
+	case EXPR_SIZEOF:
+		expression->sizeofe.type = read_type(r);
+		break;
+	case EXPR_FUNC:
+		read_function(r, &expression->func.function);
+		break;
+	EXPR_UNARY_CASES
+		expression->unary.value = read_expression(r);
+		break;
+	EXPR_BINARY_CASES
+		expression->binary.left  = read_expression(r);
+		expression->binary.right = read_expression(r);
+		break;
+	default:
+		break;
+	}
+	return expression;
+}
+
+static statement_t *read_statements(reader_t *r)
+{
+	statement_t *first = NULL;
+	statement_t *last  = NULL;
+	while (!r->error) {
+		uint64_t kind = read_uint(r);
+		if (kind == STATEMENT_INVALID)
+			break;
+		if (kind > STATEMENT_LAST) {
+			r->error = true;
+			break;
+		}
+
+		statement_t *statement = allocate_statement((statement_kind_t) kind);
+		read_position(r, &statement->base.source_position);
+
+		switch (statement->kind) {
+		case STATEMENT_BLOCK:
+			statement->block.statements = read_statements(r);
+			read_position(r, &statement->block.end_position);
+			read_context(r, &statement->block.context);
+			break;
+		case STATEMENT_RETURN:
+			statement->returns.value = read_expression(r);
+			break;
+		case STATEMENT_DECLARATION:
+			read_embedded_entity(r,
+					(entity_t*) &statement->declaration.entity,
+					ENTITY_VARIABLE);
+			break;
+		case STATEMENT_IF:
+			statement->ifs.condition       = read_expression(r);
+			statement->ifs.true_statement  = read_statements(r);
+			statement->ifs.false_statement = read_statements(r);
+			break;
+		case STATEMENT_EXPRESSION:
+			statement->expression.expression = read_expression(r);
+			break;
+		case STATEMENT_GOTO:
+			statement->gotos.label_symbol = read_symbol(r);
+			break;
+		case STATEMENT_LABEL:
+			read_embedded_entity(r, (entity_t*) &statement->label.label,
+			                     ENTITY_LABEL);
+			break;
+		default:
+			break;
+		}
+
+		if (last != NULL) {
+			last->base.next = statement;
+		} else {
+			first = statement;
+		}
+		last = statement;
+	}
+	return first;
+}
+
+static bool read_header(reader_t *r, uint64_t hash)
+{
+	for (size_t i = 0; i < sizeof(interface_magic); ++i) {
+		if (read_byte(r) != (unsigned char) interface_magic[i])
+			return false;
+	}
+	if (read_uint(r) != INTERFACE_FORMAT)
+		return false;
+
+	size_t      len;
+	const char *version = read_string_bytes(r, &len);
+	if (version == NULL || len != sizeof(compiler_version) - 1
+	        || memcmp(version, compiler_version, len) != 0)
+		return false;
+
+	return read_uint(r) == hash && !r->error;
+}
+
+void module_cache_set_dir(const char *dir)
+{
+	cache_dir = dir;
+}
+
+#define HASH_BASIS  UINT64_C(14695981039346656037)
+
+static uint64_t hash_bytes(uint64_t hash, const unsigned char *bytes,
+                           size_t size)
+{
+	/* 64 bit FNV-1a */
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= UINT64_C(1099511628211);
+	}
+	return hash;
+}
+
+bool module_cache_hash(FILE *in, uint64_t *hash)
+{
+	if (cache_dir == NULL)
+		return false;
+
+	struct stat st;
+	int         fd = fileno(in);
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	long const pos = ftell(in);
+	if (pos < 0)
+		return false;
+
+	uint64_t result = hash_bytes(HASH_BASIS, (const unsigned char*) compiler_version,
+	                    sizeof(compiler_version));
+
+	unsigned char buf[4096];
+	size_t        n;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		result = hash_bytes(result, buf, n);
+	}
+	bool ok = !ferror(in);
+	if (fseek(in, pos, SEEK_SET) != 0)
+		panic("couldn't seek back in input file");
+
+	*hash = result;
+	return ok;
+}
+
+static void get_interface_name(char *buf, size_t buflen, uint64_t hash)
+{
+	int res = snprintf(buf, buflen, "%s/%016" PRIx64 ".fli", cache_dir, hash);
+	if (res < 0 || (size_t) res >= buflen)
+		panic("module cache path too long");
+}
+
+void module_cache_record(uint64_t hash, const parser_t *parser)
+{
+	symbol_t        *module_name;
+	const context_t *context = parser_get_context(parser, &module_name);
+
+	writer_t w;
+	memset(&w, 0, sizeof(w));
+	w.data = NEW_ARR_F(unsigned char, 0);
+	object_id_set_init(&w.ids);
+	obstack_init(&w.obst);
+
+	for (size_t i = 0; i < sizeof(interface_magic); ++i) {
+		write_byte(&w, (unsigned char) interface_magic[i]);
+	}
+	write_uint(&w, INTERFACE_FORMAT);
+	write_string(&w, compiler_version);
+	write_uint(&w, hash);
+	write_symbol(&w, module_name);
+	write_context(&w, context);
+
+	/* a checksum of everything before it, 8 bytes little endian */
+	uint64_t checksum = hash_bytes(HASH_BASIS, w.data, ARR_LEN(w.data));
+	for (unsigned i = 0; i < 8; ++i) {
+		write_byte(&w, (unsigned char) (checksum >> (i * 8)));
+	}
+
+	object_id_set_destroy(&w.ids);
+	obstack_free(&w.obst, NULL);
+
+	if (w.unsupported) {
+		DEL_ARR_F(w.data);
+		return;
+	}
+
+	if (recorded == NULL)
+		recorded = NEW_ARR_F(recorded_interface_t, 0);
+	recorded_interface_t interface;
+	interface.hash = hash;
+	interface.data = w.data;
+	ARR_APP1(recorded_interface_t, recorded, interface);
+}
+
+static bool write_interface(const recorded_interface_t *interface)
+{
+	char name[4096];
+	char temp_name[4096 + 32];
+	get_interface_name(name, sizeof(name), interface->hash);
+	/* a concurrent compiler never sees a partially written file */
+	snprintf(temp_name, sizeof(temp_name), "%s.%ld.tmp", name,
+	         (long) getpid());
+
+	FILE *out = fopen(temp_name, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Warning: couldn't open '%s': %s\n", temp_name,
+		        strerror(errno));
+		return false;
+	}
+	size_t size = ARR_LEN(interface->data);
+	bool   ok   = fwrite(interface->data, 1, size, out) == size;
+	ok &= fclose(out) == 0;
+	if (ok && rename(temp_name, name) != 0)
+		ok = false;
+	if (!ok) {
+		fprintf(stderr, "Warning: couldn't write module interface '%s': %s\n",
+		        name, strerror(errno));
+		unlink(temp_name);
+	}
+	return ok;
+}
+
+static void free_recorded(void)
+{
+	for (size_t i = 0; i < ARR_LEN(recorded); ++i) {
+		DEL_ARR_F(recorded[i].data);
+	}
+	DEL_ARR_F(recorded);
+	recorded = NULL;
+}
+
+void module_cache_flush(void)
+{
+	if (recorded == NULL)
+		return;
+
+	if (mkdir(cache_dir, 0777) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Warning: couldn't create '%s': %s\n", cache_dir,
+		        strerror(errno));
+	} else {
+		for (size_t i = 0; i < ARR_LEN(recorded); ++i) {
+			if (!write_interface(&recorded[i]))
+				break;
+		}
+	}
+
+	free_recorded();
+}
+
+bool module_cache_load(uint64_t hash, const char *input_name,
+                       symbol_t **module_name, context_t *context)
+{
+	if (cache_dir == NULL)
+		return false;
+
+	char name[4096];
+	get_interface_name(name, sizeof(name), hash);
+	int fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < 8) {
+		close(fd);
+		return false;
+	}
+	size_t const length = (size_t) st.st_size;
+	void  *const base   = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return false;
+
+	const unsigned char *data     = base;
+	size_t const         size     = length - 8;
+	uint64_t             checksum = 0;
+	for (unsigned i = 0; i < 8; ++i) {
+		checksum |= (uint64_t) data[size + i] << (i * 8);
+	}
+	if (checksum != hash_bytes(HASH_BASIS, data, size)) {
+		munmap(base, length);
+		return false;
+	}
+
+	reader_t r;
+	memset(&r, 0, sizeof(r));
+	r.pos        = data;
+	r.end        = data + size;
+	r.input_name = input_name;
+	r.entities   = NEW_ARR_F(entity_t*, 0);
+	r.types      = NEW_ARR_F(type_t*, 0);
+
+	bool result = read_header(&r, hash);
+	if (result) {
+		memset(context, 0, sizeof(context[0]));
+		*module_name = read_symbol(&r);
+		read_context(&r, context);
+		result = !r.error && r.pos == r.end;
+	}
+
+	DEL_ARR_F(r.types);
+	DEL_ARR_F(r.entities);
+	munmap(base, length);
+	return result;
+}
+
+void exit_module_cache(void)
+{
+	if (recorded != NULL)
+		free_recorded();
+}
@@ -0,0 +1,49 @@
+#ifndef MODULE_CACHE_H
+#define MODULE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ast.h"
+#include "symbol.h"
+#include "parser.h"
+
+/**
+ * Sets the directory for module interface files, NULL (the default) disables
+ * them. The interface of a source file holds its parsed declarations, it is
+ * found by a hash of the file contents and only used by the compiler version
+ * that wrote it.
+ */
+void module_cache_set_dir(const char *dir);
+
+/**
+ * Computes the key of the interface of the rest of the file @p in. Returns
+ * false if the cache is disabled or @p in is no regular file.
+ */
+bool module_cache_hash(FILE *in, uint64_t *hash);
+
+/**
+ * Loads the interface with the key @p hash. On success the declarations are
+ * stored in @p context and the name of their module in @p module_name (see
+ * parser_get_context()), they still have to be appended to the module.
+ * Returns false if there is no valid interface.
+ */
+bool module_cache_load(uint64_t hash, const char *input_name,
+                       symbol_t **module_name, context_t *context);
+
+/**
+ * Serializes the declarations of @p parser after a successful
+ * parser_parse(). The interface is written by module_cache_flush().
+ */
+void module_cache_record(uint64_t hash, const parser_t *parser);
+
+/**
+ * Writes the recorded interfaces. Only call this when the program passed
+ * the semantic checks, so the cache never holds broken modules.
+ */
+void module_cache_flush(void);
+
+void exit_module_cache(void);
+
+#endif
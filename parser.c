@@ -7,17 +7,22 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "symbol_table_t.h"
 #include "lexer.h"
 #include "symbol.h"
 #include "type_hash.h"
+#include "mem_report.h"
 #include "ast_t.h"
 #include "type_t.h"
 #include "adt/array.h"
 #include "adt/obst.h"
 #include "adt/util.h"
 #include "adt/error.h"
+#include "adt/xmalloc.h"
+#include "compiler.h"
 
 //#define ABORT_ON_ERROR
 //#define PRINT_TOKENS
@@ -27,16 +32,70 @@ static parse_statement_function    *statement_parsers;
 static parse_declaration_function  *declaration_parsers;
 static parse_attribute_function    *attribute_parsers;
 
-static unsigned char token_anchor_set[T_LAST_TOKEN];
+/** the state of the parser for one input file */
+struct parser_t {
+	lexer_t        lexer;
+	token_t        token;
+	lexed_token_t *tokens;      /**< tokens from parser_tokenize() or NULL */
+	size_t         next_lexed;  /**< index of the next token in tokens */
+	lexed_token_t *lazy_tokens; /**< buffer of skip_function_body() */
+	symbol_t      *current_module_name;
+	context_t     *current_context;
+	context_t      file_context;
+	unsigned char  token_anchor_set[T_LAST_TOKEN];
+	int            error;
+	/** arguments of the calls being parsed, see parse_call_expression() */
+	expression_t **argument_stack;
+};
 
-static symbol_t  *current_module_name;
-static context_t *current_context;
+/**
+ * The parser running in this thread. The parse functions registered by
+ * plugins have no parser argument, so all parse functions find their state
+ * here.
+ */
+static THREAD_LOCAL parser_t *parser;
+
+/* copies of the current token and position for the plugin api */
+token_t           token;
+source_position_t source_position;
+/** false in parser threads, plugins are only used by serial parsing */
+static THREAD_LOCAL bool update_plugin_globals = true;
+/** skip the bodies of top level functions, see parser_set_lazy_bodies() */
+static bool lazy_bodies;
+
+/** obstacks of the parser threads, they hold AST nodes until exit_parser */
+static struct obstack **thread_obstacks;
+static pthread_mutex_t  thread_obstacks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** a part of the input lexed by a lexer thread, see parser_tokenize() */
+typedef struct lex_chunk_t lex_chunk_t;
+struct lex_chunk_t {
+	lexer_t              lexer;
+	const unsigned char *begin;
+	const unsigned char *end;   /**< begin of the next chunk, NULL if last */
+	const unsigned char *stop;  /**< where the lexer stopped, NULL at the end */
+	lexed_token_t       *tokens;
+};
 
-static int      error = 0;
-       token_t  token;
+/** the chunks of one parser_tokenize() call, taken by its lexer threads */
+typedef struct lex_queue_t lex_queue_t;
+struct lex_queue_t {
+	lex_chunk_t     *chunks;
+	size_t           n_chunks;
+	size_t           next_chunk; /**< the first chunk not taken yet */
+	pthread_mutex_t  lock;
+};
 
 module_t *modules;
 
+#define PtrKeyedSet        module_set
+#define PtrKeyedEntry      module_t
+#define PtrKeyedKey(entry) (entry)->name
+#include "adt/ptr_keyed_set.h"
+
+/** the entries of modules by name */
+static module_set_t module_set;
+
 static inline void *allocate_ast_zero(size_t size)
 {
 	void *res = allocate_ast(size);
@@ -103,9 +162,19 @@ expression_t *allocate_expression(expression_kind_t kind)
 	size_t        size       = get_expression_struct_size(kind);
 	expression_t *expression = allocate_ast_zero(size);
 	expression->kind         = kind;
+	mem_report_count_expression(kind);
 	return expression;
 }
 
+call_arguments_t *allocate_call_arguments(unsigned n_arguments)
+{
+	size_t            size      = sizeof(call_arguments_t)
+	                              + n_arguments * sizeof(expression_t*);
+	call_arguments_t *arguments = allocate_ast(size);
+	arguments->n_arguments      = n_arguments;
+	return arguments;
+}
+
 static size_t get_statement_struct_size(statement_kind_t kind)
 {
 	static const size_t sizes[] = {
@@ -123,11 +192,12 @@ static size_t get_statement_struct_size(statement_kind_t kind)
 	return sizes[kind];
 };
 
-static statement_t *allocate_statement(statement_kind_t kind)
+statement_t *allocate_statement(statement_kind_t kind)
 {
 	size_t       size      = get_statement_struct_size(kind);
 	statement_t *statement = allocate_ast_zero(size);
 	statement->kind        = kind;
+	mem_report_count_statement(kind);
 	return statement;
 }
 
@@ -161,43 +231,63 @@ type_t *allocate_type(type_kind_t kind)
 	return type;
 }
 
+/** the position of the current token */
+static source_position_t current_position(void)
+{
+	return make_source_position(parser->lexer.input_name,
+	                            parser->lexer.linenr);
+}
+
 void next_token(void)
 {
-	lexer_next_token(&token);
+	if (parser->tokens != NULL) {
+		const lexed_token_t *lexed = &parser->tokens[parser->next_lexed];
+		/* stay at the final T_EOF like the lexer does */
+		if (lexed->token.type != T_EOF)
+			++parser->next_lexed;
+		parser->token        = lexed->token;
+		parser->lexer.linenr = lexed->linenr;
+	} else {
+		lexer_next_token(&parser->lexer, &parser->token);
+	}
+	if (update_plugin_globals) {
+		token           = parser->token;
+		source_position = current_position();
+	}
 
 #ifdef PRINT_TOKENS
-	print_token(stderr, &token);
+	print_token(stderr, &parser->token);
 	fprintf(stderr, "\n");
 #endif
 }
 
 static void replace_token_type(token_type_t type)
 {
-	token.type = type;
+	parser->token.type = type;
 }
 
 static inline void eat(token_type_t type)
 {
-	assert(token.type == type);
+	assert(parser->token.type == type);
 	next_token();
 }
 
 static void add_anchor_token(token_type_t token_type)
 {
 	assert(token_type < T_LAST_TOKEN);
-	++token_anchor_set[token_type];
+	++parser->token_anchor_set[token_type];
 }
 
 static void rem_anchor_token(token_type_t token_type)
 {
 	assert(token_type < T_LAST_TOKEN);
-	assert(token_anchor_set[token_type] != 0);
-	--token_anchor_set[token_type];
+	assert(parser->token_anchor_set[token_type] != 0);
+	--parser->token_anchor_set[token_type];
 }
 
 static inline void parser_found_error(void)
 {
-	error = 1;
+	parser->error = 1;
 #ifdef ABORT_ON_ERROR
 	abort();
 #endif
@@ -205,32 +295,35 @@ static inline void parser_found_error(void)
 
 void parser_print_error_prefix(void)
 {
-	fputs(source_position.input_name, stderr);
-	fputc(':', stderr);
-	fprintf(stderr, "%d", source_position.linenr);
-	fputs(": error: ", stderr);
+	FILE *errors = parser->lexer.errors;
+
+	fputs(parser->lexer.input_name, errors);
+	fputc(':', errors);
+	fprintf(errors, "%d", parser->lexer.linenr);
+	fputs(": error: ", errors);
 	parser_found_error();
 }
 
 static void parse_error(const char *message)
 {
 	parser_print_error_prefix();
-	fprintf(stderr, "parse error: %s\n", message);
+	fprintf(parser->lexer.errors, "parse error: %s\n", message);
 }
 
 static void parse_error_expected(const char *message, ...)
 {
+	FILE   *errors = parser->lexer.errors;
 	va_list args;
-	int first = 1;
+	int     first  = 1;
 
 	if (message != NULL) {
 		parser_print_error_prefix();
-		fprintf(stderr, "%s\n", message);
+		fprintf(errors, "%s\n", message);
 	}
 	parser_print_error_prefix();
-	fputs("Parse error: got ", stderr);
-	print_token(stderr, &token);
-	fputs(", expected ", stderr);
+	fputs("Parse error: got ", errors);
+	print_token(errors, &parser->token);
+	fputs(", expected ", errors);
 
 	va_start(args, message);
 	token_type_t token_type = va_arg(args, token_type_t);
@@ -238,13 +331,13 @@ static void parse_error_expected(const char *message, ...)
 		if (first == 1) {
 			first = 0;
 		} else {
-			fprintf(stderr, ", ");
+			fprintf(errors, ", ");
 		}
-		print_token_type(stderr, token_type);
+		print_token_type(errors, token_type);
 		token_type = va_arg(args, token_type_t);
 	}
 	va_end(args);
-	fprintf(stderr, "\n");
+	fprintf(errors, "\n");
 }
 
 /**
@@ -252,17 +345,17 @@ static void parse_error_expected(const char *message, ...)
  */
 static void maybe_eat_block(void)
 {
-	if (token.type != T_INDENT)
+	if (parser->token.type != T_INDENT)
 		return;
 	next_token();
 
 	unsigned indent = 1;
 	while (indent >= 1) {
-		if (token.type == T_INDENT) {
+		if (parser->token.type == T_INDENT) {
 			indent++;
-		} else if (token.type == T_DEDENT) {
+		} else if (parser->token.type == T_DEDENT) {
 			indent--;
-		} else if (token.type == T_EOF) {
+		} else if (parser->token.type == T_EOF) {
 			break;
 		}
 		next_token();
@@ -285,11 +378,11 @@ static void eat_until_matching_token(token_type_t type)
 	unsigned parenthesis_count = 0;
 	unsigned brace_count       = 0;
 	unsigned bracket_count     = 0;
-	while (token.type        != end_token ||
+	while (parser->token.type        != end_token ||
 	       parenthesis_count != 0         ||
 	       brace_count       != 0         ||
 	       bracket_count     != 0) {
-		switch (token.type) {
+		switch (parser->token.type) {
 		case T_EOF: return;
 		case '(': ++parenthesis_count; break;
 		case '{': ++brace_count;       break;
@@ -309,7 +402,7 @@ static void eat_until_matching_token(token_type_t type)
 			if (bracket_count > 0)
 				--bracket_count;
 check_stop:
-			if (token.type        == end_token &&
+			if (parser->token.type        == end_token &&
 			    parenthesis_count == 0         &&
 			    brace_count       == 0         &&
 			    bracket_count     == 0)
@@ -328,12 +421,13 @@ check_stop:
  */
 static void eat_until_anchor(void)
 {
-	while (token_anchor_set[token.type] == 0) {
-		if (token.type == '(' || token.type == '{' || token.type == '[')
-			eat_until_matching_token(token.type);
-		if (token.type == ':') {
+	while (parser->token_anchor_set[parser->token.type] == 0) {
+		token_type_t type = parser->token.type;
+		if (type == '(' || type == '{' || type == '[')
+			eat_until_matching_token(type);
+		if (parser->token.type == ':') {
 			next_token();
-			if (!token_anchor_set[token.type] == 0) {
+			if (!parser->token_anchor_set[parser->token.type] == 0) {
 				maybe_eat_block();
 			}
 		} else {
@@ -344,11 +438,11 @@ static void eat_until_anchor(void)
 
 #define expect(expected, error_label)                      \
 	do {                                                   \
-		if (UNLIKELY(token.type != (expected))) {          \
+		if (UNLIKELY(parser->token.type != (expected))) {          \
 			parse_error_expected(NULL, (expected), 0);     \
 			add_anchor_token(expected);                    \
 			eat_until_anchor();                            \
-			if (token.type == expected)                    \
+			if (parser->token.type == expected)                    \
 				next_token();                              \
 			rem_anchor_token(expected);                    \
 			goto error_label;                              \
@@ -356,7 +450,7 @@ static void eat_until_anchor(void)
 		next_token();                                      \
 	} while (0)
 
-static void parse_function(function_t *function);
+static void parse_function(function_t *function, bool lazy_body);
 
 static statement_t *parse_block(void);
 
@@ -365,7 +459,7 @@ static void parse_parameter_declarations(function_type_t *function_type,
 
 static atomic_type_kind_t parse_unsigned_atomic_type(void)
 {
-	switch (token.type) {
+	switch (parser->token.type) {
 	case T_byte:
 		next_token();
 		return ATOMIC_TYPE_UBYTE;
@@ -374,7 +468,7 @@ static atomic_type_kind_t parse_unsigned_atomic_type(void)
 		return ATOMIC_TYPE_USHORT;
 	case T_long:
 		next_token();
-		if (token.type == T_long) {
+		if (parser->token.type == T_long) {
 			next_token();
 			return ATOMIC_TYPE_ULONGLONG;
 		}
@@ -391,7 +485,7 @@ static atomic_type_kind_t parse_unsigned_atomic_type(void)
 
 static atomic_type_kind_t parse_signed_atomic_type(void)
 {
-	switch (token.type) {
+	switch (parser->token.type) {
 	case T_bool:
 		next_token();
 		return ATOMIC_TYPE_BOOL;
@@ -403,7 +497,7 @@ static atomic_type_kind_t parse_signed_atomic_type(void)
 		return ATOMIC_TYPE_SHORT;
 	case T_long:
 		next_token();
-		if (token.type == T_long) {
+		if (parser->token.type == T_long) {
 			next_token();
 			return ATOMIC_TYPE_LONGLONG;
 		}
@@ -428,7 +522,7 @@ static type_t *parse_atomic_type(void)
 {
 	atomic_type_kind_t akind;
 
-	switch (token.type) {
+	switch (parser->token.type) {
 	case T_unsigned:
 		next_token();
 		akind = parse_unsigned_atomic_type();
@@ -465,7 +559,7 @@ static type_argument_t *parse_type_arguments(void)
 	type_argument_t *first_argument = parse_type_argument();
 	type_argument_t *last_argument  = first_argument;
 
-	while (token.type == ',') {
+	while (parser->token.type == ',') {
 		next_token();
 		type_argument_t *type_argument = parse_type_argument();
 
@@ -493,14 +587,14 @@ end_error:
 
 static type_t *parse_type_ref(void)
 {
-	assert(token.type == T_IDENTIFIER);
+	assert(parser->token.type == T_IDENTIFIER);
 
 	type_t *type = allocate_type(TYPE_REFERENCE);
-	type->reference.symbol          = token.v.symbol;
-	type->reference.source_position = source_position;
+	type->reference.symbol          = parser->token.v.symbol;
+	type->reference.source_position = current_position();
 	next_token();
 
-	if (token.type == '<') {
+	if (parser->token.type == '<') {
 		next_token();
 		add_anchor_token('>');
 		type->reference.type_arguments = parse_type_arguments();
@@ -537,17 +631,17 @@ static compound_entry_t *parse_compound_entries(void)
 {
 	compound_entry_t *result     = NULL;
 	compound_entry_t *last_entry = NULL;
-	while (token.type != T_DEDENT && token.type != T_EOF) {
+	while (parser->token.type != T_DEDENT && parser->token.type != T_EOF) {
 		compound_entry_t *entry = allocate_ast_zero(sizeof(entry[0]));
 
-		if (token.type != T_IDENTIFIER) {
+		if (parser->token.type != T_IDENTIFIER) {
 			parse_error_expected("Problem while parsing compound entry",
 								 T_IDENTIFIER, 0);
 			eat_until_matching_token(T_NEWLINE);
 			next_token();
 			continue;
 		}
-		entry->symbol = token.v.symbol;
+		entry->symbol = parser->token.v.symbol;
 		next_token();
 
 		expect(':', end_error);
@@ -584,7 +678,7 @@ static type_t *parse_union_type(void)
 
 	/* force end of statement */
 	rem_anchor_token(T_DEDENT);
-	assert(token.type == T_DEDENT);
+	assert(parser->token.type == T_DEDENT);
 	replace_token_type(T_NEWLINE);
 
 end_error:
@@ -607,7 +701,7 @@ static type_t *parse_struct_type(void)
 
 	/* force end of statement */
 	rem_anchor_token(T_DEDENT);
-	assert(token.type == T_DEDENT);
+	assert(parser->token.type == T_DEDENT);
 	replace_token_type(T_NEWLINE);
 
 end_error:
@@ -638,7 +732,7 @@ type_t *parse_type(void)
 {
 	type_t *type;
 
-	switch (token.type) {
+	switch (parser->token.type) {
 	case T_unsigned:
 	case T_signed:
 	case T_bool:
@@ -674,16 +768,16 @@ type_t *parse_type(void)
 		break;
 	default:
 		parser_print_error_prefix();
-		fprintf(stderr, "Token ");
-		print_token(stderr, &token);
-		fprintf(stderr, " doesn't start a type\n");
+		fprintf(parser->lexer.errors, "Token ");
+		print_token(parser->lexer.errors, &parser->token);
+		fprintf(parser->lexer.errors, " doesn't start a type\n");
 		type = type_invalid;
 		break;
 	}
 
 	/* parse type modifiers */
 	while (true) {
-		switch (token.type) {
+		switch (parser->token.type) {
 		case '*': {
 			next_token();
 			type = make_pointer_type_no_hash(type);
@@ -716,7 +810,7 @@ end_error:
 static expression_t *parse_string_const(void)
 {
 	expression_t *expression       = allocate_expression(EXPR_STRING_CONST);
-	expression->string_const.value = token.v.string;
+	expression->string_const.value = parser->token.v.string;
 	next_token();
 
 	return expression;
@@ -725,7 +819,7 @@ static expression_t *parse_string_const(void)
 static expression_t *parse_int_const(void)
 {
 	expression_t *expression    = allocate_expression(EXPR_INT_CONST);
-	expression->int_const.value = token.v.intvalue;
+	expression->int_const.value = parser->token.v.intvalue;
 	next_token();
 
 	return expression;
@@ -762,7 +856,7 @@ static expression_t *parse_func_expression(void)
 {
 	eat(T_func);
 	expression_t *expression = allocate_expression(EXPR_FUNC);
-	parse_function(&expression->func.function);
+	parse_function(&expression->func.function, false);
 
 	return expression;
 }
@@ -770,10 +864,10 @@ static expression_t *parse_func_expression(void)
 static expression_t *parse_reference(void)
 {
 	expression_t *expression     = allocate_expression(EXPR_REFERENCE);
-	expression->reference.symbol = token.v.symbol;
+	expression->reference.symbol = parser->token.v.symbol;
 	next_token();
 
-	if (token.type == T_TYPESTART) {
+	if (parser->token.type == T_TYPESTART) {
 		next_token();
 		add_anchor_token('>');
 		expression->reference.type_arguments = parse_type_arguments();
@@ -797,7 +891,7 @@ static expression_t *parse_sizeof(void)
 	eat(T_sizeof);
 	expression_t *expression = allocate_expression(EXPR_SIZEOF);
 
-	if (token.type == '(') {
+	if (parser->token.type == '(') {
 		next_token();
 		type_t *type = allocate_type(TYPE_TYPEOF);
 		add_anchor_token(')');
@@ -924,9 +1018,9 @@ void register_expression_infix_parser(parse_expression_infix_function parser,
 static expression_t *expected_expression_error(void)
 {
 	parser_print_error_prefix();
-	fprintf(stderr, "expected expression, got token ");
-	print_token(stderr, & token);
-	fprintf(stderr, "\n");
+	fprintf(parser->lexer.errors, "expected expression, got token ");
+	print_token(parser->lexer.errors, & parser->token);
+	fprintf(parser->lexer.errors, "\n");
 
 	return create_error_expression();
 }
@@ -971,25 +1065,31 @@ static expression_t *parse_call_expression(expression_t *left)
 	add_anchor_token(')');
 	add_anchor_token(',');
 
-	if (token.type != ')') {
-		call_argument_t *last_argument = NULL;
+	/* the arguments of nested calls are pushed on top of ours, so ours are
+	 * the last ones when we are done */
+	if (parser->argument_stack == NULL)
+		parser->argument_stack = NEW_ARR_F(expression_t*, 0);
+	size_t first = ARR_LEN(parser->argument_stack);
 
+	if (parser->token.type != ')') {
 		while (true) {
-			call_argument_t *argument = allocate_ast_zero(sizeof(argument[0]));
+			expression_t *argument = parse_expression();
+			ARR_APP1(expression_t*, parser->argument_stack, argument);
 
-			argument->expression = parse_expression();
-			if (last_argument == NULL) {
-				expression->call.arguments = argument;
-			} else {
-				last_argument->next = argument;
-			}
-			last_argument = argument;
-
-			if (token.type != ',')
+			if (parser->token.type != ',')
 				break;
 			next_token();
 		}
 	}
+
+	size_t            n_arguments = ARR_LEN(parser->argument_stack) - first;
+	call_arguments_t *arguments
+		= allocate_call_arguments((unsigned) n_arguments);
+	memcpy(arguments->arguments, &parser->argument_stack[first],
+	       n_arguments * sizeof(arguments->arguments[0]));
+	ARR_SHRINKLEN(parser->argument_stack, first);
+	expression->call.arguments = arguments;
+
 	rem_anchor_token(',');
 	rem_anchor_token(')');
 	expect(')', end_error);
@@ -1004,12 +1104,12 @@ static expression_t *parse_select_expression(expression_t *compound)
 	expression_t *expression    = allocate_expression(EXPR_SELECT);
 	expression->select.compound = compound;
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing compound select",
 		                     T_IDENTIFIER, 0);
 		return NULL;
 	}
-	expression->select.symbol = token.v.symbol;
+	expression->select.symbol = parser->token.v.symbol;
 	next_token();
 
 	return expression;
@@ -1022,7 +1122,7 @@ static expression_t *parse_array_expression(expression_t *array_ref)
 	expression->array_access.array_ref = array_ref;
 	expression->array_access.index     = parse_expression();
 
-	if (token.type != ']') {
+	if (parser->token.type != ']') {
 		parse_error_expected("Problem while parsing array access", ']', 0);
 		return NULL;
 	}
@@ -1136,17 +1236,17 @@ static void register_expression_parsers(void)
 
 expression_t *parse_sub_expression(unsigned precedence)
 {
-	if (token.type == T_ERROR) {
+	if (parser->token.type == T_ERROR) {
 		return expected_expression_error();
 	}
 
-	expression_parse_function_t *parser
-		= & expression_parsers[token.type];
-	source_position_t  start = source_position;
+	expression_parse_function_t *entry
+		= & expression_parsers[parser->token.type];
+	source_position_t  start = current_position();
 	expression_t      *left;
 
-	if (parser->parser != NULL) {
-		left = parser->parser();
+	if (entry->parser != NULL) {
+		left = entry->parser();
 	} else {
 		left = expected_expression_error();
 	}
@@ -1154,17 +1254,17 @@ expression_t *parse_sub_expression(unsigned precedence)
 	left->base.source_position = start;
 
 	while (true) {
-		if (token.type == T_ERROR) {
+		if (parser->token.type == T_ERROR) {
 			return expected_expression_error();
 		}
 
-		parser = &expression_parsers[token.type];
-		if (parser->infix_parser == NULL)
+		entry = &expression_parsers[parser->token.type];
+		if (entry->infix_parser == NULL)
 			break;
-		if (parser->infix_precedence < precedence)
+		if (entry->infix_precedence < precedence)
 			break;
 
-		left = parser->infix_parser(left);
+		left = entry->infix_parser(left);
 		assert(left != NULL);
 		left->base.source_position = start;
 	}
@@ -1182,7 +1282,7 @@ static statement_t *parse_return_statement(void)
 	eat(T_return);
 
 	statement_t *return_statement = allocate_statement(STATEMENT_RETURN);
-	if (token.type != T_NEWLINE) {
+	if (parser->token.type != T_NEWLINE) {
 		return_statement->returns.value = parse_expression();
 	}
 	expect(T_NEWLINE, end_error);
@@ -1201,13 +1301,13 @@ static statement_t *parse_goto_statement(void)
 	eat(T_goto);
 
 	statement_t *goto_statement = allocate_statement(STATEMENT_GOTO);
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("problem while parsing goto statement",
 		                     T_IDENTIFIER, 0);
 		eat_until_anchor();
 		goto end_error;
 	}
-	goto_statement->gotos.label_symbol = token.v.symbol;
+	goto_statement->gotos.label_symbol = parser->token.v.symbol;
 	next_token();
 
 	expect(T_NEWLINE, end_error);
@@ -1223,14 +1323,14 @@ static statement_t *parse_label_statement(void)
 	eat(':');
 
 	statement_t *label = allocate_statement(STATEMENT_LABEL);
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("problem while parsing label", T_IDENTIFIER, 0);
 		eat_until_anchor();
 		goto end_error;
 	}
 	label->label.label.base.kind            = ENTITY_LABEL;
-	label->label.label.base.source_position = source_position;
-	label->label.label.base.symbol          = token.v.symbol;
+	label->label.label.base.source_position = current_position();
+	label->label.label.base.symbol          = parser->token.v.symbol;
 	next_token();
 
 	add_entity((entity_t*) &label->label.label);
@@ -1245,12 +1345,12 @@ end_error:
 
 static statement_t *parse_sub_block(void)
 {
-	if (token.type != T_NEWLINE) {
+	if (parser->token.type != T_NEWLINE) {
 		return parse_statement();
 	}
 	eat(T_NEWLINE);
 
-	if (token.type != T_INDENT) {
+	if (parser->token.type != T_INDENT) {
 		/* create an empty block */
 		statement_t *block = allocate_statement(STATEMENT_BLOCK);
 		return block;
@@ -1268,9 +1368,9 @@ static statement_t *parse_if_statement(void)
 
 	statement_t *true_statement  = parse_sub_block();
 	statement_t *false_statement = NULL;
-	if (token.type == T_else) {
+	if (parser->token.type == T_else) {
 		next_token();
-		if (token.type == ':')
+		if (parser->token.type == ':')
 			next_token();
 		false_statement = parse_sub_block();
 	}
@@ -1292,7 +1392,7 @@ static statement_t *parse_initial_assignment(symbol_t *symbol)
 	expression->reference.symbol = symbol;
 
 	expression_t *assign         = allocate_expression(EXPR_BINARY_ASSIGN);
-	assign->base.source_position = source_position;
+	assign->base.source_position = current_position();
 	assign->binary.left          = expression;
 	assign->binary.right         = parse_expression();
 
@@ -1309,7 +1409,7 @@ static statement_t *parse_variable_declaration(void)
 	eat(T_var);
 
 	while (true) {
-		if (token.type != T_IDENTIFIER) {
+		if (parser->token.type != T_IDENTIFIER) {
 			parse_error_expected("problem while parsing variable declaration",
 			                     T_IDENTIFIER, 0);
 			eat_until_anchor();
@@ -1319,15 +1419,15 @@ static statement_t *parse_variable_declaration(void)
 		statement_t *statement = allocate_statement(STATEMENT_DECLARATION);
 
 		entity_t *entity = (entity_t*) &statement->declaration.entity;
-		symbol_t *symbol = token.v.symbol;
+		symbol_t *symbol = parser->token.v.symbol;
 		entity->base.kind            = ENTITY_VARIABLE;
-		entity->base.source_position = source_position;
+		entity->base.source_position = current_position();
 		entity->base.symbol          = symbol;
 		next_token();
 
 		add_entity(entity);
 
-		if (token.type == ':') {
+		if (parser->token.type == ':') {
 			next_token();
 			entity->variable.type = parse_type();
 		}
@@ -1341,7 +1441,7 @@ static statement_t *parse_variable_declaration(void)
 		last_statement = statement;
 
 		/* do we have an assignment expression? */
-		if (token.type == '=') {
+		if (parser->token.type == '=') {
 			next_token();
 			statement_t *assign = parse_initial_assignment(symbol);
 
@@ -1350,7 +1450,7 @@ static statement_t *parse_variable_declaration(void)
 		}
 
 		/* check if we have more declared symbols separated by ',' */
-		if (token.type != ',')
+		if (parser->token.type != ',')
 			break;
 		next_token();
 	}
@@ -1375,7 +1475,7 @@ static statement_t *parse_newline(void)
 {
 	eat(T_NEWLINE);
 
-	if (token.type == T_INDENT)
+	if (parser->token.type == T_INDENT)
 		return parse_block();
 
 	return NULL;
@@ -1395,19 +1495,19 @@ static void register_statement_parsers(void)
 statement_t *parse_statement(void)
 {
 	statement_t       *statement = NULL;
-	source_position_t  start     = source_position;
+	source_position_t  start     = current_position();
 
-	parse_statement_function parser = NULL;
-	if (token.type < ARR_LEN(statement_parsers))
-		parser = statement_parsers[token.type];
+	parse_statement_function statement_parser = NULL;
+	if (parser->token.type < ARR_LEN(statement_parsers))
+		statement_parser = statement_parsers[parser->token.type];
 
 	add_anchor_token(T_NEWLINE);
-	if (parser != NULL) {
-		statement = parser();
+	if (statement_parser != NULL) {
+		statement = statement_parser();
 	} else {
 		parse_declaration_function declaration_parser = NULL;
-		if (token.type < ARR_LEN(declaration_parsers))
-			declaration_parser = declaration_parsers[token.type];
+		if (parser->token.type < ARR_LEN(declaration_parsers))
+			declaration_parser = declaration_parsers[parser->token.type];
 
 		if (declaration_parser != NULL) {
 			declaration_parser();
@@ -1436,13 +1536,13 @@ static statement_t *parse_block(void)
 
 	statement_t *block_statement = allocate_statement(STATEMENT_BLOCK);
 
-	context_t *last_context = current_context;
-	current_context         = &block_statement->block.context;
+	context_t *last_context = parser->current_context;
+	parser->current_context         = &block_statement->block.context;
 
 	add_anchor_token(T_DEDENT);
 
 	statement_t *last_statement = NULL;
-	while (token.type != T_DEDENT) {
+	while (parser->token.type != T_DEDENT) {
 		/* parse statement */
 		statement_t *statement = parse_statement();
 		if (statement == NULL)
@@ -1459,10 +1559,10 @@ static statement_t *parse_block(void)
 			last_statement = last_statement->base.next;
 	}
 
-	assert(current_context == &block_statement->block.context);
-	current_context = last_context;
+	assert(parser->current_context == &block_statement->block.context);
+	parser->current_context = last_context;
 
-	block_statement->block.end_position = source_position;
+	block_statement->block.end_position = current_position();
 	rem_anchor_token(T_DEDENT);
 	expect(T_DEDENT, end_error);
 
@@ -1481,7 +1581,7 @@ static void parse_parameter_declarations(function_type_t *function_type,
 		*parameters = NULL;
 
 	expect('(', end_error2);
-	if (token.type == ')') {
+	if (parser->token.type == ')') {
 		next_token();
 		return;
 	}
@@ -1489,11 +1589,11 @@ static void parse_parameter_declarations(function_type_t *function_type,
 	add_anchor_token(')');
 	add_anchor_token(',');
 	while (true) {
-		if (token.type == T_DOTDOTDOT) {
+		if (parser->token.type == T_DOTDOTDOT) {
 			function_type->variable_arguments = 1;
 			next_token();
 
-			if (token.type == ',') {
+			if (parser->token.type == ',') {
 				parse_error("'...' has to be the last argument in a function "
 				            "parameter list");
 				eat_until_anchor();
@@ -1502,13 +1602,13 @@ static void parse_parameter_declarations(function_type_t *function_type,
 			break;
 		}
 
-		if (token.type != T_IDENTIFIER) {
+		if (parser->token.type != T_IDENTIFIER) {
 			parse_error_expected("problem while parsing parameter",
 			                     T_IDENTIFIER, 0);
 			eat_until_anchor();
 			goto end_error;
 		}
-		symbol_t *symbol = token.v.symbol;
+		symbol_t *symbol = parser->token.v.symbol;
 		next_token();
 
 		expect(':', end_error);
@@ -1528,7 +1628,7 @@ static void parse_parameter_declarations(function_type_t *function_type,
 			entity_t *entity = allocate_entity(ENTITY_FUNCTION_PARAMETER);
 			entity->base.kind            = ENTITY_FUNCTION_PARAMETER;
 			entity->base.symbol          = symbol;
-			entity->base.source_position = source_position;
+			entity->base.source_position = current_position();
 			entity->parameter.type       = param_type->type;
 
 			if (last_parameter != NULL) {
@@ -1539,7 +1639,7 @@ static void parse_parameter_declarations(function_type_t *function_type,
 			last_parameter = &entity->parameter;
 		}
 
-		if (token.type != ',')
+		if (parser->token.type != ',')
 			break;
 		next_token();
 	}
@@ -1562,11 +1662,11 @@ static type_constraint_t *parse_type_constraints(void)
 	type_constraint_t *first_constraint = NULL;
 	type_constraint_t *last_constraint  = NULL;
 
-	while (token.type == T_IDENTIFIER) {
+	while (parser->token.type == T_IDENTIFIER) {
 		type_constraint_t *constraint
 			= allocate_ast_zero(sizeof(constraint[0]));
 
-		constraint->concept_symbol = token.v.symbol;
+		constraint->concept_symbol = parser->token.v.symbol;
 		next_token();
 
 		if (last_constraint == NULL) {
@@ -1584,17 +1684,17 @@ static entity_t *parse_type_parameter(void)
 {
 	entity_t *entity = allocate_entity(ENTITY_TYPE_VARIABLE);
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("problem while parsing type parameter",
 		                     T_IDENTIFIER, 0);
 		eat_until_anchor();
 		return NULL;
 	}
-	entity->base.source_position = source_position;
-	entity->base.symbol          = token.v.symbol;
+	entity->base.source_position = current_position();
+	entity->base.symbol          = parser->token.v.symbol;
 	next_token();
 
-	if (token.type == ':') {
+	if (parser->token.type == ':') {
 		next_token();
 		entity->type_variable.constraints = parse_type_constraints();
 	}
@@ -1621,7 +1721,7 @@ static type_variable_t *parse_type_parameters(context_t *context)
 			context->entities        = type_variable;
 		}
 
-		if (token.type != ',')
+		if (parser->token.type != ',')
 			break;
 		next_token();
 	}
@@ -1632,24 +1732,72 @@ static type_variable_t *parse_type_parameters(context_t *context)
 void add_entity(entity_t *entity)
 {
 	assert(entity != NULL);
-	assert(entity->base.source_position.input_name != NULL);
-	assert(current_context != NULL);
+	assert(entity->base.source_position != NO_SOURCE_POSITION);
+	assert(parser->current_context != NULL);
+
+	entity->base.next         = parser->current_context->entities;
+	parser->current_context->entities = entity;
+}
+
+/**
+ * Skips a function body (NEWLINE INDENT ... DEDENT) and stores its tokens in
+ * @p function to be parsed by parse_lazy_body().
+ */
+static void skip_function_body(function_t *function)
+{
+	lexed_token_t *tokens = parser->lazy_tokens;
+	if (tokens == NULL) {
+		tokens = NEW_ARR_F(lexed_token_t, 0);
+	} else {
+		ARR_SHRINKLEN(tokens, 0);
+	}
+
+	unsigned depth = 0;
+	do {
+		lexed_token_t lexed;
+		lexed.token  = parser->token;
+		lexed.linenr = parser->lexer.linenr;
+		ARR_APP1(lexed_token_t, tokens, lexed);
+
+		if (parser->token.type == T_EOF)
+			break;
+		if (parser->token.type == T_INDENT) {
+			++depth;
+		} else if (parser->token.type == T_DEDENT) {
+			--depth;
+		}
+		next_token();
+	} while (depth > 0 || parser->token.type == T_INDENT);
+
+	size_t n_tokens = ARR_LEN(tokens);
+	if (tokens[n_tokens - 1].token.type != T_EOF) {
+		lexed_token_t eof;
+		memset(&eof, 0, sizeof(eof));
+		eof.token.type = T_EOF;
+		eof.linenr     = parser->lexer.linenr;
+		ARR_APP1(lexed_token_t, tokens, eof);
+		++n_tokens;
+	}
+	parser->lazy_tokens = tokens;
 
-	entity->base.next         = current_context->entities;
-	current_context->entities = entity;
+	lazy_body_t *lazy_body = allocate_ast_zero(sizeof(lazy_body[0]));
+	lazy_body->tokens      = allocate_ast(n_tokens * sizeof(tokens[0]));
+	memcpy(lazy_body->tokens, tokens, n_tokens * sizeof(tokens[0]));
+	lazy_body->input_name  = parser->lexer.input_name;
+	function->lazy_body    = lazy_body;
 }
 
-static void parse_function(function_t *function)
+static void parse_function(function_t *function, bool lazy_body)
 {
 	type_t *type = allocate_type(TYPE_FUNCTION);
 
-	context_t *last_context = current_context;
-	current_context         = &function->context;
+	context_t *last_context = parser->current_context;
+	parser->current_context         = &function->context;
 
-	if (token.type == '<') {
+	if (parser->token.type == '<') {
 		next_token();
 		add_anchor_token('>');
-		function->type_parameters = parse_type_parameters(current_context);
+		function->type_parameters = parse_type_parameters(parser->current_context);
 		rem_anchor_token('>');
 		expect('>', end_error);
 	}
@@ -1664,26 +1812,34 @@ static void parse_function(function_t *function)
 	}
 
 	type->function.result_type = type_void;
-	if (token.type == ':') {
+	if (parser->token.type == ':') {
 		next_token();
-		if (token.type == T_NEWLINE) {
-			function->statement = parse_sub_block();
+		if (parser->token.type == T_NEWLINE) {
+			if (lazy_body) {
+				skip_function_body(function);
+			} else {
+				function->statement = parse_sub_block();
+			}
 			goto function_parser_end;
 		}
 
 		type->function.result_type = parse_type();
 
-		if (token.type == ':') {
+		if (parser->token.type == ':') {
 			next_token();
-			function->statement = parse_sub_block();
+			if (lazy_body && parser->token.type == T_NEWLINE) {
+				skip_function_body(function);
+			} else {
+				function->statement = parse_sub_block();
+			}
 			goto function_parser_end;
 		}
 	}
 	expect(T_NEWLINE, end_error);
 
 function_parser_end:
-	assert(current_context == &function->context);
-	current_context = last_context;
+	assert(parser->current_context == &function->context);
+	parser->current_context = last_context;
 
 end_error:
 	;
@@ -1695,22 +1851,25 @@ static void parse_function_declaration(void)
 
 	entity_t *declaration = allocate_entity(ENTITY_FUNCTION);
 
-	if (token.type == T_extern) {
+	if (parser->token.type == T_extern) {
 		declaration->function.function.is_extern = true;
 		next_token();
 	}
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing function",
 		                     T_IDENTIFIER, 0);
 		eat_until_anchor();
 		return;
 	}
-	declaration->base.source_position = source_position;
-	declaration->base.symbol          = token.v.symbol;
+	declaration->base.source_position = current_position();
+	declaration->base.symbol          = parser->token.v.symbol;
 	next_token();
 
-	parse_function(&declaration->function.function);
+	/* bodies of nested functions are part of the body around them */
+	bool lazy_body = lazy_bodies
+	                 && parser->current_context == &parser->file_context;
+	parse_function(&declaration->function.function, lazy_body);
 
 	add_entity(declaration);
 }
@@ -1722,23 +1881,23 @@ static void parse_global_variable(void)
 	entity_t *declaration = allocate_entity(ENTITY_VARIABLE);
 	declaration->variable.is_global = true;
 
-	if (token.type == T_extern) {
+	if (parser->token.type == T_extern) {
 		next_token();
 		declaration->variable.is_extern = true;
 	}
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing global variable",
 		                     T_IDENTIFIER, 0);
 		eat_until_anchor();
 		return;
 	}
 
-	declaration->base.source_position = source_position;
-	declaration->base.symbol          = token.v.symbol;
+	declaration->base.source_position = current_position();
+	declaration->base.symbol          = parser->token.v.symbol;
 	next_token();
 
-	if (token.type != ':') {
+	if (parser->token.type != ':') {
 		parse_error_expected("global variables must have a type specified",
 		                     ':', 0);
 		eat_until_anchor();
@@ -1758,16 +1917,16 @@ static void parse_constant(void)
 
 	entity_t *declaration = allocate_entity(ENTITY_CONSTANT);
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing constant", T_IDENTIFIER, 0);
 		eat_until_anchor();
 		return;
 	}
-	declaration->base.source_position = source_position;
-	declaration->base.symbol          = token.v.symbol;
+	declaration->base.source_position = current_position();
+	declaration->base.symbol          = parser->token.v.symbol;
 	next_token();
 
-	if (token.type == ':') {
+	if (parser->token.type == ':') {
 		next_token();
 		declaration->constant.type = parse_type();
 	}
@@ -1787,14 +1946,14 @@ static void parse_typealias(void)
 
 	entity_t *declaration = allocate_entity(ENTITY_TYPEALIAS);
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing typealias",
 		                     T_IDENTIFIER, 0);
 		eat_until_anchor();
 		return;
 	}
-	declaration->base.source_position = source_position;
-	declaration->base.symbol          = token.v.symbol;
+	declaration->base.source_position = current_position();
+	declaration->base.symbol          = parser->token.v.symbol;
 	next_token();
 
 	expect('=', end_error);
@@ -1811,24 +1970,24 @@ static attribute_t *parse_attribute(void)
 
 	attribute_t *attribute = NULL;
 
-	if (token.type == T_ERROR) {
+	if (parser->token.type == T_ERROR) {
 		parse_error("problem while parsing attribute");
 		return NULL;
 	}
 
-	parse_attribute_function parser = NULL;
-	if (token.type < ARR_LEN(attribute_parsers))
-		parser = attribute_parsers[token.type];
+	parse_attribute_function attribute_parser = NULL;
+	if (parser->token.type < ARR_LEN(attribute_parsers))
+		attribute_parser = attribute_parsers[parser->token.type];
 
-	if (parser == NULL) {
+	if (attribute_parser == NULL) {
 		parser_print_error_prefix();
-		print_token(stderr, &token);
-		fprintf(stderr, " doesn't start a known attribute type\n");
+		print_token(parser->lexer.errors, &parser->token);
+		fprintf(parser->lexer.errors, " doesn't start a known attribute type\n");
 		return NULL;
 	}
 
-	if (parser != NULL) {
-		attribute = parser();
+	if (attribute_parser != NULL) {
+		attribute = attribute_parser();
 	}
 
 	return attribute;
@@ -1838,7 +1997,7 @@ attribute_t *parse_attributes(void)
 {
 	attribute_t *last = NULL;
 
-	while (token.type == '$') {
+	while (parser->token.type == '$') {
 		attribute_t *attribute = parse_attribute();
 		if (attribute != NULL) {
 			attribute->next = last;
@@ -1855,20 +2014,20 @@ static void parse_struct(void)
 
 	entity_t *declaration = allocate_entity(ENTITY_TYPEALIAS);
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing struct",
 		                     T_IDENTIFIER, 0);
 		eat_until_anchor();
 		return;
 	}
-	declaration->base.source_position = source_position;
-	declaration->base.symbol          = token.v.symbol;
+	declaration->base.source_position = current_position();
+	declaration->base.symbol          = parser->token.v.symbol;
 	next_token();
 
 	type_t *type = allocate_type(TYPE_COMPOUND_STRUCT);
 	type->compound.symbol = declaration->base.symbol;
 
-	if (token.type == '<') {
+	if (parser->token.type == '<') {
 		next_token();
 		type->compound.type_parameters
 			= parse_type_parameters(&type->compound.context);
@@ -1882,7 +2041,7 @@ static void parse_struct(void)
 	expect(':', end_error);
 	expect(T_NEWLINE, end_error);
 
-	if (token.type == T_INDENT) {
+	if (parser->token.type == T_INDENT) {
 		next_token();
 		type->compound.entries = parse_compound_entries();
 		eat(T_DEDENT);
@@ -1900,14 +2059,14 @@ static void parse_union(void)
 
 	entity_t *declaration = allocate_entity(ENTITY_TYPEALIAS);
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing union",
 		                     T_IDENTIFIER, 0);
 		eat_until_anchor();
 		return;
 	}
-	declaration->base.source_position = source_position;
-	declaration->base.symbol          = token.v.symbol;
+	declaration->base.source_position = current_position();
+	declaration->base.symbol          = parser->token.v.symbol;
 	next_token();
 
 	type_t *type = allocate_type(TYPE_COMPOUND_UNION);
@@ -1919,7 +2078,7 @@ static void parse_union(void)
 	expect(':', end_error);
 	expect(T_NEWLINE, end_error);
 
-	if (token.type == T_INDENT) {
+	if (parser->token.type == T_INDENT) {
 		next_token();
 		type->compound.entries = parse_compound_entries();
 		eat(T_DEDENT);
@@ -1938,21 +2097,21 @@ static concept_function_t *parse_concept_function(void)
 
 	type_t *type = allocate_type(TYPE_FUNCTION);
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing concept function",
 		                     T_IDENTIFIER, 0);
 		eat_until_anchor();
 		goto end_error;
 	}
 
-	declaration->base.source_position = source_position;
-	declaration->base.symbol          = token.v.symbol;
+	declaration->base.source_position = current_position();
+	declaration->base.symbol          = parser->token.v.symbol;
 	next_token();
 
 	parse_parameter_declarations(&type->function,
 	                             &declaration->concept_function.parameters);
 
-	if (token.type == ':') {
+	if (parser->token.type == ':') {
 		next_token();
 		type->function.result_type = parse_type();
 	} else {
@@ -1976,18 +2135,18 @@ static void parse_concept(void)
 
 	entity_t *declaration = allocate_entity(ENTITY_CONCEPT);
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing concept",
 		                     T_IDENTIFIER, 0);
 		eat_until_anchor();
 		return;
 	}
 
-	declaration->base.source_position = source_position;
-	declaration->base.symbol          = token.v.symbol;
+	declaration->base.source_position = current_position();
+	declaration->base.symbol          = parser->token.v.symbol;
 	next_token();
 
-	if (token.type == '<') {
+	if (parser->token.type == '<') {
 		next_token();
 		context_t *context                   = &declaration->concept.context;
 		add_anchor_token('>');
@@ -1998,14 +2157,14 @@ static void parse_concept(void)
 	expect(':', end_error);
 	expect(T_NEWLINE, end_error);
 
-	if (token.type != T_INDENT) {
+	if (parser->token.type != T_INDENT) {
 		goto end_of_parse_concept;
 	}
 	next_token();
 
 	concept_function_t *last_function = NULL;
-	while (token.type != T_DEDENT) {
-		if (token.type == T_EOF) {
+	while (parser->token.type != T_DEDENT) {
+		if (parser->token.type == T_EOF) {
 			parse_error("EOF while parsing concept");
 			goto end_of_parse_concept;
 		}
@@ -2036,17 +2195,17 @@ static concept_function_instance_t *parse_concept_function_instance(void)
 		= allocate_ast_zero(sizeof(function_instance[0]));
 
 	expect(T_func, end_error);
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing concept function "
 		                     "instance", T_IDENTIFIER, 0);
 		eat_until_anchor();
 		goto end_error;
 	}
-	function_instance->source_position = source_position;
-	function_instance->symbol          = token.v.symbol;
+	function_instance->source_position = current_position();
+	function_instance->symbol          = parser->token.v.symbol;
 	next_token();
 
-	parse_function(&function_instance->function);
+	parse_function(&function_instance->function, false);
 	return function_instance;
 
 end_error:
@@ -2058,18 +2217,18 @@ static void parse_concept_instance(void)
 	eat(T_instance);
 
 	concept_instance_t *instance = allocate_ast_zero(sizeof(instance[0]));
-	instance->source_position    = source_position;
+	instance->source_position    = current_position();
 
-	if (token.type != T_IDENTIFIER) {
+	if (parser->token.type != T_IDENTIFIER) {
 		parse_error_expected("Problem while parsing concept instance",
 		                     T_IDENTIFIER, 0);
 		eat_until_anchor();
 		return;
 	}
-	instance->concept_symbol = token.v.symbol;
+	instance->concept_symbol = parser->token.v.symbol;
 	next_token();
 
-	if (token.type == '<') {
+	if (parser->token.type == '<') {
 		next_token();
 		instance->type_parameters
 			= parse_type_parameters(&instance->context);
@@ -2081,18 +2240,18 @@ static void parse_concept_instance(void)
 	expect(':', end_error);
 	expect(T_NEWLINE, end_error);
 
-	if (token.type != T_INDENT) {
+	if (parser->token.type != T_INDENT) {
 		goto add_instance;
 	}
 	eat(T_INDENT);
 
 	concept_function_instance_t *last_function = NULL;
-	while (token.type != T_DEDENT) {
-		if (token.type == T_EOF) {
+	while (parser->token.type != T_DEDENT) {
+		if (parser->token.type == T_EOF) {
 			parse_error("EOF while parsing concept instance");
 			return;
 		}
-		if (token.type == T_NEWLINE) {
+		if (parser->token.type == T_NEWLINE) {
 			next_token();
 			continue;
 		}
@@ -2111,9 +2270,10 @@ static void parse_concept_instance(void)
 	eat(T_DEDENT);
 
 add_instance:
-	assert(current_context != NULL);
-	instance->next                     = current_context->concept_instances;
-	current_context->concept_instances = instance;
+	context_t *context = parser->current_context;
+	assert(context != NULL);
+	instance->next             = context->concept_instances;
+	context->concept_instances = instance;
 	return;
 
 end_error:
@@ -2128,17 +2288,17 @@ static void skip_declaration(void)
 static void parse_import(void)
 {
 	eat(T_import);
-	if (token.type != T_STRING_LITERAL) {
+	if (parser->token.type != T_STRING_LITERAL) {
 		parse_error_expected("problem while parsing import directive",
 		                     T_STRING_LITERAL, 0);
 		eat_until_anchor();
 		return;
 	}
-	symbol_t *modulename = symbol_table_insert(token.v.string);
+	symbol_t *modulename = symbol_table_insert(parser->token.v.string);
 	next_token();
 
 	while (true) {
-		if (token.type != T_IDENTIFIER) {
+		if (parser->token.type != T_IDENTIFIER) {
 			parse_error_expected("problem while parsing import directive",
 			                     T_IDENTIFIER, 0);
 			eat_until_anchor();
@@ -2147,14 +2307,14 @@ static void parse_import(void)
 
 		import_t *import        = allocate_ast_zero(sizeof(import[0]));
 		import->module          = modulename;
-		import->symbol          = token.v.symbol;
-		import->source_position = source_position;
+		import->symbol          = parser->token.v.symbol;
+		import->source_position = current_position();
 
-		import->next = current_context->imports;
-		current_context->imports = import;
+		import->next = parser->current_context->imports;
+		parser->current_context->imports = import;
 		next_token();
 
-		if (token.type != ',')
+		if (parser->token.type != ',')
 			break;
 		eat(',');
 	}
@@ -2169,10 +2329,10 @@ static void parse_export(void)
 	eat(T_export);
 
 	while (true) {
-		if (token.type == T_NEWLINE) {
+		if (parser->token.type == T_NEWLINE) {
 			break;
 		}
-		if (token.type != T_IDENTIFIER) {
+		if (parser->token.type != T_IDENTIFIER) {
 			parse_error_expected("problem while parsing export directive",
 			                     T_IDENTIFIER, 0);
 			eat_until_anchor();
@@ -2180,15 +2340,15 @@ static void parse_export(void)
 		}
 
 		export_t *export        = allocate_ast_zero(sizeof(export[0]));
-		export->symbol          = token.v.symbol;
-		export->source_position = source_position;
+		export->symbol          = parser->token.v.symbol;
+		export->source_position = current_position();
 		next_token();
 
-		assert(current_context != NULL);
-		export->next             = current_context->exports;
-		current_context->exports = export;
+		assert(parser->current_context != NULL);
+		export->next             = parser->current_context->exports;
+		parser->current_context->exports = export;
 
-		if (token.type != ',') {
+		if (parser->token.type != ',') {
 			break;
 		}
 		next_token();
@@ -2204,20 +2364,22 @@ static void parse_module(void)
 	eat(T_module);
 
 	/* a simple URL string without a protocol */
-	if (token.type != T_STRING_LITERAL) {
+	if (parser->token.type != T_STRING_LITERAL) {
 		parse_error_expected("problem while parsing module", T_STRING_LITERAL, 0);
 		return;
 	}
 
-	symbol_t *new_module_name = symbol_table_insert(token.v.string);
+	symbol_t *new_module_name = symbol_table_insert(parser->token.v.string);
 	next_token();
 
-	if (current_module_name != NULL && current_module_name != new_module_name) {
+	if (parser->current_module_name != NULL
+			&& parser->current_module_name != new_module_name) {
 		parser_print_error_prefix();
-		fprintf(stderr, "new module name '%s' overrides old name '%s'\n",
-		        new_module_name->string, current_module_name->string);
+		fprintf(parser->lexer.errors,
+		        "new module name '%s' overrides old name '%s'\n",
+		        new_module_name->string, parser->current_module_name->string);
 	}
-	current_module_name = new_module_name;
+	parser->current_module_name = new_module_name;
 
 	expect(T_NEWLINE, end_error);
 
@@ -2227,10 +2389,10 @@ end_error:
 
 void parse_declaration(void)
 {
-	if (token.type == T_EOF)
+	if (parser->token.type == T_EOF)
 		return;
 
-	if (token.type == T_ERROR) {
+	if (parser->token.type == T_ERROR) {
 		/* this shouldn't happen if the lexer is correct... */
 		parse_error_expected("problem while parsing declaration",
 		                     T_DEDENT, 0);
@@ -2238,8 +2400,8 @@ void parse_declaration(void)
 	}
 
 	parse_declaration_function parse = NULL;
-	if (token.type < ARR_LEN(declaration_parsers))
-		parse = declaration_parsers[token.type];
+	if (parser->token.type < ARR_LEN(declaration_parsers))
+		parse = declaration_parsers[parser->token.type];
 
 	if (parse == NULL) {
 		parse_error_expected("Couldn't parse declaration",
@@ -2268,113 +2430,345 @@ static void register_declaration_parsers(void)
 	register_declaration_parser(skip_declaration,           T_NEWLINE);
 }
 
+module_t *find_module(symbol_t *name)
+{
+	module_t key;
+	key.name = name;
+	return module_set_find(&module_set, &key);
+}
+
 static module_t *get_module(symbol_t *name)
 {
 	if (name == NULL) {
 		name = symbol_table_insert("");
 	}
 
-	/* search for an existing module */
-	module_t *module = modules;
-	for ( ; module != NULL; module = module->next) {
-		if (module->name == name)
-			break;
-	}
+	module_t *module = find_module(name);
 	if (module == NULL) {
 		module       = allocate_ast_zero(sizeof(module[0]));
 		module->name = name;
 		module->next = modules;
 		modules      = module;
+		module_set_insert(&module_set, module);
 	}
 	return module;
 }
 
-static void append_context(context_t *dest, const context_t *source)
+/**
+ * Appends the lists of @p source to the ones of @p module. Only the new lists
+ * are walked, the module remembers where its lists end.
+ */
+static void append_context(module_t *module, const context_t *source)
 {
-	entity_t *last = dest->entities;
-	if (last != NULL) {
+	context_t *dest = &module->context;
+
+	if (source->entities != NULL) {
+		if (module->last_entity != NULL) {
+			module->last_entity->base.next = source->entities;
+		} else {
+			dest->entities = source->entities;
+		}
+		entity_t *last = source->entities;
 		while (last->base.next != NULL) {
 			last = last->base.next;
 		}
-		last->base.next = source->entities;
-	} else {
-		dest->entities = source->entities;
+		module->last_entity = last;
 	}
 
-	concept_instance_t *last_concept_instance = dest->concept_instances;
-	if (last_concept_instance != NULL) {
-		while (last_concept_instance->next != NULL) {
-			last_concept_instance = last_concept_instance->next;
+	if (source->concept_instances != NULL) {
+		if (module->last_concept_instance != NULL) {
+			module->last_concept_instance->next = source->concept_instances;
+		} else {
+			dest->concept_instances = source->concept_instances;
 		}
-		last_concept_instance->next = source->concept_instances;
-	} else {
-		dest->concept_instances = source->concept_instances;
+		concept_instance_t *last = source->concept_instances;
+		while (last->next != NULL) {
+			last = last->next;
+		}
+		module->last_concept_instance = last;
 	}
 
-	export_t *last_export = dest->exports;
-	if (last_export != NULL) {
-		while (last_export->next != NULL) {
-			last_export = last_export->next;
+	if (source->exports != NULL) {
+		if (module->last_export != NULL) {
+			module->last_export->next = source->exports;
+		} else {
+			dest->exports = source->exports;
 		}
-		last_export->next = source->exports;
-	} else {
-		dest->exports = source->exports;
+		export_t *last = source->exports;
+		while (last->next != NULL) {
+			last = last->next;
+		}
+		module->last_export = last;
 	}
 
-	import_t *last_import = dest->imports;
-	if (last_import != NULL) {
-		while (last_import->next != NULL) {
-			last_import = last_import->next;
+	if (source->imports != NULL) {
+		if (module->last_import != NULL) {
+			module->last_import->next = source->imports;
+		} else {
+			dest->imports = source->imports;
 		}
-		last_import->next = source->imports;
-	} else {
-		dest->imports = source->imports;
+		import_t *last = source->imports;
+		while (last->next != NULL) {
+			last = last->next;
+		}
+		module->last_import = last;
 	}
 }
 
-bool parse_file(FILE *in, const char *input_name)
+parser_t *parser_from_file(FILE *in, const char *input_name, FILE *errors)
 {
-	memset(token_anchor_set, 0, sizeof(token_anchor_set));
+	parser_t *new_parser = XMALLOCZ(parser_t);
 
 	/* get the lexer running */
-	input_t *input = input_from_stream(in, NULL);
-	lexer_init(input, input_name);
-	next_token();
+	input_t *input = input_from_file(in, NULL);
+	lexer_init(&new_parser->lexer, input, input_name, errors);
 
-	context_t file_context;
-	memset(&file_context, 0, sizeof(file_context));
+	return new_parser;
+}
 
-	assert(current_context == NULL);
-	current_context = &file_context;
+void parser_init_thread(void)
+{
+	struct obstack *obst = XMALLOC(struct obstack);
+	obstack_init(obst);
+	mem_report_add_obstack("parser threads", obst);
+	ast_obstack           = obst;
+	type_obst             = obst;
+	update_plugin_globals = false;
 
-	current_module_name = NULL;
+	pthread_mutex_lock(&thread_obstacks_lock);
+	ARR_APP1(struct obstack*, thread_obstacks, obst);
+	pthread_mutex_unlock(&thread_obstacks_lock);
+}
+
+static void *lex_thread(void *data)
+{
+	lex_queue_t *queue = (lex_queue_t*) data;
+	/* string literals are allocated on the AST obstack */
+	parser_init_thread();
+
+	for (;;) {
+		pthread_mutex_lock(&queue->lock);
+		size_t i = queue->next_chunk++;
+		pthread_mutex_unlock(&queue->lock);
+		if (i >= queue->n_chunks)
+			break;
+
+		lex_chunk_t *chunk = &queue->chunks[i];
+		chunk->stop = lexer_tokenize(&chunk->lexer, chunk->end, &chunk->tokens);
+	}
+	return NULL;
+}
+
+/**
+ * Puts the tokens of the chunks together in input order. A chunk is only used
+ * if the lexer before it stopped exactly at its beginning, otherwise (the
+ * beginning was inside a comment or string) that lexer continues. Returns
+ * NULL if a used lexer printed diagnostics.
+ */
+static lexed_token_t *join_lex_chunks(lex_chunk_t *chunks, size_t n_chunks)
+{
+	lex_chunk_t         *current = &chunks[0];
+	lexed_token_t       *tokens  = current->tokens;
+	const unsigned char *stop    = current->stop;
+	bool                 errors  = false;
+	current->tokens = NULL;
+
+	for (size_t i = 1; i < n_chunks && stop != NULL; ++i) {
+		lex_chunk_t *chunk = &chunks[i];
+		if (stop < chunk->begin)
+			stop = lexer_tokenize(&current->lexer, chunk->begin, &tokens);
+		if (stop != chunk->begin)
+			continue;
+
+		errors |= ftell(current->lexer.errors) != 0;
+		unsigned line_offset = current->lexer.linenr - 1;
+		for (size_t t = 0; t < ARR_LEN(chunk->tokens); ++t) {
+			lexed_token_t lexed = chunk->tokens[t];
+			lexed.linenr += line_offset;
+			ARR_APP1(lexed_token_t, tokens, lexed);
+		}
+		chunk->lexer.linenr += line_offset;
+
+		current = chunk;
+		stop    = chunk->stop;
+	}
+	if (stop != NULL)
+		lexer_tokenize(&current->lexer, NULL, &tokens);
+	errors |= ftell(current->lexer.errors) != 0;
+
+	if (errors) {
+		DEL_ARR_F(tokens);
+		return NULL;
+	}
+	return tokens;
+}
+
+bool parser_tokenize(parser_t *parser, unsigned n_threads)
+{
+	assert(parser->tokens == NULL);
+
+	const unsigned char **starts   = XMALLOCN(const unsigned char*, n_threads);
+	size_t                n_chunks = lexer_split(&parser->lexer, n_threads,
+	                                             starts);
+	if (n_chunks < 2) {
+		xfree(starts);
+		return false;
+	}
+
+	lex_chunk_t *chunks = XMALLOCNZ(lex_chunk_t, n_chunks);
+	for (size_t i = 0; i < n_chunks; ++i) {
+		lex_chunk_t *chunk = &chunks[i];
+		chunk->begin  = starts[i];
+		chunk->end    = i + 1 < n_chunks ? starts[i + 1] : NULL;
+		chunk->tokens = NEW_ARR_F(lexed_token_t, 0);
+		lexer_init_chunk(&chunk->lexer, &parser->lexer, chunk->begin);
+		/* diagnostics of chunks that turn out to be unusable are dropped */
+		chunk->lexer.errors = tmpfile();
+		if (chunk->lexer.errors == NULL)
+			panic("couldn't create temporary file");
+	}
+	xfree(starts);
+
+	lex_queue_t queue;
+	queue.chunks     = chunks;
+	queue.n_chunks   = n_chunks;
+	queue.next_chunk = 0;
+	pthread_mutex_init(&queue.lock, NULL);
+
+	symbol_table_set_locking(true);
+	pthread_t *threads = XMALLOCN(pthread_t, n_chunks);
+	for (size_t t = 0; t < n_chunks; ++t) {
+		if (pthread_create(&threads[t], NULL, lex_thread, &queue) != 0)
+			panic("couldn't create lexer thread");
+	}
+	for (size_t t = 0; t < n_chunks; ++t) {
+		pthread_join(threads[t], NULL);
+	}
+	xfree(threads);
+	symbol_table_set_locking(false);
+	pthread_mutex_destroy(&queue.lock);
+
+	parser->tokens     = join_lex_chunks(chunks, n_chunks);
+	parser->next_lexed = 0;
+
+	for (size_t i = 0; i < n_chunks; ++i) {
+		lex_chunk_t *chunk = &chunks[i];
+		fclose(chunk->lexer.errors);
+		lexer_destroy(&chunk->lexer);
+		if (chunk->tokens != NULL)
+			DEL_ARR_F(chunk->tokens);
+	}
+	xfree(chunks);
+
+	return parser->tokens != NULL;
+}
+
+void parser_free(parser_t *parser)
+{
+	if (parser->tokens != NULL)
+		DEL_ARR_F(parser->tokens);
+	if (parser->lazy_tokens != NULL)
+		DEL_ARR_F(parser->lazy_tokens);
+	if (parser->argument_stack != NULL)
+		DEL_ARR_F(parser->argument_stack);
+
+	input_t *input = parser->lexer.input;
+	lexer_destroy(&parser->lexer);
+	input_free(input);
+	xfree(parser);
+}
+
+bool parser_parse(parser_t *new_parser)
+{
+	parser_t *old_parser = parser;
+	parser = new_parser;
+
+	next_token();
+
+	assert(parser->current_context == NULL);
+	parser->current_context = &parser->file_context;
 
 	add_anchor_token(T_EOF);
-	while (token.type != T_EOF) {
+	while (parser->token.type != T_EOF) {
 		parse_declaration();
 	}
 	rem_anchor_token(T_EOF);
 
-	assert(current_context == &file_context);
-	current_context = NULL;
-
-	/* append stuff to module */
-	module_t *module = get_module(current_module_name);
-	append_context(&module->context, &file_context);
+	assert(parser->current_context == &parser->file_context);
+	parser->current_context = NULL;
 
 	/* check that we have matching rem_anchor_token calls for each add */
 #ifndef NDEBUG
 	for (int i = 0; i < T_LAST_TOKEN; ++i) {
-		if (token_anchor_set[i] > 0) {
+		if (parser->token_anchor_set[i] > 0) {
 			panic("leaked token");
 		}
 	}
 #endif
 
-	lexer_destroy();
-	input_free(input);
+	bool result = !parser->error;
+	parser = old_parser;
+	return result;
+}
+
+const context_t *parser_get_context(const parser_t *parser,
+                                    symbol_t **module_name)
+{
+	*module_name = parser->current_module_name;
+	return &parser->file_context;
+}
+
+void append_to_module(symbol_t *module_name, const context_t *context)
+{
+	module_t *module = get_module(module_name);
+	append_context(module, context);
+}
+
+void parser_append_to_module(parser_t *parser)
+{
+	append_to_module(parser->current_module_name, &parser->file_context);
+}
 
-	return !error;
+void parser_set_lazy_bodies(bool enable)
+{
+	lazy_bodies = enable;
+}
+
+bool parse_lazy_body(function_t *function)
+{
+	lazy_body_t *lazy_body = function->lazy_body;
+	assert(lazy_body != NULL && !lazy_body->parsed);
+	lazy_body->parsed = true;
+
+	parser_t body_parser;
+	memset(&body_parser, 0, sizeof(body_parser));
+	body_parser.lexer.errors     = stderr;
+	body_parser.lexer.input_name = lazy_body->input_name;
+	body_parser.tokens           = lazy_body->tokens;
+	body_parser.current_context  = &function->context;
+
+	parser_t *old_parser = parser;
+	parser = &body_parser;
+
+	next_token();
+	add_anchor_token(T_EOF);
+	function->statement = parse_sub_block();
+	rem_anchor_token(T_EOF);
+
+	if (body_parser.argument_stack != NULL)
+		DEL_ARR_F(body_parser.argument_stack);
+	parser = old_parser;
+	return !body_parser.error;
+}
+
+bool parse_file(FILE *in, const char *input_name)
+{
+	parser_t *file_parser = parser_from_file(in, input_name, stderr);
+	bool      result      = parser_parse(file_parser);
+	parser_append_to_module(file_parser);
+	parser_free(file_parser);
+
+	return result;
 }
 
 void init_parser(void)
@@ -2383,6 +2777,8 @@ void init_parser(void)
 	statement_parsers   = NEW_ARR_F(parse_statement_function, 0);
 	declaration_parsers = NEW_ARR_F(parse_declaration_function, 0);
 	attribute_parsers   = NEW_ARR_F(parse_attribute_function, 0);
+	thread_obstacks     = NEW_ARR_F(struct obstack*, 0);
+	module_set_init(&module_set);
 
 	register_expression_parsers();
 	register_statement_parsers();
@@ -2391,6 +2787,14 @@ void init_parser(void)
 
 void exit_parser(void)
 {
+	for (size_t i = 0; i < ARR_LEN(thread_obstacks); ++i) {
+		mem_report_remove_obstack(thread_obstacks[i]);
+		obstack_free(thread_obstacks[i], NULL);
+		xfree(thread_obstacks[i]);
+	}
+	DEL_ARR_F(thread_obstacks);
+	module_set_destroy(&module_set);
+	modules = NULL;
 	DEL_ARR_F(attribute_parsers);
 	DEL_ARR_F(declaration_parsers);
 	DEL_ARR_F(expression_parsers);
@@ -3,7 +3,78 @@
 
 #include <stdio.h>
 #include "ast.h"
+#include "symbol.h"
 
+typedef struct parser_t parser_t;
+
+/**
+ * Creates a parser for the rest of the file @p in, its diagnostics are
+ * printed to @p errors.
+ */
+parser_t *parser_from_file(FILE *in, const char *input_name, FILE *errors);
+void      parser_free(parser_t *parser);
+
+/**
+ * Lexes the input of @p parser up front with @p n_threads threads, each
+ * taking a chunk that starts at a top level declaration. Returns false if
+ * the input is too small to be split or the lexer found errors: their
+ * diagnostics belong between the parse errors, so the input is lexed during
+ * parsing as usual then.
+ */
+bool parser_tokenize(parser_t *parser, unsigned n_threads);
+
+/**
+ * Parses the whole input of @p parser. Returns false if there were errors.
+ */
+bool parser_parse(parser_t *parser);
+
+/**
+ * Prepares the calling thread for parsing in parallel to other threads: it
+ * gets its own obstack for AST nodes and types (freed by exit_parser()).
+ * Plugins can't be used in such threads.
+ */
+void parser_init_thread(void);
+
+/**
+ * Appends the declarations found by parser_parse() to their module.
+ */
+void parser_append_to_module(parser_t *parser);
+
+/**
+ * Returns the declarations found by parser_parse(). *module_name is set to
+ * the name given by a module declaration, NULL if there was none.
+ */
+const context_t *parser_get_context(const parser_t *parser,
+                                    symbol_t **module_name);
+
+/**
+ * Appends the declarations in @p context to the module @p module_name (NULL
+ * is the default module).
+ */
+void append_to_module(symbol_t *module_name, const context_t *context);
+
+/**
+ * Returns the module named @p name, NULL if no file declared it.
+ */
+module_t *find_module(symbol_t *name);
+
+/**
+ * In lazy mode the bodies of top level functions are only stored as tokens.
+ * They are parsed by parse_lazy_body() when semantic analysis needs them, so
+ * functions that are never used cost little. Errors in their bodies are not
+ * reported then.
+ */
+void parser_set_lazy_bodies(bool enable);
+
+/**
+ * Parses the body of @p function, which was skipped in lazy mode. Returns
+ * false if there were syntax errors.
+ */
+bool parse_lazy_body(function_t *function);
+
+/**
+ * Parses a file and appends its declarations to their module.
+ */
 bool parse_file(FILE *in, const char *input_name);
 
 void init_parser(void);
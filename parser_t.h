@@ -21,7 +21,9 @@ typedef struct expression_parse_function_t {
 	parse_expression_infix_function  infix_parser;
 } expression_parse_function_t;
 
-extern token_t token;
+/* the current token and position of the parser, for plugins */
+extern token_t           token;
+extern source_position_t source_position;
 
 void register_expression_parser(parse_expression_function parser,
                                 token_type_t token_type);
@@ -1,6 +1,7 @@
 #include <config.h>
 
 #include <stdbool.h>
+#include <string.h>
 
 #include "semantic_t.h"
 
@@ -8,14 +9,38 @@
 #include "type_t.h"
 #include "type_hash.h"
 #include "match_type.h"
+#include "type_tuple_map.h"
+#include "mem_report.h"
+#include "parser.h"
 #include "adt/obst.h"
 #include "adt/array.h"
 #include "adt/error.h"
+#include "adt/xmalloc.h"
 
 //#define DEBUG_TYPEVAR_BINDINGS
 //#define ABORT_ON_ERRORS
 //#define DEBUG_ENVIRONMENT
 
+#define PtrKeyedSet        entity_index
+#define PtrKeyedEntry      entity_t
+#define PtrKeyedKey(entry) (entry)->base.symbol
+#define PtrKeyedDeclared
+#include "adt/ptr_keyed_set.h"
+
+/** contexts with fewer entities are searched linearly */
+#define ENTITY_INDEX_MIN_ENTITIES  8
+
+/**
+ * The concept instance found for concrete type arguments, see
+ * index_concept_instances()
+ */
+typedef struct instance_entry_t instance_entry_t;
+struct instance_entry_t {
+	concept_instance_t *instance;
+	/** the polymorphic instances older than instance */
+	concept_instance_t *older_polymorphic;
+};
+
 typedef struct environment_entry_t environment_entry_t;
 struct environment_entry_t {
 	symbol_t    *symbol;
@@ -23,11 +48,32 @@ struct environment_entry_t {
 	const void  *up_context;
 };
 
+/** the environment stack grows by chunks of this many entries */
+#define ENVIRONMENT_CHUNK_SIZE  512
+
+typedef struct environment_chunk_t environment_chunk_t;
+struct environment_chunk_t {
+	environment_chunk_t *prev;
+	environment_chunk_t *next;  /**< kept after popping, for the next push */
+	environment_entry_t  entries[ENVIRONMENT_CHUNK_SIZE];
+};
+
 static lower_statement_function  *statement_lowerers  = NULL;
 static lower_expression_function *expression_lowerers = NULL;
 
 static struct obstack        symbol_environment_obstack;
-static environment_entry_t **symbol_stack;
+/* the environment stack: the chunk holding its top, the number of entries
+ * used in that chunk and the number of entries in the chunks below */
+static environment_chunk_t  *environment_chunk;
+static size_t                environment_chunk_top;
+static size_t                environment_chunk_base;
+/** used functions with lazily parsed bodies, checked by check_module() */
+static entity_t            **lazy_functions;
+/** concrete concept instances by type arguments, also used by ast2firm */
+static type_tuple_map_t     *instance_index;
+static struct obstack        instance_index_obstack;
+/** contexts with an entity index, it is freed at the end of check_semantic() */
+static context_t           **indexed_contexts;
 static bool                  found_export;
 static bool                  found_errors;
 
@@ -53,7 +99,9 @@ static void resolve_function_types(function_t *function);
 
 void print_error_prefix(const source_position_t position)
 {
-	fprintf(stderr, "%s:%d: error: ", position.input_name, position.linenr);
+	unsigned    linenr;
+	const char *input_name = decode_source_position(position, &linenr);
+	fprintf(stderr, "%s:%u: error: ", input_name, linenr);
 	found_errors = true;
 #ifdef ABORT_ON_ERRORS
 	abort();
@@ -62,7 +110,9 @@ void print_error_prefix(const source_position_t position)
 
 void print_warning_prefix(const source_position_t position)
 {
-	fprintf(stderr, "%s:%d: warning: ", position.input_name, position.linenr);
+	unsigned    linenr;
+	const char *input_name = decode_source_position(position, &linenr);
+	fprintf(stderr, "%s:%u: warning: ", input_name, linenr);
 }
 
 void error_at(const source_position_t position,
@@ -72,19 +122,37 @@ void error_at(const source_position_t position,
 	fprintf(stderr, "%s\n", message);
 }
 
+static environment_chunk_t *new_environment_chunk(environment_chunk_t *prev)
+{
+	environment_chunk_t *chunk
+		= obstack_alloc(&symbol_environment_obstack, sizeof(chunk[0]));
+	chunk->prev = prev;
+	chunk->next = NULL;
+	return chunk;
+}
+
+/** moves the top of the environment stack to the next chunk */
+static void next_environment_chunk(void)
+{
+	environment_chunk_t *chunk = environment_chunk;
+	if (chunk->next == NULL)
+		chunk->next = new_environment_chunk(chunk);
+
+	environment_chunk       = chunk->next;
+	environment_chunk_base += ENVIRONMENT_CHUNK_SIZE;
+	environment_chunk_top   = 0;
+}
+
 /**
  * pushs an environment_entry on the environment stack and links the
  * corresponding symbol to the new entry
  */
 static void environment_push(entity_t *entity, const void *context)
 {
+	if (UNLIKELY(environment_chunk_top == ENVIRONMENT_CHUNK_SIZE))
+		next_environment_chunk();
 	environment_entry_t *entry
-		= obstack_alloc(&symbol_environment_obstack, sizeof(entry[0]));
-	memset(entry, 0, sizeof(entry[0]));
-
-	int top = ARR_LEN(symbol_stack);
-	ARR_RESIZE(environment_entry_t*, symbol_stack, top + 1);
-	symbol_stack[top] = entry;
+		= &environment_chunk->entries[environment_chunk_top++];
 
 	symbol_t *symbol = entity->base.symbol;
 
@@ -110,62 +178,66 @@ static void environment_push(entity_t *entity, const void *context)
 	symbol->context   = context;
 }
 
-/**
- * pops symbols from the environment stack until @p new_top is the top element
- */
-static inline
-void environment_pop_to(size_t new_top)
+static void pop_environment_entry(const environment_entry_t *entry)
 {
-	environment_entry_t *entry = NULL;
-	size_t top = ARR_LEN(symbol_stack);
-	size_t i;
-
-	if (new_top == top)
-		return;
+	symbol_t *symbol = entry->symbol;
+	entity_t *entity = symbol->entity;
 
-	assert(new_top < top);
-	i = top;
-	do {
-		entry  = symbol_stack[i - 1];
-
-		symbol_t *symbol = entry->symbol;
-		entity_t *entity = symbol->entity;
-
-		if (entity->base.refs == 0 && !entity->base.exported) {
-			switch (entity->kind) {
-			/* only warn for functions/variables at the moment, we don't
-			   count refs on types yet */
-			case ENTITY_FUNCTION:
-			case ENTITY_VARIABLE:
-				print_warning_prefix(entity->base.source_position);
-				fprintf(stderr, "%s '%s' was declared but never read\n",
-						get_entity_kind_name(entity->kind), symbol->string);
-			default:
-				break;
-			}
+	if (entity->base.refs == 0 && !entity->base.exported) {
+		switch (entity->kind) {
+		/* only warn for functions/variables at the moment, we don't
+		   count refs on types yet */
+		case ENTITY_FUNCTION:
+		case ENTITY_VARIABLE:
+			print_warning_prefix(entity->base.source_position);
+			fprintf(stderr, "%s '%s' was declared but never read\n",
+					get_entity_kind_name(entity->kind), symbol->string);
+		default:
+			break;
 		}
+	}
 
 #ifdef DEBUG_ENVIRONMENT
-		fprintf(stderr, "Pop symbol '%s'\n", symbol->string);
+	fprintf(stderr, "Pop symbol '%s'\n", symbol->string);
 #endif
 
-		symbol->entity  = entry->up;
-		symbol->context = entry->up_context;
-
-		--i;
-	} while (i != new_top);
-	obstack_free(&symbol_environment_obstack, entry);
-
-	ARR_SHRINKLEN(symbol_stack, (int) new_top);
+	symbol->entity  = entry->up;
+	symbol->context = entry->up_context;
 }
 
 /**
- * returns the top element of the environment stack
+ * returns the top element of the environment stack, a marker for
+ * environment_pop_to()
  */
 static inline
 size_t environment_top(void)
 {
-	return ARR_LEN(symbol_stack);
+	return environment_chunk_base + environment_chunk_top;
+}
+
+/**
+ * pops symbols from the environment stack until @p new_top is the top element
+ */
+static inline
+void environment_pop_to(size_t new_top)
+{
+	assert(new_top <= environment_top());
+
+	while (environment_top() > new_top) {
+		if (environment_chunk_top == 0) {
+			environment_chunk       = environment_chunk->prev;
+			environment_chunk_base -= ENVIRONMENT_CHUNK_SIZE;
+			environment_chunk_top   = ENVIRONMENT_CHUNK_SIZE;
+		}
+
+		size_t                     stop    = new_top > environment_chunk_base
+		                                   ? new_top - environment_chunk_base : 0;
+		const environment_entry_t *entries = environment_chunk->entries;
+		for (size_t i = environment_chunk_top; i > stop; --i) {
+			pop_environment_entry(&entries[i - 1]);
+		}
+		environment_chunk_top = stop;
+	}
 }
 
 static type_t *normalize_type(type_t *type);
@@ -197,12 +269,6 @@ static type_t *resolve_type_reference(type_reference_t *type_ref)
 	if (entity->kind == ENTITY_TYPE_VARIABLE) {
 		type_variable_t *type_variable = &entity->type_variable;
 
-		if (type_variable->current_type != NULL) {
-			/* not sure if this is really a problem... */
-			fprintf(stderr, "Debug warning: unresolved type var ref found "
-			        "a concrete type...\n");
-			return type_variable->current_type;
-		}
 		type_ref->base.kind     = TYPE_REFERENCE_TYPE_VARIABLE;
 		type_ref->type_variable = type_variable;
 		return typehash_insert((type_t*) type_ref);
@@ -265,7 +331,10 @@ static type_t *resolve_type_reference(type_reference_t *type_ref)
 		assert(compound_type != NULL);
 		bind_typevariables->polymorphic_type = compound_type;
 
-		type = (type_t*) bind_typevariables;
+		type = typehash_insert((type_t*) bind_typevariables);
+		if (type != (type_t*) bind_typevariables) {
+			obstack_free(type_obst, bind_typevariables);
+		}
 	}
 
 	return type;
@@ -273,11 +342,6 @@ static type_t *resolve_type_reference(type_reference_t *type_ref)
 
 static type_t *resolve_type_reference_type_var(type_reference_t *type_ref)
 {
-	type_variable_t *type_variable = type_ref->type_variable;
-	if (type_variable->current_type != NULL) {
-		return normalize_type(type_variable->current_type);
-	}
-
 	return typehash_insert((type_t*) type_ref);
 }
 
@@ -368,7 +432,9 @@ static type_t *normalize_type(type_t *type)
 	case TYPE_TYPEOF: {
 		typeof_type_t *typeof_type = (typeof_type_t*) type;
 		typeof_type->expression = check_expression(typeof_type->expression);
-		return type;
+		/* use the (interned) type of the expression */
+		type_t *expression_type = typeof_type->expression->base.type;
+		return expression_type != NULL ? expression_type : type;
 	}
 
 	case TYPE_REFERENCE:
@@ -397,6 +463,31 @@ static type_t *normalize_type(type_t *type)
 	panic("Unknown type found");
 }
 
+/**
+ * Parses the body of @p function if it was skipped by the parser in lazy
+ * mode.
+ */
+static void parse_lazy_function(function_t *function)
+{
+	if (function->lazy_body == NULL || function->lazy_body->parsed)
+		return;
+	if (!parse_lazy_body(function))
+		found_errors = true;
+}
+
+/**
+ * Records that the function @p entity is used. If it has a lazy body that
+ * was not checked yet it is parsed and queued for checking.
+ */
+static void use_function(entity_t *entity)
+{
+	function_t *function = &entity->function.function;
+	if (function->lazy_body == NULL || function->lazy_body->parsed)
+		return;
+	parse_lazy_function(function);
+	ARR_APP1(entity_t*, lazy_functions, entity);
+}
+
 static type_t *check_reference(entity_t *entity,
                                const source_position_t source_position)
 {
@@ -417,6 +508,7 @@ static type_t *check_reference(entity_t *entity,
 		}
 		return type;
 	case ENTITY_FUNCTION:
+		use_function(entity);
 		return make_pointer_type((type_t*) entity->function.function.type);
 	case ENTITY_CONSTANT: {
 		constant_t *constant = &entity->constant;
@@ -857,50 +949,212 @@ static void check_binary_expression(binary_expression_t *binexpr)
 }
 
 /**
- * find a concept instance matching the current type_variable configuration
+ * Tests whether matching @p type against a type is the same as comparing the
+ * two (hash-consed) types, so no type variables are bound by it.
  */
-static concept_instance_t *_find_concept_instance(concept_t *concept,
-                                                  const source_position_t *pos)
+static bool is_concrete_type(type_t *type)
 {
-	concept_instance_t *instance;
-	for ( instance = concept->instances; instance != NULL;
-			instance = instance->next_in_concept) {
+	switch (type->kind) {
+	case TYPE_VOID:
+	case TYPE_ATOMIC:
+		return true;
+	case TYPE_COMPOUND_STRUCT:
+	case TYPE_COMPOUND_UNION:
+		return type->compound.type_parameters == NULL;
+	case TYPE_POINTER:
+		return typehash_is_interned(type)
+		       && is_concrete_type(type->pointer.points_to);
+	case TYPE_BIND_TYPEVARIABLES: {
+		if (!typehash_is_interned(type))
+			return false;
+		type_argument_t *argument = type->bind_typevariables.type_arguments;
+		for ( ; argument != NULL; argument = argument->next) {
+			if (!is_concrete_type(argument->type))
+				return false;
+		}
+		return true;
+	}
+	default:
+		/* function types match even if only one of them is variadic,
+		 * arrays can't be matched at all */
+		return false;
+	}
+}
+
+static bool is_concrete_argument_list(const type_argument_t *arguments,
+                                      const type_variable_t *parameters)
+{
+	for ( ; arguments != NULL && parameters != NULL;
+	     arguments = arguments->next, parameters = parameters->next) {
+		if (!is_concrete_type(arguments->type))
+			return false;
+	}
+	return arguments == NULL && parameters == NULL;
+}
+
+/**
+ * Matches the type arguments of @p instance against the types @p substitution
+ * binds to the concept parameters. The type parameters of polymorphic
+ * instances are only bound while matching.
+ */
+static bool match_concept_instance(concept_instance_t *instance,
+                                   const type_substitution_t *substitution,
+                                   const source_position_t *pos)
+{
+	concept_t *concept = instance->concept;
+
+	size_t n_instance_parameters = 0;
+	for (type_variable_t *parameter = instance->type_parameters;
+	     parameter != NULL; parameter = parameter->next) {
+		++n_instance_parameters;
+	}
+	type_t *instance_types[n_instance_parameters > 0
+	                       ? n_instance_parameters : 1];
+	memset(instance_types, 0, sizeof(instance_types));
+	type_bindings_t bindings;
+	bindings.type_parameters = instance->type_parameters;
+	bindings.types           = instance_types;
+
+	type_argument_t *argument  = instance->type_arguments;
+	type_variable_t *parameter = concept->type_parameters;
+	while (argument != NULL && parameter != NULL) {
+		type_t *type = get_substituted_type(substitution, parameter);
+		if (type == NULL) {
+			print_error_prefix(*pos);
+			panic("type variable has no type set while searching "
+			      "concept instance");
+		}
+		if (!match_variant_to_concrete_type(&bindings, argument->type, type,
+					concept->base.source_position, false))
+			return false;
+
+		argument  = argument->next;
+		parameter = parameter->next;
+	}
+	if (argument != NULL || parameter != NULL) {
+		print_error_prefix(instance->source_position);
+		panic("type argument count of concept instance doesn't match "
+		      "type parameter count of concept");
+	}
+	return true;
+}
+
+/**
+ * Matches all instances of @p concept, starting with the newest one. Used if
+ * the bound types can't be looked up in the instance index.
+ */
+static concept_instance_t *match_concept_instances(concept_t *concept,
+		const type_substitution_t *substitution, const source_position_t *pos)
+{
+	concept_instance_t *instance = concept->instances;
+	for ( ; instance != NULL; instance = instance->next_in_concept) {
 		assert(instance->concept == concept);
+		if (match_concept_instance(instance, substitution, pos))
+			break;
+	}
+	return instance;
+}
 
-		type_argument_t *argument  = instance->type_arguments;
-		type_variable_t *parameter = concept->type_parameters;
-		bool             match     = true;
-		while (argument != NULL && parameter != NULL) {
-			if (parameter->current_type == NULL) {
-				print_error_prefix(*pos);
-				panic("type variable has no type set while searching "
-				      "concept instance");
-			}
-			if (!match_variant_to_concrete_type(
-						argument->type, parameter->current_type,
-						concept->base.source_position, false)) {
-				match = false;
-				break;
-			}
+/**
+ * Adds the instances of @p concept registered since the last call to the
+ * instance index. Instances with concrete type arguments are found by their
+ * arguments, the others are kept in the polymorphic_instances list.
+ */
+static void index_concept_instances(concept_t *concept)
+{
+	concept_instance_t *newest = concept->instances;
+	if (newest == concept->indexed_instances)
+		return;
+
+	size_t n_parameters = 0;
+	for (type_variable_t *parameter = concept->type_parameters;
+	     parameter != NULL; parameter = parameter->next) {
+		++n_parameters;
+	}
 
-			argument  = argument->next;
-			parameter = parameter->next;
+	/* the instance list starts with the newest one, index the oldest first */
+	concept_instance_t **new_instances = NEW_ARR_F(concept_instance_t*, 0);
+	for (concept_instance_t *instance = newest;
+	     instance != concept->indexed_instances;
+	     instance = instance->next_in_concept) {
+		ARR_APP1(concept_instance_t*, new_instances, instance);
+	}
+
+	for (size_t i = ARR_LEN(new_instances); i > 0; --i) {
+		concept_instance_t *instance = new_instances[i - 1];
+		assert(instance->concept == concept);
+
+		if (n_parameters == 0
+		    || !is_concrete_argument_list(instance->type_arguments,
+		                                  concept->type_parameters)) {
+			instance->next_polymorphic     = concept->polymorphic_instances;
+			concept->polymorphic_instances = instance;
+			continue;
 		}
-		if (match && (argument != NULL || parameter != NULL)) {
-			print_error_prefix(instance->source_position);
-			panic("type argument count of concept instance doesn't match "
-			      "type parameter count of concept");
+
+		type_t          *types[n_parameters];
+		type_argument_t *argument = instance->type_arguments;
+		for (size_t t = 0; t < n_parameters; ++t, argument = argument->next) {
+			types[t] = argument->type;
 		}
-		if (match)
-			break;
+
+		/* a newer instance for the same types replaces the older one, it is
+		 * found first */
+		instance_entry_t *entry
+			= obstack_alloc(&instance_index_obstack, sizeof(entry[0]));
+		entry->instance          = instance;
+		entry->older_polymorphic = concept->polymorphic_instances;
+		type_tuple_map_set(instance_index, concept, types, n_parameters, entry);
 	}
+	concept->indexed_instances = newest;
+	DEL_ARR_F(new_instances);
+}
 
-	return instance;
+/**
+ * Finds a concept instance matching the types @p substitution binds to the
+ * concept parameters. Like a walk over all instances (starting with the newest
+ * one) this returns the first match, but concrete instances are looked up in
+ * the instance index and only polymorphic ones are matched one by one.
+ */
+static concept_instance_t *_find_concept_instance(concept_t *concept,
+		const type_substitution_t *substitution, const source_position_t *pos)
+{
+	index_concept_instances(concept);
+
+	size_t n_parameters = 0;
+	for (type_variable_t *parameter = concept->type_parameters;
+	     parameter != NULL; parameter = parameter->next) {
+		type_t *type = get_substituted_type(substitution, parameter);
+		if (type == NULL || !is_concrete_type(type))
+			return match_concept_instances(concept, substitution, pos);
+		++n_parameters;
+	}
+	if (n_parameters == 0)
+		return match_concept_instances(concept, substitution, pos);
+
+	type_t          *types[n_parameters];
+	type_variable_t *parameter = concept->type_parameters;
+	for (size_t i = 0; i < n_parameters; ++i, parameter = parameter->next) {
+		types[i] = get_substituted_type(substitution, parameter);
+	}
+
+	instance_entry_t   *entry
+		= type_tuple_map_find(instance_index, concept, types, n_parameters);
+	concept_instance_t *older = entry != NULL ? entry->older_polymorphic : NULL;
+
+	/* polymorphic instances newer than the concrete one come first */
+	concept_instance_t *instance = concept->polymorphic_instances;
+	for ( ; instance != older; instance = instance->next_polymorphic) {
+		if (match_concept_instance(instance, substitution, pos))
+			return instance;
+	}
+	return entry != NULL ? entry->instance : NULL;
 }
 
-concept_instance_t *find_concept_instance(concept_t *concept)
+concept_instance_t *find_concept_instance(concept_t *concept,
+		const type_substitution_t *substitution)
 {
-	return _find_concept_instance(concept, NULL);
+	return _find_concept_instance(concept, substitution, NULL);
 }
 
 /** tests whether a type variable has a concept as constraint */
@@ -934,7 +1188,8 @@ concept_function_instance_t *get_function_from_concept_instance(
 	return NULL;
 }
 
-static void resolve_concept_function_instance(reference_expression_t *reference)
+static void resolve_concept_function_instance(reference_expression_t *reference,
+		const type_substitution_t *substitution)
 {
 	entity_t *entity = reference->entity;
 	assert(entity->kind == ENTITY_CONCEPT_FUNCTION);
@@ -949,12 +1204,12 @@ static void resolve_concept_function_instance(reference_expression_t *reference)
 	bool cant_resolve = false;
 	type_variable_t *type_var = concept->type_parameters;
 	while (type_var != NULL) {
-		type_t *current_type = type_var->current_type;
-		if (current_type == NULL)
+		type_t *bound_type = get_substituted_type(substitution, type_var);
+		if (bound_type == NULL)
 			return;
 
-		if (current_type->kind == TYPE_REFERENCE_TYPE_VARIABLE) {
-			type_reference_t *type_ref      = (type_reference_t*) current_type;
+		if (bound_type->kind == TYPE_REFERENCE_TYPE_VARIABLE) {
+			type_reference_t *type_ref      = (type_reference_t*) bound_type;
 			type_variable_t  *type_variable = type_ref->type_variable;
 
 			if (!type_variable_has_constraint(type_variable, concept)) {
@@ -976,19 +1231,18 @@ static void resolve_concept_function_instance(reference_expression_t *reference)
 		return;
 	}
 
-	/* we assume that all typevars have current_type set */
+	/* all typevars are bound to concrete types now */
 	const source_position_t *pos      = &reference->base.source_position;
-	concept_instance_t      *instance = _find_concept_instance(concept, pos);
+	concept_instance_t      *instance
+		= _find_concept_instance(concept, substitution, pos);
 	if (instance == NULL) {
 		print_error_prefix(reference->base.source_position);
 		fprintf(stderr, "there's no instance of concept '%s' for type ",
 		        concept->base.symbol->string);
 		type_variable_t *typevar = concept->type_parameters;
 		while (typevar != NULL) {
-			if (typevar->current_type != NULL) {
-				print_type(typevar->current_type);
-				fprintf(stderr, " ");
-			}
+			print_type(get_substituted_type(substitution, typevar));
+			fprintf(stderr, " ");
 			typevar = typevar->next;
 		}
 		fprintf(stderr, "\n");
@@ -1013,13 +1267,21 @@ static void resolve_concept_function_instance(reference_expression_t *reference)
 #endif
 }
 
+/**
+ * Checks that the types @p substitution binds to @p type_variables are
+ * instances of their constraints.
+ */
 static void check_type_constraints(type_variable_t *type_variables,
+                                   const type_substitution_t *substitution,
                                    const source_position_t source_position)
 {
 	type_variable_t *type_var     = type_variables;
 	while (type_var != NULL) {
-		type_constraint_t *constraint   = type_var->constraints;
-		type_t            *current_type = type_var->current_type;
+		type_t            *bound_type = get_substituted_type(substitution,
+		                                                     type_var);
+		/* a missing type was already reported by the caller */
+		type_constraint_t *constraint
+			= bound_type != NULL ? type_var->constraints : NULL;
 
 		for ( ;constraint != NULL; constraint = constraint->next) {
 			concept_t *concept = constraint->concept;
@@ -1027,8 +1289,8 @@ static void check_type_constraints(type_variable_t *type_variables,
 			if (concept == NULL)
 				continue;
 
-			if (current_type->kind == TYPE_REFERENCE_TYPE_VARIABLE) {
-				type_reference_t *ref      = (type_reference_t*) current_type;
+			if (bound_type->kind == TYPE_REFERENCE_TYPE_VARIABLE) {
+				type_reference_t *ref      = (type_reference_t*) bound_type;
 				type_variable_t  *type_var = ref->type_variable;
 
 				if (!type_variable_has_constraint(type_var, concept)) {
@@ -1040,12 +1302,14 @@ static void check_type_constraints(type_variable_t *type_variables,
 				continue;
 			}
 
-			/* set typevariable values for the concept
+			/* bind the type parameters of the concept
 			 * This currently only works for conceptes with 1 parameter */
-			concept->type_parameters->current_type = type_var->current_type;
+			const type_substitution_t *concept_substitution
+				= make_type_substitution_from_types(concept->type_parameters,
+				                                    &bound_type);
 
-			concept_instance_t *instance
-				= _find_concept_instance(concept, & source_position);
+			concept_instance_t *instance = _find_concept_instance(concept,
+					concept_substitution, & source_position);
 			if (instance == NULL) {
 				print_error_prefix(source_position);
 				fprintf(stderr, "concrete type for type variable '%s' of "
@@ -1053,13 +1317,10 @@ static void check_type_constraints(type_variable_t *type_variables,
 				        type_var->base.symbol->string);
 				print_error_prefix(source_position);
 				fprintf(stderr, "type ");
-				print_type(type_var->current_type);
+				print_type(bound_type);
 				fprintf(stderr, " is no instance of concept '%s'\n",
 				        concept->base.symbol->string);
 			}
-
-			/* reset typevar binding */
-			concept->type_parameters->current_type = NULL;
 		}
 
 		type_var = type_var->next;
@@ -1203,22 +1464,25 @@ static void check_call_expression(call_expression_t *call)
 		}
 	}
 
-	/* clear typevariable configuration */
-	if (type_variables != NULL) {
-		type_variable_t *type_var = type_variables;
-		while (type_var != NULL) {
-			type_var->current_type = NULL;
-
-			type_var = type_var->next;
-		}
+	/* the type variable configuration of this call */
+	size_t n_type_variables = 0;
+	for (type_variable_t *type_var = type_variables; type_var != NULL;
+	     type_var = type_var->next) {
+		++n_type_variables;
 	}
+	type_t *bound_types[n_type_variables > 0 ? n_type_variables : 1];
+	memset(bound_types, 0, sizeof(bound_types));
+	type_bindings_t bindings;
+	bindings.type_parameters = type_variables;
+	bindings.types           = bound_types;
 
 	/* apply type arguments */
+	const type_substitution_t *explicit_substitution = NULL;
 	if (type_arguments != NULL) {
 		type_variable_t *type_var      = type_variables;
 		type_argument_t *type_argument = type_arguments;
-		while (type_argument != NULL && type_var != NULL) {
-			type_var->current_type = type_argument->type;
+		for (size_t t = 0; type_argument != NULL && type_var != NULL; ++t) {
+			bound_types[t] = type_argument->type;
 
 			type_var      = type_var->next;
 			type_argument = type_argument->next;
@@ -1228,36 +1492,41 @@ static void check_call_expression(call_expression_t *call)
 			error_at(function->base.source_position,
 			         "wrong number of type arguments on function reference");
 		}
+		explicit_substitution
+			= make_type_substitution_from_types(type_variables, bound_types);
 	}
 
 	/* check call arguments, match argument types against expected types
 	 * and try to determine type variable configuration */
-	call_argument_t           *argument   = call->arguments;
+	call_arguments_t          *arguments  = call->arguments;
 	function_parameter_type_t *param_type = function_type->parameter_types;
-	int                      i          = 0;
-	while (argument != NULL) {
+	for (unsigned i = 0; i < arguments->n_arguments; ++i) {
 		if (param_type == NULL && !function_type->variable_arguments) {
 			error_at(call->base.source_position,
 			         "too much arguments for function call\n");
 			break;
 		}
 
-		argument->expression     = check_expression(argument->expression);
-		expression_t *expression = argument->expression;
+		expression_t *expression
+			= check_expression(arguments->arguments[i]);
 
 		type_t       *wanted_type;
 		type_t       *expression_type = expression->base.type;
 
 		if (param_type != NULL) {
 			wanted_type = param_type->type;
+			if (explicit_substitution != NULL)
+				wanted_type = substitute_type(explicit_substitution,
+				                              wanted_type);
 		} else {
 			wanted_type = get_default_param_type(expression_type,
-			                        argument->expression->base.source_position);
+			                        expression->base.source_position);
 		}
 
 		/* match type of argument against type variables */
 		if (type_variables != NULL && type_arguments == NULL) {
-			match_variant_to_concrete_type(wanted_type, expression_type,
+			match_variant_to_concrete_type(&bindings, wanted_type,
+			                               expression_type,
 			                               expression->base.source_position,
 										   true);
 		} else if (expression_type != wanted_type) {
@@ -1269,7 +1538,7 @@ static void check_call_expression(call_expression_t *call)
 			                expression->base.source_position, lenient);
 			if (new_expression == NULL) {
 				print_error_prefix(expression->base.source_position);
-				fprintf(stderr, "invalid type for argument %d of call: ", i);
+				fprintf(stderr, "invalid type for argument %u of call: ", i);
 				print_type(expression->base.type);
 				fprintf(stderr, " should be ");
 				print_type(wanted_type);
@@ -1278,12 +1547,10 @@ static void check_call_expression(call_expression_t *call)
 				expression = new_expression;
 			}
 		}
-		argument->expression = expression;
+		arguments->arguments[i] = expression;
 
-		argument   = argument->next;
 		if (param_type != NULL)
 			param_type = param_type->next;
-		++i;
 	}
 	if (param_type != NULL) {
 		error_at(call->base.source_position,
@@ -1293,8 +1560,8 @@ static void check_call_expression(call_expression_t *call)
 	/* test whether we could determine the concrete types for all type
 	 * variables */
 	type_variable_t *type_var = type_variables;
-	while (type_var != NULL) {
-		if (type_var->current_type == NULL) {
+	for (size_t t = 0; type_var != NULL; ++t) {
+		if (bound_types[t] == NULL) {
 			print_error_prefix(call->base.source_position);
 			fprintf(stderr, "Couldn't determine concrete type for type "
 					"variable '%s' in call expression\n",
@@ -1303,7 +1570,7 @@ static void check_call_expression(call_expression_t *call)
 #ifdef DEBUG_TYPEVAR_BINDING
 		fprintf(stderr, "TypeVar '%s'(%p) bound to ",
 		        type_var->base.symbol->string, type_var);
-		print_type(type_var->current_type);
+		print_type(bound_types[t]);
 		fprintf(stderr, "\n");
 #endif
 
@@ -1315,37 +1582,29 @@ static void check_call_expression(call_expression_t *call)
 	if (type_variables != NULL) {
 		reference_expression_t *ref    = (reference_expression_t*) function;
 		entity_t               *entity = ref->entity;
-		type_variable_t        *type_parameters;
+		const type_substitution_t *substitution
+			= make_type_substitution_from_types(type_variables, bound_types);
 
-		result_type = create_concrete_type(result_type);
+		result_type = substitute_type(substitution, result_type);
 
 		if (entity->kind == ENTITY_CONCEPT_FUNCTION) {
 			/* we might be able to resolve the concept_function_instance now */
-			resolve_concept_function_instance(ref);
-
-			concept_function_t *concept_function = &entity->concept_function;
-			concept_t          *concept          = concept_function->concept;
-			type_parameters                      = concept->type_parameters;
+			resolve_concept_function_instance(ref, substitution);
 		} else {
 			/* check type constraints */
 			assert(entity->kind == ENTITY_FUNCTION);
-			check_type_constraints(type_variables,
+			check_type_constraints(type_variables, substitution,
 			                       call->base.source_position);
-
-			function_entity_t *function_entity = &entity->function;
-			type_parameters = function_entity->function.type_parameters;
 		}
 
 		/* set type arguments on the reference expression */
 		if (ref->type_arguments == NULL) {
-			type_variable_t *type_var      = type_parameters;
 			type_argument_t *last_argument = NULL;
-			while (type_var != NULL) {
+			for (size_t t = 0; t < n_type_variables; ++t) {
 				type_argument_t *argument = allocate_ast(sizeof(argument[0]));
 				memset(argument, 0, sizeof(argument[0]));
 
-				type_t *current_type = type_var->current_type;
-				argument->type       = current_type;
+				argument->type = bound_types[t];
 
 				if (last_argument != NULL) {
 					last_argument->next = argument;
@@ -1353,26 +1612,10 @@ static void check_call_expression(call_expression_t *call)
 					ref->type_arguments = argument;
 				}
 				last_argument = argument;
-				type_var      = type_var->next;
 			}
 		}
 
-		ref->base.type = create_concrete_type(ref->base.type);
-	}
-
-	/* clear typevariable configuration */
-	if (type_variables != NULL) {
-		type_variable_t *type_var = type_variables;
-		while (type_var != NULL) {
-			type_var->current_type = NULL;
-
-#ifdef DEBUG_TYPEVAR_BINDINGS
-			fprintf(stderr, "Unbind %s(%p)\n",
-			        type_var->declaration.symbol->string, type_var);
-#endif
-
-			type_var = type_var->next;
-		}
+		ref->base.type = substitute_type(substitution, ref->base.type);
 	}
 
 	call->base.type = result_type;
@@ -1614,14 +1857,49 @@ static void check_unary_expression(unary_expression_t *unary_expression)
 	panic("Unknown unary expression found");
 }
 
-static entity_t *find_entity(const context_t *context, symbol_t *symbol)
+/**
+ * Returns the first entity named @p symbol in @p context. Large contexts (like
+ * the ones of modules) get an index on the first lookup, they don't change
+ * anymore once the semantic checks run.
+ */
+static entity_t *find_entity(context_t *context, symbol_t *symbol)
+{
+	if (context->entity_index == NULL) {
+		entity_t *entity    = context->entities;
+		unsigned  n_checked = 0;
+		for ( ; entity != NULL && n_checked < ENTITY_INDEX_MIN_ENTITIES;
+		     entity = entity->base.next, ++n_checked) {
+			if (entity->base.symbol == symbol)
+				return entity;
+		}
+		if (entity == NULL)
+			return NULL;
+
+		entity_index_t *index = XMALLOC(entity_index_t);
+		entity_index_init(index);
+		/* inserting keeps the first entity of a symbol */
+		for (entity = context->entities; entity != NULL;
+		     entity = entity->base.next) {
+			entity_index_insert(index, entity);
+		}
+		context->entity_index = index;
+		ARR_APP1(context_t*, indexed_contexts, context);
+	}
+
+	entity_base_t key;
+	key.symbol = symbol;
+	return entity_index_find(context->entity_index, (entity_t*) &key);
+}
+
+static void free_entity_indices(void)
 {
-	entity_t *entity = context->entities;
-	for ( ; entity != NULL; entity = entity->base.next) {
-		if (entity->base.symbol == symbol)
-			break;
+	for (size_t i = 0; i < ARR_LEN(indexed_contexts); ++i) {
+		context_t *context = indexed_contexts[i];
+		entity_index_destroy(context->entity_index);
+		xfree(context->entity_index);
+		context->entity_index = NULL;
 	}
-	return entity;
+	DEL_ARR_F(indexed_contexts);
 }
 
 static void check_select_expression(select_expression_t *select)
@@ -1703,11 +1981,10 @@ static void check_select_expression(select_expression_t *select)
 
 	/* resolve type varible bindings if needed */
 	if (bind_typevariables != NULL) {
-		int old_top = typevar_binding_stack_top();
-		push_type_variable_bindings(compound_type->type_parameters,
-		                            bind_typevariables->type_arguments);
-		result_type = create_concrete_type(entry->type);
-		pop_type_variable_bindings(old_top);
+		const type_substitution_t *substitution
+			= make_type_substitution(NULL, compound_type->type_parameters,
+			                         bind_typevariables->type_arguments);
+		result_type = substitute_type(substitution, entry->type);
 	}
 
 	select->compound_entry = entry;
@@ -2084,6 +2361,7 @@ static void check_function(function_t *function, symbol_t *symbol,
 {
 	if (function->is_extern)
 		return;
+	parse_lazy_function(function);
 
 	int old_top = environment_top();
 	push_context(&function->context);
@@ -2357,6 +2635,9 @@ static void check_export(const export_t *export)
 
 	entity->base.exported = true;
 	found_export          = true;
+
+	if (entity->kind == ENTITY_FUNCTION)
+		use_function(entity);
 }
 
 static void check_and_push_context(context_t *context)
@@ -2406,6 +2687,9 @@ static void check_and_push_context(context_t *context)
 	for ( ; entity != NULL; entity = entity->base.next) {
 		switch (entity->kind) {
 		case ENTITY_FUNCTION: {
+			/* lazily parsed functions are checked when they are used */
+			if (entity->function.function.lazy_body != NULL)
+				break;
 			check_function(&entity->function.function,
 			               entity->base.symbol,
 			               entity->base.source_position);
@@ -2458,16 +2742,6 @@ void register_expression_lowerer(lower_expression_function function,
 	expression_lowerers[expression_type] = function;
 }
 
-static module_t *find_module(symbol_t *name)
-{
-	module_t *module = modules;
-	for ( ; module != NULL; module = module->next) {
-		if (module->name == name)
-			break;
-	}
-	return module;
-}
-
 static void check_module(module_t *module)
 {
 	if (module->processed)
@@ -2526,6 +2800,16 @@ static void check_module(module_t *module)
 	}
 
 	check_and_push_context(&module->context);
+
+	/* check the used lazily parsed functions while the module is visible */
+	while (ARR_LEN(lazy_functions) > 0) {
+		size_t    last   = ARR_LEN(lazy_functions) - 1;
+		entity_t *entity = lazy_functions[last];
+		ARR_SHRINKLEN(lazy_functions, last);
+
+		check_function(&entity->function.function, entity->base.symbol,
+		               entity->base.source_position);
+	}
 	environment_pop_to(old_top);
 
 	assert(module->processing);
@@ -2537,10 +2821,16 @@ static void check_module(module_t *module)
 bool check_semantic(void)
 {
 	obstack_init(&symbol_environment_obstack);
+	mem_report_add_obstack("semantic", &symbol_environment_obstack);
+
+	environment_chunk      = new_environment_chunk(NULL);
+	environment_chunk_top  = 0;
+	environment_chunk_base = 0;
 
-	symbol_stack  = NEW_ARR_F(environment_entry_t*, 0);
-	found_errors  = false;
-	found_export  = false;
+	lazy_functions   = NEW_ARR_F(entity_t*, 0);
+	indexed_contexts = NEW_ARR_F(context_t*, 0);
+	found_errors     = false;
+	found_export     = false;
 
 	type_bool     = make_atomic_type(ATOMIC_TYPE_BOOL);
 	type_byte     = make_atomic_type(ATOMIC_TYPE_BYTE);
@@ -2561,7 +2851,10 @@ bool check_semantic(void)
 		found_errors = true;
 	}
 
-	DEL_ARR_F(symbol_stack);
+	free_entity_indices();
+	DEL_ARR_F(lazy_functions);
+	environment_chunk = NULL;
+	mem_report_remove_obstack(&symbol_environment_obstack);
 	obstack_free(&symbol_environment_obstack, NULL);
 
 	return !found_errors;
@@ -2575,10 +2868,18 @@ void init_semantic_module(void)
 	register_expression_lowerer(lower_incdec_expression, EXPR_UNARY_INCREMENT);
 	register_expression_lowerer(lower_incdec_expression, EXPR_UNARY_DECREMENT);
 	register_expression_lowerer(lower_sub_expression, EXPR_BINARY_SUB);
+
+	obstack_init(&instance_index_obstack);
+	mem_report_add_obstack("semantic", &instance_index_obstack);
+	instance_index = new_type_tuple_map();
 }
 
 void exit_semantic_module(void)
 {
+	free_type_tuple_map(instance_index);
+	mem_report_remove_obstack(&instance_index_obstack);
+	obstack_free(&instance_index_obstack, NULL);
+
 	DEL_ARR_F(expression_lowerers);
 	DEL_ARR_F(statement_lowerers);
 }
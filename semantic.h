@@ -2,12 +2,18 @@
 #define SEMANTIC_H
 
 #include "ast.h"
+#include "type.h"
 
 /* check static semantic of a bunch of files and organize them into modules
  * if semantic is fine */
 bool check_semantic(void);
 
-concept_instance_t *find_concept_instance(concept_t *concept);
+/**
+ * returns the instance of @p concept for the types @p substitution binds to
+ * its type parameters, NULL if there is none
+ */
+concept_instance_t *find_concept_instance(concept_t *concept,
+		const type_substitution_t *substitution);
 
 concept_function_instance_t *get_function_from_concept_instance(
 		concept_instance_t *instance, concept_function_t *function);
@@ -0,0 +1,117 @@
+#include <config.h>
+
+#include <pthread.h>
+
+#include "source_position.h"
+#include "compiler.h"
+#include "adt/error.h"
+#include "adt/util.h"
+#include "adt/xmalloc.h"
+
+/*
+ * A position is (block << LINE_BITS) | (linenr & LINE_MASK), where a block
+ * stands for 2^LINE_BITS consecutive lines of one input. Blocks are registered
+ * when the first position in them is made, block 0 means unknown.
+ */
+#define LINE_BITS   12
+#define LINE_MASK   ((1u << LINE_BITS) - 1)
+#define MAX_BLOCKS  (1u << (32 - LINE_BITS))
+#define PAGE_BITS   10
+#define PAGE_SIZE   (1u << PAGE_BITS)
+#define N_PAGES     (MAX_BLOCKS / PAGE_SIZE)
+
+typedef struct position_block_t position_block_t;
+struct position_block_t {
+	const char *input_name;
+	unsigned    first_line;
+};
+
+/** the blocks never move once registered, so decoding needs no lock */
+static position_block_t *pages[N_PAGES];
+static unsigned          n_blocks;
+static pthread_mutex_t   blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+/** incremented by init_source_positions(), so old thread caches are not used */
+static unsigned          generation;
+
+/* the block of the last position made by this thread */
+static THREAD_LOCAL const char *last_input_name;
+static THREAD_LOCAL unsigned    last_first_line;
+static THREAD_LOCAL unsigned    last_block;
+static THREAD_LOCAL unsigned    last_generation;
+
+static position_block_t *get_block(unsigned block)
+{
+	return &pages[block / PAGE_SIZE][block % PAGE_SIZE];
+}
+
+/**
+ * Returns the block of @p first_line of @p input_name, registering it if
+ * needed. There are few blocks (one per 4096 lines) and threads mostly stay in
+ * the block they used last, so a linear search is good enough.
+ */
+static unsigned find_block(const char *input_name, unsigned first_line)
+{
+	for (unsigned b = n_blocks; b > 0; --b) {
+		const position_block_t *block = get_block(b);
+		if (block->input_name == input_name && block->first_line == first_line)
+			return b;
+	}
+
+	unsigned b = n_blocks + 1;
+	if (b >= MAX_BLOCKS)
+		panic("too many source lines");
+	if (pages[b / PAGE_SIZE] == NULL)
+		pages[b / PAGE_SIZE] = XMALLOCN(position_block_t, PAGE_SIZE);
+
+	position_block_t *block = get_block(b);
+	block->input_name = input_name;
+	block->first_line = first_line;
+	n_blocks          = b;
+	return b;
+}
+
+source_position_t make_source_position(const char *input_name,
+                                       unsigned linenr)
+{
+	unsigned first_line = linenr & ~LINE_MASK;
+	if (UNLIKELY(input_name != last_input_name || first_line != last_first_line
+	             || last_generation != generation)) {
+		pthread_mutex_lock(&blocks_lock);
+		last_block = find_block(input_name, first_line);
+		pthread_mutex_unlock(&blocks_lock);
+
+		last_input_name = input_name;
+		last_first_line = first_line;
+		last_generation = generation;
+	}
+	return (source_position_t) (last_block << LINE_BITS | (linenr & LINE_MASK));
+}
+
+const char *decode_source_position(source_position_t position,
+                                   unsigned *linenr)
+{
+	if (position == NO_SOURCE_POSITION) {
+		if (linenr != NULL)
+			*linenr = 0;
+		return NULL;
+	}
+
+	const position_block_t *block = get_block(position >> LINE_BITS);
+	if (linenr != NULL)
+		*linenr = block->first_line | (position & LINE_MASK);
+	return block->input_name;
+}
+
+void init_source_positions(void)
+{
+	n_blocks = 0;
+	++generation;
+}
+
+void exit_source_positions(void)
+{
+	for (size_t i = 0; i < N_PAGES; ++i) {
+		xfree(pages[i]);
+		pages[i] = NULL;
+	}
+}
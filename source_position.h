@@ -0,0 +1,32 @@
+#ifndef SOURCE_POSITION_H
+#define SOURCE_POSITION_H
+
+#include <stdint.h>
+
+/**
+ * A line in one of the inputs, as a compact id which is only decoded when a
+ * diagnostic or debug info is produced. 0 is an unknown position.
+ */
+typedef uint32_t source_position_t;
+
+#define NO_SOURCE_POSITION  ((source_position_t) 0)
+
+/**
+ * Returns the position of line @p linenr of input @p input_name. Inputs are
+ * told apart by the address of their name. May be called from several threads
+ * at once.
+ */
+source_position_t make_source_position(const char *input_name,
+                                       unsigned linenr);
+
+/**
+ * Returns the input name of @p position and stores its line in @p linenr
+ * (which may be NULL). Returns NULL for an unknown position.
+ */
+const char *decode_source_position(source_position_t position,
+                                   unsigned *linenr);
+
+void init_source_positions(void);
+void exit_source_positions(void);
+
+#endif
@@ -0,0 +1,46 @@
+#include <config.h>
+
+#include <string.h>
+#include <pthread.h>
+
+#include "string_pool.h"
+#include "mem_report.h"
+#include "adt/obst.h"
+#include "adt/strset.h"
+
+static strset_t        string_pool;
+static struct obstack  string_obst;
+/** string literals are rare compared to identifiers, so always lock */
+static pthread_mutex_t string_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *string_pool_insert(const char *string)
+{
+	return string_pool_insert_len(string, strlen(string));
+}
+
+const char *string_pool_insert_len(const char *string, size_t len)
+{
+	pthread_mutex_lock(&string_pool_lock);
+
+	char       *copy   = obstack_copy0(&string_obst, string, len);
+	const char *result = strset_insert(&string_pool, copy);
+	if (result != copy)
+		obstack_free(&string_obst, copy);
+
+	pthread_mutex_unlock(&string_pool_lock);
+	return result;
+}
+
+void init_string_pool(void)
+{
+	obstack_init(&string_obst);
+	mem_report_add_obstack("strings", &string_obst);
+	strset_init(&string_pool);
+}
+
+void exit_string_pool(void)
+{
+	strset_destroy(&string_pool);
+	mem_report_remove_obstack(&string_obst);
+	obstack_free(&string_obst, NULL);
+}
@@ -0,0 +1,23 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <stddef.h>
+
+/**
+ * Returns the pooled copy of the 0 terminated @p string. Equal strings get the
+ * same pointer, so the contents of string literals are only stored once for
+ * all inputs and can be compared (and hashed) by address. The pool can be
+ * used from several threads at once.
+ */
+const char *string_pool_insert(const char *string);
+
+/**
+ * Like string_pool_insert but takes the first @p len bytes of @p string, which
+ * needs not be 0 terminated.
+ */
+const char *string_pool_insert_len(const char *string, size_t len);
+
+void init_string_pool(void);
+void exit_string_pool(void);
+
+#endif
@@ -1,67 +1,225 @@
 #include <config.h>
 
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
 #include "symbol_table_t.h"
-#include "adt/hash_string.h"
+#include "compiler.h"
+#include "mem_report.h"
+#include "adt/error.h"
 #include "adt/obst.h"
+#include "adt/util.h"
+#include "adt/xmalloc.h"
 
 struct obstack symbol_obstack;
 
-static inline void init_symbol_table_entry(symbol_t *entry, const char *string)
+static symbol_table_t  real_symbol_table;
+symbol_table_t        *symbol_table = NULL;
+/** files may be parsed in parallel, see main.c */
+static bool            use_lock;
+/** incremented by init_symbol_table(), so old thread arenas are not used */
+static unsigned        generation;
+
+static THREAD_LOCAL symbol_arena_t *thread_arena;
+static THREAD_LOCAL unsigned        thread_arena_generation;
+
+/** the table grows when it is fuller than this (in 1/4) */
+#define MAX_LOAD_QUARTERS  3
+/** initial number of buckets per shard */
+#define INITIAL_BUCKETS    32
+
+/**
+ * Hashes 8 bytes at a time with multiply-xorshift steps and a murmur3
+ * finalizer. This is faster than the bytewise FNV of hash_string_size and
+ * mixes all bits: the high bits select the shard, the low bits the bucket.
+ */
+static inline uint32_t hash_symbol_string(const char *string, size_t len)
 {
-	entry->ID      = 0;
-	entry->string  = string;
-	entry->entity  = NULL;
-	entry->context = NULL;
+	const uint64_t multiplier = UINT64_C(0x9e3779b97f4a7c15);
+	uint64_t       hash       = len * multiplier;
+	size_t         i          = 0;
+	for ( ; i + 8 <= len; i += 8) {
+		uint64_t word;
+		memcpy(&word, string + i, sizeof(word));
+		hash  = (hash ^ word) * multiplier;
+		hash ^= hash >> 32;
+	}
+	if (i < len) {
+		/* a variable sized memcpy would be a library call */
+		uint64_t word = 0;
+		for (unsigned shift = 0; i < len; ++i, shift += 8) {
+			word |= (uint64_t) (unsigned char) string[i] << shift;
+		}
+		hash  = (hash ^ word) * multiplier;
+		hash ^= hash >> 32;
+	}
+
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xff51afd7ed558ccd);
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+	hash ^= hash >> 33;
+	return (uint32_t) hash;
 }
 
-#define HashSet                    symbol_table_t
-#define HashSetIterator            symbol_table_iterator_t
-#define HashSetEntry               symbol_table_hash_entry_t
-#define ValueType                  symbol_t*
-#define NullValue                  NULL
-#define DeletedValue               ((symbol_t*)-1)
-#define KeyType                    const char *
-#define ConstKeyType               const char *
-#define GetKey(value)              (value)->string
-#define InitData(this,value,key)   { (value) = (ValueType) obstack_alloc(&symbol_obstack, sizeof(symbol_t)); init_symbol_table_entry((value), key); }
-#define Hash(this, key)            hash_string(key)
-#define KeysEqual(this,key1,key2)  (strcmp(key1, key2) == 0)
-#define SetRangeEmpty(ptr,size)    memset(ptr, 0, (size) * sizeof(symbol_table_hash_entry_t))
-#define SCALAR_RETURN
-
-#define hashset_init            _symbol_table_init
-#define hashset_init_size       _symbol_table_init_size
-#define hashset_destroy         _symbol_table_destroy
-#define hashset_insert          _symbol_table_insert
-#define hashset_remove          _symbol_table_remove
-#define hashset_find            _symbol_table_find
-#define hashset_size            _symbol_table_size
-#define hashset_iterator_init   _symbol_table_iterator_init
-#define hashset_iterator_next   _symbol_table_iterator_next
-#define hashset_remove_iterator _symbol_table_remove_iterator
-
-#include "adt/hashset.c"
+static void init_buckets(symbol_table_shard_t *shard, size_t n_buckets)
+{
+	shard->entries   = XMALLOCNZ(symbol_table_entry_t, n_buckets);
+	shard->n_buckets = n_buckets;
+}
 
-static symbol_table_t  real_symbol_table;
-symbol_table_t        *symbol_table = NULL;
+static void grow(symbol_table_shard_t *shard)
+{
+	symbol_table_entry_t *old_entries   = shard->entries;
+	size_t                old_n_buckets = shard->n_buckets;
+	init_buckets(shard, old_n_buckets * 2);
+
+	/* the stored hashes make rehashing cheap */
+	size_t mask = shard->n_buckets - 1;
+	for (size_t i = 0; i < old_n_buckets; ++i) {
+		const symbol_table_entry_t *entry = &old_entries[i];
+		if (entry->symbol == NULL)
+			continue;
+
+		size_t b = entry->hash & mask;
+		while (shard->entries[b].symbol != NULL) {
+			b = (b + 1) & mask;
+		}
+		shard->entries[b] = *entry;
+	}
+	xfree(old_entries);
+}
+
+/**
+ * Returns the arena of the current thread, only this thread allocates on it.
+ */
+static symbol_arena_t *get_thread_arena(void)
+{
+	if (LIKELY(thread_arena != NULL && thread_arena_generation == generation))
+		return thread_arena;
+
+	symbol_arena_t *arena = XMALLOC(symbol_arena_t);
+	obstack_init(&arena->symbols);
+	obstack_init(&arena->strings);
+	mem_report_add_obstack("symbols", &arena->symbols);
+	mem_report_add_obstack("symbols", &arena->strings);
+
+	pthread_mutex_lock(&symbol_table->arenas_lock);
+	arena->next          = symbol_table->arenas;
+	symbol_table->arenas = arena;
+	pthread_mutex_unlock(&symbol_table->arenas_lock);
+
+	thread_arena            = arena;
+	thread_arena_generation = generation;
+	return arena;
+}
+
+static symbol_t *new_symbol(const char *string, size_t len)
+{
+	symbol_arena_t *arena  = get_thread_arena();
+	symbol_t       *symbol = obstack_alloc(&arena->symbols, sizeof(symbol[0]));
+	symbol->string  = obstack_copy0(&arena->strings, string, len);
+	symbol->ID      = 0;
+	symbol->entity  = NULL;
+	symbol->context = NULL;
+	return symbol;
+}
+
+static symbol_t *shard_insert(symbol_table_shard_t *shard, uint32_t hash,
+                              const char *string, size_t len)
+{
+	size_t mask = shard->n_buckets - 1;
+	size_t b    = hash & mask;
+	for ( ; shard->entries[b].symbol != NULL; b = (b + 1) & mask) {
+		const symbol_table_entry_t *entry = &shard->entries[b];
+		if (entry->hash == hash && entry->len == len
+		        && memcmp(entry->symbol->string, string, len) == 0)
+			return entry->symbol;
+	}
+
+	if ((shard->n_symbols + 1) * 4 > shard->n_buckets * MAX_LOAD_QUARTERS) {
+		grow(shard);
+		mask = shard->n_buckets - 1;
+		b    = hash & mask;
+		while (shard->entries[b].symbol != NULL) {
+			b = (b + 1) & mask;
+		}
+	}
+
+	symbol_table_entry_t *entry = &shard->entries[b];
+	entry->hash   = hash;
+	entry->len    = (uint32_t) len;
+	entry->symbol = new_symbol(string, len);
+	++shard->n_symbols;
+	return entry->symbol;
+}
 
 symbol_t *symbol_table_insert(const char *symbol)
 {
-	return _symbol_table_insert(symbol_table, symbol);
+	return symbol_table_insert_len(symbol, strlen(symbol));
+}
+
+symbol_t *symbol_table_insert_len(const char *string, size_t len)
+{
+	if (len >= UINT32_MAX)
+		panic("symbol too long");
+
+	uint32_t              hash  = hash_symbol_string(string, len);
+	symbol_table_shard_t *shard
+		= &symbol_table->shards[hash >> (32 - SYMBOL_TABLE_SHARD_BITS)];
+	if (!use_lock)
+		return shard_insert(shard, hash, string, len);
+
+	/* threads interning different symbols rarely wait for each other */
+	pthread_mutex_lock(&shard->lock);
+	symbol_t *symbol = shard_insert(shard, hash, string, len);
+	pthread_mutex_unlock(&shard->lock);
+
+	return symbol;
+}
+
+void symbol_table_set_locking(bool enable)
+{
+	use_lock = enable;
 }
 
 void init_symbol_table(void)
 {
-	symbol_table_t *this = &real_symbol_table;
+	symbol_table_t *table = &real_symbol_table;
 	obstack_init(&symbol_obstack);
-	_symbol_table_init(this);
+	mem_report_add_obstack("symbols", &symbol_obstack);
+	for (size_t i = 0; i < SYMBOL_TABLE_SHARDS; ++i) {
+		symbol_table_shard_t *shard = &table->shards[i];
+		pthread_mutex_init(&shard->lock, NULL);
+		init_buckets(shard, INITIAL_BUCKETS);
+		shard->n_symbols = 0;
+	}
+	table->arenas = NULL;
+	pthread_mutex_init(&table->arenas_lock, NULL);
+	++generation;
 
-	symbol_table = this;
+	symbol_table = table;
 }
 
 void exit_symbol_table(void)
 {
-	_symbol_table_destroy(symbol_table);
+	for (size_t i = 0; i < SYMBOL_TABLE_SHARDS; ++i) {
+		symbol_table_shard_t *shard = &symbol_table->shards[i];
+		xfree(shard->entries);
+		pthread_mutex_destroy(&shard->lock);
+	}
+	for (symbol_arena_t *arena = symbol_table->arenas, *next; arena != NULL;
+	     arena = next) {
+		next = arena->next;
+		mem_report_remove_obstack(&arena->symbols);
+		mem_report_remove_obstack(&arena->strings);
+		obstack_free(&arena->symbols, NULL);
+		obstack_free(&arena->strings, NULL);
+		xfree(arena);
+	}
+	pthread_mutex_destroy(&symbol_table->arenas_lock);
+	mem_report_remove_obstack(&symbol_obstack);
 	obstack_free(&symbol_obstack, NULL);
 
 	symbol_table = NULL;
@@ -1,11 +1,29 @@
 #ifndef SYMBOL_TABLE_H
 #define SYMBOL_TABLE_H
 
+#include <stddef.h>
+#include <stdbool.h>
 #include "symbol.h"
 #include "adt/obst.h"
 
 symbol_t *symbol_table_insert(const char *symbol);
 
+/**
+ * Like symbol_table_insert but takes the first @p len bytes of @p string, so
+ * it can be used on strings which are not 0 terminated.
+ */
+symbol_t *symbol_table_insert_len(const char *string, size_t len);
+
+/**
+ * Inserting is only thread safe while locking is enabled, which costs time.
+ * The table is split into shards with a lock each, so threads interning
+ * different symbols rarely wait for each other. Symbols never move, so the
+ * returned pointers can be used by all threads. Fields of a symbol (like the
+ * ID of a token from register_new_token()) have to be set before the threads
+ * are started.
+ */
+void symbol_table_set_locking(bool enable);
+
 void init_symbol_table(void);
 void exit_symbol_table(void);
 
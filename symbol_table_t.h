@@ -1,21 +1,58 @@
 #ifndef SYMBOL_TABLE_T_H
 #define SYMBOL_TABLE_T_H
 
+#include <stdint.h>
+#include <pthread.h>
 #include "symbol_table.h"
 #include "adt/obst.h"
 #include "symbol.h"
 
-#define HashSet          symbol_table_t
-#define HashSetIterator  symbol_table_iterator_t
-#define HashSetEntry     symbol_table_hash_entry_t
-#define ValueType        symbol_t*
-#include "adt/hashset.h"
-#undef ValueType
-#undef HashSetEntry
-#undef HashSetIterator
-#undef HashSet
+/**
+ * A bucket of the symbol table. The hash and the length of the string are
+ * stored next to the symbol pointer, so a probe only looks at the symbol
+ * itself when they match.
+ */
+typedef struct symbol_table_entry_t symbol_table_entry_t;
+struct symbol_table_entry_t {
+	uint32_t  hash;
+	uint32_t  len;
+	symbol_t *symbol; /**< NULL for an empty bucket */
+};
 
-typedef struct symbol_table_iterator_t  symbol_table_iterator_t;
-typedef struct symbol_table_t           symbol_table_t;
+#define SYMBOL_TABLE_SHARD_BITS  5
+#define SYMBOL_TABLE_SHARDS      (1 << SYMBOL_TABLE_SHARD_BITS)
+
+/**
+ * Part of the symbol table: an open addressing hash table with linear probing
+ * and its own lock, so threads only contend when they intern symbols of the
+ * same shard.
+ */
+typedef struct symbol_table_shard_t symbol_table_shard_t;
+struct symbol_table_shard_t {
+	pthread_mutex_t       lock;
+	symbol_table_entry_t *entries;
+	size_t                n_buckets; /**< a power of 2 */
+	size_t                n_symbols;
+};
+
+/**
+ * Memory for the symbols created by one thread. The symbols of a thread are
+ * packed in the order they were created, which is about the order they are
+ * used in.
+ */
+typedef struct symbol_arena_t symbol_arena_t;
+struct symbol_arena_t {
+	struct obstack  symbols; /**< the symbol_t objects */
+	struct obstack  strings;
+	symbol_arena_t *next;
+};
+
+/** the symbols are distributed to the shards by the high bits of the hash */
+typedef struct symbol_table_t symbol_table_t;
+struct symbol_table_t {
+	symbol_table_shard_t shards[SYMBOL_TABLE_SHARDS];
+	symbol_arena_t      *arenas;
+	pthread_mutex_t      arenas_lock;
+};
 
 #endif
@@ -0,0 +1,108 @@
+#!/bin/sh
+# Compiles the test programs and compares their output with the .ref files.
+# With -j the compiler has to produce the same assembly as without it, and
+# programs compiled from cached module interfaces have to behave the same.
+#
+# usage: test/check.sh [path/to/fluffy]
+
+FLUFFY=${1:-./fluffy}
+case $FLUFFY in
+	/*) ;;
+	*) FLUFFY=$(pwd)/$FLUFFY ;;
+esac
+TESTDIR=$(cd "$(dirname "$0")" && pwd)
+STDLIB="construct cstdio cstdlib cstring ctime ctype ctypes"
+STDLIB=$(for f in $STDLIB; do printf '%s ' "$TESTDIR/../stdlib/$f.fluffy"; done)
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/fluffy-check.XXXXXX") || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+failed=0
+fail() {
+	echo "FAIL: $*"
+	failed=1
+}
+
+# compile <fluffy arguments...>: runs the compiler in $WORK, prints the
+# diagnostics if it fails
+compile() {
+	if ! (cd "$WORK" && "$FLUFFY" "$@") > "$WORK/compile.log" 2>&1; then
+		cat "$WORK/compile.log"
+		return 1
+	fi
+}
+
+# run_program <ref file> <fluffy arguments...>: compiles and runs a.out, its
+# output has to match the ref file
+run_program() {
+	ref=$1
+	shift
+	rm -f "$WORK/a.out"
+	if ! compile "$@" -o a.out; then
+		fail "compiling $*"
+		return
+	fi
+	(cd "$WORK" && ./a.out) > "$WORK/output" 2>&1
+	cmp -s "$WORK/output" "$ref" || fail "output of $* differs from $ref"
+}
+
+# same_assembly <fluffy arguments...>: compiles serially and with -j4, both
+# have to produce the same assembly
+same_assembly() {
+	if ! compile -S "$@" -o out.s; then
+		fail "compiling $*"
+		return
+	fi
+	mv "$WORK/out.s" "$WORK/serial.s"
+	if ! compile -j4 -S "$@" -o out.s; then
+		fail "compiling -j4 $*"
+		return
+	fi
+	cmp -s "$WORK/serial.s" "$WORK/out.s" \
+		|| fail "-j4 changes the assembly of $*"
+}
+
+# module_cache <ref file> <fluffy arguments...>: the first compilation writes
+# the interfaces to the cache, the second one reads them back. This is done
+# with and without --lazy-bodies, cached lazy bodies are kept as tokens
+module_cache() {
+	ref=$1
+	shift
+	for lazy in "" --lazy-bodies; do
+		rm -rf "$WORK/cache"
+		run_program "$ref" $lazy --module-cache "$WORK/cache" "$@"
+		if [ -z "$(ls "$WORK/cache" 2> /dev/null)" ]; then
+			fail "no interfaces cached for $lazy $*"
+			continue
+		fi
+		run_program "$ref" $lazy --module-cache "$WORK/cache" "$@"
+	done
+}
+
+for test in "$TESTDIR"/*.fluffy; do
+	ref=$test.ref
+	[ -f "$ref" ] || continue
+	run_program "$ref" "$test"
+	# several inputs are parsed in parallel
+	same_assembly $STDLIB "$test"
+	module_cache "$ref" "$test"
+done
+
+MODULES="$TESTDIR/modules/module.fluffy $TESTDIR/modules/main.fluffy"
+run_program "$TESTDIR/modules/main.fluffy.ref" $MODULES
+same_assembly $MODULES
+module_cache "$TESTDIR/modules/main.fluffy.ref" $MODULES
+
+# a large input is lexed in parallel chunks
+awk 'BEGIN {
+	for (i = 0; i < 5000; ++i)
+		printf("func generated%d(a : int) : int:\n\treturn a + %d\n\n", i, i)
+}' > "$WORK/large.fluffy"
+cat "$TESTDIR/fib.fluffy" >> "$WORK/large.fluffy"
+same_assembly "$WORK/large.fluffy"
+run_program "$TESTDIR/fib.fluffy.ref" "$WORK/large.fluffy"
+
+if [ $failed -ne 0 ]; then
+	exit 1
+fi
+echo "all tests passed"
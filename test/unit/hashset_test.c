@@ -0,0 +1,185 @@
+/*
+ * Randomized test for the generic hashset: inserts, removes and looks up
+ * strings in a strset (group probing backend) and in a set using the classic
+ * backend and compares the results with a plain array. The sets grow and
+ * shrink several times. Any mismatch aborts with a message.
+ *
+ * usage: hashset_test
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adt/strset.h"
+#include "adt/hash_string.h"
+#include "adt/xmalloc.h"
+
+#define HashSet          classic_set_t
+#define HashSetIterator  classic_set_iterator_t
+#define HashSetEntry     classic_set_entry_t
+#define ValueType        const char*
+#include "adt/hashset.h"
+#undef ValueType
+#undef HashSetEntry
+#undef HashSetIterator
+#undef HashSet
+
+typedef struct classic_set_t          classic_set_t;
+typedef struct classic_set_iterator_t classic_set_iterator_t;
+
+#define HashSet                    classic_set_t
+#define HashSetIterator            classic_set_iterator_t
+#define HashSetEntry               classic_set_entry_t
+#define ValueType                  const char*
+#define ConstKeyType               const char*
+#define NullValue                  NULL
+#define DeletedValue               ((void*)-1)
+#define Hash(this, value)          hash_string(value)
+#define KeysEqual(this,key1,key2)  (strcmp(key1, key2) == 0)
+#define SetRangeEmpty(ptr,size)    memset(ptr, 0, (size) * sizeof(classic_set_entry_t))
+#define SCALAR_RETURN
+
+#define hashset_init            classic_set_init
+#define hashset_init_size       classic_set_init_size
+#define hashset_destroy         classic_set_destroy
+#define hashset_insert          classic_set_insert
+#define hashset_remove          classic_set_remove
+#define hashset_find            classic_set_find
+#define hashset_size            classic_set_size
+#define hashset_iterator_init   classic_set_iterator_init
+#define hashset_iterator_next   classic_set_iterator_next
+#define hashset_remove_iterator classic_set_remove_iterator
+
+#include "adt/hashset.c"
+
+/** number of distinct keys */
+#define N_KEYS        50000
+/** random operations per round */
+#define N_OPERATIONS  400000
+/** the sets are emptied and refilled this often */
+#define N_ROUNDS      3
+
+static char  *keys[N_KEYS];
+static char   present[N_KEYS];
+static size_t n_present;
+
+static unsigned random_state = 1;
+
+/** a small xorshift generator, so the test is the same everywhere */
+static unsigned next_random(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static void check(int condition, const char *set, const char *message)
+{
+	if (!condition) {
+		fprintf(stderr, "%s: %s\n", set, message);
+		abort();
+	}
+}
+
+/*
+ * The test is the same for both backends, only the names differ. Equal keys
+ * are looked up with a copy, so they are compared by contents.
+ */
+#define DEFINE_SET_TEST(prefix, set_t, iterator_t)                              \
+static void test_##prefix(void)                                                 \
+{                                                                               \
+	const char *name = #prefix;                                                 \
+	set_t       set;                                                            \
+	prefix##_init(&set);                                                        \
+	memset(present, 0, sizeof(present));                                        \
+	n_present = 0;                                                              \
+                                                                                \
+	for (unsigned round = 0; round < N_ROUNDS; ++round) {                       \
+		for (unsigned op = 0; op < N_OPERATIONS; ++op) {                        \
+			unsigned    r    = next_random();                                   \
+			size_t      i    = r % N_KEYS;                                      \
+			const char *key  = keys[i];                                         \
+			char        copy[32];                                               \
+			strcpy(copy, key);                                                  \
+			/* insert more often than remove, so the set grows first */         \
+			switch ((r >> 20) % 5) {                                            \
+			case 0:                                                             \
+			case 1: {                                                           \
+				const char *result = prefix##_insert(&set, key);                \
+				check(result == key, name, "insert returned another key");      \
+				if (!present[i]) {                                              \
+					present[i] = 1;                                             \
+					++n_present;                                                \
+				}                                                               \
+				break;                                                          \
+			}                                                                   \
+			case 2:                                                             \
+				prefix##_remove(&set, copy);                                    \
+				if (present[i]) {                                               \
+					present[i] = 0;                                             \
+					--n_present;                                                \
+				}                                                               \
+				break;                                                          \
+			default: {                                                          \
+				const char *result = prefix##_find(&set, copy);                 \
+				check(present[i] ? result == key : result == NULL, name,        \
+				      "find disagrees with the reference");                     \
+				break;                                                          \
+			}                                                                   \
+			}                                                                   \
+			check(prefix##_size(&set) == n_present, name, "wrong size");        \
+		}                                                                       \
+                                                                                \
+		/* every key is seen exactly once by the iterator */                    \
+		iterator_t  iter;                                                       \
+		const char *value;                                                      \
+		size_t      n_seen = 0;                                                 \
+		prefix##_iterator_init(&iter, &set);                                    \
+		while ((value = prefix##_iterator_next(&iter)) != NULL) {               \
+			size_t i = (size_t) strtoul(value + 1, NULL, 10);                   \
+			check(i < N_KEYS && keys[i] == value && present[i] == 1, name,      \
+			      "iterator returned an unknown key");                          \
+			present[i] = 2;                                                     \
+			++n_seen;                                                           \
+		}                                                                       \
+		check(n_seen == n_present, name, "iterator missed keys");               \
+		for (size_t i = 0; i < N_KEYS; ++i) {                                   \
+			if (present[i] == 2)                                                \
+				present[i] = 1;                                                 \
+		}                                                                       \
+                                                                                \
+		/* empty the set through the iterator, it shrinks again */             \
+		prefix##_iterator_init(&iter, &set);                                    \
+		while ((value = prefix##_iterator_next(&iter)) != NULL) {               \
+			prefix##_remove_iterator(&set, &iter);                              \
+		}                                                                       \
+		check(prefix##_size(&set) == 0, name, "set not empty");                 \
+		memset(present, 0, sizeof(present));                                    \
+		n_present = 0;                                                          \
+	}                                                                           \
+	prefix##_destroy(&set);                                                     \
+	printf("%s: ok\n", name);                                                   \
+}
+
+DEFINE_SET_TEST(strset, strset_t, strset_iterator_t)
+DEFINE_SET_TEST(classic_set, classic_set_t, classic_set_iterator_t)
+
+int main(void)
+{
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "k%lu", (unsigned long) i);
+		keys[i] = xstrdup(buf);
+	}
+
+	test_strset();
+	test_classic_set();
+
+	for (size_t i = 0; i < N_KEYS; ++i) {
+		free(keys[i]);
+	}
+	return 0;
+}
@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include "symbol.h"
+#include "lexer.h"
 #include "adt/array.h"
 
 static symbol_t **token_symbols = NULL;
@@ -47,6 +48,7 @@ int register_new_token(const char *token)
 	symbol_t *symbol = symbol_table_insert(token);
 	symbol->ID       = token_id;
 	ARR_APP1(symbol_t*, token_symbols, symbol);
+	lexer_register_token(symbol);
 
 	return token_id;
 }
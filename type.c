@@ -3,24 +3,26 @@
 #include "type_t.h"
 #include "ast_t.h"
 #include "type_hash.h"
+#include "type_tuple_map.h"
+#include "mem_report.h"
 #include "adt/error.h"
-#include "adt/array.h"
 
-//#define DEBUG_TYPEVAR_BINDING
-
-typedef struct typevar_binding_t typevar_binding_t;
-struct typevar_binding_t {
-	type_variable_t *type_variable;
-	type_t          *old_current_type;
+struct type_substitution_t {
+	type_variable_t *type_parameters;
+	size_t           n_types;
+	type_t          *types[];   /**< bound to the type parameters in order */
 };
 
-static typevar_binding_t *typevar_binding_stack = NULL;
+/** interns the substitutions, keyed by the type parameters */
+static type_tuple_map_t *substitutions;
+/** the results of substitute_type(), keyed by the substitution */
+static type_tuple_map_t *substituted_types;
 
-static struct obstack  _type_obst;
-struct obstack        *type_obst = &_type_obst;
+static struct obstack        _type_obst;
+THREAD_LOCAL struct obstack *type_obst = &_type_obst;
 
-static type_base_t  type_void_    = { TYPE_VOID, NULL };
-static type_base_t  type_invalid_ = { TYPE_INVALID, NULL };
+static type_base_t  type_void_    = { TYPE_VOID, NULL, 0 };
+static type_base_t  type_invalid_ = { TYPE_INVALID, NULL, 0 };
 type_t             *type_void     = (type_t*) &type_void_;
 type_t             *type_invalid  = (type_t*) &type_invalid_;
 
@@ -29,13 +31,17 @@ static FILE* out;
 void init_type_module()
 {
 	obstack_init(type_obst);
-	typevar_binding_stack = NEW_ARR_F(typevar_binding_t, 0);
+	mem_report_add_obstack("types", type_obst);
+	substitutions     = new_type_tuple_map();
+	substituted_types = new_type_tuple_map();
 	out = stderr;
 }
 
 void exit_type_module()
 {
-	DEL_ARR_F(typevar_binding_stack);
+	free_type_tuple_map(substituted_types);
+	free_type_tuple_map(substitutions);
+	mem_report_remove_obstack(type_obst);
 	obstack_free(type_obst, NULL);
 }
 
@@ -105,11 +111,6 @@ static void print_type_reference(const type_reference_t *type)
 
 static void print_type_variable(const type_variable_t *type_variable)
 {
-	if (type_variable->current_type != NULL) {
-		print_type(type_variable->current_type);
-		return;
-	}
-
 	fprintf(out, "%s:", type_variable->base.symbol->string);
 
 	type_constraint_t *constraint = type_variable->constraints;
@@ -154,13 +155,15 @@ static void print_bind_type_variables(const bind_typevariables_type_t *type)
 {
 	compound_type_t *polymorphic_type = type->polymorphic_type;
 
-	int old_top = typevar_binding_stack_top();
-	push_type_variable_bindings(polymorphic_type->type_parameters,
-	                            type->type_arguments);
-
-	print_type((type_t*) polymorphic_type);
-
-	pop_type_variable_bindings(old_top);
+	fprintf(out, "%s<", polymorphic_type->symbol->string);
+	type_argument_t *type_argument = type->type_arguments;
+	for ( ; type_argument != NULL; type_argument = type_argument->next) {
+		if (type_argument != type->type_arguments) {
+			fprintf(out, ", ");
+		}
+		print_type(type_argument->type);
+	}
+	fprintf(out, ">");
 }
 
 void print_type(const type_t *type)
@@ -302,19 +305,23 @@ type_t* make_pointer_type(type_t *points_to)
 	return normalized_type;
 }
 
+static type_t *substitute(const type_substitution_t *substitution,
+                          type_t *type);
+
 static type_t *create_concrete_compound_type(compound_type_t *type)
 {
 	/* TODO: handle structs with typevars */
 	return (type_t*) type;
 }
 
-static type_t *create_concrete_function_type(function_type_t *type)
+static type_t *create_concrete_function_type(
+		const type_substitution_t *substitution, function_type_t *type)
 {
 	int need_new_type = 0;
 
 	type_t *new_type = allocate_type(TYPE_FUNCTION);
 	
-	type_t *result_type = create_concrete_type(type->result_type);
+	type_t *result_type = substitute(substitution, type->result_type);
 	if (result_type != type->result_type)
 		need_new_type = 1;
 	new_type->function.result_type = result_type;
@@ -323,7 +330,7 @@ static type_t *create_concrete_function_type(function_type_t *type)
 	function_parameter_type_t *last_parameter_type = NULL;
 	while (parameter_type != NULL) {
 		type_t *param_type     = parameter_type->type;
-		type_t *new_param_type = create_concrete_type(param_type);
+		type_t *new_param_type = substitute(substitution, param_type);
 
 		if (new_param_type != param_type)
 			need_new_type = 1;
@@ -345,15 +352,23 @@ static type_t *create_concrete_function_type(function_type_t *type)
 
 	if (!need_new_type) {
 		obstack_free(type_obst, new_type);
-		new_type = (type_t*) type;
+		return (type_t*) type;
 	}
 
-	return new_type;
+	new_type->function.variable_arguments = type->variable_arguments;
+
+	type_t *normalized_type = typehash_insert(new_type);
+	if (normalized_type != new_type) {
+		obstack_free(type_obst, new_type);
+	}
+
+	return normalized_type;
 }
 
-static type_t *create_concrete_pointer_type(pointer_type_t *type)
+static type_t *create_concrete_pointer_type(
+		const type_substitution_t *substitution, pointer_type_t *type)
 {
-	type_t *points_to = create_concrete_type(type->points_to);
+	type_t *points_to = substitute(substitution, type->points_to);
 
 	if (points_to == type->points_to)
 		return (type_t*) type;
@@ -369,20 +384,21 @@ static type_t *create_concrete_pointer_type(pointer_type_t *type)
 	return normalized_type;
 }
 
-static type_t *create_concrete_type_variable_reference_type(type_reference_t *type)
+static type_t *create_concrete_type_variable_reference_type(
+		const type_substitution_t *substitution, type_reference_t *type)
 {
-	type_variable_t *type_variable = type->type_variable;
-	type_t          *current_type  = type_variable->current_type;
+	type_t *bound_type = get_substituted_type(substitution, type->type_variable);
 
-	if (current_type != NULL)
-		return current_type;
+	if (bound_type != NULL)
+		return bound_type;
 
 	return (type_t*) type;
 }
 
-static type_t *create_concrete_array_type(array_type_t *type)
+static type_t *create_concrete_array_type(
+		const type_substitution_t *substitution, array_type_t *type)
 {
-	type_t *element_type = create_concrete_type(type->element_type);
+	type_t *element_type = substitute(substitution, type->element_type);
 	if (element_type == type->element_type)
 		return (type_t*) type;
 
@@ -398,7 +414,8 @@ static type_t *create_concrete_array_type(array_type_t *type)
 	return normalized_type;
 }
 
-static type_t *create_concrete_typevar_binding_type(bind_typevariables_type_t *type)
+static type_t *create_concrete_typevar_binding_type(
+		const type_substitution_t *substitution, bind_typevariables_type_t *type)
 {
 	int changed = 0;
 
@@ -407,7 +424,7 @@ static type_t *create_concrete_typevar_binding_type(bind_typevariables_type_t *t
 	type_argument_t *type_argument = type->type_arguments;
 	while (type_argument != NULL) {
 		type_t *type     = type_argument->type;
-		type_t *new_type = create_concrete_type(type);
+		type_t *new_type = substitute(substitution, type);
 
 		if (new_type != type) {
 			changed = 1;
@@ -445,7 +462,8 @@ static type_t *create_concrete_typevar_binding_type(bind_typevariables_type_t *t
 	return normalized_type;
 }
 
-type_t *create_concrete_type(type_t *type)
+static type_t *_substitute(const type_substitution_t *substitution,
+                          type_t *type)
 {
 	switch (type->kind) {
 	case TYPE_INVALID:
@@ -459,16 +477,19 @@ type_t *create_concrete_type(type_t *type)
 	case TYPE_COMPOUND_UNION:
 		return create_concrete_compound_type((compound_type_t*) type);
 	case TYPE_FUNCTION:
-		return create_concrete_function_type((function_type_t*) type);
+		return create_concrete_function_type(substitution,
+		                                     (function_type_t*) type);
 	case TYPE_POINTER:
-		return create_concrete_pointer_type((pointer_type_t*) type);
+		return create_concrete_pointer_type(substitution,
+		                                    (pointer_type_t*) type);
 	case TYPE_ARRAY:
-		return create_concrete_array_type((array_type_t*) type);
+		return create_concrete_array_type(substitution,
+		                                  (array_type_t*) type);
 	case TYPE_REFERENCE_TYPE_VARIABLE:
-		return create_concrete_type_variable_reference_type(
+		return create_concrete_type_variable_reference_type(substitution,
 				(type_reference_t*) type);
 	case TYPE_BIND_TYPEVARIABLES:
-		return create_concrete_typevar_binding_type(
+		return create_concrete_typevar_binding_type(substitution,
 		        (bind_typevariables_type_t*) type);
 	case TYPE_TYPEOF:
 		panic("TODO: concrete type for typeof()");
@@ -480,87 +501,89 @@ type_t *create_concrete_type(type_t *type)
 	return type;
 }
 
-int typevar_binding_stack_top()
+/** memoized _substitute() */
+static type_t *substitute(const type_substitution_t *substitution, type_t *type)
 {
-	return ARR_LEN(typevar_binding_stack);
+	type_t *result = type_tuple_map_find(substituted_types, substitution,
+	                                     &type, 1);
+	if (result == NULL) {
+		result = _substitute(substitution, type);
+		type_tuple_map_set(substituted_types, substitution, &type, 1, result);
+	}
+	return result;
 }
 
-void push_type_variable_bindings(type_variable_t *type_parameters,
-                                 type_argument_t *type_arguments)
+type_t *substitute_type(const type_substitution_t *substitution, type_t *type)
 {
-	type_variable_t *type_parameter;
-	type_argument_t *type_argument;
+	assert(substitution != NULL);
+	return substitute(substitution, type);
+}
 
-	if (type_parameters == NULL || type_arguments == NULL)
-		return;
+/** returns the substitution binding @p type_parameters to @p types */
+static const type_substitution_t *intern_substitution(
+		type_variable_t *type_parameters, type_t *const *types, size_t n_types)
+{
+	type_substitution_t *substitution = type_tuple_map_find(substitutions,
+			type_parameters, types, n_types);
+	if (substitution != NULL)
+		return substitution;
+
+	substitution = obstack_alloc(type_obst, sizeof(substitution[0])
+	                             + n_types * sizeof(substitution->types[0]));
+	substitution->type_parameters = type_parameters;
+	substitution->n_types         = n_types;
+	memcpy(substitution->types, types, n_types * sizeof(types[0]));
+
+	type_tuple_map_set(substitutions, type_parameters, types, n_types,
+	                   substitution);
+	return substitution;
+}
 
-	/* we have to take care that all rebinding happens atomically, so we first
-	 * create the structures on the binding stack and misuse the
-	 * old_current_type value to temporarily save the new! current_type.
-	 * We can then walk the list and set the new types */
-	type_parameter = type_parameters;
-	type_argument  = type_arguments;
-
-	int old_top = typevar_binding_stack_top();
-	int top     = ARR_LEN(typevar_binding_stack) + 1;
-	while (type_parameter != NULL) {
-		type_t *type = type_argument->type;
-		while (type->kind == TYPE_REFERENCE_TYPE_VARIABLE) {
-			type_reference_t *ref = (type_reference_t*) type;
-			type_variable_t  *var = ref->type_variable;
-
-			if (var->current_type == NULL) {
-				break;
-			}
-			type = var->current_type;
-		}
+const type_substitution_t *make_type_substitution(
+		const type_substitution_t *outer, type_variable_t *type_parameters,
+		type_argument_t *type_arguments)
+{
+	size_t n_types = 0;
+	type_variable_t *type_parameter = type_parameters;
+	for ( ; type_parameter != NULL; type_parameter = type_parameter->next) {
+		++n_types;
+	}
 
-		top = ARR_LEN(typevar_binding_stack) + 1;
-		ARR_RESIZE(typevar_binding_t, typevar_binding_stack, top);
+	type_t          *types[n_types > 0 ? n_types : 1];
+	type_argument_t *type_argument = type_arguments;
+	for (size_t i = 0; i < n_types; ++i) {
+		assert(type_argument != NULL);
+		types[i] = outer != NULL ? substitute_type(outer, type_argument->type)
+		                         : type_argument->type;
+		type_argument = type_argument->next;
+	}
+	assert(type_argument == NULL);
 
-		typevar_binding_t *binding = & typevar_binding_stack[top-1];
-		binding->type_variable     = type_parameter;
-		binding->old_current_type  = type;
+	return intern_substitution(type_parameters, types, n_types);
+}
 
-		type_parameter = type_parameter->next;
-		type_argument  = type_argument->next;
-	}
-	assert(type_parameter == NULL && type_argument == NULL);
-
-	for (int i = old_top+1; i <= top; ++i) {
-		typevar_binding_t *binding       = & typevar_binding_stack[i-1];
-		type_variable_t   *type_variable = binding->type_variable;
-		type_t            *new_type      = binding->old_current_type;
-
-		binding->old_current_type   = type_variable->current_type;
-		type_variable->current_type = new_type;
-
-#ifdef DEBUG_TYPEVAR_BINDING
-		fprintf(stderr, "binding '%s'(%p) to ", type_variable->symbol->string,
-		        type_variable);
-		print_type(stderr, type_variable->current_type);
-		fprintf(stderr, "\n");
-#endif
+const type_substitution_t *make_type_substitution_from_types(
+		type_variable_t *type_parameters, type_t *const *types)
+{
+	size_t n_types = 0;
+	type_variable_t *type_parameter = type_parameters;
+	for ( ; type_parameter != NULL; type_parameter = type_parameter->next) {
+		++n_types;
 	}
+
+	return intern_substitution(type_parameters, types, n_types);
 }
 
-void pop_type_variable_bindings(int new_top)
+type_t *get_substituted_type(const type_substitution_t *substitution,
+                             const type_variable_t *type_variable)
 {
-	int top = ARR_LEN(typevar_binding_stack) - 1;
-	for (int i = top; i >= new_top; --i) {
-		typevar_binding_t *binding       = & typevar_binding_stack[i];
-		type_variable_t   *type_variable = binding->type_variable;
-		type_variable->current_type      = binding->old_current_type;
-
-#ifdef DEBUG_TYPEVAR_BINDING
-		fprintf(stderr, "reset binding of '%s'(%p) to ",
-		        type_variable->symbol->string, type_variable);
-		print_type(stderr, binding->old_current_type);
-		fprintf(stderr, "\n");
-#endif
+	const type_variable_t *type_parameter = substitution->type_parameters;
+	for (size_t i = 0; i < substitution->n_types; ++i) {
+		if (type_parameter == type_variable)
+			return substitution->types[i];
+		type_parameter = type_parameter->next;
 	}
-
-	ARR_SHRINKLEN(typevar_binding_stack, new_top);
+	return NULL;
 }
 
 type_t *skip_typeref(type_t *type)
@@ -48,19 +48,42 @@ int is_type_numeric(const type_t *type);
 int type_valid(const type_t *type);
 
 /**
- * returns a normalized copy of a type with type variables replaced by their
- * current type. The given type (and all its hierarchy) is not modified.
+ * An immutable binding of type variables to types. Substitutions are interned,
+ * so equal substitutions are the same object, and substituting a type with
+ * one is memoized.
  */
-type_t *create_concrete_type(type_t *type);
+typedef struct type_substitution_t type_substitution_t;
 
-type_t *skip_typeref(type_t *type);
+/**
+ * Returns the substitution binding @p type_parameters to @p type_arguments.
+ * The arguments are substituted with @p outer first (unless it is NULL).
+ */
+const type_substitution_t *make_type_substitution(
+		const type_substitution_t *outer, type_variable_t *type_parameters,
+		type_argument_t *type_arguments);
 
-int typevar_binding_stack_top(void);
+/**
+ * Returns the substitution binding the i-th of @p type_parameters to
+ * @p types[i]. A NULL type leaves its type parameter unbound.
+ */
+const type_substitution_t *make_type_substitution_from_types(
+		type_variable_t *type_parameters, type_t *const *types);
 
-void push_type_variable_bindings(type_variable_t *type_parameters,
-                                 type_argument_t *type_arguments);
+/**
+ * Returns the type bound to @p type_variable by @p substitution, NULL if it
+ * does not bind it.
+ */
+type_t *get_substituted_type(const type_substitution_t *substitution,
+                             const type_variable_t *type_variable);
 
-void pop_type_variable_bindings(int new_top);
+/**
+ * returns a normalized copy of @p type with the type variables bound by
+ * @p substitution replaced. The given type (and all its hierarchy) is not
+ * modified.
+ */
+type_t *substitute_type(const type_substitution_t *substitution, type_t *type);
+
+type_t *skip_typeref(type_t *type);
 
 #endif
 
@@ -4,14 +4,19 @@
 #include "type_hash.h"
 
 #include "adt/error.h"
+#include "adt/hash_ptr.h"
 #include "type_t.h"
+#include "mem_report.h"
 
 #include <assert.h>
+#include <pthread.h>
 
 #define HashSet         type_hash_t
 #define HashSetIterator type_hash_iterator_t
 #define ValueType       type_t*
+#define GROUP_PROBING
 #include "adt/hashset.h"
+#undef GROUP_PROBING
 #undef ValueType
 #undef HashSetIterator
 #undef HashSet
@@ -19,64 +24,67 @@
 typedef struct type_hash_iterator_t  type_hash_iterator_t;
 typedef struct type_hash_t           type_hash_t;
 
-static unsigned hash_ptr(const void *ptr)
+/*
+ * The hash of a type is computed once when it is interned and cached in
+ * type_base_t. The parts of a type are interned before the type itself, so
+ * they are hashed by address (which is what types_equal() compares).
+ */
+
+static unsigned hash_combine(unsigned hash, unsigned value)
 {
-	unsigned ptr_int = ((const char*) ptr - (const char*) NULL);
-	return ptr_int >> 3;
+	return (hash ^ hash_mix(value)) * 0x9E3779B1u + 0x7F4A7C15u;
 }
 
-static unsigned hash_atomic_type(const atomic_type_t *type)
+static unsigned hash_atomic_type(unsigned hash, const atomic_type_t *type)
 {
-	unsigned some_prime = 27644437;
-
-	return type->akind * some_prime;
+	return hash_combine(hash, type->akind);
 }
 
-static unsigned hash_pointer_type(const pointer_type_t *type)
+static unsigned hash_pointer_type(unsigned hash, const pointer_type_t *type)
 {
-	return hash_ptr(type->points_to);
+	return hash_combine(hash, hash_ptr(type->points_to));
 }
 
-static unsigned hash_array_type(const array_type_t *type)
+static unsigned hash_array_type(unsigned hash, const array_type_t *type)
 {
-	return hash_ptr(type->element_type) ^ hash_ptr(type->size_expression);
+	hash = hash_combine(hash, hash_ptr(type->element_type));
+	return hash_combine(hash, hash_ptr(type->size_expression));
 }
 
-static unsigned hash_compound_type(const compound_type_t *type)
+static unsigned hash_compound_type(unsigned hash, const compound_type_t *type)
 {
-	unsigned result = hash_ptr(type->symbol);
-
-	return result;
+	/* compound types are equal if their symbols are, see
+	 * compound_types_equal() */
+	return hash_combine(hash, hash_ptr(type->symbol));
 }
 
-static unsigned hash_type(const type_t *type);
-
-static unsigned hash_function_type(const function_type_t *type)
+static unsigned hash_function_type(unsigned hash, const function_type_t *type)
 {
-	unsigned result = hash_ptr(type->result_type);
+	hash = hash_combine(hash, hash_ptr(type->result_type));
 
 	function_parameter_type_t *parameter = type->parameter_types;
 	while (parameter != NULL) {
-		result ^= hash_ptr(parameter->type);
+		hash      = hash_combine(hash, hash_ptr(parameter->type));
 		parameter = parameter->next;
 	}
-	if (type->variable_arguments)
-		result = ~result;
 
-	return result;
+	return hash_combine(hash, type->variable_arguments);
 }
 
-static unsigned hash_type_reference_type_variable(const type_reference_t *type)
+static unsigned hash_type_reference_type_variable(unsigned hash,
+                                                  const type_reference_t *type)
 {
-	return hash_ptr(type->type_variable);
+	return hash_combine(hash, hash_ptr(type->type_variable));
 }
 
-static unsigned hash_bind_typevariables_type_t(const bind_typevariables_type_t *type)
+static unsigned hash_bind_typevariables_type_t(unsigned hash,
+		const bind_typevariables_type_t *type)
 {
-	unsigned hash = hash_compound_type(type->polymorphic_type);
+	hash = hash_combine(hash, hash_ptr(type->polymorphic_type));
+
 	type_argument_t *argument = type->type_arguments;
 	while (argument != NULL) {
-		hash ^= hash_type(argument->type);
+		hash     = hash_combine(hash, hash_ptr(argument->type));
 		argument = argument->next;
 	}
 
@@ -85,6 +93,8 @@ static unsigned hash_bind_typevariables_type_t(const bind_typevariables_type_t *
 
 static unsigned hash_type(const type_t *type)
 {
+	unsigned hash = hash_mix(type->kind);
+
 	switch (type->kind) {
 	case TYPE_INVALID:
 	case TYPE_VOID:
@@ -92,24 +102,22 @@ static unsigned hash_type(const type_t *type)
 	case TYPE_REFERENCE:
 		panic("internalizing void or invalid types not possible");
 	case TYPE_REFERENCE_TYPE_VARIABLE:
-		return hash_type_reference_type_variable(&type->reference);
+		return hash_type_reference_type_variable(hash, &type->reference);
 	case TYPE_ATOMIC:
-		return hash_atomic_type(&type->atomic);
-	case TYPE_TYPEOF: {
-		return hash_ptr(type->typeof.expression);
-	}
+		return hash_atomic_type(hash, &type->atomic);
+	case TYPE_TYPEOF:
+		return hash_combine(hash, hash_ptr(type->typeof.expression));
 	case TYPE_COMPOUND_STRUCT:
 	case TYPE_COMPOUND_UNION:
-		return hash_compound_type(&type->compound);
+		return hash_compound_type(hash, &type->compound);
 	case TYPE_FUNCTION:
-		return hash_function_type(&type->function);
+		return hash_function_type(hash, &type->function);
 	case TYPE_POINTER:
-		return hash_pointer_type(&type->pointer);
+		return hash_pointer_type(hash, &type->pointer);
 	case TYPE_ARRAY:
-		return hash_array_type(&type->array);
+		return hash_array_type(hash, &type->array);
 	case TYPE_BIND_TYPEVARIABLES:
-		return hash_bind_typevariables_type_t(
-				&type->bind_typevariables);
+		return hash_bind_typevariables_type_t(hash, &type->bind_typevariables);
 	}
 	abort();
 }
@@ -238,7 +246,7 @@ static bool types_equal(const type_t *type1, const type_t *type2)
 #define ValueType                  type_t*
 #define NullValue                  NULL
 #define DeletedValue               ((type_t*)-1)
-#define Hash(this, key)            hash_type(key)
+#define Hash(this, key)            ((key)->base.hash)
 #define KeysEqual(this,key1,key2)  types_equal(key1, key2)
 #define SetRangeEmpty(ptr,size)    memset(ptr, 0, (size) * sizeof(*(ptr)))
 
@@ -247,16 +255,20 @@ static bool types_equal(const type_t *type1, const type_t *type2)
 #define hashset_destroy          _typehash_destroy
 #define hashset_insert           _typehash_insert
 #define hashset_remove           typehash_remove
-#define hashset_find             typehash_find
+#define hashset_find             _typehash_find
+#define hashset_find_hash        _typehash_find_hash
 #define hashset_size             typehash_size
 #define hashset_iterator_init    typehash_iterator_init
 #define hashset_iterator_next    typehash_iterator_next
 #define hashset_remove_iterator  typehash_remove_iterator
 #define SCALAR_RETURN
+#define GROUP_PROBING
 
 #include "adt/hashset.c"
 
-static type_hash_t typehash;
+static type_hash_t     typehash;
+/** files may be parsed in parallel, see main.c */
+static pthread_mutex_t typehash_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void init_typehash(void)
 {
@@ -270,10 +282,40 @@ void exit_typehash(void)
 
 type_t *typehash_insert(type_t *type)
 {
-	return _typehash_insert(&typehash, type);
+	type->base.hash = hash_type(type);
+
+	pthread_mutex_lock(&typehash_lock);
+	type_t *result = _typehash_insert(&typehash, type);
+	pthread_mutex_unlock(&typehash_lock);
+
+	if (result == type)
+		mem_report_count_type();
+	return result;
+}
+
+/** looks up a type without changing it, only interning stores the hash */
+static type_t *typehash_find(type_t *type)
+{
+	unsigned hash = hash_type(type);
+	return _typehash_find_hash(&typehash, type, hash);
 }
 
 int typehash_contains(type_t *type)
 {
-	return typehash_find(&typehash, type) != NULL;
+	return typehash_find(type) != NULL;
+}
+
+bool typehash_is_interned(type_t *type)
+{
+	switch (type->kind) {
+	case TYPE_INVALID:
+	case TYPE_VOID:
+		/* there is only one of them, see type.c */
+		return true;
+	case TYPE_ERROR:
+	case TYPE_REFERENCE:
+		return false;
+	default:
+		return typehash_find(type) == type;
+	}
 }
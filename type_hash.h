@@ -1,6 +1,8 @@
 #ifndef TYPE_HASH_H
 #define TYPE_HASH_H
 
+#include <stdbool.h>
+
 #include "type.h"
 
 void init_typehash(void);
@@ -8,5 +10,10 @@ void exit_typehash(void);
 
 type_t *typehash_insert(type_t *type);
 int     typehash_contains(type_t *type);
+/**
+ * Returns true if @p type is the interned representative of its type (void
+ * and invalid types always are).
+ */
+bool    typehash_is_interned(type_t *type);
 
 #endif
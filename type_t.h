@@ -7,10 +7,12 @@
 #include "lexer.h"
 #include "ast.h"
 #include "ast_t.h"
+#include "compiler.h"
 #include "adt/obst.h"
 #include <libfirm/typerep.h>
 
-struct obstack *type_obst;
+/** types are allocated here, each parser thread has its own obstack */
+extern THREAD_LOCAL struct obstack *type_obst;
 
 typedef enum {
 	TYPE_INVALID,
@@ -49,6 +51,7 @@ typedef enum {
 struct type_base_t {
 	type_kind_t  kind;
 	ir_type     *firm_type;
+	unsigned     hash;       /**< set when the type is interned */
 };
 
 struct atomic_type_t {
@@ -0,0 +1,133 @@
+#include <config.h>
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "type_tuple_map.h"
+#include "mem_report.h"
+#include "adt/hash_ptr.h"
+#include "adt/obst.h"
+#include "adt/xmalloc.h"
+
+typedef struct type_tuple_entry_t type_tuple_entry_t;
+struct type_tuple_entry_t {
+	const void     *owner;
+	type_t *const  *types;
+	size_t          n_types;
+	unsigned        hash;
+	void           *value;
+};
+
+#define HashSet         type_tuple_set_t
+#define HashSetIterator type_tuple_set_iterator_t
+#define ValueType       type_tuple_entry_t*
+#define GROUP_PROBING
+#include "adt/hashset.h"
+#undef GROUP_PROBING
+#undef ValueType
+#undef HashSetIterator
+#undef HashSet
+
+typedef struct type_tuple_set_t          type_tuple_set_t;
+typedef struct type_tuple_set_iterator_t type_tuple_set_iterator_t;
+
+static bool type_tuple_entries_equal(const type_tuple_entry_t *entry1,
+                                     const type_tuple_entry_t *entry2)
+{
+	return entry1->owner == entry2->owner
+	    && entry1->n_types == entry2->n_types
+	    && memcmp(entry1->types, entry2->types,
+	              entry1->n_types * sizeof(entry1->types[0])) == 0;
+}
+
+#define HashSet                    type_tuple_set_t
+#define HashSetIterator            type_tuple_set_iterator_t
+#define ValueType                  type_tuple_entry_t*
+#define NullValue                  NULL
+#define DeletedValue               ((type_tuple_entry_t*)-1)
+#define Hash(this, key)            ((key)->hash)
+#define KeysEqual(this,key1,key2)  type_tuple_entries_equal(key1, key2)
+#define SetRangeEmpty(ptr,size)    memset(ptr, 0, (size) * sizeof(*(ptr)))
+
+#define hashset_init             type_tuple_set_init
+#define hashset_init_size        type_tuple_set_init_size
+#define hashset_destroy          type_tuple_set_destroy
+#define hashset_insert           type_tuple_set_insert
+#define hashset_remove           type_tuple_set_remove
+#define hashset_find             type_tuple_set_find
+#define hashset_size             type_tuple_set_size
+#define hashset_iterator_init    type_tuple_set_iterator_init
+#define hashset_iterator_next    type_tuple_set_iterator_next
+#define hashset_remove_iterator  type_tuple_set_remove_iterator
+#define SCALAR_RETURN
+#define GROUP_PROBING
+
+#include "adt/hashset.c"
+
+struct type_tuple_map_t {
+	type_tuple_set_t set;
+	struct obstack   obst;  /**< the entries and their type tuples */
+};
+
+static unsigned hash_type_tuple(const void *owner, type_t *const *types,
+                                size_t n_types)
+{
+	unsigned hash = hash_ptr(owner);
+	for (size_t i = 0; i < n_types; ++i) {
+		hash = hash * 0x9E3779B1u ^ hash_ptr(types[i]);
+	}
+	return hash;
+}
+
+type_tuple_map_t *new_type_tuple_map(void)
+{
+	type_tuple_map_t *map = XMALLOC(type_tuple_map_t);
+	type_tuple_set_init(&map->set);
+	obstack_init(&map->obst);
+	mem_report_add_obstack("type tuples", &map->obst);
+	return map;
+}
+
+void free_type_tuple_map(type_tuple_map_t *map)
+{
+	type_tuple_set_destroy(&map->set);
+	mem_report_remove_obstack(&map->obst);
+	obstack_free(&map->obst, NULL);
+	xfree(map);
+}
+
+void *type_tuple_map_find(const type_tuple_map_t *map, const void *owner,
+                          type_t *const *types, size_t n_types)
+{
+	type_tuple_entry_t key;
+	key.owner   = owner;
+	key.types   = types;
+	key.n_types = n_types;
+	key.hash    = hash_type_tuple(owner, types, n_types);
+
+	type_tuple_entry_t *entry = type_tuple_set_find(&map->set, &key);
+	return entry != NULL ? entry->value : NULL;
+}
+
+void type_tuple_map_set(type_tuple_map_t *map, const void *owner,
+                        type_t *const *types, size_t n_types, void *value)
+{
+	type_tuple_entry_t *entry
+		= obstack_alloc(&map->obst, sizeof(entry[0]));
+	entry->owner   = owner;
+	entry->types   = types;
+	entry->n_types = n_types;
+	entry->hash    = hash_type_tuple(owner, types, n_types);
+
+	type_tuple_entry_t *found = type_tuple_set_insert(&map->set, entry);
+	if (found != entry) {
+		obstack_free(&map->obst, entry);
+		found->value = value;
+		return;
+	}
+
+	/* keep a copy of the types */
+	entry->types = obstack_copy(&map->obst, types,
+	                            n_types * sizeof(types[0]));
+	entry->value = value;
+}
@@ -0,0 +1,32 @@
+#ifndef TYPE_TUPLE_MAP_H
+#define TYPE_TUPLE_MAP_H
+
+#include <stddef.h>
+
+#include "type.h"
+
+/**
+ * Maps an owner (a concept, a polymorphic function, ...) together with a
+ * tuple of types to a value. The types are compared by address, so they
+ * should be hash-consed.
+ */
+typedef struct type_tuple_map_t type_tuple_map_t;
+
+type_tuple_map_t *new_type_tuple_map(void);
+void              free_type_tuple_map(type_tuple_map_t *map);
+
+/**
+ * Returns the value stored for @p owner and the @p n_types types in
+ * @p types, NULL if there is none.
+ */
+void *type_tuple_map_find(const type_tuple_map_t *map, const void *owner,
+                          type_t *const *types, size_t n_types);
+
+/**
+ * Stores @p value for @p owner and the @p n_types types in @p types (which
+ * are copied), replacing the previous value.
+ */
+void type_tuple_map_set(type_tuple_map_t *map, const void *owner,
+                        type_t *const *types, size_t n_types, void *value);
+
+#endif